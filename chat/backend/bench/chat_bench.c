@@ -0,0 +1,573 @@
+/**
+ * chat_bench: microbenchmarks de los módulos del servidor.
+ *
+ * Cada resultado se imprime como una línea JSON en stdout:
+ *   {"bench":"...","param":N,"ops":...,"total_ns":...,"ns_per_op":...,"ops_per_sec":...}
+ * para poder guardarlos y compararlos entre versiones. 'param' es el tamaño
+ * del escenario (usuarios, clientes, etc.; 0 si no aplica).
+ *
+ * Uso: chat_bench [filtro]  (solo corre los benchmarks cuyo nombre contiene 'filtro')
+ *
+ * Los clientes son wsi falsos: ningún camino medido los desreferencia, porque
+ * sin set_service_context() el encolado no despierta a libwebsockets. El tipo
+ * "register" de process_message no se mide porque consulta el socket del wsi.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libwebsockets.h>
+#include <cjson/cJSON.h>
+#include "logger.h"
+#include "time_utils.h"
+#include "user_manager.h"
+#include "connection_manager.h"
+#include "thread_manager.h"
+#include "slab.h"
+#include "json_arena.h"
+#include "binproto.h"
+#include "deflate.h"
+#include "json_slice.h"
+#include "text_scan.h"
+
+#define BENCH_MAX_PENDING 2000000   // Mensajes encolados como máximo por escenario
+#define BENCH_PROCESS_ITERS 20000
+#define BENCH_PROCESS_CLIENTS 10
+
+static const char *filter = NULL;
+static FILE *results = NULL;
+
+static bool selected(const char *name) {
+    return !filter || strstr(name, filter) != NULL;
+}
+
+static void report(const char *name, size_t param, uint64_t ops, uint64_t total_ns) {
+    double ns_per_op = ops ? (double)total_ns / (double)ops : 0.0;
+    double ops_per_sec = total_ns ? (double)ops * 1e9 / (double)total_ns : 0.0;
+    fprintf(results,
+            "{\"bench\":\"%s\",\"param\":%zu,\"ops\":%llu,\"total_ns\":%llu,"
+            "\"ns_per_op\":%.1f,\"ops_per_sec\":%.0f}\n",
+            name, param, (unsigned long long)ops, (unsigned long long)total_ns,
+            ns_per_op, ops_per_sec);
+    fflush(results);
+}
+
+/* wsi falso para el cliente i; nunca se desreferencia */
+static struct lws *fake_wsi(size_t i) {
+    return (struct lws *)(uintptr_t)(0x10000 + i * 64);
+}
+
+static void fake_username(char *buf, size_t cap, size_t i) {
+    snprintf(buf, cap, "bench%zu", i);
+}
+
+static void add_fake_clients(size_t count, bool with_users) {
+    char name[32];
+    for (size_t i = 0; i < count; i++) {
+        fake_username(name, sizeof(name), i);
+        if (with_users)
+            register_user(name, "127.0.0.1");
+        add_client(fake_wsi(i), name, NULL);
+    }
+}
+
+/* Quita los clientes falsos; libera también sus colas pendientes */
+static void remove_fake_clients(size_t count) {
+    for (size_t i = 0; i < count; i++)
+        remove_client(fake_wsi(i));
+}
+
+/* ---------- user_manager ---------- */
+
+static void bench_users(void) {
+    static const size_t sizes[] = { 1000, 10000, 20000 };
+    char name[32];
+    if (!selected("register_user") && !selected("get_user_info") &&
+        !selected("check_inactive_users") && !selected("search_users"))
+        return;
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s];
+
+        free_all_users();
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < n; i++) {
+            fake_username(name, sizeof(name), i);
+            register_user(name, "127.0.0.1");
+        }
+        uint64_t elapsed = monotonic_ns() - start;
+        if (selected("register_user"))
+            report("register_user", n, n, elapsed);
+
+        if (selected("get_user_info")) {
+            unsigned seed = 1;
+            size_t iters = 100000;
+            start = monotonic_ns();
+            for (size_t i = 0; i < iters; i++) {
+                fake_username(name, sizeof(name), (size_t)rand_r(&seed) % n);
+                cJSON *info = get_user_info(name);
+                cJSON_Delete(info);
+            }
+            report("get_user_info", n, iters, monotonic_ns() - start);
+        }
+
+        // Páginas de 50 para prefijos de ~1/10 y ~1/100 del registro, y un estado
+        // que nadie tiene (el índice descarta el registro entero sin recorrerlo)
+        if (selected("search_users")) {
+            static const struct { const char *name; const char *prefix; const char *status; } cases[] = {
+                { "search_users_prefix", "bench1", NULL },
+                { "search_users_prefix_deep", "bench12", NULL },
+                { "search_users_status_miss", "", "OCUPADO" },
+            };
+            size_t iters = 20000;
+            for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+                if (!selected(cases[c].name))
+                    continue;
+                start = monotonic_ns();
+                for (size_t i = 0; i < iters; i++) {
+                    bool more;
+                    cJSON *page = search_users(cases[c].prefix, cases[c].status, NULL, 50, &more);
+                    cJSON_Delete(page);
+                }
+                report(cases[c].name, n, iters, monotonic_ns() - start);
+            }
+        }
+
+        if (selected("check_inactive_users")) {
+            size_t iters = 200;
+            time_t now = time(NULL);
+            start = monotonic_ns();
+            for (size_t i = 0; i < iters; i++)
+                check_inactive_users(now);
+            report("check_inactive_users", n, iters, monotonic_ns() - start);
+        }
+    }
+    free_all_users();
+}
+
+/* ---------- connection_manager ---------- */
+
+static void bench_fanout(void) {
+    static const size_t sizes[] = { 10, 100, 1000, 10000 };
+    static const char msg[] =
+        "{\"type\":\"broadcast\",\"sender\":\"bench0\",\"content\":\"hola a todos\","
+        "\"timestamp\":\"2024-01-01 00:00:00\"}";
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t clients = sizes[s];
+        size_t iters = BENCH_MAX_PENDING / clients;
+        if (iters > 100000)
+            iters = 100000;
+
+        if (selected("broadcast_message")) {
+            add_fake_clients(clients, false);
+            uint64_t start = monotonic_ns();
+            for (size_t i = 0; i < iters; i++)
+                broadcast_message(msg, sizeof(msg) - 1);
+            report("broadcast_message", clients, iters, monotonic_ns() - start);
+            remove_fake_clients(clients);
+        }
+
+        if (selected("enqueue_pending_message")) {
+            add_fake_clients(clients, false);
+            unsigned seed = 1;
+            iters = 200000;
+            uint64_t start = monotonic_ns();
+            for (size_t i = 0; i < iters; i++)
+                enqueue_pending_message(fake_wsi((size_t)rand_r(&seed) % clients),
+                                        msg, sizeof(msg) - 1);
+            report("enqueue_pending_message", clients, iters, monotonic_ns() - start);
+            remove_fake_clients(clients);
+        }
+    }
+}
+
+/* ---------- thread_manager ---------- */
+
+static void bench_dispatch(void) {
+    if (!selected("dispatch_message"))
+        return;
+    static const char msg[] = "{\"type\":\"noop\"}";
+    const size_t iters = 200000;
+    const size_t workers = 4;
+
+    init_thread_pool(workers);
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < iters; i++)
+        dispatch_message(fake_wsi(0), rx_buffer_from(msg, sizeof(msg) - 1), monotonic_ns());
+    uint64_t enqueued = monotonic_ns() - start;
+    // Hasta que los workers vacían la cola
+    while (get_task_queue_depth() > 0)
+        sched_yield();
+    uint64_t drained = monotonic_ns() - start;
+    report("dispatch_message_enqueue", workers, iters, enqueued);
+    report("dispatch_message_throughput", workers, iters, drained);
+    shutdown_thread_pool();
+}
+
+static void bench_process(void) {
+    static const struct {
+        const char *name;
+        const char *msg;
+    } cases[] = {
+        { "process_broadcast",     "{\"type\":\"broadcast\",\"sender\":\"bench0\",\"content\":\"hola\"}" },
+        { "process_private",       "{\"type\":\"private\",\"sender\":\"bench0\",\"target\":\"bench1\",\"content\":\"hola\"}" },
+        { "process_list_users",    "{\"type\":\"list_users\",\"sender\":\"bench0\"}" },
+        { "process_user_info",     "{\"type\":\"user_info\",\"sender\":\"bench0\",\"target\":\"bench1\"}" },
+        { "process_change_status", "{\"type\":\"change_status\",\"sender\":\"bench0\",\"content\":\"OCUPADO\"}" },
+        { "process_join_room",     "{\"type\":\"join_room\",\"sender\":\"bench0\",\"target\":\"sala\"}" },
+        { "process_room_message",  "{\"type\":\"room_message\",\"sender\":\"bench0\",\"target\":\"sala\",\"content\":\"hola\"}" },
+        { "process_list_rooms",    "{\"type\":\"list_rooms\",\"sender\":\"bench0\"}" },
+        { "process_subscribe",     "{\"type\":\"subscribe\",\"sender\":\"bench0\",\"content\":\"presence.*\"}" },
+        { "process_unsubscribe",   "{\"type\":\"unsubscribe\",\"sender\":\"bench0\",\"content\":\"presence.*\"}" },
+        { "process_leave_room",    "{\"type\":\"leave_room\",\"sender\":\"bench0\",\"target\":\"sala\"}" },
+        { "process_unknown",       "{\"type\":\"noop\",\"sender\":\"bench0\"}" },
+    };
+
+    bool any = false;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+        any = any || selected(cases[c].name);
+    if (!any)
+        return;
+
+    // Las respuestas se acumulan en las colas hasta remove_fake_clients()
+    add_fake_clients(BENCH_PROCESS_CLIENTS, true);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        if (!selected(cases[c].name))
+            continue;
+        size_t len = strlen(cases[c].msg);
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < BENCH_PROCESS_ITERS; i++)
+            process_message(fake_wsi(0), cases[c].msg, len);
+        report(cases[c].name, BENCH_PROCESS_CLIENTS, BENCH_PROCESS_ITERS,
+               monotonic_ns() - start);
+    }
+    remove_fake_clients(BENCH_PROCESS_CLIENTS);
+    free_all_users();
+}
+
+/* ---------- binproto ---------- */
+
+/* Traducción de un broadcast típico en cada sentido (incluye crear el frame
+   de origen, porque la traducción se guarda en él) y el reenvío de un
+   broadcast que llega en binario */
+static void bench_binproto(void) {
+    static const char json[] =
+        "{\"type\":\"broadcast\",\"sender\":\"bench0\",\"content\":\"hola a todos\","
+        "\"timestamp\":\"2024-01-01 00:00:00\"}";
+    const size_t iters = 200000;
+    frame_t *json_frame = frame_create(json, sizeof(json) - 1);
+    frame_t *bin_frame = json_frame ? binproto_frame(json_frame, true) : NULL;
+    if (!bin_frame) {
+        frame_release(json_frame);
+        return;
+    }
+    if (selected("binproto_json_to_bin")) {
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < iters; i++) {
+            frame_t *f = frame_create(json, sizeof(json) - 1);
+            binproto_frame(f, true);
+            frame_release(f);
+        }
+        report("binproto_json_to_bin", json_frame->len, iters, monotonic_ns() - start);
+    }
+    if (selected("binproto_bin_to_json")) {
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < iters; i++) {
+            frame_t *f = frame_create_raw((const char *)frame_payload(bin_frame), bin_frame->len);
+            f->binary = true;
+            binproto_frame(f, false);
+            frame_release(f);
+        }
+        report("binproto_bin_to_json", bin_frame->len, iters, monotonic_ns() - start);
+    }
+    if (selected("process_binary_broadcast")) {
+        char msg[64];
+        json_writer_t w = { msg, 0 };
+        bin_write_type(&w, BIN_TYPE_BROADCAST);
+        bin_write_str(&w, BIN_KEY_SENDER, "bench0", 6);
+        bin_write_str(&w, BIN_KEY_CONTENT, "hola", 4);
+        add_fake_clients(BENCH_PROCESS_CLIENTS, true);
+        uint64_t start = monotonic_ns();
+        for (size_t i = 0; i < BENCH_PROCESS_ITERS; i++)
+            process_binary_message(fake_wsi(0), msg, w.len);
+        report("process_binary_broadcast", BENCH_PROCESS_CLIENTS, BENCH_PROCESS_ITERS,
+               monotonic_ns() - start);
+        remove_fake_clients(BENCH_PROCESS_CLIENTS);
+        free_all_users();
+    }
+    frame_release(json_frame);
+}
+
+/* ---------- deflate ---------- */
+
+/* Compresión compartida de un broadcast de chat (una vez por frame, no por
+   destinatario); cada iteración crea el frame porque el resultado queda en él */
+static void bench_deflate(void) {
+    if (!selected("deflate_frame"))
+        return;
+    char msg[512];
+    int len = snprintf(msg, sizeof(msg),
+                       "{\"type\":\"broadcast\",\"sender\":\"bench0\",\"content\":\"%s\","
+                       "\"timestamp\":\"2024-01-01 00:00:00\"}",
+                       "hola a todos, ¿cómo va todo por ahí? acá todo bien, hola a todos");
+    const size_t iters = 100000;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < iters; i++) {
+        frame_t *f = frame_create(msg, (size_t)len);
+        deflate_frame(f);
+        frame_release(f);
+    }
+    report("deflate_frame", (size_t)len, iters, monotonic_ns() - start);
+}
+
+/* ---------- text_scan ---------- */
+
+/* Validación UTF-8, escaneo y escape del content de un mensaje según su
+   tamaño, con cada versión que soporta la CPU. Cada escenario recorre
+   BENCH_TEXT_BYTES en total: los bytes por segundo son param * ops_per_sec. */
+#define BENCH_TEXT_BYTES (64 * 1024 * 1024)
+
+/* Casos borde de UTF-8 y JSON para comparar las versiones de text_scan */
+static const char *const scan_cases[] = {
+    "\xC3\xA1", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\xF4\x8F\xBF\xBF",     // Válidos
+    "\xED\x9F\xBF", "\xEE\x80\x80",                                    // Alrededor de los surrogates
+    "\xC3", "\xE2\x82", "\xF0\x9F\x98",                                 // Cortados
+    "\xED\xA0\x80", "\xED\xBF\xBF",                                    // Surrogates
+    "\xC0\x80", "\xC1\xBF", "\xE0\x80\x80", "\xE0\x9F\xBF",               // Sobrelargos
+    "\xF0\x80\x80\x80", "\xF0\x8F\xBF\xBF",
+    "\xF4\x90\x80\x80", "\xF5\x80\x80\x80", "\xFF", "\x80", "\xBF",         // Fuera de rango y sueltos
+    "\"", "\\", "\x1F", "\x7F", "\n", "",                                   // "" es un NUL
+};
+#define SCAN_CASES (sizeof(scan_cases) / sizeof(scan_cases[0]))
+
+/* Compara cada versión con la escalar sobre 's' */
+static bool scan_agrees(const char *s, size_t len, text_scan_level_t cpu) {
+    text_scan_set_level(TEXT_SCAN_SCALAR);
+    bool valid = utf8_valid(s, len);
+    size_t span = json_plain_span(s, len);
+    for (int level = TEXT_SCAN_SCALAR + 1; level <= (int)cpu; level++) {
+        text_scan_set_level((text_scan_level_t)level);
+        bool level_valid = utf8_valid(s, len);
+        size_t level_span = json_plain_span(s, len);
+        if (level_valid != valid || level_span != span) {
+            fprintf(stderr, "text_scan %s difiere de scalar en %zu bytes: "
+                    "utf8_valid %d/%d, json_plain_span %zu/%zu\n",
+                    text_scan_level_name((text_scan_level_t)level), len,
+                    level_valid, valid, level_span, span);
+            for (size_t i = 0; i < len; i++)
+                fprintf(stderr, "%02x%s", (unsigned char)s[i], i + 1 < len ? " " : "\n");
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Antes de medir, las versiones vectoriales tienen que dar lo mismo que la
+   escalar: cada caso borde en todas las posiciones de dos bloques de 32
+   bytes (así también queda partido entre dos bloques de 16 o 32), con el
+   texto cortado en cada byte del caso y con inicios desalineados, y además
+   textos al azar armados con los mismos casos */
+static bool check_text_scan(text_scan_level_t cpu) {
+    char buf[128];
+    bool ok = true;
+    for (size_t c = 0; c < SCAN_CASES && ok; c++) {
+        size_t case_len = strlen(scan_cases[c]);
+        if (case_len == 0)
+            case_len = 1;   // El NUL
+        for (size_t start = 0; start < 4 && ok; start++) {
+            for (size_t pos = 0; pos < 64 && ok; pos++) {
+                memset(buf, 'a', sizeof(buf));
+                memcpy(buf + start + pos, scan_cases[c], case_len);
+                ok = scan_agrees(buf + start, 96, cpu);
+                for (size_t cut = 0; cut <= case_len && ok; cut++)
+                    ok = scan_agrees(buf + start, pos + cut, cpu);
+            }
+        }
+    }
+    unsigned seed = 1;
+    for (int round = 0; round < 20000 && ok; round++) {
+        // Tres de cada cuatro tramos son ASCII, para que haya textos válidos largos
+        char *text = buf + round % 4;
+        size_t len = 0, target = (size_t)rand_r(&seed) % (sizeof(buf) - 4);
+        while (len < target) {
+            unsigned pick = (unsigned)rand_r(&seed);
+            const char *piece = pick % 4 ? "abcdefghijklmnop" : scan_cases[pick / 4 % SCAN_CASES];
+            size_t piece_len = pick % 4 ? 1 + pick / 4 % 16 : strlen(piece);
+            if (piece_len == 0)
+                piece_len = 1;
+            if (piece_len > target - len)
+                piece_len = target - len;
+            memcpy(text + len, piece, piece_len);
+            len += piece_len;
+        }
+        ok = scan_agrees(text, len, cpu);
+    }
+    text_scan_set_level(cpu);
+    return ok;
+}
+
+static void bench_text_scan(void) {
+    static const size_t sizes[] = { 64, 1024, 16 * 1024, 256 * 1024 };
+    const size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    // Texto pegado: sobre todo ASCII, con acentos y saltos de línea que escapar
+    static const char line[] = "hola a todos, ¿cómo va todo por ahí? acá todo bien\n";
+    // Escapado ocupa menos del doble: solo '\n' crece, a dos bytes
+    char *text = malloc(max_size);
+    char *json = malloc(max_size * 2 + 16);
+    char *escaped = malloc(max_size * 2 + 2);
+    if (!text || !json || !escaped) {
+        free(text);
+        free(json);
+        free(escaped);
+        return;
+    }
+    for (size_t i = 0; i < max_size; i++)
+        text[i] = line[i % (sizeof(line) - 1)];
+    // Sin cortar un carácter de dos bytes al final de cada tamaño
+    for (size_t i = 0; i + 1 < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if ((unsigned char)text[sizes[i] - 1] >= 0xC0)
+            text[sizes[i] - 1] = text[sizes[i]] = '.';
+    }
+    if ((unsigned char)text[max_size - 1] >= 0xC0)
+        text[max_size - 1] = '.';
+
+    volatile size_t sink = 0;
+    text_scan_level_t cpu = text_scan_level();
+    if (!check_text_scan(cpu)) {
+        fprintf(stderr, "Las versiones de text_scan no coinciden; no se miden\n");
+        free(text);
+        free(json);
+        free(escaped);
+        exit(EXIT_FAILURE);
+    }
+    for (int level = TEXT_SCAN_SCALAR; level <= (int)cpu; level++) {
+        text_scan_set_level((text_scan_level_t)level);
+        const char *suffix = text_scan_level_name((text_scan_level_t)level);
+        char name[64];
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            size_t size = sizes[i];
+            size_t iters = BENCH_TEXT_BYTES / size;
+
+            snprintf(name, sizeof(name), "utf8_valid_%s", suffix);
+            if (selected(name)) {
+                uint64_t start = monotonic_ns();
+                for (size_t k = 0; k < iters; k++)
+                    sink += utf8_valid(text, size);
+                report(name, size, iters, monotonic_ns() - start);
+            }
+
+            // El content escapado dentro de un objeto, como llega de un cliente
+            json_writer_t w = { json, 0 };
+            json_write_literal(&w, "{\"content\":");
+            json_write_string_len(&w, text, size);
+            json_write_literal(&w, "}");
+
+            snprintf(name, sizeof(name), "json_escape_%s", suffix);
+            if (selected(name)) {
+                uint64_t start = monotonic_ns();
+                for (size_t k = 0; k < iters; k++) {
+                    json_writer_t out = { escaped, 0 };
+                    json_write_string_len(&out, text, size);
+                    sink += out.len;
+                }
+                report(name, size, iters, monotonic_ns() - start);
+            }
+
+            snprintf(name, sizeof(name), "json_scan_%s", suffix);
+            if (selected(name)) {
+                json_fields_t fields;
+                uint64_t start = monotonic_ns();
+                for (size_t k = 0; k < iters; k++)
+                    sink += json_slice_scan(json, w.len, &fields);
+                report(name, size, iters, monotonic_ns() - start);
+            }
+        }
+    }
+    text_scan_set_level(cpu);
+    (void)sink;
+    free(text);
+    free(json);
+    free(escaped);
+}
+
+/* ---------- utils ---------- */
+
+/* Aloca y libera por tandas, como las colas pendientes: slab contra malloc */
+static void bench_alloc(void) {
+    const size_t batch = 1024;
+    const size_t rounds = 1000;
+    void **ptrs = malloc(batch * sizeof(void *));
+    if (!ptrs)
+        return;
+    if (selected("slab_alloc_free")) {
+        uint64_t start = monotonic_ns();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < batch; i++)
+                ptrs[i] = slab_alloc(sizeof(pending_msg_t));
+            for (size_t i = 0; i < batch; i++)
+                slab_free(ptrs[i]);
+        }
+        report("slab_alloc_free", sizeof(pending_msg_t), batch * rounds, monotonic_ns() - start);
+    }
+    if (selected("malloc_free")) {
+        uint64_t start = monotonic_ns();
+        for (size_t r = 0; r < rounds; r++) {
+            for (size_t i = 0; i < batch; i++)
+                ptrs[i] = malloc(sizeof(pending_msg_t));
+            for (size_t i = 0; i < batch; i++)
+                free(ptrs[i]);
+        }
+        report("malloc_free", sizeof(pending_msg_t), batch * rounds, monotonic_ns() - start);
+    }
+    free(ptrs);
+}
+
+static void bench_timestamp(void) {
+    if (!selected("get_timestamp"))
+        return;
+    const size_t iters = 1000000;
+    uint64_t start = monotonic_ns();
+    for (size_t i = 0; i < iters; i++)
+        free(get_timestamp());
+    report("get_timestamp", 0, iters, monotonic_ns() - start);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1)
+        filter = argv[1];
+
+    // Los resultados van al stdout original; los logs del servidor se descartan
+    // para que no se mezclen con el JSON ni pesen en las mediciones
+    int out_fd = dup(STDOUT_FILENO);
+    results = out_fd >= 0 ? fdopen(out_fd, "w") : NULL;
+    if (!results) {
+        fprintf(stderr, "No se pudo duplicar stdout\n");
+        return 1;
+    }
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+    }
+    logger_init();
+    json_arena_install();
+
+    bench_users();
+    bench_fanout();
+    bench_dispatch();
+    bench_process();
+    bench_binproto();
+    bench_deflate();
+    bench_text_scan();
+    bench_timestamp();
+    bench_alloc();
+
+    logger_shutdown();
+    fclose(results);
+    return 0;
+}
@@ -0,0 +1,250 @@
+#include "capture.h"
+#include "logger.h"
+#include "time_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+#define CAPTURE_FLUSH_NS 1000000000ULL   // Con tráfico, entrega el buffer al escritor al menos cada 1 s
+#define CAPTURE_VARINT_MAX 10
+
+static const char CAPTURE_MAGIC[8] = "CHCAP1";
+
+static FILE *capture_file = NULL;
+static bool capturing = false;
+
+// Buffer que llena el hilo de servicio y buffer que está escribiendo el hilo escritor
+static unsigned char *active_buf = NULL;
+static size_t active_len = 0;
+static unsigned char *pending_buf = NULL;   // NULL: el escritor está libre
+static size_t pending_len = 0;
+static unsigned char *spare_buf = NULL;     // Buffer libre para el próximo cambio
+
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool stop_writer = false;
+
+static capture_conn_t next_conn = 1;
+static uint64_t last_record_ns = 0;
+static uint64_t last_handoff_ns = 0;
+static unsigned long long dropped = 0;
+
+static size_t put_varint(unsigned char *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+static void *capture_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&writer_mutex);
+    while (true) {
+        while (!pending_buf && !stop_writer)
+            pthread_cond_wait(&writer_cond, &writer_mutex);
+        if (!pending_buf)
+            break;
+        unsigned char *buf = pending_buf;
+        size_t len = pending_len;
+        pthread_mutex_unlock(&writer_mutex);
+
+        if (fwrite(buf, 1, len, capture_file) != len)
+            log_error("Error escribiendo la captura: %s", strerror(errno));
+
+        pthread_mutex_lock(&writer_mutex);
+        spare_buf = buf;
+        pending_buf = NULL;
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+/* Entrega el buffer activo al escritor. Retorna false si aún está ocupado. */
+static bool handoff(uint64_t now) {
+    pthread_mutex_lock(&writer_mutex);
+    if (pending_buf || !spare_buf) {
+        pthread_mutex_unlock(&writer_mutex);
+        return false;
+    }
+    pending_buf = active_buf;
+    pending_len = active_len;
+    active_buf = spare_buf;
+    spare_buf = NULL;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    active_len = 0;
+    last_handoff_ns = now;
+    return true;
+}
+
+static void append_record(capture_kind_t kind, capture_conn_t conn,
+                          const void *data, size_t len) {
+    uint64_t now = monotonic_ns();
+    size_t needed = 3 * CAPTURE_VARINT_MAX + len;
+    if (needed > CAPTURE_BUFFER_SIZE) {
+        dropped++;
+        return;
+    }
+    if ((active_len + needed > CAPTURE_BUFFER_SIZE ||
+         (active_len > 0 && now - last_handoff_ns >= CAPTURE_FLUSH_NS)) &&
+        !handoff(now) && active_len + needed > CAPTURE_BUFFER_SIZE) {
+        // El escritor va atrasado: se descarta en vez de bloquear
+        dropped++;
+        return;
+    }
+
+    unsigned char *p = active_buf + active_len;
+    p += put_varint(p, ((uint64_t)conn << 2) | (uint64_t)kind);
+    p += put_varint(p, now - last_record_ns);
+    if (kind == CAPTURE_DATA) {
+        p += put_varint(p, len);
+        memcpy(p, data, len);
+        p += len;
+    }
+    active_len = (size_t)(p - active_buf);
+    last_record_ns = now;
+}
+
+bool capture_start(const char *path) {
+    if (capturing)
+        return true;
+    capture_file = fopen(path, "wb");
+    if (!capture_file) {
+        log_error("No se pudo abrir la captura %s: %s", path, strerror(errno));
+        return false;
+    }
+    active_buf = malloc(CAPTURE_BUFFER_SIZE);
+    spare_buf = malloc(CAPTURE_BUFFER_SIZE);
+    if (!active_buf || !spare_buf) {
+        log_error("Error al asignar memoria para la captura");
+        goto fail;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t start_epoch_ns = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    if (fwrite(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC), 1, capture_file) != 1 ||
+        fwrite(&start_epoch_ns, sizeof(start_epoch_ns), 1, capture_file) != 1) {
+        log_error("Error escribiendo la cabecera de la captura");
+        goto fail;
+    }
+
+    stop_writer = false;
+    if (pthread_create(&writer_thread, NULL, capture_writer, NULL) != 0) {
+        log_error("No se pudo iniciar el hilo de la captura");
+        goto fail;
+    }
+    last_record_ns = last_handoff_ns = monotonic_ns();
+    active_len = 0;
+    dropped = 0;
+    capturing = true;
+    log_info("Capturando tráfico entrante en %s", path);
+    return true;
+
+fail:
+    free(active_buf);
+    free(spare_buf);
+    active_buf = spare_buf = NULL;
+    fclose(capture_file);
+    capture_file = NULL;
+    return false;
+}
+
+void capture_stop(void) {
+    if (!capturing)
+        return;
+    capturing = false;
+
+    pthread_mutex_lock(&writer_mutex);
+    stop_writer = true;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer_thread, NULL);
+
+    // El escritor ya vació su buffer; queda lo que había en el activo
+    if (active_len > 0 && fwrite(active_buf, 1, active_len, capture_file) != active_len)
+        log_error("Error escribiendo la captura: %s", strerror(errno));
+    fclose(capture_file);
+    capture_file = NULL;
+    free(active_buf);
+    free(spare_buf);
+    active_buf = spare_buf = NULL;
+    if (dropped > 0)
+        log_error("Captura: %llu registros descartados", dropped);
+}
+
+capture_conn_t capture_open(void) {
+    if (!capturing)
+        return 0;
+    capture_conn_t conn = next_conn++;
+    append_record(CAPTURE_OPEN, conn, NULL, 0);
+    return conn;
+}
+
+void capture_frame(capture_conn_t conn, const void *data, size_t len) {
+    if (capturing && conn)
+        append_record(CAPTURE_DATA, conn, data, len);
+}
+
+void capture_close(capture_conn_t conn) {
+    if (capturing && conn)
+        append_record(CAPTURE_CLOSE, conn, NULL, 0);
+}
+
+/* ---------- Lectura ---------- */
+
+static bool get_varint(capture_reader_t *r, uint64_t *out) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64 && r->pos < r->end; shift += 7) {
+        unsigned char b = *r->pos++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool capture_reader_init(capture_reader_t *r, const void *buf, size_t len) {
+    if (len < sizeof(CAPTURE_MAGIC) + sizeof(int64_t) ||
+        memcmp(buf, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+        return false;
+    r->pos = (const unsigned char *)buf + sizeof(CAPTURE_MAGIC);
+    memcpy(&r->start_epoch_ns, r->pos, sizeof(int64_t));
+    r->pos += sizeof(int64_t);
+    r->end = (const unsigned char *)buf + len;
+    r->time_ns = 0;
+    return true;
+}
+
+bool capture_next(capture_reader_t *r, capture_record_t *rec) {
+    uint64_t head, delta;
+    if (r->pos >= r->end || !get_varint(r, &head) || !get_varint(r, &delta))
+        return false;
+    rec->kind = (capture_kind_t)(head & 3);
+    rec->conn = (capture_conn_t)(head >> 2);
+    r->time_ns += delta;
+    rec->time_ns = r->time_ns;
+    rec->data = NULL;
+    rec->len = 0;
+    if (rec->kind == CAPTURE_DATA) {
+        uint64_t len;
+        if (!get_varint(r, &len) || len > (uint64_t)(r->end - r->pos))
+            return false;
+        rec->data = (const char *)r->pos;
+        rec->len = (size_t)len;
+        r->pos += len;
+    } else if (rec->kind != CAPTURE_OPEN && rec->kind != CAPTURE_CLOSE) {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Captura del tráfico entrante para reproducirlo después (ver chat_replay).
+ *
+ * Formato del archivo:
+ *   cabecera: "CHCAP1\0\0" (8 bytes) + int64 con el inicio en ns de época
+ *   registros: varint (conn_id << 2 | tipo), varint delta_ns desde el registro
+ *              anterior y, solo en CAPTURE_DATA, varint largo + payload.
+ *
+ * Todos los capture_* se llaman desde el hilo de servicio de libwebsockets
+ * (un solo productor): solo copian a un buffer en memoria. Un hilo aparte
+ * escribe los buffers llenos a disco; si va atrasado, el registro se descarta
+ * y se cuenta en vez de bloquear al hilo de servicio.
+ */
+
+typedef enum {
+    CAPTURE_OPEN = 0,    // Conexión establecida
+    CAPTURE_DATA = 1,    // Frame recibido
+    CAPTURE_CLOSE = 2    // Conexión cerrada
+} capture_kind_t;
+
+/* Id de conexión para los registros; 0 si la captura está apagada */
+typedef uint32_t capture_conn_t;
+
+// Empieza a capturar en 'path'. Retorna false si no se pudo abrir el archivo.
+bool capture_start(const char *path);
+
+// Escribe lo pendiente y cierra el archivo.
+void capture_stop(void);
+
+// Registra una conexión nueva y retorna su id (0 si no se está capturando).
+capture_conn_t capture_open(void);
+
+// Registra un frame recibido en la conexión 'conn'.
+void capture_frame(capture_conn_t conn, const void *data, size_t len);
+
+// Registra el cierre de la conexión 'conn'.
+void capture_close(capture_conn_t conn);
+
+/* ---------- Lectura ---------- */
+
+typedef struct {
+    capture_kind_t kind;
+    capture_conn_t conn;
+    uint64_t time_ns;        // Desde el inicio de la captura
+    const char *data;        // Apunta dentro del buffer leído (solo CAPTURE_DATA)
+    size_t len;
+} capture_record_t;
+
+typedef struct {
+    const unsigned char *pos;
+    const unsigned char *end;
+    uint64_t time_ns;
+    int64_t start_epoch_ns;
+} capture_reader_t;
+
+// Valida la cabecera de una captura completa en memoria.
+bool capture_reader_init(capture_reader_t *r, const void *buf, size_t len);
+
+// Lee el siguiente registro. Retorna false al final o si el archivo está truncado.
+bool capture_next(capture_reader_t *r, capture_record_t *rec);
+
+#endif
@@ -0,0 +1,653 @@
+/**
+ * chat_loadgen: generador de carga sin interfaz para el servidor de chat.
+ *
+ * Abre muchas conexiones desde un solo proceso, repartidas entre unos pocos
+ * hilos; cada hilo tiene su propio contexto de libwebsockets y atiende sus
+ * conexiones sin bloquear. Cada conexión se registra y luego envía una mezcla
+ * configurable de broadcast/private/list_users a una tasa objetivo.
+ *
+ * La latencia de punta a punta se mide con el instante de envío (reloj
+ * monotónico) embebido en el contenido de cada mensaje; para list_users, cuya
+ * respuesta no trae el contenido, se usa la cola de envíos de la conexión.
+ *
+ * Con -b las conexiones negocian chat-protocol-bin (ver binproto.h).
+ */
+#include <libwebsockets.h>
+#include <cjson/cJSON.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "histogram.h"
+#include "time_utils.h"
+#include "binproto.h"
+#include "deflate.h"
+#include "config.h"
+
+// Alrededor del contenido: el JSON de un private (55 bytes) con los dos
+// nombres (prefijo de hasta 31 + índice de hasta 10 dígitos); el binario es menor
+#define LG_ENVELOPE 160
+#define LG_STAMP_LEN 21             // "<ns>:" al inicio del contenido, como máximo
+#define LG_RX_BUFFER 1024           // Bloque de recepción; lo más grande llega en partes
+#define LG_TICK_US 1000             // Revisión de envíos vencidos cada 1 ms
+#define LG_OUTSTANDING_LIST 64      // list_users sin respuesta por conexión
+#define LG_RAMP_TIMEOUT 30          // Segundos máximos esperando los registros
+
+typedef enum {
+    LG_BROADCAST,
+    LG_PRIVATE,
+    LG_LIST_USERS,
+    LG_KIND_COUNT
+} lg_kind_t;
+
+static const char *kind_names[LG_KIND_COUNT] = { "broadcast", "private", "list_users" };
+
+// Fases globales de la corrida
+enum { PHASE_RAMP, PHASE_MEASURE, PHASE_STOP };
+
+typedef struct lg_thread lg_thread_t;
+
+typedef struct {
+    lg_thread_t *owner;
+    struct lws *wsi;
+    int index;                      // Índice global; el usuario es <prefijo><índice>
+    bool connected;
+    bool registered;
+    bool closed;
+    uint64_t next_send_ns;          // Próximo envío programado (lazo abierto)
+    // Instantes de envío de list_users aún sin respuesta (FIFO)
+    uint64_t list_sent[LG_OUTSTANDING_LIST];
+    unsigned list_head, list_tail;
+    // Reensamblado de mensajes fragmentados
+    char *rx;
+    size_t rx_len, rx_cap;
+} lg_conn_t;
+
+struct lg_thread {
+    pthread_t thread;
+    struct lws_context *context;
+    lws_sorted_usec_list_t sul;
+    lg_conn_t *conns;
+    int conn_count;
+    unsigned seed;
+    // Solo los escribe el hilo dueño; el principal los lee al final
+    histogram_t latency[LG_KIND_COUNT];
+    uint64_t sent[LG_KIND_COUNT];
+    uint64_t received[LG_KIND_COUNT];
+    uint64_t errors;
+    unsigned char *tx_buf;          // LWS_PRE + msg_cap bytes
+    char *content;                  // content_len + 1 bytes
+};
+
+// Configuración (se fija antes de lanzar los hilos)
+static const char *server_host = NULL;
+static int server_port = 0;
+static int total_conns = 1000;
+static int thread_total = 4;
+static double target_rate = 1000.0;          // Mensajes por segundo, total
+static unsigned mix[LG_KIND_COUNT] = { 80, 15, 5 };
+static unsigned mix_total = 100;
+static int duration_secs = 30;
+static size_t content_size = 64;
+static size_t content_len;                  // content_size, o el instante si es más largo
+static size_t msg_cap;                      // Mensaje más largo que se arma
+static char name_prefix[32];
+static bool use_binary = false;             // chat-protocol-bin en vez de JSON
+static bool use_deflate = false;            // Ofrecer permessage-deflate
+static uint64_t send_interval_ns;           // Intervalo entre envíos de una conexión
+
+static atomic_int phase = PHASE_RAMP;
+static atomic_int connected_count = 0;
+static atomic_int registered_count = 0;
+static atomic_int failed_count = 0;
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [opciones] <IP_del_servidor> <puerto_del_servidor>\n"
+            "  -c <n>      conexiones (por defecto %d)\n"
+            "  -t <n>      hilos de event loop (por defecto %d)\n"
+            "  -r <n>      mensajes por segundo en total (por defecto %.0f)\n"
+            "  -m <b:p:l>  mezcla broadcast:private:list_users (por defecto %u:%u:%u)\n"
+            "  -d <seg>    duración de la medición (por defecto %d)\n"
+            "  -s <bytes>  tamaño del contenido (por defecto %zu, máx %d)\n"
+            "  -p <pref>   prefijo de los usuarios (por defecto lg<pid>_)\n"
+            "  -b          usar el subprotocolo binario %s\n"
+            "  -z          ofrecer compresión permessage-deflate\n"
+            "Con miles de conexiones puede ser necesario subir 'ulimit -n'.\n",
+            prog, total_conns, thread_total, target_rate,
+            mix[0], mix[1], mix[2], duration_secs, content_size, MAX_MESSAGE_SIZE - LG_ENVELOPE,
+            BINPROTO_NAME);
+}
+
+static bool parse_mix(const char *arg) {
+    unsigned b, p, l;
+    if (sscanf(arg, "%u:%u:%u", &b, &p, &l) != 3 || b + p + l == 0)
+        return false;
+    mix[LG_BROADCAST] = b;
+    mix[LG_PRIVATE] = p;
+    mix[LG_LIST_USERS] = l;
+    mix_total = b + p + l;
+    return true;
+}
+
+static lg_kind_t pick_kind(lg_thread_t *t) {
+    unsigned r = (unsigned)rand_r(&t->seed) % mix_total;
+    if (r < mix[LG_BROADCAST])
+        return LG_BROADCAST;
+    if (r < mix[LG_BROADCAST] + mix[LG_PRIVATE])
+        return LG_PRIVATE;
+    return LG_LIST_USERS;
+}
+
+static int pick_target(lg_conn_t *c) {
+    lg_thread_t *t = c->owner;
+    int target = total_conns > 1 ? (int)((unsigned)rand_r(&t->seed) % (unsigned)total_conns) : c->index;
+    if (target == c->index && total_conns > 1)
+        target = (target + 1) % total_conns;
+    return target;
+}
+
+/* Mensaje de build_message en binario: las dos pasadas del writer miden y
+   escriben directo en 'buf' */
+static size_t build_binary(lg_conn_t *c, char *buf, size_t cap, lg_kind_t kind, uint64_t now,
+                           const char *content, size_t content_len) {
+    char sender[64], target[64];
+    int sender_len = snprintf(sender, sizeof(sender), "%s%d", name_prefix, c->index);
+    int target_len = 0;
+    bin_type_t type;
+    switch (kind) {
+        case LG_BROADCAST:
+            type = BIN_TYPE_BROADCAST;
+            break;
+        case LG_PRIVATE:
+            type = BIN_TYPE_PRIVATE;
+            target_len = snprintf(target, sizeof(target), "%s%d", name_prefix, pick_target(c));
+            break;
+        case LG_LIST_USERS:
+            if (c->list_tail - c->list_head == LG_OUTSTANDING_LIST)
+                return 0;
+            c->list_sent[c->list_tail++ % LG_OUTSTANDING_LIST] = now;
+            type = BIN_TYPE_LIST_USERS;
+            break;
+        default:
+            return 0;
+    }
+    // Primera pasada: solo mide
+    json_writer_t w = { NULL, 0 };
+    while (true) {
+        bin_write_type(&w, type);
+        bin_write_str(&w, BIN_KEY_SENDER, sender, (size_t)sender_len);
+        if (target_len > 0)
+            bin_write_str(&w, BIN_KEY_TARGET, target, (size_t)target_len);
+        if (kind != LG_LIST_USERS)
+            bin_write_str(&w, BIN_KEY_CONTENT, content, content_len);
+        if (w.out)
+            return w.len;
+        if (w.len > cap)
+            return 0;
+        w = (json_writer_t){ buf, 0 };
+    }
+}
+
+/* Arma el siguiente mensaje de 'c' en 'buf'. Retorna su largo o 0. */
+static size_t build_message(lg_conn_t *c, char *buf, size_t cap, lg_kind_t kind, uint64_t now) {
+    char *content = c->owner->content;
+    // Instante de envío al inicio del contenido; el resto es relleno
+    int n = snprintf(content, content_len + 1, "%llu:", (unsigned long long)now);
+    size_t len = (size_t)n;
+    while (len < content_size)
+        content[len++] = 'x';
+    content[len] = '\0';
+
+    if (use_binary)
+        return build_binary(c, buf, cap, kind, now, content, len);
+
+    switch (kind) {
+        case LG_BROADCAST:
+            n = snprintf(buf, cap,
+                         "{\"type\":\"broadcast\",\"sender\":\"%s%d\",\"content\":\"%s\"}",
+                         name_prefix, c->index, content);
+            break;
+        case LG_PRIVATE: {
+            int target = pick_target(c);
+            n = snprintf(buf, cap,
+                         "{\"type\":\"private\",\"sender\":\"%s%d\",\"target\":\"%s%d\",\"content\":\"%s\"}",
+                         name_prefix, c->index, name_prefix, target, content);
+            break;
+        }
+        case LG_LIST_USERS:
+            if (c->list_tail - c->list_head == LG_OUTSTANDING_LIST)
+                return 0;   // Demasiadas sin respuesta; se salta este envío
+            c->list_sent[c->list_tail++ % LG_OUTSTANDING_LIST] = now;
+            n = snprintf(buf, cap, "{\"type\":\"list_users\",\"sender\":\"%s%d\"}",
+                         name_prefix, c->index);
+            break;
+        default:
+            return 0;
+    }
+    if (n < 0 || (size_t)n >= cap)
+        return 0;
+    return (size_t)n;
+}
+
+static void record(lg_thread_t *t, lg_kind_t kind, uint64_t sent_ns) {
+    t->received[kind]++;
+    uint64_t now = monotonic_ns();
+    if (atomic_load_explicit(&phase, memory_order_relaxed) == PHASE_MEASURE && now > sent_ns)
+        histogram_record(&t->latency[kind], now - sent_ns);
+}
+
+/* Extrae el instante de envío embebido en el contenido ("<ns>:relleno") */
+static bool content_sent_ns(const char *content, size_t len, uint64_t *out) {
+    uint64_t v = 0;
+    size_t i = 0;
+    while (i < len && content[i] >= '0' && content[i] <= '9')
+        v = v * 10 + (uint64_t)(content[i++] - '0');
+    if (i == 0 || i >= len || content[i] != ':')
+        return false;
+    *out = v;
+    return true;
+}
+
+/* Mensaje recibido, ya decodificado en cualquiera de los dos formatos */
+static void handle_message(lg_conn_t *c, const char *type, const char *content, size_t content_len) {
+    lg_thread_t *t = c->owner;
+    uint64_t sent_ns;
+    if (strcmp(type, "register_success") == 0) {
+        if (!c->registered) {
+            c->registered = true;
+            atomic_fetch_add(&registered_count, 1);
+        }
+    } else if (strcmp(type, "broadcast") == 0) {
+        if (content_sent_ns(content, content_len, &sent_ns))
+            record(t, LG_BROADCAST, sent_ns);
+    } else if (strcmp(type, "private") == 0) {
+        if (content_sent_ns(content, content_len, &sent_ns))
+            record(t, LG_PRIVATE, sent_ns);
+    } else if (strcmp(type, "list_users_response") == 0) {
+        if (c->list_head != c->list_tail)
+            record(t, LG_LIST_USERS, c->list_sent[c->list_head++ % LG_OUTSTANDING_LIST]);
+    } else if (strcmp(type, "error") == 0) {
+        t->errors++;
+    }
+}
+
+static void handle_object(lg_conn_t *c, const cJSON *json) {
+    const cJSON *type = cJSON_GetObjectItemCaseSensitive(json, "type");
+    const cJSON *content = cJSON_GetObjectItemCaseSensitive(json, "content");
+    if (cJSON_IsString(type) && type->valuestring) {
+        bool has_content = cJSON_IsString(content) && content->valuestring;
+        handle_message(c, type->valuestring, has_content ? content->valuestring : "",
+                       has_content ? strlen(content->valuestring) : 0);
+    }
+}
+
+static void handle_json(lg_conn_t *c, const char *msg) {
+    cJSON *json = cJSON_Parse(msg);
+    if (!json)
+        return;
+    // Un lote de broadcasts llega como arreglo
+    if (cJSON_IsArray(json)) {
+        const cJSON *item;
+        cJSON_ArrayForEach(item, json)
+            handle_object(c, item);
+    } else {
+        handle_object(c, json);
+    }
+    cJSON_Delete(json);
+}
+
+static void handle_binary(lg_conn_t *c, const char *msg, size_t len);
+
+static bool handle_batch_item(const void *msg, size_t len, void *ctx) {
+    handle_binary(ctx, msg, len);
+    return true;
+}
+
+static void handle_binary(lg_conn_t *c, const char *msg, size_t len) {
+    if (bin_batch_each(msg, len, handle_batch_item, c))
+        return;
+    bin_msg_t decoded;
+    char type[32];
+    if (!bin_decode(msg, len, &decoded) || decoded.type_len >= sizeof(type))
+        return;
+    memcpy(type, decoded.type_name, decoded.type_len);
+    type[decoded.type_len] = '\0';
+    const bin_field_t *content = bin_get(&decoded, BIN_KEY_CONTENT);
+    if (content && content->kind == BIN_VAL_STR)
+        handle_message(c, type, content->str, content->str_len);
+    else
+        handle_message(c, type, "", 0);
+}
+
+static void handle_receive(lg_conn_t *c, struct lws *wsi, const char *in, size_t len) {
+    if (c->rx_len + len + 1 > c->rx_cap) {
+        size_t new_cap = c->rx_cap ? c->rx_cap : 4096;
+        while (new_cap < c->rx_len + len + 1)
+            new_cap *= 2;
+        char *grown = realloc(c->rx, new_cap);
+        if (!grown) {
+            c->rx_len = 0;
+            return;
+        }
+        c->rx = grown;
+        c->rx_cap = new_cap;
+    }
+    memcpy(c->rx + c->rx_len, in, len);
+    c->rx_len += len;
+    if (!lws_is_final_fragment(wsi))
+        return;
+    c->rx[c->rx_len] = '\0';
+    if (use_binary)
+        handle_binary(c, c->rx, c->rx_len);
+    else
+        handle_json(c, c->rx);
+    c->rx_len = 0;
+}
+
+static void handle_writeable(lg_conn_t *c, struct lws *wsi) {
+    char *payload = (char *)&c->owner->tx_buf[LWS_PRE];
+    size_t len = 0;
+    uint64_t now = monotonic_ns();
+    lg_kind_t kind = LG_KIND_COUNT;
+
+    if (!c->registered && use_binary) {
+        char sender[64];
+        int n = snprintf(sender, sizeof(sender), "%s%d", name_prefix, c->index);
+        json_writer_t w = { payload, 0 };
+        bin_write_type(&w, BIN_TYPE_REGISTER);
+        bin_write_str(&w, BIN_KEY_SENDER, sender, (size_t)n);
+        len = w.len;
+    } else if (!c->registered) {
+        int n = snprintf(payload, msg_cap,
+                         "{\"type\":\"register\",\"sender\":\"%s%d\",\"content\":null}",
+                         name_prefix, c->index);
+        len = n > 0 ? (size_t)n : 0;
+    } else if (atomic_load_explicit(&phase, memory_order_acquire) == PHASE_MEASURE &&
+               c->next_send_ns <= now) {
+        kind = pick_kind(c->owner);
+        len = build_message(c, payload, msg_cap, kind, now);
+        // Lazo abierto: el próximo envío se programa desde el anterior, no desde
+        // ahora, para que un servidor lento no reduzca la carga que recibe
+        c->next_send_ns += send_interval_ns;
+    }
+    if (len == 0)
+        return;
+    if (lws_write(wsi, (unsigned char *)payload, len, use_binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT) < (int)len) {
+        c->owner->errors++;
+        return;
+    }
+    if (kind != LG_KIND_COUNT)
+        c->owner->sent[kind]++;
+    // Si quedó atrasada, sigue escribiendo en el próximo ciclo
+    if (kind != LG_KIND_COUNT && c->next_send_ns <= now)
+        lws_callback_on_writable(wsi);
+}
+
+static int callback_loadgen(struct lws *wsi, enum lws_callback_reasons reason,
+                            void *user, void *in, size_t len) {
+    lg_conn_t *c = (lg_conn_t *)user;
+    switch (reason) {
+        case LWS_CALLBACK_CLIENT_ESTABLISHED: {
+            int flag = 1;
+            setsockopt(lws_get_socket_fd(wsi), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+            c->connected = true;
+            atomic_fetch_add(&connected_count, 1);
+            lws_callback_on_writable(wsi);   // Envía el registro
+            break;
+        }
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            atomic_fetch_add(&failed_count, 1);
+            if (c) {
+                c->wsi = NULL;
+                c->closed = true;
+            }
+            break;
+        case LWS_CALLBACK_CLIENT_RECEIVE:
+            handle_receive(c, wsi, (const char *)in, len);
+            break;
+        case LWS_CALLBACK_CLIENT_WRITEABLE:
+            handle_writeable(c, wsi);
+            break;
+        case LWS_CALLBACK_CLIENT_CLOSED:
+            if (c) {
+                c->wsi = NULL;
+                c->closed = true;
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static const struct lws_protocols protocols[] = {
+    { "chat-protocol", callback_loadgen, 0, LG_RX_BUFFER },
+    { BINPROTO_NAME, callback_loadgen, 0, LG_RX_BUFFER, BINPROTO_ID, NULL, 0 },
+    { NULL, NULL, 0, 0 }
+};
+
+/* Tick del hilo: pide escritura a las conexiones con un envío vencido */
+static void tick(lws_sorted_usec_list_t *sul) {
+    lg_thread_t *t = lws_container_of(sul, lg_thread_t, sul);
+    // acquire: los next_send_ns los fija el hilo principal antes de pasar a MEASURE
+    if (atomic_load_explicit(&phase, memory_order_acquire) == PHASE_MEASURE) {
+        uint64_t now = monotonic_ns();
+        for (int i = 0; i < t->conn_count; i++) {
+            lg_conn_t *c = &t->conns[i];
+            if (c->wsi && c->registered && c->next_send_ns <= now)
+                lws_callback_on_writable(c->wsi);
+        }
+    }
+    lws_sul_schedule(t->context, 0, &t->sul, tick, LG_TICK_US);
+}
+
+static void *event_loop(void *arg) {
+    lg_thread_t *t = arg;
+
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = protocols;
+    // Espacio para todas las conexiones del hilo más un margen
+    info.fd_limit_per_thread = (unsigned)t->conn_count + 16;
+    if (use_deflate)
+        info.extensions = deflate_extensions;
+    t->context = lws_create_context(&info);
+    if (!t->context) {
+        fprintf(stderr, "[LOADGEN] Error creando contexto\n");
+        return NULL;
+    }
+
+    for (int i = 0; i < t->conn_count; i++) {
+        lg_conn_t *c = &t->conns[i];
+        struct lws_client_connect_info ccinfo;
+        memset(&ccinfo, 0, sizeof(ccinfo));
+        ccinfo.context  = t->context;
+        ccinfo.address  = server_host;
+        ccinfo.port     = server_port;
+        ccinfo.path     = "/chat";
+        ccinfo.host     = server_host;
+        ccinfo.origin   = server_host;
+        ccinfo.protocol = protocols[use_binary].name;
+        ccinfo.userdata = c;
+        ccinfo.pwsi     = &c->wsi;
+        // Si falla, lws ya pudo haber avisado con CLIENT_CONNECTION_ERROR
+        if (!lws_client_connect_via_info(&ccinfo) && !c->closed) {
+            atomic_fetch_add(&failed_count, 1);
+            c->closed = true;
+        }
+    }
+
+    lws_sul_schedule(t->context, 0, &t->sul, tick, LG_TICK_US);
+    while (atomic_load(&phase) != PHASE_STOP)
+        lws_service(t->context, 0);
+
+    lws_sul_cancel(&t->sul);
+    lws_context_destroy(t->context);
+    return NULL;
+}
+
+static void print_report(lg_thread_t *threads, double elapsed) {
+    histogram_t *total = calloc(LG_KIND_COUNT + 1, sizeof(histogram_t));
+    if (!total)
+        return;
+    uint64_t sent[LG_KIND_COUNT] = { 0 }, received[LG_KIND_COUNT] = { 0 }, errors = 0;
+    uint64_t all_sent = 0, all_received = 0;
+    for (int i = 0; i < thread_total; i++) {
+        for (int k = 0; k < LG_KIND_COUNT; k++) {
+            histogram_merge(&total[k], &threads[i].latency[k]);
+            histogram_merge(&total[LG_KIND_COUNT], &threads[i].latency[k]);
+            sent[k] += threads[i].sent[k];
+            received[k] += threads[i].received[k];
+        }
+        errors += threads[i].errors;
+    }
+
+    printf("\n=== RESULTADOS (%.1f s) ===\n", elapsed);
+    printf("Conexiones: %d abiertas, %d registradas, %d fallidas\n",
+           atomic_load(&connected_count), atomic_load(&registered_count),
+           atomic_load(&failed_count));
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n",
+           "tipo", "enviados", "recibidos", "env/s", "p50 us", "p99 us", "p999 us");
+    for (int k = 0; k <= LG_KIND_COUNT; k++) {
+        const char *name = k < LG_KIND_COUNT ? kind_names[k] : "total";
+        uint64_t s = k < LG_KIND_COUNT ? sent[k] : all_sent;
+        uint64_t r = k < LG_KIND_COUNT ? received[k] : all_received;
+        printf("%-12s %10llu %10llu %10.0f %10.1f %10.1f %10.1f\n", name,
+               (unsigned long long)s, (unsigned long long)r, (double)s / elapsed,
+               (double)histogram_percentile(&total[k], 50.0) / 1e3,
+               (double)histogram_percentile(&total[k], 99.0) / 1e3,
+               (double)histogram_percentile(&total[k], 99.9) / 1e3);
+        if (k < LG_KIND_COUNT) {
+            all_sent += s;
+            all_received += r;
+        }
+    }
+    printf("Recepciones/s: %.0f (broadcast cuenta una por destinatario)\n",
+           (double)all_received / elapsed);
+    printf("Errores: %llu\n", (unsigned long long)errors);
+    free(total);
+}
+
+int main(int argc, char **argv) {
+    snprintf(name_prefix, sizeof(name_prefix), "lg%d_", (int)getpid());
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:r:m:d:s:p:bzh")) != -1) {
+        switch (opt) {
+            case 'c': total_conns = atoi(optarg); break;
+            case 't': thread_total = atoi(optarg); break;
+            case 'r': target_rate = atof(optarg); break;
+            case 'd': duration_secs = atoi(optarg); break;
+            case 's': content_size = (size_t)strtoull(optarg, NULL, 10); break;
+            case 'p': snprintf(name_prefix, sizeof(name_prefix), "%s", optarg); break;
+            case 'b': use_binary = true; break;
+            case 'z': use_deflate = true; break;
+            case 'm':
+                if (!parse_mix(optarg)) {
+                    fprintf(stderr, "[LOADGEN] Mezcla inválida: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2 || total_conns <= 0 || thread_total <= 0 ||
+        target_rate <= 0 || duration_secs <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    // Cada mensaje debe caber entero en el búfer y en MAX_MESSAGE_SIZE del servidor
+    content_len = content_size > LG_STAMP_LEN ? content_size : LG_STAMP_LEN;
+    if (content_len > MAX_MESSAGE_SIZE - LG_ENVELOPE) {
+        fprintf(stderr, "[LOADGEN] Contenido de %zu bytes: el servidor acepta mensajes de hasta %d\n",
+                content_size, MAX_MESSAGE_SIZE);
+        return 1;
+    }
+    msg_cap = content_len + LG_ENVELOPE;
+    server_host = argv[optind];
+    server_port = atoi(argv[optind + 1]);
+    if (thread_total > total_conns)
+        thread_total = total_conns;
+    // Cada conexión envía a total_rate / total_conns mensajes por segundo
+    send_interval_ns = (uint64_t)(1e9 * total_conns / target_rate);
+
+    lws_set_log_level(0, NULL);
+
+    lg_conn_t *conns = calloc((size_t)total_conns, sizeof(lg_conn_t));
+    lg_thread_t *threads = calloc((size_t)thread_total, sizeof(lg_thread_t));
+    if (!conns || !threads) {
+        fprintf(stderr, "[LOADGEN] Sin memoria\n");
+        return 1;
+    }
+
+    // Reparte las conexiones en bloques contiguos entre los hilos
+    int offset = 0;
+    for (int i = 0; i < thread_total; i++) {
+        lg_thread_t *t = &threads[i];
+        t->conns = &conns[offset];
+        t->conn_count = total_conns / thread_total + (i < total_conns % thread_total);
+        t->seed = (unsigned)(getpid() * 31 + i);
+        t->tx_buf = malloc(LWS_PRE + msg_cap);
+        t->content = malloc(content_len + 1);
+        if (!t->tx_buf || !t->content) {
+            fprintf(stderr, "[LOADGEN] Sin memoria\n");
+            return 1;
+        }
+        for (int j = 0; j < t->conn_count; j++) {
+            t->conns[j].owner = t;
+            t->conns[j].index = offset + j;
+        }
+        offset += t->conn_count;
+    }
+
+    printf("[LOADGEN] %d conexiones, %d hilos, %.0f msg/s, mezcla %u:%u:%u, %d s\n",
+           total_conns, thread_total, target_rate, mix[0], mix[1], mix[2], duration_secs);
+    for (int i = 0; i < thread_total; i++)
+        pthread_create(&threads[i].thread, NULL, event_loop, &threads[i]);
+
+    // Rampa: esperar a que se registren todas (o a que se agote el tiempo)
+    uint64_t ramp_start = monotonic_ns();
+    while (atomic_load(&registered_count) + atomic_load(&failed_count) < total_conns &&
+           monotonic_ns() - ramp_start < (uint64_t)LG_RAMP_TIMEOUT * 1000000000ULL)
+        usleep(100000);
+    printf("[LOADGEN] Registradas %d/%d conexiones en %.1f s\n",
+           atomic_load(&registered_count), total_conns,
+           (double)(monotonic_ns() - ramp_start) / 1e9);
+
+    // Escalona el primer envío de cada conexión dentro de un intervalo
+    uint64_t start = monotonic_ns();
+    for (int i = 0; i < total_conns; i++)
+        conns[i].next_send_ns = start + send_interval_ns * (uint64_t)i / (uint64_t)total_conns;
+    atomic_store(&phase, PHASE_MEASURE);
+
+    sleep((unsigned)duration_secs);
+    double elapsed = (double)(monotonic_ns() - start) / 1e9;
+    atomic_store(&phase, PHASE_STOP);
+    for (int i = 0; i < thread_total; i++) {
+        if (threads[i].context)
+            lws_cancel_service(threads[i].context);
+        pthread_join(threads[i].thread, NULL);
+    }
+
+    print_report(threads, elapsed);
+
+    for (int i = 0; i < total_conns; i++)
+        free(conns[i].rx);
+    for (int i = 0; i < thread_total; i++) {
+        free(threads[i].tx_buf);
+        free(threads[i].content);
+    }
+    free(conns);
+    free(threads);
+    return 0;
+}
@@ -0,0 +1,393 @@
+/**
+ * chat_replay: reproduce una captura de tráfico (chat_server <puerto> <captura>)
+ * contra un servidor local, por conexiones WebSocket reales.
+ *
+ * Cada conexión capturada se abre, envía sus frames y se cierra en los mismos
+ * instantes relativos, escalados por la velocidad (-s 1 = tiempo real, -s N =
+ * N veces más rápido, -s max = sin esperas). Los frames de una conexión
+ * conservan su orden. Un solo hilo atiende todas las conexiones, así que a
+ * velocidad 1x el orden global también es el de la captura.
+ *
+ * La latencia se mide por conexión, desde cada envío hasta el siguiente frame
+ * recibido cuyo "sender" sea "server" o el propio usuario (las respuestas y el
+ * eco de sus broadcasts); es una aproximación para tráfico que no es
+ * petición/respuesta.
+ */
+#define _GNU_SOURCE
+#include <libwebsockets.h>
+#include <cjson/cJSON.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "capture.h"
+#include "histogram.h"
+#include "time_utils.h"
+
+#define RP_RX_BUFFER 4096           // Recepción; los mensajes más largos llegan en fragmentos
+#define RP_BATCH 1024               // Eventos por tick antes de volver a atender sockets
+#define RP_OUTSTANDING 256          // Envíos sin respuesta recordados por conexión
+#define RP_DRAIN_NS 5000000000ULL   // Espera por respuestas al terminar la captura
+
+typedef struct {
+    capture_record_t rec;
+    int32_t next;                   // Siguiente frame pendiente de la misma conexión
+} rp_event_t;
+
+typedef enum { RP_IDLE, RP_CONNECTING, RP_OPEN, RP_CLOSED } rp_state_t;
+
+typedef struct {
+    struct lws *wsi;
+    rp_state_t state;
+    bool close_pending;             // La captura cerró la conexión tras sus frames
+    int32_t queue_head, queue_tail; // Frames por enviar (índices en events)
+    char sender_match[96];          // "sender":"<usuario>" una vez conocido
+    uint64_t sent_at[RP_OUTSTANDING];
+    unsigned sent_head, sent_tail;
+} rp_conn_t;
+
+static rp_event_t *events = NULL;
+static size_t event_count = 0;
+static size_t cursor = 0;
+static rp_conn_t *conns = NULL;
+static size_t conn_count = 0;
+
+static const char *server_host = NULL;
+static int server_port = 0;
+static double speed = 1.0;          // 0 = máxima velocidad
+static struct lws_context *context = NULL;
+static lws_sorted_usec_list_t sul;
+static uint64_t replay_start_ns = 0;
+static uint64_t finished_ns = 0;    // Cuando se procesó el último evento
+static bool done = false;
+
+static histogram_t latency;
+static histogram_t schedule_lag;    // Cuánto tarde se procesó cada evento
+static uint64_t frames_sent = 0, frames_received = 0;
+static uint64_t opened = 0, failed = 0, skipped = 0;
+static int open_conns = 0;
+
+// Frame a enviar con LWS_PRE libre adelante; crece hasta el evento más largo
+static unsigned char *write_buf = NULL;
+static size_t write_cap = 0;
+
+static const char SERVER_SENDER[] = "\"sender\":\"server\"";
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Uso: %s [-s velocidad] <captura> <IP_del_servidor> <puerto_del_servidor>\n"
+            "  -s <n|max>  1 = tiempo real (por defecto), N = N veces más rápido, max = sin esperas\n",
+            prog);
+}
+
+/* Carga la captura completa en memoria y arma la lista de eventos */
+static char *load_capture(const char *path, size_t *out_len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = size > 0 ? malloc((size_t)size) : NULL;
+    if (!buf || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        fprintf(stderr, "[REPLAY] No se pudo leer %s\n", path);
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *out_len = (size_t)size;
+    return buf;
+}
+
+static bool build_events(const char *buf, size_t len) {
+    capture_reader_t r;
+    capture_record_t rec;
+    if (!capture_reader_init(&r, buf, len)) {
+        fprintf(stderr, "[REPLAY] El archivo no es una captura válida\n");
+        return false;
+    }
+    size_t cap = 1024;
+    events = malloc(cap * sizeof(rp_event_t));
+    capture_conn_t max_conn = 0;
+    while (events && capture_next(&r, &rec)) {
+        if (event_count == cap) {
+            cap *= 2;
+            rp_event_t *grown = realloc(events, cap * sizeof(rp_event_t));
+            if (!grown)
+                return false;
+            events = grown;
+        }
+        events[event_count].rec = rec;
+        events[event_count].next = -1;
+        event_count++;
+        if (rec.conn > max_conn)
+            max_conn = rec.conn;
+    }
+    if (r.pos < r.end)
+        fprintf(stderr, "[REPLAY] Captura truncada; se usan %zu eventos\n", event_count);
+
+    conn_count = (size_t)max_conn + 1;
+    conns = calloc(conn_count, sizeof(rp_conn_t));
+    if (!events || !conns)
+        return false;
+    for (size_t i = 0; i < conn_count; i++)
+        conns[i].queue_head = conns[i].queue_tail = -1;
+    return true;
+}
+
+/* Aprende el usuario de la conexión a partir de su "register" */
+static void learn_sender(rp_conn_t *c, const rp_event_t *ev) {
+    if (c->sender_match[0])
+        return;
+    cJSON *json = cJSON_ParseWithLength(ev->rec.data, ev->rec.len);
+    if (!json)
+        return;
+    const cJSON *type = cJSON_GetObjectItemCaseSensitive(json, "type");
+    const cJSON *sender = cJSON_GetObjectItemCaseSensitive(json, "sender");
+    if (cJSON_IsString(type) && strcmp(type->valuestring, "register") == 0 &&
+        cJSON_IsString(sender) && sender->valuestring)
+        snprintf(c->sender_match, sizeof(c->sender_match), "\"sender\":\"%s\"",
+                 sender->valuestring);
+    cJSON_Delete(json);
+}
+
+static int callback_replay(struct lws *wsi, enum lws_callback_reasons reason,
+                           void *user, void *in, size_t len) {
+    rp_conn_t *c = (rp_conn_t *)user;
+    switch (reason) {
+        case LWS_CALLBACK_CLIENT_ESTABLISHED: {
+            int flag = 1;
+            setsockopt(lws_get_socket_fd(wsi), IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+            c->state = RP_OPEN;
+            opened++;
+            open_conns++;
+            if (c->queue_head >= 0 || c->close_pending)
+                lws_callback_on_writable(wsi);
+            break;
+        }
+        case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+            failed++;
+            if (c) {
+                c->state = RP_CLOSED;
+                c->wsi = NULL;
+            }
+            break;
+        case LWS_CALLBACK_CLIENT_WRITEABLE: {
+            if (c->queue_head < 0) {
+                // Sin frames pendientes y la captura ya la cerró
+                return c->close_pending ? -1 : 0;
+            }
+            rp_event_t *ev = &events[c->queue_head];
+            c->queue_head = ev->next;
+            if (c->queue_head < 0)
+                c->queue_tail = -1;
+
+            size_t n = ev->rec.len;
+            if (LWS_PRE + n > write_cap) {
+                unsigned char *grown = realloc(write_buf, LWS_PRE + n);
+                if (!grown) {
+                    fprintf(stderr, "[REPLAY] Sin memoria para un frame de %zu bytes\n", n);
+                    return -1;
+                }
+                write_buf = grown;
+                write_cap = LWS_PRE + n;
+            }
+            memcpy(&write_buf[LWS_PRE], ev->rec.data, n);
+            learn_sender(c, ev);
+            if (lws_write(wsi, &write_buf[LWS_PRE], n, LWS_WRITE_TEXT) < (int)n)
+                return -1;
+            frames_sent++;
+            if (c->sent_tail - c->sent_head == RP_OUTSTANDING)
+                c->sent_head++;     // Se olvida el más viejo
+            c->sent_at[c->sent_tail++ % RP_OUTSTANDING] = monotonic_ns();
+            if (c->queue_head >= 0 || c->close_pending)
+                lws_callback_on_writable(wsi);
+            break;
+        }
+        case LWS_CALLBACK_CLIENT_RECEIVE:
+            if (lws_is_final_fragment(wsi))
+                frames_received++;
+            if (lws_is_first_fragment(wsi) && c->sent_head != c->sent_tail &&
+                (memmem(in, len, SERVER_SENDER, sizeof(SERVER_SENDER) - 1) ||
+                 (c->sender_match[0] &&
+                  memmem(in, len, c->sender_match, strlen(c->sender_match))))) {
+                uint64_t sent = c->sent_at[c->sent_head++ % RP_OUTSTANDING];
+                histogram_record(&latency, monotonic_ns() - sent);
+            }
+            break;
+        case LWS_CALLBACK_CLIENT_CLOSED:
+            if (c && c->state == RP_OPEN)
+                open_conns--;
+            if (c) {
+                c->state = RP_CLOSED;
+                c->wsi = NULL;
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static const struct lws_protocols protocols[] = {
+    { "chat-protocol", callback_replay, 0, RP_RX_BUFFER },
+    { NULL, NULL, 0, 0 }
+};
+
+static void open_connection(rp_conn_t *c) {
+    struct lws_client_connect_info ccinfo;
+    memset(&ccinfo, 0, sizeof(ccinfo));
+    ccinfo.context  = context;
+    ccinfo.address  = server_host;
+    ccinfo.port     = server_port;
+    ccinfo.path     = "/chat";
+    ccinfo.host     = server_host;
+    ccinfo.origin   = server_host;
+    ccinfo.protocol = protocols[0].name;
+    ccinfo.userdata = c;
+    ccinfo.pwsi     = &c->wsi;
+    c->state = RP_CONNECTING;
+    if (!lws_client_connect_via_info(&ccinfo) && c->state == RP_CONNECTING) {
+        failed++;
+        c->state = RP_CLOSED;
+    }
+}
+
+static void apply_event(size_t index) {
+    rp_event_t *ev = &events[index];
+    rp_conn_t *c = &conns[ev->rec.conn];
+    switch (ev->rec.kind) {
+        case CAPTURE_OPEN:
+            if (c->state == RP_IDLE)
+                open_connection(c);
+            break;
+        case CAPTURE_DATA:
+            if (c->state != RP_CONNECTING && c->state != RP_OPEN) {
+                skipped++;
+                break;
+            }
+            if (c->queue_tail >= 0)
+                events[c->queue_tail].next = (int32_t)index;
+            else
+                c->queue_head = (int32_t)index;
+            c->queue_tail = (int32_t)index;
+            if (c->state == RP_OPEN)
+                lws_callback_on_writable(c->wsi);
+            break;
+        case CAPTURE_CLOSE:
+            c->close_pending = true;
+            if (c->state == RP_OPEN)
+                lws_callback_on_writable(c->wsi);
+            break;
+    }
+}
+
+static uint64_t due_ns(size_t index) {
+    if (speed == 0.0)
+        return replay_start_ns;
+    return replay_start_ns + (uint64_t)((double)events[index].rec.time_ns / speed);
+}
+
+/* Procesa los eventos vencidos y se reprograma para el siguiente */
+static void tick(lws_sorted_usec_list_t *s) {
+    (void)s;
+    uint64_t now = monotonic_ns();
+    for (int n = 0; n < RP_BATCH && cursor < event_count && due_ns(cursor) <= now; n++) {
+        histogram_record(&schedule_lag, now - due_ns(cursor));
+        apply_event(cursor++);
+    }
+    if (cursor < event_count) {
+        uint64_t due = due_ns(cursor);
+        lws_usec_t wait_us = due > now ? (lws_usec_t)((due - now) / 1000) : 0;
+        lws_sul_schedule(context, 0, &sul, tick, wait_us);
+    } else if (!finished_ns) {
+        finished_ns = now;
+    }
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "s:h")) != -1) {
+        switch (opt) {
+            case 's':
+                speed = strcmp(optarg, "max") == 0 ? 0.0 : atof(optarg);
+                if (speed < 0.0) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    server_host = argv[optind + 1];
+    server_port = atoi(argv[optind + 2]);
+
+    size_t capture_len = 0;
+    char *capture = load_capture(argv[optind], &capture_len);
+    if (!capture || !build_events(capture, capture_len))
+        return 1;
+    if (speed == 0.0)
+        printf("[REPLAY] %zu eventos, %zu conexiones, velocidad max\n", event_count, conn_count - 1);
+    else
+        printf("[REPLAY] %zu eventos, %zu conexiones, velocidad %gx\n", event_count, conn_count - 1, speed);
+
+    lws_set_log_level(0, NULL);
+    struct lws_context_creation_info info;
+    memset(&info, 0, sizeof(info));
+    info.port = CONTEXT_PORT_NO_LISTEN;
+    info.protocols = protocols;
+    context = lws_create_context(&info);
+    if (!context) {
+        fprintf(stderr, "[REPLAY] Error creando contexto\n");
+        return 1;
+    }
+
+    replay_start_ns = monotonic_ns();
+    lws_sul_schedule(context, 0, &sul, tick, 0);
+    while (!done) {
+        lws_service(context, 0);
+        // Terminada la captura, se espera a que cierren o a que pase el margen
+        if (finished_ns && (open_conns == 0 || monotonic_ns() - finished_ns > RP_DRAIN_NS))
+            done = true;
+    }
+    uint64_t end_ns = monotonic_ns();
+    lws_sul_cancel(&sul);
+    lws_context_destroy(context);
+
+    double elapsed = (double)(end_ns - replay_start_ns) / 1e9;
+    double captured = event_count ? (double)events[event_count - 1].rec.time_ns / 1e9 : 0.0;
+    printf("\n=== RESULTADOS ===\n");
+    printf("Duración: %.2f s (captura: %.2f s)\n", elapsed, captured);
+    printf("Conexiones: %llu abiertas, %llu fallidas\n",
+           (unsigned long long)opened, (unsigned long long)failed);
+    printf("Frames: %llu enviados (%.0f/s), %llu recibidos (%.0f/s), %llu omitidos\n",
+           (unsigned long long)frames_sent, (double)frames_sent / elapsed,
+           (unsigned long long)frames_received, (double)frames_received / elapsed,
+           (unsigned long long)skipped);
+    printf("Latencia us: p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+           (double)histogram_percentile(&latency, 50.0) / 1e3,
+           (double)histogram_percentile(&latency, 99.0) / 1e3,
+           (double)histogram_percentile(&latency, 99.9) / 1e3,
+           (double)atomic_load(&latency.max) / 1e3);
+    printf("Retraso respecto del horario us: p99 %.1f  max %.1f\n",
+           (double)histogram_percentile(&schedule_lag, 99.0) / 1e3,
+           (double)atomic_load(&schedule_lag.max) / 1e3);
+
+    free(conns);
+    free(events);
+    free(write_buf);
+    free(capture);
+    return 0;
+}
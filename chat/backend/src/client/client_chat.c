@@ -1,6 +1,7 @@
 #include <libwebsockets.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <pthread.h>
 #include <cjson/cJSON.h>
@@ -10,21 +11,74 @@
 #include <time.h>
 #include <errno.h>
 
-#define MAX_MSG_LEN 512 
+#define MAX_MSG_LEN (1024 * 1024)  // Igual que MAX_MESSAGE_SIZE del servidor
+#define RX_CHUNK 4096               // rx_buffer_size: los mensajes mayores llegan en partes
+#define RECONNECT_BASE_MS 250       // Espera del primer reintento de conexión
+#define RECONNECT_MAX_MS 10000      // Tope de la espera entre reintentos
+
+// Ping/pong: un servidor caído se detecta sin esperar a TCP y dispara la reconexión
+static const lws_retry_bo_t liveness_policy = {
+    .secs_since_valid_ping = 15,
+    .secs_since_valid_hangup = 40,
+};
 
 // Variables globales para la conexión y la sincronización
 static struct lws *client_wsi;
 static struct lws_context *context;
 static volatile int force_exit;
-static char send_buffer[LWS_PRE + MAX_MSG_LEN];
+static volatile int disconnect_requested;   // Cerrar al vaciar la cola de salida
+static int connected;                       // Solo lo usa el hilo de servicio
+static struct lws_client_connect_info connect_info;
+
+/* Reanudación de la sesión (solo hilo de servicio): token recibido en
+   register_success y frames recibidos en la sesión, que se envían como
+   last_seq para que el servidor reenvíe lo que se perdió en la caída. */
+static char resume_token[64];
+static uint64_t received_seq;
+static uint64_t conn_frames;                // Frames recibidos en la conexión actual
+static bool reconnecting;                   // La conexión actual reemplaza a una caída
+static unsigned reconnect_attempts;
+static lws_sorted_usec_list_t reconnect_sul;
 static char user_name[50];
 
-static pthread_mutex_t resp_mutex = PTHREAD_MUTEX_INITIALIZER; // Para sincronizar respuestas
+/* Mensaje entrante en reensamblado (solo hilo de servicio): lws lo entrega
+   en varios RECEIVE si viene fragmentado o no cabe en RX_CHUNK. */
+static char *rx_msg;
+static size_t rx_len;
+static size_t rx_cap;
+
+/* Cola de mensajes salientes: el hilo del menú encola y el de servicio escribe.
+   Cada mensaje reserva LWS_PRE bytes al inicio para lws_write. */
+typedef struct out_msg {
+    struct out_msg *next;
+    bool resume;            // Pedido de reanudación (siempre al frente)
+    size_t len;
+    unsigned char data[];
+} out_msg_t;
+
+static out_msg_t *out_head = NULL;
+static out_msg_t *out_tail = NULL;
+static pthread_mutex_t out_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Peticiones que esperan respuesta. Se resuelven por "id" si el servidor lo
+   devuelve; si no, por el tipo de respuesta esperado, en orden de envío. */
+typedef struct pending_req {
+    unsigned id;
+    const char *response_type;
+    struct pending_req *next;
+} pending_req_t;
+
+static pending_req_t *pending_reqs = NULL;
+static unsigned next_request_id = 1;
+
+static pthread_mutex_t resp_mutex = PTHREAD_MUTEX_INITIALIZER; // Protege pending_reqs
 static pthread_cond_t resp_cond = PTHREAD_COND_INITIALIZER;
-static int response_ready = 0;
 
 static pthread_mutex_t stdout_mutex = PTHREAD_MUTEX_INITIALIZER; // Para proteger la salida estándar
 
+// Cursor de la página siguiente de la última búsqueda ("" si no hay más); con stdout_mutex
+static char search_next[256];
+
 // Muestra el menú de opciones
 void show_menu(void) {
     pthread_mutex_lock(&stdout_mutex);
@@ -35,22 +89,65 @@ void show_menu(void) {
     printf("4. Información de Usuario\n");
     printf("5. Cambio de Estado\n");
     printf("6. Desconectar\n");
+    printf("7. Chat en Sala\n");
+    printf("8. Suscribirse a eventos\n");
+    printf("9. Buscar usuarios\n");
     printf("Opción: ");
     fflush(stdout);
     pthread_mutex_unlock(&stdout_mutex);
 }
 
-// Espera respuesta del servidor o timeout (5 segundos)
-void wait_for_response(void) {
+static bool request_pending(unsigned id) {
+    for (pending_req_t *r = pending_reqs; r; r = r->next) {
+        if (r->id == id)
+            return true;
+    }
+    return false;
+}
+
+// Espera la respuesta a la petición 'id', con timeout de 5 segundos
+void wait_for_response(unsigned id) {
     pthread_mutex_lock(&resp_mutex);
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
-    ts.tv_sec += 5;  
+    ts.tv_sec += 5;
     int ret = 0;
-    while (!response_ready && !force_exit && ret != ETIMEDOUT) {
+    while (request_pending(id) && !force_exit && ret != ETIMEDOUT) {
         ret = pthread_cond_timedwait(&resp_cond, &resp_mutex, &ts);
     }
-    response_ready = 0;
+    // Si no llegó, se deja de esperar por ella
+    pending_req_t **cur = &pending_reqs;
+    while (*cur) {
+        if ((*cur)->id == id) {
+            pending_req_t *done = *cur;
+            *cur = done->next;
+            free(done);
+            break;
+        }
+        cur = &(*cur)->next;
+    }
+    pthread_mutex_unlock(&resp_mutex);
+}
+
+/* Marca como respondida la petición que corresponde a este mensaje del servidor */
+static void resolve_request(cJSON *json, const char *type) {
+    cJSON *id = cJSON_GetObjectItem(json, "id");
+    bool is_error = strcmp(type, "error") == 0;
+
+    pthread_mutex_lock(&resp_mutex);
+    pending_req_t **cur = &pending_reqs;
+    while (*cur) {
+        pending_req_t *r = *cur;
+        bool match = cJSON_IsNumber(id) ? r->id == (unsigned)id->valuedouble
+                                        : is_error || strcmp(r->response_type, type) == 0;
+        if (match) {
+            *cur = r->next;
+            free(r);
+            pthread_cond_broadcast(&resp_cond);
+            break;
+        }
+        cur = &r->next;
+    }
     pthread_mutex_unlock(&resp_mutex);
 }
 
@@ -75,6 +172,22 @@ void process_server_response(const char *json_str) {
         return;
     }
 
+    // Numeración para reanudar: el servidor numera todos los frames de la
+    // sesión menos resume_success, que indica desde dónde sigue la cuenta
+    conn_frames++;
+    if (strcmp(type->valuestring, "resume_success") == 0) {
+        cJSON *seq = cJSON_GetObjectItem(json, "seq");
+        received_seq = cJSON_IsNumber(seq) ? (uint64_t)seq->valuedouble : 0;
+    } else if (strcmp(type->valuestring, "register_success") == 0) {
+        // Sesión nueva: se cuenta desde el inicio de esta conexión
+        received_seq = conn_frames;
+        cJSON *token = cJSON_GetObjectItem(json, "resume_token");
+        if (cJSON_IsString(token))
+            snprintf(resume_token, sizeof(resume_token), "%s", token->valuestring);
+    } else {
+        received_seq++;
+    }
+
     pthread_mutex_lock(&stdout_mutex);
     if (strcmp(type->valuestring, "broadcast") == 0 ||
         strcmp(type->valuestring, "private") == 0) {
@@ -103,6 +216,77 @@ void process_server_response(const char *json_str) {
         cJSON_Delete(json);
         return;
     }
+    else if (strcmp(type->valuestring, "room_message") == 0) {
+        cJSON *sender = cJSON_GetObjectItem(json, "sender");
+        cJSON *target = cJSON_GetObjectItem(json, "target");
+        cJSON *content = cJSON_GetObjectItem(json, "content");
+        cJSON *timestamp = cJSON_GetObjectItem(json, "timestamp");
+        if (sender && target && content && timestamp) {
+            printf("\n[SALA %s] %s: %s\n%s\n",
+                   target->valuestring,
+                   sender->valuestring,
+                   content->valuestring,
+                   timestamp->valuestring);
+        } else {
+            printf("[SERVER] Mensaje de sala con campos faltantes.\n");
+        }
+        fflush(stdout);
+        pthread_mutex_unlock(&stdout_mutex);
+        cJSON_Delete(json);
+        return;
+    }
+    else if (strcmp(type->valuestring, "room_joined") == 0 ||
+             strcmp(type->valuestring, "room_left") == 0) {
+        cJSON *target = cJSON_GetObjectItem(json, "target");
+        cJSON *content = cJSON_GetObjectItem(json, "content");
+        if (target && content)
+            printf("\n[SERVER] %s: %s\n", content->valuestring, target->valuestring);
+    }
+    else if (strcmp(type->valuestring, "event") == 0) {
+        cJSON *topic = cJSON_GetObjectItem(json, "topic");
+        cJSON *content = cJSON_GetObjectItem(json, "content");
+        char *content_str = content ? cJSON_PrintUnformatted(content) : NULL;
+        printf("\n[EVENTO %s] %s\n", topic ? topic->valuestring : "?",
+               content_str ? content_str : "");
+        free(content_str);
+        fflush(stdout);
+        pthread_mutex_unlock(&stdout_mutex);
+        cJSON_Delete(json);
+        return;
+    }
+    else if (strcmp(type->valuestring, "subscribed") == 0) {
+        cJSON *content = cJSON_GetObjectItem(json, "content");
+        printf("\n[SERVER] Suscrito a %s\n", content->valuestring);
+    }
+    else if (strcmp(type->valuestring, "delivery_ack") == 0) {
+        // Un solo frame confirma todos los privados entregados en la ventana
+        cJSON *ids = cJSON_GetObjectItem(json, "content");
+        int delivered = cJSON_IsArray(ids) ? cJSON_GetArraySize(ids) : 0;
+        printf("\n[ENTREGADO] %d mensaje(s) privado(s)\n", delivered);
+    }
+    else if (strcmp(type->valuestring, "multicast_result") == 0) {
+        cJSON *content = cJSON_GetObjectItem(json, "content");
+        cJSON *delivered = cJSON_GetObjectItem(content, "delivered");
+        cJSON *offline = cJSON_GetObjectItem(content, "offline");
+        printf("\n[SERVER] Multicast encolado para %.0f usuario(s)",
+               cJSON_IsNumber(delivered) ? delivered->valuedouble : 0);
+        if (cJSON_IsArray(offline) && cJSON_GetArraySize(offline) > 0) {
+            printf("; sin conexión:");
+            cJSON *user;
+            cJSON_ArrayForEach(user, offline) {
+                if (cJSON_IsString(user))
+                    printf(" %s", user->valuestring);
+            }
+        }
+        printf("\n");
+    }
+    else if (strcmp(type->valuestring, "resume_success") == 0) {
+        cJSON *missed = cJSON_GetObjectItem(json, "missed");
+        printf("\n[CLIENT] Sesión reanudada");
+        if (cJSON_IsNumber(missed) && missed->valuedouble > 0)
+            printf(" (%.0f mensajes no se pudieron recuperar)", missed->valuedouble);
+        printf("\n");
+    }
     else if (strcmp(type->valuestring, "register_success") == 0) {
         cJSON *content = cJSON_GetObjectItem(json, "content");
         cJSON *userList = cJSON_GetObjectItem(json, "userList");
@@ -128,6 +312,21 @@ void process_server_response(const char *json_str) {
             }
         }
     }
+    else if (strcmp(type->valuestring, "search_users_response") == 0) {
+        cJSON *content = cJSON_GetObjectItem(json, "content");
+        cJSON *users = cJSON_GetObjectItem(content, "users");
+        cJSON *next = cJSON_GetObjectItem(content, "next");
+        printf("\n[SERVER] Usuarios encontrados:\n");
+        cJSON *user;
+        cJSON_ArrayForEach(user, users) {
+            cJSON *name = cJSON_GetObjectItem(user, "username");
+            cJSON *status = cJSON_GetObjectItem(user, "status");
+            if (cJSON_IsString(name) && cJSON_IsString(status))
+                printf(" - %s (%s)\n", name->valuestring, status->valuestring);
+        }
+        snprintf(search_next, sizeof(search_next), "%s",
+                 cJSON_IsString(next) ? next->valuestring : "");
+    }
     else if (strcmp(type->valuestring, "user_info_response") == 0) {
         cJSON *target = cJSON_GetObjectItem(json, "target");
         cJSON *content = cJSON_GetObjectItem(json, "content");
@@ -171,45 +370,124 @@ void process_server_response(const char *json_str) {
     }
     fflush(stdout);
     pthread_mutex_unlock(&stdout_mutex);
-    
-    // Señala que la respuesta ya está lista
-    pthread_mutex_lock(&resp_mutex);
-    response_ready = 1;
-    pthread_cond_signal(&resp_cond);
-    pthread_mutex_unlock(&resp_mutex);
+
+    // Despierta a quien esperaba esta respuesta
+    resolve_request(json, type->valuestring);
     cJSON_Delete(json);
 }
 
-// Prepara el mensaje y solicita escribir al servidor
-void request_write(const char *json_str) {
+/* Encola el mensaje y despierta al hilo de servicio para que lo escriba.
+   Un pedido de reanudación va al frente y reemplaza al de una conexión
+   anterior que se cayó antes de enviarlo. */
+static void queue_message(const char *json_str, bool resume) {
     size_t len = strlen(json_str);
     if (len >= MAX_MSG_LEN) {
         fprintf(stderr, "[CLIENT] Mensaje demasiado largo.\n");
         return;
     }
-    memset(send_buffer, 0, sizeof(send_buffer));
-    memcpy(&send_buffer[LWS_PRE], json_str, len);
-    lws_callback_on_writable(client_wsi);
+    out_msg_t *msg = malloc(sizeof(out_msg_t) + LWS_PRE + len);
+    if (!msg) {
+        fprintf(stderr, "[CLIENT] Sin memoria para el mensaje.\n");
+        return;
+    }
+    msg->next = NULL;
+    msg->resume = resume;
+    msg->len = len;
+    memcpy(&msg->data[LWS_PRE], json_str, len);
+
+    pthread_mutex_lock(&out_mutex);
+    if (resume) {
+        if (out_head && out_head->resume) {
+            out_msg_t *stale = out_head;
+            out_head = stale->next;
+            if (!out_head)
+                out_tail = NULL;
+            free(stale);
+        }
+        msg->next = out_head;
+        out_head = msg;
+        if (!out_tail)
+            out_tail = msg;
+    } else {
+        if (out_tail)
+            out_tail->next = msg;
+        else
+            out_head = msg;
+        out_tail = msg;
+    }
+    pthread_mutex_unlock(&out_mutex);
+
+    // lws_callback_on_writable solo es seguro desde el hilo de servicio:
+    // se le pide en LWS_CALLBACK_EVENT_WAIT_CANCELLED
     lws_cancel_service(context);
 }
 
-// Sesión de chat: modo broadcast o privado
+void request_write(const char *json_str) {
+    queue_message(json_str, false);
+}
+
+/* Agrega un "id" a 'json', lo encola y retorna el id. Si response_type no es
+   NULL, registra la petición para poder esperarla con wait_for_response. */
+static unsigned send_request(cJSON *json, const char *response_type) {
+    pthread_mutex_lock(&resp_mutex);
+    unsigned id = next_request_id++;
+    if (response_type) {
+        pending_req_t *req = malloc(sizeof(pending_req_t));
+        if (req) {
+            req->id = id;
+            req->response_type = response_type;
+            req->next = NULL;
+            pending_req_t **cur = &pending_reqs;
+            while (*cur)
+                cur = &(*cur)->next;
+            *cur = req;
+        }
+    }
+    pthread_mutex_unlock(&resp_mutex);
+
+    cJSON_AddNumberToObject(json, "id", id);
+    char *msg = cJSON_PrintUnformatted(json);
+    if (msg) {
+        request_write(msg);
+        free(msg);
+    }
+    return id;
+}
+
+// Envía una solicitud para unirse (join = 1) o salir (join = 0) de una sala
+static unsigned send_room_membership(const char *room, int join) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "type", join ? "join_room" : "leave_room");
+    cJSON_AddStringToObject(json, "sender", user_name);
+    cJSON_AddStringToObject(json, "target", room);
+    unsigned id = send_request(json, join ? "room_joined" : "room_left");
+    cJSON_Delete(json);
+    return id;
+}
+
+// Sesión de chat: modo broadcast, privado o sala
 void chat_session(int mode, const char *target) {
+    const char *mode_name = mode == 1 ? "BROADCAST" : mode == 2 ? "MENSAJE PRIVADO" : "SALA";
+    if (mode == 3)
+        wait_for_response(send_room_membership(target, 1));
+
     pthread_mutex_lock(&stdout_mutex);
-    printf("\n=== MODO CHAT %s ===\n", mode == 1 ? "BROADCAST" : "MENSAJE PRIVADO");
+    printf("\n=== MODO CHAT %s ===\n", mode_name);
     printf("Escribe tus mensajes y presiona Enter para enviarlos.\n");
     printf("Escribe '/salir' para volver al menú.\n");
     fflush(stdout);
     pthread_mutex_unlock(&stdout_mutex);
 
-    char buf[256];
+    // getline: una línea pegada (p. ej. un log) se envía entera, hasta MAX_MSG_LEN
+    char *buf = NULL;
+    size_t buf_cap = 0;
     while (1) {
         pthread_mutex_lock(&stdout_mutex);
         printf("chat> ");
         fflush(stdout);
         pthread_mutex_unlock(&stdout_mutex);
 
-        if (!fgets(buf, sizeof(buf), stdin))
+        if (getline(&buf, &buf_cap, stdin) < 0)
             break;
         char *p = strchr(buf, '\n');
         if (p) *p = '\0';
@@ -225,17 +503,41 @@ void chat_session(int mode, const char *target) {
             cJSON_AddStringToObject(json, "type", "broadcast");
             cJSON_AddStringToObject(json, "sender", user_name);
             cJSON_AddStringToObject(json, "content", buf);
+        } else if (mode == 2 && strchr(target, ',')) {
+            // Varios destinatarios separados por comas: un solo multicast
+            cJSON *targets = cJSON_CreateArray();
+            char *list = strdup(target);
+            char *save = NULL;
+            for (char *name = list ? strtok_r(list, ",", &save) : NULL; name;
+                 name = strtok_r(NULL, ",", &save)) {
+                while (*name == ' ') name++;
+                if (*name)
+                    cJSON_AddItemToArray(targets, cJSON_CreateString(name));
+            }
+            free(list);
+            cJSON_AddStringToObject(json, "type", "multicast");
+            cJSON_AddStringToObject(json, "sender", user_name);
+            cJSON_AddItemToObject(json, "target", targets);
+            cJSON_AddStringToObject(json, "content", buf);
         } else if (mode == 2) {
             cJSON_AddStringToObject(json, "type", "private");
             cJSON_AddStringToObject(json, "sender", user_name);
             cJSON_AddStringToObject(json, "target", target);
             cJSON_AddStringToObject(json, "content", buf);
+        } else if (mode == 3) {
+            cJSON_AddStringToObject(json, "type", "room_message");
+            cJSON_AddStringToObject(json, "sender", user_name);
+            cJSON_AddStringToObject(json, "target", target);
+            cJSON_AddStringToObject(json, "content", buf);
         }
-        char *msg = cJSON_PrintUnformatted(json);
-        request_write(msg);
-        free(msg);
+        // Sin esperar respuesta: los mensajes pegados o en script se envían en ráfaga
+        send_request(json, NULL);
         cJSON_Delete(json);
     }
+    free(buf);
+
+    if (mode == 3)
+        wait_for_response(send_room_membership(target, 0));
 
     pthread_mutex_lock(&stdout_mutex);
     printf("Saliendo del modo chat...\n");
@@ -243,6 +545,56 @@ void chat_session(int mode, const char *target) {
     pthread_mutex_unlock(&stdout_mutex);
 }
 
+/* Al reconectar, lo primero que se envía es el pedido de reanudación */
+static void queue_resume(void) {
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "type", "resume");
+    cJSON_AddStringToObject(json, "sender", user_name);
+    cJSON_AddStringToObject(json, "content", resume_token);
+    cJSON_AddNumberToObject(json, "last_seq", (double)received_seq);
+    char *msg = cJSON_PrintUnformatted(json);
+    if (msg) {
+        queue_message(msg, true);
+        free(msg);
+    }
+    cJSON_Delete(json);
+}
+
+static void schedule_reconnect(void);
+
+static void reconnect_cb(lws_sorted_usec_list_t *sul) {
+    (void)sul;
+    reconnecting = true;
+    client_wsi = lws_client_connect_via_info(&connect_info);
+    if (!client_wsi)
+        schedule_reconnect();
+}
+
+/* Backoff exponencial con jitter: tras una caída de red muchos clientes
+   reconectan a la vez, y el jitter reparte esos intentos en el tiempo */
+static void schedule_reconnect(void) {
+    unsigned shift = reconnect_attempts < 6 ? reconnect_attempts : 6;
+    unsigned max_ms = RECONNECT_BASE_MS << shift;
+    if (max_ms > RECONNECT_MAX_MS)
+        max_ms = RECONNECT_MAX_MS;
+    unsigned delay_ms = max_ms / 2 + (unsigned)rand() % (max_ms / 2 + 1);
+    reconnect_attempts++;
+
+    pthread_mutex_lock(&stdout_mutex);
+    printf("\n[CLIENT] Conexión perdida; reintentando en %u ms...\n", delay_ms);
+    fflush(stdout);
+    pthread_mutex_unlock(&stdout_mutex);
+    lws_sul_schedule(context, 0, &reconnect_sul, reconnect_cb, (lws_usec_t)delay_ms * 1000);
+}
+
+/* Termina el cliente y libera a quien esté esperando una respuesta */
+static void finish_session(void) {
+    force_exit = 1;
+    pthread_mutex_lock(&resp_mutex);
+    pthread_cond_broadcast(&resp_cond);
+    pthread_mutex_unlock(&resp_mutex);
+}
+
 // Callback de libwebsockets para eventos del cliente
 static int callback_client(struct lws *wsi, enum lws_callback_reasons reason,
                            void *user, void *in, size_t len) {
@@ -254,45 +606,98 @@ static int callback_client(struct lws *wsi, enum lws_callback_reasons reason,
         printf("\n[CLIENT] Conexión establecida.\n");
         fflush(stdout);
         pthread_mutex_unlock(&stdout_mutex);
-        // Envía registro de usuario
-        cJSON *reg = cJSON_CreateObject();
-        cJSON_AddStringToObject(reg, "type", "register");
-        cJSON_AddStringToObject(reg, "sender", user_name);
-        cJSON_AddNullToObject(reg, "content");
-
-        char *reg_str = cJSON_PrintUnformatted(reg);
-        request_write(reg_str);
-        free(reg_str);
-        cJSON_Delete(reg);
+        connected = 1;
+        conn_frames = 0;
+        reconnect_attempts = 0;
+        // En la primera conexión el registro ya está encolado desde main
+        if (reconnecting)
+            queue_resume();
+        lws_callback_on_writable(wsi);
         break;
     }
     case LWS_CALLBACK_CLIENT_RECEIVE: {
-        char *msg = malloc(len + 1);
-        if (msg) {
-            memcpy(msg, in, len);
-            msg[len] = '\0';
+        if (rx_len + len + 1 > rx_cap) {
+            size_t cap = rx_cap ? rx_cap * 2 : RX_CHUNK;
+            while (cap < rx_len + len + 1)
+                cap *= 2;
+            char *grown = realloc(rx_msg, cap);
+            if (!grown) {
+                fprintf(stderr, "[CLIENT] Sin memoria para el mensaje recibido.\n");
+                return -1;
+            }
+            rx_msg = grown;
+            rx_cap = cap;
+        }
+        memcpy(rx_msg + rx_len, in, len);
+        rx_len += len;
+        if (!lws_is_final_fragment(wsi))
+            break;
+        rx_msg[rx_len] = '\0';
+        rx_len = 0;
 
-            cJSON *json = cJSON_Parse(msg);
-            if (json) {
-                char *json_str = cJSON_PrintUnformatted(json);
-                process_server_response(json_str);
+        cJSON *json = cJSON_Parse(rx_msg);
+        if (json) {
+            // Un lote de broadcasts llega como arreglo: se muestra cada uno
+            const cJSON *item = cJSON_IsArray(json) ? json->child : json;
+            for (; item; item = cJSON_IsArray(json) ? item->next : NULL) {
+                char *json_str = cJSON_PrintUnformatted(item);
+                if (json_str)
+                    process_server_response(json_str);
                 free(json_str);
-                cJSON_Delete(json);
             }
-            free(msg);
+            cJSON_Delete(json);
+        }
+        break;
+    }
+    case LWS_CALLBACK_EVENT_WAIT_CANCELLED: {
+        // Otro hilo encoló mensajes o pidió salir
+        pthread_mutex_lock(&out_mutex);
+        bool has_pending = out_head != NULL;
+        pthread_mutex_unlock(&out_mutex);
+        if (connected && (has_pending || disconnect_requested)) {
+            lws_callback_on_writable(client_wsi);
+        } else if (!connected && disconnect_requested) {
+            // Se pidió salir mientras se esperaba para reconectar
+            lws_sul_cancel(&reconnect_sul);
+            finish_session();
         }
         break;
     }
     case LWS_CALLBACK_CLIENT_WRITEABLE: {
-        size_t msg_len = strlen(&send_buffer[LWS_PRE]);
-        if (msg_len) {
-            lws_write(wsi, (unsigned char*)&send_buffer[LWS_PRE], msg_len, LWS_WRITE_TEXT);
-            memset(&send_buffer[LWS_PRE], 0, MAX_MSG_LEN);
+        // Un mensaje por callback; si quedan más se vuelve a pedir escritura
+        pthread_mutex_lock(&out_mutex);
+        out_msg_t *msg = out_head;
+        if (msg) {
+            out_head = msg->next;
+            if (!out_head)
+                out_tail = NULL;
         }
+        bool more = out_head != NULL;
+        pthread_mutex_unlock(&out_mutex);
+
+        if (!msg)
+            return disconnect_requested ? -1 : 0;   // Cola vacía: ya se puede cerrar
+        int n = lws_write(wsi, &msg->data[LWS_PRE], msg->len, LWS_WRITE_TEXT);
+        free(msg);
+        if (n < 0)
+            return -1;
+        if (more || disconnect_requested)
+            lws_callback_on_writable(wsi);
         break;
     }
+    case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
+    case LWS_CALLBACK_CLIENT_CLOSED:
     case LWS_CALLBACK_CLOSED:
-        force_exit = 1;
+        connected = 0;
+        client_wsi = NULL;
+        rx_len = 0;     // Un mensaje a medias de la conexión caída no se completa
+        // Una sesión registrada que se cae sin pedirlo se reconecta y reanuda;
+        // lo encolado mientras tanto se envía después del "resume"
+        if (!disconnect_requested && resume_token[0]) {
+            schedule_reconnect();
+            break;
+        }
+        finish_session();
         break;
     default:
         break;
@@ -302,10 +707,23 @@ static int callback_client(struct lws *wsi, enum lws_callback_reasons reason,
 
 // Definición de protocolos para libwebsockets
 static const struct lws_protocols protocols[] = {
-    { "chat-protocol", callback_client, 0, MAX_MSG_LEN },
+    { "chat-protocol", callback_client, 0, RX_CHUNK },
     { NULL, NULL, 0, 0 }
 };
 
+// Compresión permessage-deflate si el servidor la acepta. La ventana que pide
+// para el servidor acota la memoria del descompresor en el cliente.
+#define CLIENT_WINDOW_BITS 15
+#define SERVER_WINDOW_BITS 15
+#define STR_(x) #x
+#define STR(x) STR_(x)
+static const struct lws_extension extensions[] = {
+    { "permessage-deflate", lws_extension_callback_pm_deflate,
+      "permessage-deflate; client_max_window_bits=" STR(CLIENT_WINDOW_BITS)
+      "; server_max_window_bits=" STR(SERVER_WINDOW_BITS) },
+    { NULL, NULL, NULL }
+};
+
 // Hilo para mostrar el menú y gestionar las opciones del usuario
 void *menu_thread(void *_) {
     char choice[10], buf[256];
@@ -316,13 +734,14 @@ void *menu_thread(void *_) {
 
         int opt = atoi(choice);
         cJSON *json = NULL;
+        const char *response_type = NULL;   // Respuesta que se espera a la petición
         switch(opt) {
             case 1:
                 chat_session(1, NULL);
                 break;
             case 2: {
                 pthread_mutex_lock(&stdout_mutex);
-                printf("Destinatario: ");
+                printf("Destinatario (varios separados por comas): ");
                 fflush(stdout);
                 pthread_mutex_unlock(&stdout_mutex);
                 if (!fgets(buf, sizeof(buf), stdin))
@@ -336,6 +755,7 @@ void *menu_thread(void *_) {
                 json = cJSON_CreateObject();
                 cJSON_AddStringToObject(json, "type", "list_users");
                 cJSON_AddStringToObject(json, "sender", user_name);
+                response_type = "list_users_response";
                 break;
             }
             case 4: {
@@ -351,6 +771,7 @@ void *menu_thread(void *_) {
                 cJSON_AddStringToObject(json, "type", "user_info");
                 cJSON_AddStringToObject(json, "sender", user_name);
                 cJSON_AddStringToObject(json, "target", target);
+                response_type = "user_info_response";
                 break;
             }
             case 5: {
@@ -381,18 +802,95 @@ void *menu_thread(void *_) {
                 cJSON_AddStringToObject(json, "type", "change_status");
                 cJSON_AddStringToObject(json, "sender", user_name);
                 cJSON_AddStringToObject(json, "content", status);
+                response_type = "status_update";
                 break;
             }
             case 6: {
                 json = cJSON_CreateObject();
                 cJSON_AddStringToObject(json, "type", "disconnect");
                 cJSON_AddStringToObject(json, "sender", user_name);
-                char *json_str = cJSON_PrintUnformatted(json);
-                request_write(json_str);
-                free(json_str);
+                send_request(json, NULL);
                 cJSON_Delete(json);
-                force_exit = 1;
-                continue;
+                // El hilo de servicio cierra cuando termina de enviar la cola
+                disconnect_requested = 1;
+                lws_cancel_service(context);
+                return NULL;
+            }
+            case 7: {
+                pthread_mutex_lock(&stdout_mutex);
+                printf("Sala: ");
+                fflush(stdout);
+                pthread_mutex_unlock(&stdout_mutex);
+                if (!fgets(buf, sizeof(buf), stdin))
+                    continue;
+                char *room = strtok(buf, "\n");
+                if (!room) continue;
+                chat_session(3, room);
+                break;
+            }
+            case 8: {
+                pthread_mutex_lock(&stdout_mutex);
+                printf("Tópico (ej. presence.*, room.eng.#): ");
+                fflush(stdout);
+                pthread_mutex_unlock(&stdout_mutex);
+                if (!fgets(buf, sizeof(buf), stdin))
+                    continue;
+                char *pattern = strtok(buf, "\n");
+                if (!pattern) continue;
+                json = cJSON_CreateObject();
+                cJSON_AddStringToObject(json, "type", "subscribe");
+                cJSON_AddStringToObject(json, "sender", user_name);
+                cJSON_AddStringToObject(json, "content", pattern);
+                response_type = "subscribed";
+                break;
+            }
+            case 9: {
+                char prefix[64], status[32];
+                pthread_mutex_lock(&stdout_mutex);
+                printf("Prefijo (vacío: todos): ");
+                fflush(stdout);
+                pthread_mutex_unlock(&stdout_mutex);
+                if (!fgets(prefix, sizeof(prefix), stdin))
+                    continue;
+                prefix[strcspn(prefix, "\n")] = '\0';
+                pthread_mutex_lock(&stdout_mutex);
+                printf("Estado (vacío: cualquiera): ");
+                fflush(stdout);
+                pthread_mutex_unlock(&stdout_mutex);
+                if (!fgets(status, sizeof(status), stdin))
+                    continue;
+                status[strcspn(status, "\n")] = '\0';
+
+                // Una página por petición; el cursor de cada respuesta pide la siguiente
+                char cursor[sizeof(search_next)] = "";
+                for (;;) {
+                    json = cJSON_CreateObject();
+                    cJSON_AddStringToObject(json, "type", "search_users");
+                    cJSON_AddStringToObject(json, "sender", user_name);
+                    cJSON_AddStringToObject(json, "content", prefix);
+                    if (status[0])
+                        cJSON_AddStringToObject(json, "status", status);
+                    if (cursor[0])
+                        cJSON_AddStringToObject(json, "cursor", cursor);
+                    pthread_mutex_lock(&stdout_mutex);
+                    search_next[0] = '\0';
+                    pthread_mutex_unlock(&stdout_mutex);
+                    unsigned id = send_request(json, "search_users_response");
+                    cJSON_Delete(json);
+                    json = NULL;
+                    wait_for_response(id);
+
+                    pthread_mutex_lock(&stdout_mutex);
+                    snprintf(cursor, sizeof(cursor), "%s", search_next);
+                    if (cursor[0]) {
+                        printf("¿Siguiente página? (s/n): ");
+                        fflush(stdout);
+                    }
+                    pthread_mutex_unlock(&stdout_mutex);
+                    if (!cursor[0] || !fgets(buf, sizeof(buf), stdin) || buf[0] != 's')
+                        break;
+                }
+                break;
             }
             default:
                 pthread_mutex_lock(&stdout_mutex);
@@ -402,22 +900,20 @@ void *menu_thread(void *_) {
                 continue;
         }
         if (json) {
-            char *json_str = cJSON_PrintUnformatted(json);
-            request_write(json_str);
-            free(json_str);
+            unsigned id = send_request(json, response_type);
             cJSON_Delete(json);
-            if (!force_exit)
-                wait_for_response();
+            wait_for_response(id);
         }
     }
     return NULL;
 }
 
-// Hilo que ejecuta el servicio de libwebsockets
+// Hilo que ejecuta el servicio de libwebsockets; los demás hilos lo despiertan
+// con lws_cancel_service, así que no hace falta sondear
 void *service_thread(void *_) {
     while (!force_exit) {
-        lws_service(context, 50);
-        usleep(1000);
+        if (lws_service(context, 0) < 0)
+            break;
     }
     return NULL;
 }
@@ -434,32 +930,41 @@ int main(int argc, char **argv) {
     memset(&info, 0, sizeof(info));
     info.port = CONTEXT_PORT_NO_LISTEN;
     info.protocols = protocols;
+    info.extensions = extensions;
     context = lws_create_context(&info);
     if (!context) {
         fprintf(stderr, "Error creando contexto\n");
         return 1;
     }
 
-    // Configuración de la conexión con el servidor
-    struct lws_client_connect_info ccinfo;
-    memset(&ccinfo, 0, sizeof(ccinfo));
-    ccinfo.context  = context;
-    ccinfo.address  = argv[3];
-    ccinfo.port     = atoi(argv[4]);
-    ccinfo.path     = "/chat";
-    ccinfo.host     = argv[3];
-    ccinfo.origin   = argv[3];
-    ccinfo.protocol = protocols[0].name;
-    client_wsi = lws_client_connect_via_info(&ccinfo);
+    // Configuración de la conexión con el servidor (se reutiliza al reconectar)
+    connect_info.context  = context;
+    connect_info.address  = argv[3];
+    connect_info.port     = atoi(argv[4]);
+    connect_info.path     = "/chat";
+    connect_info.host     = argv[3];
+    connect_info.origin   = argv[3];
+    connect_info.protocol = protocols[0].name;
+    connect_info.retry_and_idle_policy = &liveness_policy;
+    client_wsi = lws_client_connect_via_info(&connect_info);
     if (!client_wsi) {
-        fprintf(stderr, "[CLIENT] No se pudo conectar a %s:%s%s\n", argv[3], argv[4], ccinfo.path);
+        fprintf(stderr, "[CLIENT] No se pudo conectar a %s:%s%s\n", argv[3], argv[4], connect_info.path);
         return 1;
     }
+    srand((unsigned)time(NULL) ^ (unsigned)getpid());
+
+    // El registro se encola antes de arrancar el servicio; se envía al conectar
+    cJSON *reg = cJSON_CreateObject();
+    cJSON_AddStringToObject(reg, "type", "register");
+    cJSON_AddStringToObject(reg, "sender", user_name);
+    cJSON_AddNullToObject(reg, "content");
+    unsigned register_id = send_request(reg, "register_success");
+    cJSON_Delete(reg);
 
     pthread_t t_menu, t_service;
     pthread_create(&t_service, NULL, service_thread, NULL);
 
-    wait_for_response();
+    wait_for_response(register_id);
 
     pthread_create(&t_menu, NULL, menu_thread, NULL);
 
@@ -467,5 +972,11 @@ int main(int argc, char **argv) {
     pthread_join(t_service, NULL);
 
     lws_context_destroy(context);
+    // Mensajes que quedaron sin enviar
+    while (out_head) {
+        out_msg_t *next = out_head->next;
+        free(out_head);
+        out_head = next;
+    }
     return 0;
 }
@@ -5,4 +5,79 @@
 #define SERVER_PORT 9000
 #define INACTIVITY_TIMEOUT 30   // Ejemplo: 30 segundos de inactividad
 
+// Vida de la conexión: lws envía un ping tras LIVENESS_PING_SECS sin tráfico
+// válido y corta si pasan LIVENESS_HANGUP_SECS sin respuesta.
+#define LIVENESS_PING_SECS 15
+#define LIVENESS_HANGUP_SECS 40
+#define TCP_KEEPALIVE_SECS 60   // Keepalive del kernel para sockets medio abiertos
+
+// Snapshots para reinicio en caliente (intervalo 0 = deshabilitado).
+#define SNAPSHOT_PATH "chat_server.snap"
+#define SNAPSHOT_INTERVAL 10          // segundos entre snapshots
+#define SNAPSHOT_RESTORE_GRACE 120    // segundos que se guarda un usuario restaurado sin reconectar
+
+// Reanudación de sesiones tras una caída de la conexión.
+#define RESUME_GRACE 30               // segundos que se guarda una sesión caída
+#define RESUME_REPLAY_FRAMES 64       // frames ya escritos que se pueden reenviar al reanudar
+#define RESUME_MAX_PENDING 1000       // mensajes encolados como máximo mientras está caída
+
+// Límite de frecuencia por conexión (token bucket); los límites por tipo están en rate_limit.c.
+#define RATE_LIMIT_PER_SEC 50         // mensajes por segundo sostenidos
+#define RATE_LIMIT_BURST 100          // ráfaga máxima
+#define RATE_LIMIT_NOTICE_NS 1000000000ULL  // como mucho un aviso por segundo al cliente
+
+// Recibos de entrega de mensajes privados: ventana en que se juntan por remitente.
+#define DELIVERY_ACK_WINDOW_MS 20
+
+// Destinatarios como máximo en un mensaje "multicast".
+#define MULTICAST_MAX_TARGETS 1000
+
+// Páginas de "search_users": tamaño si la petición no trae "limit", y tope.
+#define SEARCH_USERS_DEFAULT_LIMIT 50
+#define SEARCH_USERS_MAX_LIMIT 200
+
+// Reparto entre conexiones en el pool de hilos (deficit round robin).
+#define DRR_QUANTUM 1024              // bytes que cada conexión puede despachar por ronda
+
+// Arena por worker para el JSON de cada mensaje; lo que no cabe usa bloques extra.
+#define JSON_ARENA_SIZE (64 * 1024)
+
+// Mensajes grandes: tope del mensaje reensamblado (los que lo superan se descartan)
+// y tamaño de los fragmentos en que se escribe a cada destinatario un frame mayor.
+#define MAX_MESSAGE_SIZE (1024 * 1024)
+#define WRITE_FRAGMENT_SIZE (16 * 1024)
+
+// Compresión permessage-deflate (ver connections/deflate.h). Los mensajes enteros
+// de menos de DEFLATE_MIN_PAYLOAD bytes salen sin comprimir. Con DEFLATE_SHARED
+// el servidor no guarda contexto entre mensajes y cada frame se comprime una sola
+// vez para todos sus destinatarios.
+#define DEFLATE_ENABLED 1
+#define DEFLATE_WINDOW_BITS 15        // ventana del servidor (9..15)
+#define DEFLATE_CLIENT_WINDOW_BITS 15 // ventana que ofrecen los clientes propios (9..15)
+#define DEFLATE_LEVEL 1               // nivel de zlib: 1 es el más rápido
+#define DEFLATE_MEM_LEVEL 8
+#define DEFLATE_MIN_PAYLOAD 128
+#define DEFLATE_SHARED 1
+
+// Agrupado de broadcasts (ver connections/broadcast_batch.h): los mensajes de chat
+// que llegan dentro de la ventana salen en un solo frame por cliente. 0 = cada uno
+// por separado; entre 5 y 20 ms cambia poca latencia por muchos menos frames.
+#define BROADCAST_BATCH_MS 0
+#define BROADCAST_BATCH_MAX 256       // mensajes por lote; uno lleno sale sin esperar
+
+// Entrada local para servicios en la misma máquina (ver gateway/local_gateway.h):
+// socket Unix SOCK_SEQPACKET, un mensaje JSON por datagrama.
+#define LOCAL_GATEWAY_ENABLED 1
+#define LOCAL_GATEWAY_PATH "chat_server.sock"
+#define LOCAL_GATEWAY_MODE 0660       // permisos del socket: solo el usuario y su grupo
+#define LOCAL_GATEWAY_BACKLOG 16
+#define LOCAL_GATEWAY_RX_BATCH 64     // datagramas leídos por conexión en cada vuelta del loop
+#define LOCAL_GATEWAY_DGRAM_OVERHEAD 32   // Linux rechaza un datagrama de más de SO_SNDBUF - 32
+
+// Trazado por etapas (ver metrics/trace.h), encendido con el tercer argumento del
+// servidor: fracción de los mensajes que se trazan y buffer de spans en memoria.
+#define TRACE_SAMPLE_RATE 0.01
+#define TRACE_BUFFER_SPANS 65536
+#define TRACE_FLUSH_MS 500            // el escritor vuelca al menos cada tanto
+
 #endif
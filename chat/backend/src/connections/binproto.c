@@ -0,0 +1,433 @@
+#include "binproto.h"
+#include "text_scan.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *type_names[BIN_TYPE_COUNT] = {
+    [BIN_TYPE_OTHER]               = NULL,
+    [BIN_TYPE_REGISTER]            = "register",
+    [BIN_TYPE_REGISTER_SUCCESS]    = "register_success",
+    [BIN_TYPE_ERROR]               = "error",
+    [BIN_TYPE_BROADCAST]           = "broadcast",
+    [BIN_TYPE_PRIVATE]             = "private",
+    [BIN_TYPE_LIST_USERS]          = "list_users",
+    [BIN_TYPE_LIST_USERS_RESPONSE] = "list_users_response",
+    [BIN_TYPE_USER_INFO]           = "user_info",
+    [BIN_TYPE_USER_INFO_RESPONSE]  = "user_info_response",
+    [BIN_TYPE_CHANGE_STATUS]       = "change_status",
+    [BIN_TYPE_STATUS_UPDATE]       = "status_update",
+    [BIN_TYPE_DISCONNECT]          = "disconnect",
+    [BIN_TYPE_USER_DISCONNECTED]   = "user_disconnected",
+    [BIN_TYPE_JOIN_ROOM]           = "join_room",
+    [BIN_TYPE_LEAVE_ROOM]          = "leave_room",
+    [BIN_TYPE_ROOM_JOINED]         = "room_joined",
+    [BIN_TYPE_ROOM_LEFT]           = "room_left",
+    [BIN_TYPE_ROOM_MESSAGE]        = "room_message",
+    [BIN_TYPE_LIST_ROOMS]          = "list_rooms",
+    [BIN_TYPE_LIST_ROOMS_RESPONSE] = "list_rooms_response",
+    [BIN_TYPE_SUBSCRIBE]           = "subscribe",
+    [BIN_TYPE_SUBSCRIBED]          = "subscribed",
+    [BIN_TYPE_UNSUBSCRIBE]         = "unsubscribe",
+    [BIN_TYPE_UNSUBSCRIBED]        = "unsubscribed",
+    [BIN_TYPE_EVENT]               = "event",
+    [BIN_TYPE_RESUME]              = "resume",
+    [BIN_TYPE_RESUME_SUCCESS]      = "resume_success",
+    [BIN_TYPE_DELIVERY_ACK]        = "delivery_ack",
+    [BIN_TYPE_BATCH]               = NULL,     // Arreglo en JSON, sin "type"
+    [BIN_TYPE_MULTICAST]           = "multicast",
+    [BIN_TYPE_MULTICAST_RESULT]    = "multicast_result",
+    [BIN_TYPE_SEARCH_USERS]        = "search_users",
+    [BIN_TYPE_SEARCH_USERS_RESPONSE] = "search_users_response",
+};
+
+static const char *key_names[BIN_KEY_COUNT] = {
+    [BIN_KEY_OTHER]        = NULL,
+    [BIN_KEY_SENDER]       = "sender",
+    [BIN_KEY_TARGET]       = "target",
+    [BIN_KEY_CONTENT]      = "content",
+    [BIN_KEY_TIMESTAMP]    = "timestamp",
+    [BIN_KEY_ID]           = "id",
+    [BIN_KEY_STATUS]       = "status",
+    [BIN_KEY_USER]         = "user",
+    [BIN_KEY_TOPIC]        = "topic",
+    [BIN_KEY_SEQ]          = "seq",
+    [BIN_KEY_LAST_SEQ]     = "last_seq",
+    [BIN_KEY_RESUME_TOKEN] = "resume_token",
+    [BIN_KEY_NAME]         = "name",
+    [BIN_KEY_MEMBERS]      = "members",
+    [BIN_KEY_MISSED]       = "missed",
+    [BIN_KEY_IP]           = "ip",
+};
+
+/* Índice de 'name' en la tabla, o 0 (OTHER) si no está */
+static uint8_t lookup(const char *const *names, size_t count, const char *name, size_t len) {
+    for (size_t i = 1; i < count; i++) {
+        if (names[i] && strlen(names[i]) == len && memcmp(names[i], name, len) == 0)
+            return (uint8_t)i;
+    }
+    return 0;
+}
+
+/* ---------- Lectura ---------- */
+
+static bool get_varint(const unsigned char **p, const unsigned char *end, uint64_t *out) {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (*p >= end)
+            return false;
+        unsigned char b = *(*p)++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            *out = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool get_str(const unsigned char **p, const unsigned char *end, const char **str, size_t *len) {
+    uint64_t n;
+    if (!get_varint(p, end, &n) || n > (uint64_t)(end - *p))
+        return false;
+    *str = (const char *)*p;
+    *len = (size_t)n;
+    *p += n;
+    return true;
+}
+
+/* Un str que termina en texto JSON: tiene que ser UTF-8 válido */
+static bool get_text(const unsigned char **p, const unsigned char *end, const char **str, size_t *len) {
+    return get_str(p, end, str, len) && utf8_valid(*str, *len);
+}
+
+bool bin_decode(const void *data, size_t len, bin_msg_t *out) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    out->count = 0;
+    if (p >= end || *p >= BIN_TYPE_COUNT || *p == BIN_TYPE_BATCH)
+        return false;
+    out->type = *p++;
+    if (out->type == BIN_TYPE_OTHER) {
+        if (!get_text(&p, end, &out->type_name, &out->type_len))
+            return false;
+    } else {
+        out->type_name = type_names[out->type];
+        out->type_len = strlen(out->type_name);
+    }
+
+    while (p < end) {
+        if (out->count == JSON_SLICE_MAX_FIELDS || *p >= BIN_KEY_COUNT)
+            return false;
+        bin_field_t *f = &out->fields[out->count];
+        f->key = *p++;
+        if (f->key == BIN_KEY_OTHER) {
+            if (!get_text(&p, end, &f->name, &f->name_len))
+                return false;
+        } else {
+            f->name = key_names[f->key];
+            f->name_len = strlen(f->name);
+        }
+        if (p >= end)
+            return false;
+        f->kind = *p++;
+        uint64_t u;
+        switch (f->kind) {
+            case BIN_VAL_STR:
+                if (!get_text(&p, end, &f->str, &f->str_len))
+                    return false;
+                break;
+            case BIN_VAL_INT:
+                if (!get_varint(&p, end, &u))
+                    return false;
+                f->num = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+                break;
+            case BIN_VAL_JSON:
+                // Se copia tal cual al traducir: tiene que ser JSON válido
+                if (!get_text(&p, end, &f->str, &f->str_len) || !json_slice_valid(f->str, f->str_len))
+                    return false;
+                break;
+            default:
+                return false;
+        }
+        out->count++;
+    }
+    return true;
+}
+
+bool bin_batch_each(const void *data, size_t len, bin_batch_fn each, void *ctx) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    if (p >= end || *p++ != BIN_TYPE_BATCH)
+        return false;
+    while (p < end) {
+        const char *msg;
+        size_t msg_len;
+        if (!get_str(&p, end, &msg, &msg_len) || !each(msg, msg_len, ctx))
+            return false;
+    }
+    return true;
+}
+
+const bin_field_t *bin_get(const bin_msg_t *msg, bin_key_t key) {
+    for (size_t i = 0; i < msg->count; i++) {
+        if (msg->fields[i].key == key)
+            return &msg->fields[i];
+    }
+    return NULL;
+}
+
+const char *bin_peek_type(const void *data, size_t len) {
+    const unsigned char *p = data;
+    if (len == 0 || p[0] >= BIN_TYPE_COUNT)
+        return NULL;
+    return type_names[p[0]];
+}
+
+/* ---------- Escritura ---------- */
+
+static void write_varint(json_writer_t *w, uint64_t v) {
+    char buf[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+        buf[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    buf[n++] = (char)v;
+    json_write_raw(w, buf, n);
+}
+
+static void write_str(json_writer_t *w, const char *str, size_t len) {
+    write_varint(w, len);
+    json_write_raw(w, str, len);
+}
+
+static void write_byte(json_writer_t *w, uint8_t b) {
+    json_write_raw(w, (const char *)&b, 1);
+}
+
+/* Clave conocida por su número; si no, OTHER + nombre */
+static void write_key(json_writer_t *w, const char *name, size_t len) {
+    uint8_t key = lookup(key_names, BIN_KEY_COUNT, name, len);
+    write_byte(w, key);
+    if (key == BIN_KEY_OTHER)
+        write_str(w, name, len);
+}
+
+void bin_write_type(json_writer_t *w, bin_type_t type) {
+    write_byte(w, (uint8_t)type);
+}
+
+void bin_write_str(json_writer_t *w, bin_key_t key, const char *str, size_t len) {
+    write_byte(w, (uint8_t)key);
+    write_byte(w, BIN_VAL_STR);
+    write_str(w, str, len);
+}
+
+void bin_write_int(json_writer_t *w, bin_key_t key, int64_t value) {
+    write_byte(w, (uint8_t)key);
+    write_byte(w, BIN_VAL_INT);
+    write_varint(w, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+void bin_write_json(json_writer_t *w, const bin_msg_t *msg) {
+    json_write_literal(w, "{\"type\":");
+    json_write_string_len(w, msg->type_name, msg->type_len);
+    for (size_t i = 0; i < msg->count; i++) {
+        const bin_field_t *f = &msg->fields[i];
+        json_write_literal(w, ",");
+        json_write_string_len(w, f->name, f->name_len);
+        json_write_literal(w, ":");
+        if (f->kind == BIN_VAL_INT) {
+            char num[24];
+            int n = snprintf(num, sizeof(num), "%" PRId64, f->num);
+            json_write_raw(w, num, (size_t)n);
+        } else if (f->kind == BIN_VAL_STR) {
+            json_write_string_len(w, f->str, f->str_len);
+        } else {
+            json_write_raw(w, f->str, f->str_len);
+        }
+    }
+    json_write_literal(w, "}");
+}
+
+char *bin_json_text(const bin_msg_t *msg, size_t *len) {
+    json_writer_t w = { NULL, 0 };
+    bin_write_json(&w, msg);
+    w.out = malloc(w.len + 1);
+    if (!w.out)
+        return NULL;
+    w.len = 0;
+    bin_write_json(&w, msg);
+    w.out[w.len] = '\0';
+    *len = w.len;
+    return w.out;
+}
+
+/* Un string JSON sin escapes, como str */
+static void write_unescaped(json_writer_t *w, const json_slice_t *slice) {
+    size_t len = json_slice_unescape(slice, NULL);
+    write_varint(w, len);
+    if (w->out)
+        json_slice_unescape(slice, w->out + w->len);
+    w->len += len;
+}
+
+/* Entero de hasta 18 caracteres (cabe en int64 sin desbordar) */
+static bool parse_int(const json_slice_t *slice, int64_t *out) {
+    if (slice->kind != JSON_SLICE_NUMBER || !slice->integer || slice->len > 18)
+        return false;
+    const char *p = slice->ptr;
+    const char *end = p + slice->len;
+    bool negative = *p == '-';
+    if (negative)
+        p++;
+    int64_t v = 0;
+    while (p < end)
+        v = v * 10 + (*p++ - '0');
+    *out = negative ? -v : v;
+    return true;
+}
+
+/* JSON -> binario; json_to_binary() ya comprobó que "type" es un string */
+static void write_from_json(json_writer_t *w, const void *ctx) {
+    const json_fields_t *fields = ctx;
+    const json_slice_t *type = json_slice_get(fields, "type");
+    uint8_t tag = type->escaped ? BIN_TYPE_OTHER
+                                : lookup(type_names, BIN_TYPE_COUNT, type->ptr, type->len);
+    write_byte(w, tag);
+    if (tag == BIN_TYPE_OTHER)
+        write_unescaped(w, type);
+
+    for (size_t i = 0; i < fields->count; i++) {
+        const json_slice_t *key = &fields->keys[i];
+        const json_slice_t *value = &fields->values[i];
+        if (value == type)
+            continue;
+        write_key(w, key->ptr, key->len);
+        int64_t num;
+        if (value->kind == JSON_SLICE_STRING) {
+            write_byte(w, BIN_VAL_STR);
+            write_unescaped(w, value);
+        } else if (parse_int(value, &num)) {
+            write_byte(w, BIN_VAL_INT);
+            write_varint(w, ((uint64_t)num << 1) ^ (uint64_t)(num >> 63));
+        } else {
+            write_byte(w, BIN_VAL_JSON);
+            write_str(w, value->ptr, value->len);
+        }
+    }
+}
+
+static void write_to_json(json_writer_t *w, const void *ctx) {
+    bin_write_json(w, ctx);
+}
+
+/* ---------- Lotes ---------- */
+
+/* Un elemento del lote: objeto con "type" string. Con w == NULL solo valida. */
+static bool batch_item_to_binary(const json_slice_t *item, void *ctx) {
+    json_writer_t *w = ctx;
+    json_fields_t fields;
+    if (item->kind != JSON_SLICE_OTHER || !json_slice_scan(item->ptr, item->len, &fields))
+        return false;
+    const json_slice_t *type = json_slice_get(&fields, "type");
+    if (!type || type->kind != JSON_SLICE_STRING)
+        return false;
+    if (w) {
+        json_writer_t measure = { NULL, 0 };
+        write_from_json(&measure, &fields);
+        write_varint(w, measure.len);
+        write_from_json(w, &fields);
+    }
+    return true;
+}
+
+static void write_batch_from_json(json_writer_t *w, const void *ctx) {
+    frame_t *frame = (frame_t *)ctx;
+    write_byte(w, BIN_TYPE_BATCH);
+    json_slice_array((const char *)frame_payload(frame), frame->len, batch_item_to_binary, w);
+}
+
+typedef struct {
+    json_writer_t *w;       // NULL: solo se valida
+    bool first;
+} batch_json_t;
+
+static bool batch_item_to_json(const void *data, size_t len, void *ctx) {
+    batch_json_t *b = ctx;
+    bin_msg_t msg;
+    if (!bin_decode(data, len, &msg))
+        return false;
+    if (b->w) {
+        if (!b->first)
+            json_write_literal(b->w, ",");
+        bin_write_json(b->w, &msg);
+    }
+    b->first = false;
+    return true;
+}
+
+static void write_batch_to_json(json_writer_t *w, const void *ctx) {
+    frame_t *frame = (frame_t *)ctx;
+    batch_json_t b = { w, true };
+    json_write_literal(w, "[");
+    bin_batch_each(frame_payload(frame), frame->len, batch_item_to_json, &b);
+    json_write_literal(w, "]");
+}
+
+static bool is_json_array(frame_t *frame) {
+    const unsigned char *p = frame_payload(frame);
+    const unsigned char *end = p + frame->len;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+        p++;
+    return p < end && *p == '[';
+}
+
+static frame_t *json_to_binary(frame_t *frame) {
+    if (is_json_array(frame)) {
+        if (!json_slice_array((const char *)frame_payload(frame), frame->len, batch_item_to_binary, NULL))
+            return NULL;
+        return frame_encode_binary(write_batch_from_json, frame);
+    }
+    json_fields_t fields;
+    if (!json_slice_scan((const char *)frame_payload(frame), frame->len, &fields))
+        return NULL;
+    const json_slice_t *type = json_slice_get(&fields, "type");
+    if (!type || type->kind != JSON_SLICE_STRING)
+        return NULL;
+    return frame_encode_binary(write_from_json, &fields);
+}
+
+static frame_t *binary_to_json(frame_t *frame) {
+    if (frame->len > 0 && frame_payload(frame)[0] == BIN_TYPE_BATCH) {
+        batch_json_t check = { NULL, true };
+        if (!bin_batch_each(frame_payload(frame), frame->len, batch_item_to_json, &check))
+            return NULL;
+        return frame_encode(write_batch_to_json, frame);
+    }
+    bin_msg_t msg;
+    if (!bin_decode(frame_payload(frame), frame->len, &msg))
+        return NULL;
+    return frame_encode(write_to_json, &msg);
+}
+
+frame_t *binproto_frame(frame_t *frame, bool binary) {
+    if (frame->binary == binary)
+        return frame;
+    frame_t *translated = atomic_load_explicit(&frame->translated, memory_order_acquire);
+    if (translated)
+        return translated;
+    translated = binary ? json_to_binary(frame) : binary_to_json(frame);
+    if (!translated)
+        return NULL;
+    frame_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&frame->translated, &expected, translated,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        // Otro hilo la tradujo primero
+        frame_release(translated);
+        return expected;
+    }
+    return translated;
+}
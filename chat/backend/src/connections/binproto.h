@@ -0,0 +1,166 @@
+#ifndef BINPROTO_H
+#define BINPROTO_H
+
+#include <libwebsockets.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "frame.h"
+#include "json_slice.h"
+
+/**
+ * Subprotocolo binario "chat-protocol-bin".
+ *
+ * Lleva los mismos mensajes que el JSON de "chat-protocol", con el tipo y las
+ * claves conocidas como enteros y los strings con prefijo de largo, sin
+ * escapes ni comillas:
+ *
+ *   mensaje := tipo campo*
+ *   tipo    := u8 (BIN_TYPE_*); BIN_TYPE_OTHER va seguido de str con el nombre
+ *   campo   := clave valor
+ *   clave   := u8 (BIN_KEY_*); BIN_KEY_OTHER va seguido de str con el nombre
+ *   valor   := BIN_VAL_STR str       string (bytes UTF-8 tal cual)
+ *            | BIN_VAL_INT varint    entero con signo (zigzag)
+ *            | BIN_VAL_JSON str      cualquier otro valor como texto JSON
+ *   str     := varint largo + bytes
+ *   lote    := BIN_TYPE_BATCH str*   cada str es un mensaje completo
+ *
+ * Un lote (solo del servidor al cliente) es el arreglo de mensajes de
+ * broadcast_batch.h; en JSON es un arreglo de objetos.
+ *
+ * Los varint son LEB128 sin signo, igual que en la captura de tráfico.
+ * Los números de tipos y claves son parte del protocolo: solo se agregan al
+ * final de cada lista.
+ *
+ * El cliente elige el formato en el handshake (Sec-WebSocket-Protocol). El
+ * servidor arma cada frame en el formato de quien lo originó; solo se
+ * traduce cuando el destinatario habla el otro, y la traducción se guarda en
+ * el frame (binproto_frame), así que un broadcast se traduce una vez.
+ */
+
+#define BINPROTO_NAME "chat-protocol-bin"
+#define BINPROTO_ID 1       // lws_protocols.id de la entrada binaria
+
+typedef enum {
+    BIN_TYPE_OTHER = 0,
+    BIN_TYPE_REGISTER,
+    BIN_TYPE_REGISTER_SUCCESS,
+    BIN_TYPE_ERROR,
+    BIN_TYPE_BROADCAST,
+    BIN_TYPE_PRIVATE,
+    BIN_TYPE_LIST_USERS,
+    BIN_TYPE_LIST_USERS_RESPONSE,
+    BIN_TYPE_USER_INFO,
+    BIN_TYPE_USER_INFO_RESPONSE,
+    BIN_TYPE_CHANGE_STATUS,
+    BIN_TYPE_STATUS_UPDATE,
+    BIN_TYPE_DISCONNECT,
+    BIN_TYPE_USER_DISCONNECTED,
+    BIN_TYPE_JOIN_ROOM,
+    BIN_TYPE_LEAVE_ROOM,
+    BIN_TYPE_ROOM_JOINED,
+    BIN_TYPE_ROOM_LEFT,
+    BIN_TYPE_ROOM_MESSAGE,
+    BIN_TYPE_LIST_ROOMS,
+    BIN_TYPE_LIST_ROOMS_RESPONSE,
+    BIN_TYPE_SUBSCRIBE,
+    BIN_TYPE_SUBSCRIBED,
+    BIN_TYPE_UNSUBSCRIBE,
+    BIN_TYPE_UNSUBSCRIBED,
+    BIN_TYPE_EVENT,
+    BIN_TYPE_RESUME,
+    BIN_TYPE_RESUME_SUCCESS,
+    BIN_TYPE_DELIVERY_ACK,
+    BIN_TYPE_BATCH,
+    BIN_TYPE_MULTICAST,
+    BIN_TYPE_MULTICAST_RESULT,
+    BIN_TYPE_SEARCH_USERS,
+    BIN_TYPE_SEARCH_USERS_RESPONSE,
+    BIN_TYPE_COUNT
+} bin_type_t;
+
+typedef enum {
+    BIN_KEY_OTHER = 0,
+    BIN_KEY_SENDER,
+    BIN_KEY_TARGET,
+    BIN_KEY_CONTENT,
+    BIN_KEY_TIMESTAMP,
+    BIN_KEY_ID,
+    BIN_KEY_STATUS,
+    BIN_KEY_USER,
+    BIN_KEY_TOPIC,
+    BIN_KEY_SEQ,
+    BIN_KEY_LAST_SEQ,
+    BIN_KEY_RESUME_TOKEN,
+    BIN_KEY_NAME,
+    BIN_KEY_MEMBERS,
+    BIN_KEY_MISSED,
+    BIN_KEY_IP,
+    BIN_KEY_COUNT
+} bin_key_t;
+
+typedef enum {
+    BIN_VAL_STR = 0,
+    BIN_VAL_INT = 1,
+    BIN_VAL_JSON = 2,
+} bin_val_t;
+
+typedef struct {
+    uint8_t key;            // bin_key_t
+    const char *name;       // Nombre de la clave (no termina en '\0')
+    size_t name_len;
+    uint8_t kind;           // bin_val_t
+    const char *str;        // STR y JSON: apunta al mensaje
+    size_t str_len;
+    int64_t num;            // INT
+} bin_field_t;
+
+typedef struct {
+    uint8_t type;           // bin_type_t
+    const char *type_name;  // No termina en '\0'
+    size_t type_len;
+    bin_field_t fields[JSON_SLICE_MAX_FIELDS];
+    size_t count;
+} bin_msg_t;
+
+/* true si la conexión negoció chat-protocol-bin */
+static inline bool binproto_wsi(struct lws *wsi) {
+    const struct lws_protocols *protocol = lws_get_protocol(wsi);
+    return protocol && protocol->id == BINPROTO_ID;
+}
+
+// Valida un mensaje y anota sus campos como slices del mismo buffer. Retorna
+// false si está truncado, tiene tags desconocidos, un string que no es UTF-8,
+// un valor JSON inválido o más de JSON_SLICE_MAX_FIELDS campos, o si es un lote.
+bool bin_decode(const void *data, size_t len, bin_msg_t *out);
+
+// Llama a 'each' con cada mensaje de un lote. Retorna false si no es un lote,
+// está truncado o 'each' retorna false. No valida los mensajes.
+typedef bool (*bin_batch_fn)(const void *msg, size_t len, void *ctx);
+bool bin_batch_each(const void *data, size_t len, bin_batch_fn each, void *ctx);
+
+// Primer campo con esa clave conocida, o NULL.
+const bin_field_t *bin_get(const bin_msg_t *msg, bin_key_t key);
+
+// Nombre del tipo de un mensaje sin decodificarlo entero (NULL si es
+// BIN_TYPE_OTHER o no es válido). Para el límite de frecuencia.
+const char *bin_peek_type(const void *data, size_t len);
+
+// Escritura (json_writer_t sirve igual: out == NULL solo mide).
+void bin_write_type(json_writer_t *w, bin_type_t type);
+void bin_write_str(json_writer_t *w, bin_key_t key, const char *str, size_t len);
+void bin_write_int(json_writer_t *w, bin_key_t key, int64_t value);
+
+// Traduce un mensaje ya decodificado a JSON (sin '\n').
+void bin_write_json(json_writer_t *w, const bin_msg_t *msg);
+
+// Como bin_write_json, en un string nuevo terminado en '\0' (malloc'd,
+// liberar con free()). Deja el largo en *len. NULL sin memoria.
+char *bin_json_text(const bin_msg_t *msg, size_t *len);
+
+/* El frame en el formato pedido: el mismo si ya lo está o su traducción,
+   que se crea la primera vez (desde cualquier hilo) y vive lo que el frame.
+   No toma ni entrega referencias. NULL si no se pudo traducir. */
+frame_t *binproto_frame(frame_t *frame, bool binary);
+
+#endif
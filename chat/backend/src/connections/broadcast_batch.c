@@ -0,0 +1,137 @@
+#include "broadcast_batch.h"
+#include "connection_manager.h"
+#include "binproto.h"
+#include "logger.h"
+#include "time_utils.h"
+#include "config.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define BATCH_WINDOW_NS ((uint64_t)BROADCAST_BATCH_MS * 1000000ULL)
+
+static struct lws_context *batch_context = NULL;
+static lws_sorted_usec_list_t flush_sul;
+static bool flush_scheduled = false;        // Solo el hilo de servicio
+
+static pthread_mutex_t batch_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Un lote a la vez desde que se saca hasta que se encola: conserva el orden
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static frame_t *pending[BROADCAST_BATCH_MAX];
+static size_t pending_count = 0;
+static uint64_t opened_ns;                  // Llegada del primero del lote en curso
+
+typedef struct {
+    frame_t **frames;
+    size_t count;
+} batch_t;
+
+/* Los mensajes en JSON, sin su '\n', separados por comas */
+static void write_batch(json_writer_t *w, const void *ctx) {
+    const batch_t *batch = ctx;
+    bool first = true;
+    json_write_literal(w, "[");
+    for (size_t i = 0; i < batch->count; i++) {
+        frame_t *json = binproto_frame(batch->frames[i], false);
+        if (!json)
+            continue;
+        size_t len = json->len;
+        if (len > 0 && frame_payload(json)[len - 1] == '\n')
+            len--;
+        if (!first)
+            json_write_literal(w, ",");
+        json_write_raw(w, (const char *)frame_payload(json), len);
+        first = false;
+    }
+    json_write_literal(w, "]");
+}
+
+/* Saca el lote en curso y lo encola para todos */
+static void flush_batch(void) {
+    frame_t *frames[BROADCAST_BATCH_MAX];
+    pthread_mutex_lock(&flush_mutex);
+    pthread_mutex_lock(&batch_mutex);
+    size_t count = pending_count;
+    memcpy(frames, pending, count * sizeof(frame_t *));
+    pending_count = 0;
+    pthread_mutex_unlock(&batch_mutex);
+
+    if (count == 1) {
+        broadcast_frame(frames[0]);
+    } else if (count > 1) {
+        batch_t batch = { frames, count };
+        frame_t *frame = frame_encode(write_batch, &batch);
+        if (frame) {
+            broadcast_frame(frame);
+            frame_release(frame);
+            log_debug("Lote de %zu broadcasts encolado", count);
+        } else {
+            log_error("Error al asignar memoria para un lote de broadcasts");
+            for (size_t i = 0; i < count; i++)
+                broadcast_frame(frames[i]);
+        }
+    }
+    pthread_mutex_unlock(&flush_mutex);
+    for (size_t i = 0; i < count; i++)
+        frame_release(frames[i]);
+}
+
+static void flush_cb(lws_sorted_usec_list_t *sul) {
+    (void)sul;
+    flush_scheduled = false;
+    flush_batch();
+    // Lo que llegó mientras el timer estaba armado no despertó a nadie
+    broadcast_batch_service();
+}
+
+void broadcast_batch_init(struct lws_context *context) {
+    if (BROADCAST_BATCH_MS > 0)
+        batch_context = context;
+}
+
+void broadcast_batch_add(frame_t *frame) {
+    if (!batch_context) {
+        broadcast_frame(frame);
+        return;
+    }
+    pthread_mutex_lock(&batch_mutex);
+    // Lote lleno: sale ya, sin esperar al timer
+    while (pending_count == BROADCAST_BATCH_MAX) {
+        pthread_mutex_unlock(&batch_mutex);
+        flush_batch();
+        pthread_mutex_lock(&batch_mutex);
+    }
+    frame_retain(frame);
+    pending[pending_count++] = frame;
+    bool first = pending_count == 1;
+    if (first)
+        opened_ns = monotonic_ns();
+    pthread_mutex_unlock(&batch_mutex);
+    // El timer se arma en el hilo de servicio
+    if (first)
+        lws_cancel_service(batch_context);
+}
+
+void broadcast_batch_service(void) {
+    if (!batch_context || flush_scheduled)
+        return;
+    pthread_mutex_lock(&batch_mutex);
+    size_t count = pending_count;
+    uint64_t opened = opened_ns;
+    pthread_mutex_unlock(&batch_mutex);
+    if (count == 0)
+        return;
+    // La ventana corre desde el primer mensaje, no desde que se despertó el servicio
+    uint64_t elapsed = monotonic_ns() - opened;
+    uint64_t remaining = elapsed < BATCH_WINDOW_NS ? BATCH_WINDOW_NS - elapsed : 0;
+    flush_scheduled = true;
+    lws_sul_schedule(batch_context, 0, &flush_sul, flush_cb, (lws_usec_t)(remaining / 1000));
+}
+
+void broadcast_batch_shutdown(void) {
+    if (batch_context && flush_scheduled)
+        lws_sul_cancel(&flush_sul);
+    flush_scheduled = false;
+    batch_context = NULL;
+    flush_batch();
+}
@@ -0,0 +1,39 @@
+#ifndef BROADCAST_BATCH_H
+#define BROADCAST_BATCH_H
+
+#include <libwebsockets.h>
+#include "frame.h"
+
+/**
+ * Agrupado de broadcasts de chat.
+ *
+ * Con BROADCAST_BATCH_MS > 0, los "broadcast" que llegan dentro de una
+ * ventana se juntan y, al vencer, salen como un solo frame para cada
+ * destinatario: un arreglo JSON con los mensajes en orden de llegada
+ *   [{"type":"broadcast",...},{"type":"broadcast",...}]
+ * (en chat-protocol-bin, un BIN_TYPE_BATCH). Un lote de un solo mensaje
+ * sale como el mensaje mismo. Así, con cientos de broadcasts por segundo,
+ * los frames y escrituras por cliente dependen de la ventana y no del
+ * ritmo de mensajes, a costa de hasta BROADCAST_BATCH_MS de latencia; los
+ * demás mensajes no esperan, así que pueden adelantarse a un broadcast.
+ *
+ * Los workers agregan con broadcast_batch_add; el timer vive en el hilo de
+ * servicio, que lo arma al despertarse (broadcast_batch_service).
+ */
+
+// Habilita el agrupado con un timer en el contexto. Sin llamarla (p. ej. en
+// los benchmarks) o con BROADCAST_BATCH_MS en 0, cada broadcast sale solo.
+void broadcast_batch_init(struct lws_context *context);
+
+// Cualquier hilo: encola 'frame' para todos, en el lote en curso si hay
+// agrupado (no toma su referencia).
+void broadcast_batch_add(frame_t *frame);
+
+// Hilo de servicio, en LWS_CALLBACK_EVENT_WAIT_CANCELLED: arma el timer si
+// hay un lote esperando.
+void broadcast_batch_service(void);
+
+// Cancela el timer y envía el lote pendiente (antes de lws_context_destroy).
+void broadcast_batch_shutdown(void);
+
+#endif
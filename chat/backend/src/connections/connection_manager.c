@@ -1,94 +1,310 @@
 #include "connection_manager.h"
 #include "logger.h"
+#include "metrics.h"
+#include "time_utils.h"
+#include "slab.h"
+#include "binproto.h"
+#include "deflate.h"
+#include "local_gateway.h"
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdio.h>
+#include <sys/random.h>
 #include <cjson/cJSON.h>
 
+#define CLIENT_HASH_BUCKETS 1024
+
 static client_node_t *client_list = NULL;
 
+/* Tabla hash wsi -> cliente, para no recorrer client_list en cada envío */
+static client_node_t *client_hash[CLIENT_HASH_BUCKETS];
+
+/* Tabla hash usuario -> cliente (privados y multicast). Incluye las
+   sesiones en espera de reanudación, igual que client_list. */
+static client_node_t *client_names[CLIENT_HASH_BUCKETS];
+
+/* Tabla de sesiones: sessions[id] es el cliente con ese id denso.
+   Los ids liberados se reutilizan para mantener compactos los bitsets de salas. */
+static client_node_t **sessions = NULL;
+static uint32_t session_capacity = 0;
+static uint32_t next_session_id = 0;
+static uint32_t *free_session_ids = NULL;
+static uint32_t free_session_count = 0;
+
+/* Colas restauradas desde un snapshot cuyo usuario aún no se reconecta */
+static queue_snapshot_t *orphan_queues = NULL;
+
+/* Contexto del hilo de servicio, para despertarlo tras encolar.
+   Sin contexto (p. ej. en los benchmarks) no se despierta a nadie. */
+static struct lws_context *service_context = NULL;
+
+/* Protege client_list, las tablas y orphan_queues (workers + hilo de servicio + snapshots) */
+static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void set_service_context(struct lws_context *context) {
+    service_context = context;
+}
+
+/* Despierta al hilo de servicio para que pida escritura a los clientes con pendientes */
+static void wake_service(void) {
+    if (service_context)
+        lws_cancel_service(service_context);
+}
+
+static size_t wsi_bucket(const struct lws *wsi) {
+    uint64_t v = (uintptr_t)wsi;    // En 64 bits aun en 32: ahí v >> 32 sobre uintptr_t es UB
+    v ^= v >> 17;
+    v *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(v >> 32) & (CLIENT_HASH_BUCKETS - 1);
+}
+
 /* Busca un cliente por su wsi */
 static client_node_t* find_client_by_wsi(struct lws *wsi) {
-    client_node_t *current = client_list;
+    client_node_t *current = client_hash[wsi_bucket(wsi)];
     while (current) {
         if (current->wsi == wsi)
             return current;
-        current = current->next;
+        current = current->hash_next;
     }
     return NULL;
 }
 
+/* FNV-1a del nombre */
+static size_t name_bucket(const char *username) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)username; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h & (CLIENT_HASH_BUCKETS - 1);
+}
+
 /* Busca un cliente por su nombre de usuario */
 static client_node_t* find_client_by_username(const char *username) {
-    client_node_t *current = client_list;
+    client_node_t *current = client_names[name_bucket(username)];
     while (current) {
         if (strcmp(current->username, username) == 0)
             return current;
-        current = current->next;
+        current = current->name_next;
+    }
+    return NULL;
+}
+
+/* Saca al cliente de la tabla por usuario. Requiere clients_mutex tomado. */
+static void unlink_name_locked(client_node_t *client) {
+    client_node_t **current = &client_names[name_bucket(client->username)];
+    while (*current && *current != client)
+        current = &((*current)->name_next);
+    if (*current)
+        *current = client->name_next;
+    client->name_next = NULL;
+}
+
+static uint32_t alloc_session_id(client_node_t *client) {
+    uint32_t id;
+    if (free_session_count > 0) {
+        id = free_session_ids[--free_session_count];
+    } else {
+        if (next_session_id == session_capacity) {
+            uint32_t new_capacity = session_capacity ? session_capacity * 2 : 256;
+            client_node_t **grown = realloc(sessions, new_capacity * sizeof(*sessions));
+            uint32_t *grown_free = realloc(free_session_ids, new_capacity * sizeof(*free_session_ids));
+            if (grown)
+                sessions = grown;
+            if (grown_free)
+                free_session_ids = grown_free;
+            if (!grown || !grown_free)
+                return SESSION_NONE;
+            session_capacity = new_capacity;
+        }
+        id = next_session_id++;
+    }
+    sessions[id] = client;
+    return id;
+}
+
+static void release_session_id(uint32_t id) {
+    if (id == SESSION_NONE || id >= next_session_id)
+        return;
+    sessions[id] = NULL;
+    free_session_ids[free_session_count++] = id;
+}
+
+static void free_pending_list(pending_msg_t *msg) {
+    while (msg) {
+        pending_msg_t *tmp = msg;
+        msg = msg->next;
+        frame_release(tmp->frame);
+        delivery_receipt_free(tmp->receipt);
+        trace_release(tmp->trace);
+        slab_free(tmp);
+    }
+}
+
+/* Libera un cliente ya desenlazado: cola pendiente, frames guardados y nodo */
+static void free_client_node(client_node_t *client) {
+    free_pending_list(client->pending_head);
+    for (size_t i = 0; i < RESUME_REPLAY_FRAMES; i++) {
+        if (client->replay[i])
+            frame_release(client->replay[i]);
+    }
+    slab_free(client->username);
+    slab_free(client);
+}
+
+/* Token aleatorio en hex; sin entropía el cliente queda sin reanudación */
+static bool generate_resume_token(char out[RESUME_TOKEN_LEN + 1]) {
+    unsigned char raw[RESUME_TOKEN_LEN / 2];
+    if (getrandom(raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) {
+        out[0] = '\0';
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(raw); i++)
+        snprintf(out + i * 2, 3, "%02x", raw[i]);
+    return true;
+}
+
+/* Compara un token con el esperado en tiempo constante, para no revelar por
+   el tiempo de respuesta cuántos caracteres coinciden. Un esperado vacío
+   (sin token) no coincide con nada. */
+static bool resume_token_equal(const char expected[RESUME_TOKEN_LEN + 1], const char *token) {
+    size_t len = strnlen(token, RESUME_TOKEN_LEN + 1);
+    unsigned char diff = len != RESUME_TOKEN_LEN || expected[0] == '\0';
+    for (size_t i = 0; i < RESUME_TOKEN_LEN; i++)
+        diff |= (unsigned char)(expected[i] ^ (i < len ? token[i] : 0));
+    return diff == 0;
+}
+
+/* Saca de orphan_queues la sesión restaurada de 'username' si 'token' es el suyo */
+static queue_snapshot_t* take_orphan_queue(const char *username, const char *token) {
+    queue_snapshot_t **current = &orphan_queues;
+    while (*current) {
+        if (strcmp((*current)->username, username) == 0) {
+            if (!resume_token_equal((*current)->resume_token, token))
+                return NULL;
+            queue_snapshot_t *found = *current;
+            *current = found->next;
+            found->next = NULL;
+            return found;
+        }
+        current = &((*current)->next);
     }
     return NULL;
 }
 
-void add_client(struct lws *wsi, const char *username) {
-    client_node_t *new_node = malloc(sizeof(client_node_t));
+void add_client(struct lws *wsi, const char *username, const char *restored_token) {
+    client_node_t *new_node = slab_calloc(sizeof(client_node_t));
     if (!new_node) {
         log_error("Error al asignar memoria para el cliente");
         return;
     }
     new_node->wsi = wsi;
-    new_node->username = strdup(username);
-    new_node->pending_head = NULL;
-    new_node->pending_tail = NULL;
+    new_node->username = slab_strdup(username);
+    new_node->resumable = generate_resume_token(new_node->resume_token);
+    if (!new_node->resumable)
+        log_error("No se pudo generar el token de reanudación para %s", username);
+
+    pthread_mutex_lock(&clients_mutex);
+    new_node->session_id = alloc_session_id(new_node);
+    // Si reclamó su sesión de antes del reinicio, sus mensajes se entregan ahora
+    queue_snapshot_t *orphan = restored_token ? take_orphan_queue(username, restored_token) : NULL;
+    if (orphan && orphan->head) {
+        new_node->pending_head = orphan->head;
+        pending_msg_t *tail = NULL;
+        for (pending_msg_t *m = orphan->head; m; m = m->next) {
+            m->seq = ++new_node->next_seq;
+            new_node->pending_count++;
+            tail = m;
+        }
+        new_node->pending_tail = tail;
+        orphan->head = NULL;
+    }
     new_node->next = client_list;
     client_list = new_node;
-    log_info("Cliente agregado: %s", username);
+    size_t bucket = wsi_bucket(wsi);
+    new_node->hash_next = client_hash[bucket];
+    client_hash[bucket] = new_node;
+    // Al frente, como en client_list: con nombres repetidos gana el más nuevo
+    size_t name = name_bucket(username);
+    new_node->name_next = client_names[name];
+    client_names[name] = new_node;
+    pthread_mutex_unlock(&clients_mutex);
+
+    if (orphan) {
+        log_info("Cola restaurada reasignada a %s", username);
+        free_queue_snapshot(orphan);
+        wake_service();
+    }
+    log_info("Cliente agregado: %s (sesión %u)", username, new_node->session_id);
 }
 
 void remove_client(struct lws *wsi) {
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t **bucket = &client_hash[wsi_bucket(wsi)];
+    while (*bucket && (*bucket)->wsi != wsi)
+        bucket = &((*bucket)->hash_next);
+    if (*bucket)
+        *bucket = (*bucket)->hash_next;
+
     client_node_t **current = &client_list;
     while (*current) {
         if ((*current)->wsi == wsi) {
             client_node_t *to_remove = *current;
             *current = to_remove->next;
+            unlink_name_locked(to_remove);
             log_info("Cliente removido: %s", to_remove->username);
-            // Liberar mensajes pendientes
-            pending_msg_t *msg = to_remove->pending_head;
-            while (msg) {
-                pending_msg_t *tmp = msg;
-                msg = msg->next;
-                free(tmp->data);
-                free(tmp);
-            }
-            free(to_remove->username);
-            free(to_remove);
-            return;
+            release_session_id(to_remove->session_id);
+            free_client_node(to_remove);
+            break;
         }
         current = &((*current)->next);
     }
+    pthread_mutex_unlock(&clients_mutex);
 }
 
-void enqueue_pending_message(struct lws *wsi, const char *message, size_t message_len) {
+char *get_client_username(struct lws *wsi) {
+    char *username = NULL;
+    pthread_mutex_lock(&clients_mutex);
     client_node_t *client = find_client_by_wsi(wsi);
-    if (!client) {
-        log_error("enqueue_pending_message: cliente no encontrado");
-        return;
-    }
+    if (client)
+        username = strdup(client->username);
+    pthread_mutex_unlock(&clients_mutex);
+    return username;
+}
 
-    // Crear el nuevo nodo de mensaje pendiente
-    size_t new_len = message_len + 1; // para el '\n'
-    pending_msg_t *new_msg = malloc(sizeof(pending_msg_t));
+uint32_t get_client_session(struct lws *wsi) {
+    uint32_t id = SESSION_NONE;
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t *client = find_client_by_wsi(wsi);
+    if (client)
+        id = client->session_id;
+    pthread_mutex_unlock(&clients_mutex);
+    return id;
+}
+
+/* Encola una referencia a 'frame' en 'client'. Requiere clients_mutex tomado.
+   'now' es el monotonic_ns() del encolado, tomado una vez por envío. */
+static bool enqueue_locked(client_node_t *client, frame_t *frame, uint64_t now) {
+    // Una sesión caída guarda sus mensajes solo hasta RESUME_MAX_PENDING
+    if (!client->wsi && client->pending_count >= RESUME_MAX_PENDING) {
+        client->parked_dropped++;
+        return false;
+    }
+    pending_msg_t *new_msg = slab_alloc(sizeof(pending_msg_t));
     if (!new_msg) {
         log_error("Error al asignar memoria para pending_msg");
-        return;
+        return false;
     }
-    new_msg->data = malloc(new_len);
-    if (!new_msg->data) {
-        log_error("Error al asignar memoria para pending_msg->data");
-        free(new_msg);
-        return;
-    }
-    memcpy(new_msg->data, message, message_len);
-    new_msg->data[message_len] = '\n';
-    new_msg->len = new_len;
+    frame_retain(frame);
+    new_msg->frame = frame;
+    new_msg->enqueued_ns = now;
+    new_msg->seq = ++client->next_seq;
+    new_msg->receipt = NULL;
+    // Encolado por un worker mientras procesa un mensaje trazado
+    new_msg->trace = trace_current();
+    trace_retain(new_msg->trace);
     new_msg->next = NULL;
 
     // Enlazar a la cola pendiente del cliente
@@ -99,68 +315,660 @@ void enqueue_pending_message(struct lws *wsi, const char *message, size_t messag
         client->pending_tail->next = new_msg;
         client->pending_tail = new_msg;
     }
+    client->pending_count++;
+    return true;
+}
 
-    struct lws_context *ctx = lws_get_context(wsi);
-    lws_cancel_service(ctx); 
+void enqueue_pending_message(struct lws *wsi, const char *message, size_t message_len) {
+    frame_t *frame = frame_create(message, message_len);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame");
+        return;
+    }
+    enqueue_pending_frame(wsi, frame);
+    frame_release(frame);
 }
 
+void enqueue_pending_frame(struct lws *wsi, frame_t *frame) {
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t *client = find_client_by_wsi(wsi);
+    bool queued = client && enqueue_locked(client, frame, now);
+    pthread_mutex_unlock(&clients_mutex);
 
+    if (!client) {
+        log_error("enqueue_pending_message: cliente no encontrado");
+        return;
+    }
+    if (queued)
+        wake_service();
+}
 
 
-void write_pending_messages(struct lws *wsi) {
-    client_node_t *client = find_client_by_wsi(wsi);
-    if (!client)
+
+
+/* Guarda el frame ya escrito para poder reenviarlo al reanudar.
+   Toma la referencia de 'msg'. Requiere clients_mutex tomado. */
+static void keep_written_locked(client_node_t *client, pending_msg_t *msg) {
+    if (msg->seq == 0) {
+        frame_release(msg->frame);
         return;
-    
-    while (client->pending_head) {
-        pending_msg_t *msg = client->pending_head;
-        client->pending_head = msg->next;
-        if (client->pending_head == NULL)
-            client->pending_tail = NULL;
-        
-        unsigned char buffer[LWS_PRE + msg->len];
-        memcpy(&buffer[LWS_PRE], msg->data, msg->len);
-        int n = lws_write(wsi, &buffer[LWS_PRE], msg->len, LWS_WRITE_TEXT);
-        if (n < (int)msg->len) {
-            log_error("lws_write retornó %d (se esperaba %zu)", n, msg->len);
+    }
+    frame_t **slot = &client->replay[msg->seq % RESUME_REPLAY_FRAMES];
+    if (*slot)
+        frame_release(*slot);
+    *slot = msg->frame;
+    client->written_seq = msg->seq;
+}
+
+/* Saca el primer mensaje de la cola. Requiere clients_mutex tomado. */
+static void pop_pending_locked(client_node_t *client) {
+    client->pending_head = client->pending_head->next;
+    if (client->pending_head == NULL)
+        client->pending_tail = NULL;
+    client->pending_count--;
+    client->write_offset = 0;
+}
+
+/* Devuelve al frente de la cola un mensaje que no se pudo escribir.
+   Requiere clients_mutex tomado. */
+static void push_front_locked(client_node_t *client, pending_msg_t *msg) {
+    msg->next = client->pending_head;
+    client->pending_head = msg;
+    if (client->pending_tail == NULL)
+        client->pending_tail = msg;
+    client->pending_count++;
+}
+
+/* Escribe 'len' bytes del frame desde 'offset'. Desde el comienzo se usa
+   el espacio LWS_PRE del frame; un fragmento posterior se copia a un buffer
+   propio, porque lws_write pisaría los bytes anteriores del payload y el
+   frame puede seguir en la cola de otros destinatarios. */
+static int write_fragment(struct lws *wsi, frame_t *frame, size_t offset, size_t len, int flags) {
+    if (offset == 0) {
+        // Entero, puede salir con la compresión compartida del frame
+        deflate_set_tx_frame(len == frame->len ? frame : NULL);
+        int n = lws_write(wsi, frame_payload(frame), len, flags);
+        deflate_set_tx_frame(NULL);
+        return n;
+    }
+    static unsigned char fragment_buf[LWS_PRE + WRITE_FRAGMENT_SIZE];  // Solo el hilo de servicio
+    memcpy(fragment_buf + LWS_PRE, frame_payload(frame) + offset, len);
+    return lws_write(wsi, fragment_buf + LWS_PRE, len, flags);
+}
+
+/* Termina con un mensaje ya sacado de la cola: suma los bytes escritos y
+   guarda su frame para reenviarlo al reanudar. Retorna true si quedan más. */
+static bool finish_written(struct lws *wsi, pending_msg_t *msg, size_t written) {
+    delivery_receipt_free(msg->receipt);
+    msg->receipt = NULL;
+    trace_release(msg->trace);
+    msg->trace = NULL;
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t *client = find_client_by_wsi(wsi);
+    bool more = false;
+    if (client) {
+        client->bytes_out += written;
+        keep_written_locked(client, msg);
+        more = client->pending_head != NULL;
+    } else {
+        frame_release(msg->frame);
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    slab_free(msg);
+    return more;
+}
+
+/* Libera un mensaje sacado de la cola que no se entregó */
+static void discard_message(pending_msg_t *msg) {
+    frame_release(msg->frame);
+    delivery_receipt_free(msg->receipt);
+    trace_release(msg->trace);
+    slab_free(msg);
+}
+
+/* Por WebSocket se hace una sola escritura por callback, como pide lws: con
+   permessage-deflate un frame comprimido puede quedar a medio enviar, y otra
+   lws_write en el mismo callback se mezclaría con él; además, lo que el
+   socket no acepta queda en el buffer sin límite de lws en vez de en la cola
+   del cliente, donde cuentan RESUME_MAX_PENDING, las métricas y la
+   reanudación. Si quedan mensajes se pide otro callback.
+   Los frames de hasta WRITE_FRAGMENT_SIZE salen en una escritura; uno mayor,
+   como mensaje fragmentado, un fragmento por callback: lws solo guarda lo que
+   el socket no aceptó del último fragmento, así que un mensaje grande no
+   queda copiado entero por destinatario.
+   Una conexión local (local_gateway.h) recibe cada frame entero como un
+   datagrama y se vacía hasta que su socket se llena, porque send() no
+   guarda nada fuera de la cola: entonces el mensaje vuelve al frente.
+   Retorna -1 si hay que cerrar la conexión. */
+int write_pending_messages(struct lws *wsi) {
+    bool binary = binproto_wsi(wsi);
+    bool datagram = local_gateway_wsi(wsi);
+    while (true) {
+        // Sacar un mensaje bajo el lock y escribirlo fuera de él
+        pthread_mutex_lock(&clients_mutex);
+        client_node_t *client = find_client_by_wsi(wsi);
+        pending_msg_t *msg = client ? client->pending_head : NULL;
+        if (!msg) {
+            pthread_mutex_unlock(&clients_mutex);
+            return 0;
+        }
+        // En el formato de esta conexión; la traducción queda en el frame
+        frame_t *frame = binproto_frame(msg->frame, binary);
+        if (!frame) {
+            log_error("No se pudo traducir un frame para %s", client->username);
+            pop_pending_locked(client);
+            pthread_mutex_unlock(&clients_mutex);
+            finish_written(wsi, msg, 0);
+            continue;
+        }
+        size_t offset = client->write_offset;
+        uint32_t lane = client->session_id + 1;     // Fila del destinatario en la traza
+        size_t len = frame->len - offset;
+        bool last = datagram || len <= WRITE_FRAGMENT_SIZE;
+        if (!last)
+            len = WRITE_FRAGMENT_SIZE;
+        // Un mensaje fragmentado sigue primero en la cola hasta el último fragmento
+        if (last) {
+            pop_pending_locked(client);
         } else {
-            log_info("Se enviaron %zu bytes a %s", msg->len, client->username);
+            client->write_offset = offset + len;
+        }
+        pthread_mutex_unlock(&clients_mutex);
+
+        int n;
+        uint64_t write_ns = msg->trace ? monotonic_ns() : 0;
+        if (datagram) {
+            n = local_gateway_send(wsi, frame);
+            if (n == 0) {
+                // Se reintenta cuando el socket vuelva a aceptar datos
+                pthread_mutex_lock(&clients_mutex);
+                client = find_client_by_wsi(wsi);
+                if (client)
+                    push_front_locked(client, msg);
+                pthread_mutex_unlock(&clients_mutex);
+                if (!client)
+                    discard_message(msg);
+                lws_callback_on_writable(wsi);
+                return 0;
+            }
+            if (n == -2) {
+                // No cabe en un datagrama: se descarta sin trabar la cola
+                finish_written(wsi, msg, 0);
+                continue;
+            }
+            if (n < 0) {
+                // Un error deja el socket inservible
+                discard_message(msg);
+                return -1;
+            }
+        } else {
+            int flags = offset > 0 ? LWS_WRITE_CONTINUATION : binary ? LWS_WRITE_BINARY : LWS_WRITE_TEXT;
+            if (!last)
+                flags |= LWS_WRITE_NO_FIN;
+            n = write_fragment(wsi, frame, offset, len, flags);
+        }
+        if (msg->trace) {
+            // La espera en la cola termina con la primera escritura
+            if (offset == 0)
+                trace_span(msg->trace, TRACE_STAGE_PENDING, lane, msg->enqueued_ns, write_ns);
+            trace_span(msg->trace, TRACE_STAGE_WRITE, lane, write_ns, monotonic_ns());
+        }
+        if (n < (int)len) {
+            // Sin confirmar la entrega: la conexión se cierra y el mensaje
+            // sigue en la cola (si era un fragmento) o se descarta
+            log_error("lws_write retornó %d (se esperaba %zu)", n, len);
+            if (last)
+                discard_message(msg);
+            return -1;
+        }
+        if (!last) {
+            // El resto en el próximo callback
+            pthread_mutex_lock(&clients_mutex);
+            client = find_client_by_wsi(wsi);
+            if (client)
+                client->bytes_out += len;
+            pthread_mutex_unlock(&clients_mutex);
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+        log_debug("Se enviaron %zu bytes", frame->len);
+        metrics_record_latency(METRIC_STAGE_PROCESS_WRITTEN, monotonic_ns() - msg->enqueued_ns);
+        // Entregado al socket del destinatario: se confirma al remitente
+        if (msg->receipt) {
+            delivery_ack_delivered(msg->receipt);
+            msg->receipt = NULL;
+        }
+        bool more = finish_written(wsi, msg, len);
+        if (!datagram) {
+            if (more)
+                lws_callback_on_writable(wsi);
+            return 0;
         }
-        free(msg->data);
-        free(msg);
     }
 }
 
+void request_pending_writes(void) {
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t *cur = client_list;
+    while (cur) {
+        if (cur->pending_head != NULL && cur->wsi) {
+            lws_callback_on_writable(cur->wsi);
+        }
+        cur = cur->next;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
 void broadcast_message(const char *message, size_t message_len) {
+    // Se serializa una vez; cada cliente encola una referencia al mismo frame
+    frame_t *frame = frame_create(message, message_len);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame");
+        return;
+    }
+    broadcast_frame(frame);
+    frame_release(frame);
+}
+
+void broadcast_frame(frame_t *frame) {
+    bool queued = false;
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&clients_mutex);
     client_node_t *current = client_list;
     while (current) {
-        enqueue_pending_message(current->wsi, message, message_len);
+        if (enqueue_locked(current, frame, now))
+            queued = true;
         current = current->next;
     }
-    log_info("Mensaje broadcast encolado para todos los clientes");
+    pthread_mutex_unlock(&clients_mutex);
+    // Un solo despertar del hilo de servicio para todo el broadcast
+    if (queued)
+        wake_service();
+    log_debug("Mensaje broadcast encolado para todos los clientes");
+}
+
+size_t send_to_sessions(const uint64_t *members, size_t words, frame_t *frame) {
+    size_t sent = 0;
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&clients_mutex);
+    size_t limit_words = (next_session_id + 63) / 64;
+    if (words > limit_words)
+        words = limit_words;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t bits = members[w];
+        while (bits) {
+            uint32_t id = (uint32_t)(w * 64 + (size_t)__builtin_ctzll(bits));
+            bits &= bits - 1;
+            client_node_t *client = sessions[id];
+            if (client && enqueue_locked(client, frame, now))
+                sent++;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    if (sent)
+        wake_service();
+    return sent;
 }
 
-void send_private_message(const char *target, const char *message, size_t message_len) {
+bool send_private_message(const char *target, const char *message, size_t message_len,
+                          delivery_receipt_t *receipt) {
+    frame_t *frame = frame_create(message, message_len);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame");
+        delivery_receipt_free(receipt);
+        return false;
+    }
+    bool found = send_private_frame(target, frame, receipt);
+    frame_release(frame);
+    return found;
+}
+
+bool send_private_frame(const char *target, frame_t *frame, delivery_receipt_t *receipt) {
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&clients_mutex);
     client_node_t *client = find_client_by_username(target);
-    if (client) {
-        enqueue_pending_message(client->wsi, message, message_len);
-        log_info("Mensaje privado encolado para %s", target);
-    } else {
+    bool queued = client && enqueue_locked(client, frame, now);
+    if (queued) {
+        client->pending_tail->receipt = receipt;
+        receipt = NULL;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    delivery_receipt_free(receipt);
+    if (queued) {
+        wake_service();
+        log_debug("Mensaje privado encolado para %s", target);
+    } else if (!client) {
         log_error("Usuario destino %s no encontrado", target);
     }
+    return client != NULL;
+}
+
+size_t send_multicast_frame(const char *const *targets, size_t count, frame_t *frame,
+                            bool *offline) {
+    size_t queued = 0;
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&clients_mutex);
+    for (size_t i = 0; i < count; i++) {
+        client_node_t *client = find_client_by_username(targets[i]);
+        offline[i] = client == NULL;
+        if (client && enqueue_locked(client, frame, now))
+            queued++;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    if (queued)
+        wake_service();
+    log_debug("Multicast encolado para %zu de %zu destinatarios", queued, count);
+    return queued;
 }
 
 cJSON* get_user_list(void) {
     cJSON *array = cJSON_CreateArray();
+    pthread_mutex_lock(&clients_mutex);
     client_node_t *current = client_list;
     while (current) {
         cJSON_AddItemToArray(array, cJSON_CreateString(current->username));
         current = current->next;
     }
+    pthread_mutex_unlock(&clients_mutex);
     return array;
 }
 
+bool get_resume_token(struct lws *wsi, char out[RESUME_TOKEN_LEN + 1]) {
+    bool found = false;
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t *client = find_client_by_wsi(wsi);
+    if (client && client->resumable) {
+        memcpy(out, client->resume_token, RESUME_TOKEN_LEN + 1);
+        found = true;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return found;
+}
+
+void revoke_resume_token(struct lws *wsi) {
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t *client = find_client_by_wsi(wsi);
+    if (client)
+        client->resumable = false;
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+bool park_client(struct lws *wsi) {
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t **bucket = &client_hash[wsi_bucket(wsi)];
+    while (*bucket && (*bucket)->wsi != wsi)
+        bucket = &((*bucket)->hash_next);
+    client_node_t *client = *bucket;
+    if (!client || !client->resumable) {
+        pthread_mutex_unlock(&clients_mutex);
+        return false;
+    }
+    // Sigue en client_list y en su sesión: broadcasts y salas le siguen encolando
+    *bucket = client->hash_next;
+    client->hash_next = NULL;
+    client->wsi = NULL;
+    client->write_offset = 0;     // Al reanudar, un mensaje a medio escribir sale entero
+    client->parked_at = time(NULL);
+    log_info("Sesión de %s en espera de reanudación", client->username);
+    pthread_mutex_unlock(&clients_mutex);
+    return true;
+}
+
+bool resume_client(struct lws *wsi, const char *username, const char *token,
+                   uint64_t last_seq, cJSON *response) {
+    uint64_t now = monotonic_ns();
+    pthread_mutex_lock(&clients_mutex);
+    // Por la tabla de nombres, que incluye las sesiones en espera
+    client_node_t *client = NULL;
+    for (client_node_t *cur = client_names[name_bucket(username)]; cur; cur = cur->name_next) {
+        if (!cur->wsi && cur->resumable && strcmp(cur->username, username) == 0 &&
+            resume_token_equal(cur->resume_token, token)) {
+            client = cur;
+            break;
+        }
+    }
+    if (!client || find_client_by_wsi(wsi)) {
+        pthread_mutex_unlock(&clients_mutex);
+        return false;
+    }
+
+    // Se reenvía desde last_seq, acotado a lo que aún está en replay
+    uint64_t from = last_seq < client->written_seq ? last_seq : client->written_seq;
+    uint64_t oldest = client->written_seq >= RESUME_REPLAY_FRAMES
+                      ? client->written_seq - RESUME_REPLAY_FRAMES + 1 : 1;
+    uint64_t missed = client->parked_dropped;
+    if (from + 1 < oldest) {
+        missed += oldest - from - 1;
+        from = oldest - 1;
+    }
+
+    // La respuesta va primero y sin número: el cliente toma "seq" como base
+    cJSON_AddNumberToObject(response, "seq", (double)from);
+    cJSON_AddNumberToObject(response, "missed", (double)missed);
+    char *response_str = cJSON_PrintUnformatted(response);
+    frame_t *ack = response_str ? frame_create(response_str, strlen(response_str)) : NULL;
+    cJSON_free(response_str);
+    pending_msg_t *head = ack ? slab_alloc(sizeof(pending_msg_t)) : NULL;
+    if (!head) {
+        if (ack)
+            frame_release(ack);
+        pthread_mutex_unlock(&clients_mutex);
+        log_error("Error al asignar memoria para reanudar la sesión de %s", username);
+        return false;
+    }
+    head->frame = ack;
+    head->enqueued_ns = now;
+    head->seq = 0;
+    head->receipt = NULL;
+    head->trace = NULL;
+    head->next = NULL;
+    pending_msg_t *last = head;
+    size_t count = 1;
+
+    // Después, los frames que el cliente no confirmó y todavía están guardados
+    for (uint64_t seq = from + 1; seq <= client->written_seq; seq++) {
+        frame_t *frame = client->replay[seq % RESUME_REPLAY_FRAMES];
+        pending_msg_t *copy = frame ? slab_alloc(sizeof(pending_msg_t)) : NULL;
+        if (!copy)
+            break;
+        frame_retain(frame);
+        copy->frame = frame;
+        copy->enqueued_ns = now;
+        copy->seq = seq;
+        copy->receipt = NULL;
+        copy->trace = NULL;
+        copy->next = NULL;
+        last->next = copy;
+        last = copy;
+        count++;
+    }
+
+    // Y al final lo que se encoló mientras estuvo caída
+    last->next = client->pending_head;
+    if (!client->pending_head)
+        client->pending_tail = last;
+    client->pending_head = head;
+    client->pending_count += count;
+    client->parked_dropped = 0;
+    client->parked_at = 0;
+    client->wsi = wsi;
+    size_t bucket = wsi_bucket(wsi);
+    client->hash_next = client_hash[bucket];
+    client_hash[bucket] = client;
+    pthread_mutex_unlock(&clients_mutex);
+
+    wake_service();
+    log_info("Sesión de %s reanudada desde el frame %llu (%llu perdidos)",
+             username, (unsigned long long)from, (unsigned long long)missed);
+    return true;
+}
+
+void expire_parked_clients(time_t now, time_t max_age, session_expired_fn on_expired) {
+    client_node_t *expired = NULL;
+    pthread_mutex_lock(&clients_mutex);
+    client_node_t **current = &client_list;
+    while (*current) {
+        client_node_t *client = *current;
+        if (!client->wsi && client->parked_at && (now - client->parked_at) >= max_age) {
+            *current = client->next;
+            unlink_name_locked(client);
+            client->next = expired;
+            expired = client;
+            // El id no se libera todavía: el llamador sale de salas con él
+            sessions[client->session_id] = NULL;
+            continue;
+        }
+        current = &client->next;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+
+    for (client_node_t *client = expired; client; client = client->next) {
+        log_info("La sesión de %s no se reanudó a tiempo", client->username);
+        if (on_expired)
+            on_expired(client->username, client->session_id);
+    }
+
+    pthread_mutex_lock(&clients_mutex);
+    while (expired) {
+        client_node_t *next = expired->next;
+        release_session_id(expired->session_id);
+        free_client_node(expired);
+        expired = next;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+size_t visit_client_stats(client_stats_fn fn, void *ctx) {
+    size_t count = 0;
+    pthread_mutex_lock(&clients_mutex);
+    for (client_node_t *cur = client_list; cur; cur = cur->next) {
+        fn(cur->username, cur->bytes_out, cur->pending_count, ctx);
+        count++;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return count;
+}
+
 client_node_t* get_all_clients(void)
 {
     return client_list;
 }
+
+/* Copia una cola de mensajes pendientes; los frames se comparten */
+static pending_msg_t* copy_pending_list(const pending_msg_t *msg) {
+    pending_msg_t *head = NULL, **tail = &head;
+    while (msg) {
+        pending_msg_t *copy = slab_alloc(sizeof(pending_msg_t));
+        if (!copy)
+            break;
+        frame_retain(msg->frame);
+        copy->frame = msg->frame;
+        copy->enqueued_ns = msg->enqueued_ns;
+        copy->seq = msg->seq;
+        copy->receipt = NULL;       // Ni los recibos ni las trazas sobreviven a un reinicio
+        copy->trace = NULL;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+        msg = msg->next;
+    }
+    return head;
+}
+
+static queue_snapshot_t* new_queue_snapshot(const char *username, const char *resume_token,
+                                            pending_msg_t *head, time_t restored_at) {
+    queue_snapshot_t *snap = malloc(sizeof(queue_snapshot_t));
+    if (!snap)
+        return NULL;
+    snap->username = strdup(username);
+    if (!snap->username) {
+        free(snap);
+        return NULL;
+    }
+    snprintf(snap->resume_token, sizeof(snap->resume_token), "%s", resume_token);
+    snap->head = head;
+    snap->restored_at = restored_at;
+    snap->next = NULL;
+    return snap;
+}
+
+queue_snapshot_t* snapshot_pending_queues(void) {
+    queue_snapshot_t *result = NULL;
+    pthread_mutex_lock(&clients_mutex);
+    for (client_node_t *cur = client_list; cur; cur = cur->next) {
+        // Sin token nadie podría reclamar la sesión tras el reinicio
+        if (!cur->resumable)
+            continue;
+        queue_snapshot_t *snap = new_queue_snapshot(cur->username, cur->resume_token,
+                                                    copy_pending_list(cur->pending_head), 0);
+        if (snap) {
+            snap->next = result;
+            result = snap;
+        }
+    }
+    // Las colas huérfanas también se conservan para un segundo reinicio
+    for (queue_snapshot_t *orphan = orphan_queues; orphan; orphan = orphan->next) {
+        queue_snapshot_t *snap = new_queue_snapshot(orphan->username, orphan->resume_token,
+                                                    copy_pending_list(orphan->head), 0);
+        if (snap) {
+            snap->next = result;
+            result = snap;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return result;
+}
+
+void free_queue_snapshot(queue_snapshot_t *snap) {
+    while (snap) {
+        queue_snapshot_t *next = snap->next;
+        free_pending_list(snap->head);
+        free(snap->username);
+        free(snap);
+        snap = next;
+    }
+}
+
+bool restored_session_matches(const char *username, const char *token) {
+    bool matches = false;
+    pthread_mutex_lock(&clients_mutex);
+    for (queue_snapshot_t *orphan = orphan_queues; orphan; orphan = orphan->next) {
+        if (strcmp(orphan->username, username) == 0) {
+            matches = resume_token_equal(orphan->resume_token, token);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    return matches;
+}
+
+void restore_pending_queue(const char *username, const char *resume_token, pending_msg_t *head) {
+    queue_snapshot_t *snap = new_queue_snapshot(username, resume_token, head, time(NULL));
+    if (!snap) {
+        free_pending_list(head);
+        return;
+    }
+    pthread_mutex_lock(&clients_mutex);
+    snap->next = orphan_queues;
+    orphan_queues = snap;
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+void expire_orphan_queues(time_t now, time_t max_age) {
+    queue_snapshot_t *expired = NULL;
+    pthread_mutex_lock(&clients_mutex);
+    queue_snapshot_t **current = &orphan_queues;
+    while (*current) {
+        queue_snapshot_t *snap = *current;
+        if ((now - snap->restored_at) >= max_age) {
+            *current = snap->next;
+            snap->next = expired;
+            expired = snap;
+            continue;
+        }
+        current = &snap->next;
+    }
+    pthread_mutex_unlock(&clients_mutex);
+    free_queue_snapshot(expired);
+}
@@ -3,11 +3,29 @@
 
 #include <libwebsockets.h>
 #include <cjson/cJSON.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "frame.h"
+#include "config.h"
+#include "delivery_ack.h"
+#include "trace.h"
 
-/* Estructura para representar un mensaje pendiente de envío */
+/* Id de sesión inválido (cliente no registrado) */
+#define SESSION_NONE UINT32_MAX
+
+/* Largo del token de reanudación (hex, sin el '\0') */
+#define RESUME_TOKEN_LEN 32
+
+/* Estructura para representar un mensaje pendiente de envío.
+   El frame puede estar compartido por varias colas (broadcast, salas).
+   Los nodos (y los client_node_t) se alocan con slab_alloc(). */
 typedef struct pending_msg_s {
-    char *data;
-    size_t len;
+    frame_t *frame;
+    uint64_t enqueued_ns;         // monotonic_ns() al encolar, para las métricas
+    uint64_t seq;                 // Número de frame en la sesión (0: no se numera)
+    delivery_receipt_t *receipt;  // Recibo a confirmar al escribirlo (solo privados)
+    trace_t *trace;               // Traza del mensaje que lo originó (NULL si no se traza)
     struct pending_msg_s *next;
 } pending_msg_t;
 
@@ -15,16 +33,51 @@ typedef struct pending_msg_s {
 typedef struct client_node {
     struct lws *wsi;
     char *username;
+    uint32_t session_id;          // Id denso y reutilizable (índice en la tabla de sesiones)
     pending_msg_t *pending_head;  // Cola de mensajes pendientes
     pending_msg_t *pending_tail;
+    size_t pending_count;         // Mensajes en la cola pendiente
+    size_t write_offset;          // Bytes ya escritos del primero (frame grande en fragmentos)
+    uint64_t bytes_out;           // Bytes escritos a este cliente
+    /* Reanudación: cada frame encolado recibe un número correlativo y los
+       últimos RESUME_REPLAY_FRAMES escritos se guardan (replay[seq % N]) para
+       reenviarlos si la conexión se cae antes de que el cliente los reciba. */
+    char resume_token[RESUME_TOKEN_LEN + 1];
+    bool resumable;               // false tras un "disconnect" explícito
+    time_t parked_at;             // != 0 mientras espera reconexión (wsi == NULL)
+    uint64_t next_seq;            // Último número asignado
+    uint64_t written_seq;         // Último número escrito al socket
+    size_t parked_dropped;        // Mensajes descartados por RESUME_MAX_PENDING
+    frame_t *replay[RESUME_REPLAY_FRAMES];
     struct client_node *next;
+    struct client_node *hash_next; // Cadena en la tabla hash por wsi
+    struct client_node *name_next; // Cadena en la tabla hash por usuario
 } client_node_t;
 
+/* Registra el contexto cuyo hilo de servicio se despierta al encolar mensajes */
+void set_service_context(struct lws_context *context);
+
 /* Funciones de manejo de conexiones */
-void add_client(struct lws *wsi, const char *username);
+/* Con 'restored_token', el cliente recibe la cola restaurada de 'username'
+   si el token es el de su sesión antes del reinicio (NULL: ninguna). */
+void add_client(struct lws *wsi, const char *username, const char *restored_token);
 void remove_client(struct lws *wsi);
+/* Retorna una copia (malloc'd) del usuario asociado a 'wsi', o NULL. Liberar con free(). */
+char *get_client_username(struct lws *wsi);
 void broadcast_message(const char *message, size_t message_len);
-void send_private_message(const char *target, const char *message, size_t message_len);
+/* Como broadcast_message, con un frame ya serializado (no toma su referencia) */
+void broadcast_frame(frame_t *frame);
+/* Encola un mensaje para 'target'. Si 'receipt' no es NULL, se confirma al
+   remitente cuando se escriba (toma posesión del recibo). Retorna false si
+   'target' no tiene sesión. */
+bool send_private_message(const char *target, const char *message, size_t message_len,
+                          delivery_receipt_t *receipt);
+bool send_private_frame(const char *target, frame_t *frame, delivery_receipt_t *receipt);
+/* Encola el mismo frame para cada uno de 'targets' con un solo lock.
+   offline[i] queda en true si targets[i] no tiene sesión. Retorna la
+   cantidad de destinatarios a los que se encoló. */
+size_t send_multicast_frame(const char *const *targets, size_t count, frame_t *frame,
+                            bool *offline);
 cJSON* get_user_list(void);
 
 /* La función get_user_info se implementa en user_manager.c,
@@ -33,7 +86,76 @@ cJSON* get_user_info(const char *target);
 
 /* Funciones para encolar y enviar mensajes pendientes */
 void enqueue_pending_message(struct lws *wsi, const char *msg, size_t msg_len);
-void write_pending_messages(struct lws *wsi);
+void enqueue_pending_frame(struct lws *wsi, frame_t *frame);
+
+/* Retorna el id de sesión del cliente asociado a 'wsi', o SESSION_NONE */
+uint32_t get_client_session(struct lws *wsi);
+
+/* Encola el mismo frame para cada sesión marcada en el bitset 'members'
+   (words palabras de 64 bits). Retorna la cantidad de destinatarios. */
+size_t send_to_sessions(const uint64_t *members, size_t words, frame_t *frame);
+/* Callback de escritura: un mensaje (o fragmento) por WebSocket, o los
+   datagramas que acepte una conexión local. -1 si hay que cerrarla. */
+int write_pending_messages(struct lws *wsi);
 client_node_t* get_all_clients(void);
+/* Pide LWS_CALLBACK_SERVER_WRITEABLE para cada cliente con mensajes pendientes.
+   Debe llamarse desde el hilo de servicio de libwebsockets. */
+void request_pending_writes(void);
+
+/* Copia en 'out' el token de reanudación del cliente. Retorna false si no está registrado. */
+bool get_resume_token(struct lws *wsi, char out[RESUME_TOKEN_LEN + 1]);
+
+/* El cliente pidió desconectarse: su sesión no se guardará al cerrar */
+void revoke_resume_token(struct lws *wsi);
+
+/* Al cerrarse 'wsi', guarda su sesión (colas, salas, suscripciones) para que
+   pueda reanudarse con el token. Retorna false si no es reanudable; en ese
+   caso el llamador debe liberar la sesión como siempre. */
+bool park_client(struct lws *wsi);
+
+/* Re-asocia la sesión guardada de 'username' a 'wsi' si 'token' coincide.
+   Encola primero 'response' (se le agregan "seq" y "missed") y después los
+   frames posteriores a last_seq que aún estén disponibles, seguidos de los
+   que se encolaron mientras estaba caída. Retorna false si no hay sesión. */
+bool resume_client(struct lws *wsi, const char *username, const char *token,
+                   uint64_t last_seq, cJSON *response);
+
+/* Libera las sesiones guardadas hace más de max_age segundos. 'on_expired'
+   se llama sin el lock, antes de liberar el id de sesión, para que el
+   llamador limpie usuarios, salas y suscripciones. */
+typedef void (*session_expired_fn)(const char *username, uint32_t session_id);
+void expire_parked_clients(time_t now, time_t max_age, session_expired_fn on_expired);
+
+/* Recorre los clientes conectados bajo el lock, para las métricas.
+   Retorna la cantidad de clientes visitados. */
+typedef void (*client_stats_fn)(const char *username, uint64_t bytes_out,
+                                size_t pending_msgs, void *ctx);
+size_t visit_client_stats(client_stats_fn fn, void *ctx);
+
+/* Copia de la cola pendiente de un usuario, usada por los snapshots.
+   Las copias comparten los frames (cada pending_msg_t tiene su referencia). */
+typedef struct queue_snapshot {
+    char *username;
+    char resume_token[RESUME_TOKEN_LEN + 1];  // Para reclamarla tras un reinicio
+    pending_msg_t *head;
+    time_t restored_at;
+    struct queue_snapshot *next;
+} queue_snapshot_t;
+
+/* Copia las sesiones reanudables con su token y su cola pendiente (incluidas
+   las restauradas aún sin dueño) */
+queue_snapshot_t* snapshot_pending_queues(void);
+void free_queue_snapshot(queue_snapshot_t *snap);
+
+/* Guarda una sesión restaurada; su cola se entrega solo a quien la reclame
+   con un "resume" con 'resume_token'. Toma posesión de 'head' (nodos
+   alocados con slab_alloc; puede ser NULL). */
+void restore_pending_queue(const char *username, const char *resume_token, pending_msg_t *head);
+
+/* true si hay una sesión restaurada de 'username' con ese token */
+bool restored_session_matches(const char *username, const char *token);
+
+/* Descarta las colas restauradas cuyo usuario no volvió en max_age segundos */
+void expire_orphan_queues(time_t now, time_t max_age);
 
 #endif
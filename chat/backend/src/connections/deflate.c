@@ -0,0 +1,217 @@
+#include "deflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#include "config.h"
+
+#define PMD_NAME "permessage-deflate"
+
+/* Estado por conexión de la envoltura; 'pmd' es el de la extensión de lws,
+   que se le pasa en cada llamada como si fuera el único. */
+typedef struct {
+    void *pmd;
+    bool shared;            // El servidor no guarda contexto: acepta frames ya comprimidos
+    bool precompressed;     // El lws_write en curso lleva un payload de deflate_frame
+} deflate_conn_t;
+
+static frame_t *tx_frame;   // Solo el hilo de servicio
+
+void deflate_set_tx_frame(frame_t *frame) {
+    tx_frame = frame;
+}
+
+/* Deflate crudo con el mismo formato que la extensión: Z_SYNC_FLUSH y sin
+   los 4 bytes finales (RFC 7692, 7.2.1) */
+static frame_t *compress_frame(frame_t *frame) {
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, DEFLATE_LEVEL, Z_DEFLATED, -DEFLATE_WINDOW_BITS, DEFLATE_MEM_LEVEL,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+    // deflateBound es para Z_FINISH; el bloque vacío de Z_SYNC_FLUSH agrega hasta 5 bytes más
+    size_t cap = deflateBound(&z, (uLong)frame->len) + 8;
+    frame_t *out = frame_alloc(cap);
+    if (!out) {
+        deflateEnd(&z);
+        return NULL;
+    }
+    z.next_in = frame_payload(frame);
+    z.avail_in = (uInt)frame->len;
+    z.next_out = frame_payload(out);
+    z.avail_out = (uInt)cap;
+    int rc = deflate(&z, Z_SYNC_FLUSH);
+    size_t len = cap - z.avail_out;
+    deflateEnd(&z);
+    if (rc != Z_OK || z.avail_in != 0 || len < 4) {
+        frame_release(out);
+        return NULL;
+    }
+    len -= 4;
+    if (len >= frame->len) {
+        frame_release(out);
+        return frame;
+    }
+    out->len = len;
+    out->binary = frame->binary;
+    return out;
+}
+
+frame_t *deflate_frame(frame_t *frame) {
+    frame_t *deflated = atomic_load_explicit(&frame->deflated, memory_order_acquire);
+    if (deflated)
+        return deflated;
+    deflated = compress_frame(frame);
+    if (!deflated)
+        return NULL;
+    frame_t *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&frame->deflated, &expected, deflated,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        if (deflated != frame)
+            frame_release(deflated);
+        return expected;
+    }
+    return deflated;
+}
+
+/* Escritura de un mensaje entero: sin comprimir si es corto, o con el
+   payload compartido. Retorna false para dejársela a la extensión. */
+static bool payload_tx(deflate_conn_t *conn, struct lws_ext_pm_deflate_rx_ebufs *pmdrx, size_t flags) {
+    int opcode = (int)(flags & 0xf);
+    // Los fragmentos siguen siempre el contexto de la extensión, también el último
+    if ((opcode != LWS_WRITE_TEXT && opcode != LWS_WRITE_BINARY) || (flags & LWS_WRITE_NO_FIN))
+        return false;
+    if (pmdrx->eb_in.len < DEFLATE_MIN_PAYLOAD) {
+        pmdrx->eb_out = pmdrx->eb_in;
+        return true;
+    }
+    if (!conn->shared || !tx_frame || pmdrx->eb_in.token != frame_payload(tx_frame) ||
+        (size_t)pmdrx->eb_in.len != tx_frame->len)
+        return false;
+    frame_t *deflated = deflate_frame(tx_frame);
+    if (!deflated)
+        return false;
+    pmdrx->eb_out = pmdrx->eb_in;
+    if (deflated != tx_frame) {
+        pmdrx->eb_out.token = frame_payload(deflated);
+        pmdrx->eb_out.len = (int)deflated->len;
+        conn->precompressed = true;
+    }
+    return true;
+}
+
+static int deflate_callback(struct lws_context *context, const struct lws_extension *ext,
+                            struct lws *wsi, enum lws_extension_callback_reasons reason,
+                            void *user, void *in, size_t len) {
+    deflate_conn_t *conn = user;
+    switch (reason) {
+        case LWS_EXT_CB_CONSTRUCT:
+        case LWS_EXT_CB_CLIENT_CONSTRUCT:
+            // 'user' apunta al puntero de estado de la conexión
+            conn = calloc(1, sizeof(*conn));
+            if (!conn)
+                return -1;
+            if (lws_extension_callback_pm_deflate(context, ext, wsi, reason, &conn->pmd, in, len)) {
+                free(conn);
+                return -1;
+            }
+            *(void **)user = conn;
+            return 0;
+        case LWS_EXT_CB_DESTROY: {
+            int n = lws_extension_callback_pm_deflate(context, ext, wsi, reason,
+                                                      conn ? conn->pmd : NULL, in, len);
+            free(conn);
+            return n;
+        }
+        case LWS_EXT_CB_NAMED_OPTION_SET: {
+            int n = lws_extension_callback_pm_deflate(context, ext, wsi, reason, conn->pmd, in, len);
+            const struct lws_ext_option_arg *oa = in;
+            if (n == 0 && oa->option_name && !strcmp(oa->option_name, "server_no_context_takeover"))
+                conn->shared = true;
+            return n;
+        }
+        case LWS_EXT_CB_PAYLOAD_TX:
+            if (conn && payload_tx(conn, in, len))
+                return 0;
+            break;
+        case LWS_EXT_CB_PACKET_TX_PRESEND:
+            if (conn && conn->precompressed) {
+                // Ya comprimido: solo falta marcar RSV1 en el encabezado
+                conn->precompressed = false;
+                unsigned char *header = ((struct lws_ext_pm_deflate_rx_ebufs *)in)->eb_in.token;
+                header[0] |= 0x40;
+                return 0;
+            }
+            break;
+        default:
+            break;
+    }
+    return lws_extension_callback_pm_deflate(context, ext, wsi, reason, conn ? conn->pmd : NULL,
+                                             in, len);
+}
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+const struct lws_extension deflate_extensions[] = {
+    {
+        PMD_NAME,
+        deflate_callback,
+        // Lo que ofrecen los clientes propios (chat_loadgen)
+        PMD_NAME "; client_max_window_bits=" STR(DEFLATE_CLIENT_WINDOW_BITS)
+    },
+    { NULL, NULL, NULL }
+};
+
+/* server_max_window_bits de la primera oferta de permessage-deflate en el
+   header Sec-WebSocket-Extensions: 15 si no lo limita, 0 si no la ofrece */
+static int offered_server_window(char *offers) {
+    char *save_offer;
+    for (char *offer = strtok_r(offers, ",", &save_offer); offer;
+         offer = strtok_r(NULL, ",", &save_offer)) {
+        char *save_param;
+        char *name = strtok_r(offer, ";", &save_param);
+        if (!name)
+            continue;
+        name += strspn(name, " \t");
+        if (strncasecmp(name, PMD_NAME, strlen(PMD_NAME)) != 0)
+            continue;
+        int window = 15;
+        for (char *param = strtok_r(NULL, ";", &save_param); param;
+             param = strtok_r(NULL, ";", &save_param)) {
+            param += strspn(param, " \t");
+            if (strncasecmp(param, "server_max_window_bits", 22) != 0)
+                continue;
+            char *value = strchr(param, '=');
+            if (value)
+                window = atoi(value + 1 + strspn(value + 1, " \t\""));
+        }
+        return window;
+    }
+    return 0;
+}
+
+static void set_option(struct lws *wsi, const char *name, int value) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "%d", value);
+    lws_set_extension_option(wsi, PMD_NAME, name, buf);
+}
+
+void deflate_configure(struct lws *wsi) {
+    char offers[256];
+    if (lws_hdr_copy(wsi, offers, sizeof(offers), WSI_TOKEN_EXTENSIONS) <= 0)
+        return;
+    int window = offered_server_window(offers);
+    if (window == 0)
+        return;
+    set_option(wsi, "compression_level", DEFLATE_LEVEL);
+    set_option(wsi, "mem_level", DEFLATE_MEM_LEVEL);
+    // Achicar la ventana propia siempre es válido; agrandarla más allá de lo pedido, no
+    if (window < DEFLATE_WINDOW_BITS)
+        return;
+    set_option(wsi, "server_max_window_bits", DEFLATE_WINDOW_BITS);
+    // Sin contexto entre mensajes la salida no depende de la conexión y se comparte
+    if (DEFLATE_SHARED)
+        set_option(wsi, "server_no_context_takeover", 1);
+}
@@ -0,0 +1,47 @@
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <libwebsockets.h>
+#include <stdbool.h>
+#include "frame.h"
+
+/**
+ * Compresión permessage-deflate (RFC 7692).
+ *
+ * La hace la extensión de libwebsockets; deflate_extensions la envuelve para
+ * agregar dos cosas:
+ *
+ * - Un mensaje entero de menos de DEFLATE_MIN_PAYLOAD bytes sale sin
+ *   comprimir (sin RSV1): en mensajes cortos deflate casi no ahorra y cuesta
+ *   lo mismo por destinatario.
+ *
+ * - Compresión compartida: en las conexiones donde el servidor no guarda
+ *   contexto entre mensajes (server_no_context_takeover, ver
+ *   deflate_configure), cada mensaje se comprime desde cero, así que la
+ *   salida es la misma para todos los destinatarios. El frame se comprime
+ *   una vez (deflate_frame, guardado en el frame como las traducciones) y a
+ *   cada conexión se le escribe ese payload, en vez de correr deflate N
+ *   veces en un broadcast.
+ *
+ * Todo ocurre dentro de lws_write, en el hilo de servicio.
+ */
+
+// { "permessage-deflate", ... } y el terminador, para lws_context_creation_info.extensions
+extern const struct lws_extension deflate_extensions[];
+
+/* En LWS_CALLBACK_ESTABLISHED (con los headers del handshake todavía
+   disponibles): aplica nivel, memoria y ventana de config.h a la conexión y,
+   si su oferta lo permite, la pasa a compresión compartida. No hace nada si
+   no se negoció la extensión. */
+void deflate_configure(struct lws *wsi);
+
+/* Frame que se va a escribir entero con el próximo lws_write (NULL después).
+   La extensión solo reemplaza el payload si coincide con el de ese frame. */
+void deflate_set_tx_frame(frame_t *frame);
+
+/* El payload del frame comprimido con deflate crudo, sin contexto previo y
+   sin la cola 00 00 ff ff; se crea la primera vez y vive lo que el frame.
+   Retorna el mismo frame si comprimido no es más chico, o NULL sin memoria. */
+frame_t *deflate_frame(frame_t *frame);
+
+#endif
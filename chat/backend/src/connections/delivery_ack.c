@@ -0,0 +1,145 @@
+#include "delivery_ack.h"
+#include "connection_manager.h"
+#include "logger.h"
+#include "config.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Ids entregados de un remitente desde el último envío, ya separados por comas */
+typedef struct ack_batch {
+    char *sender;
+    char *ids;
+    size_t len;
+    size_t cap;
+    struct ack_batch *next;
+} ack_batch_t;
+
+static struct lws_context *ack_context = NULL;
+static lws_sorted_usec_list_t flush_sul;
+static bool flush_scheduled = false;
+static ack_batch_t *batches = NULL;
+
+delivery_receipt_t *delivery_receipt_create(const char *sender, const cJSON *id) {
+    if (!sender || !(cJSON_IsNumber(id) || cJSON_IsString(id)))
+        return NULL;
+    // El recibo vive más que el mensaje: el id se copia fuera de la arena de cJSON
+    char *printed = cJSON_PrintUnformatted(id);
+    delivery_receipt_t *receipt = printed ? delivery_receipt_create_raw(sender, printed, strlen(printed)) : NULL;
+    cJSON_free(printed);
+    return receipt;
+}
+
+delivery_receipt_t *delivery_receipt_create_raw(const char *sender, const char *id, size_t id_len) {
+    delivery_receipt_t *receipt = malloc(sizeof(delivery_receipt_t));
+    if (!receipt)
+        return NULL;
+    receipt->sender = strdup(sender);
+    receipt->id = strndup(id, id_len);
+    if (!receipt->sender || !receipt->id) {
+        delivery_receipt_free(receipt);
+        return NULL;
+    }
+    return receipt;
+}
+
+void delivery_receipt_free(delivery_receipt_t *receipt) {
+    if (!receipt)
+        return;
+    free(receipt->sender);
+    free(receipt->id);
+    free(receipt);
+}
+
+static void free_batch(ack_batch_t *batch) {
+    free(batch->sender);
+    free(batch->ids);
+    free(batch);
+}
+
+/* Envía un delivery_ack por remitente con todo lo entregado en la ventana */
+static void flush_acks(lws_sorted_usec_list_t *sul) {
+    (void)sul;
+    flush_scheduled = false;
+    ack_batch_t *batch = batches;
+    batches = NULL;
+    while (batch) {
+        ack_batch_t *next = batch->next;
+        static const char prefix[] = "{\"type\":\"delivery_ack\",\"sender\":\"server\",\"content\":[";
+        size_t len = sizeof(prefix) - 1 + batch->len + 2;
+        char *frame = malloc(len + 1);
+        if (frame) {
+            memcpy(frame, prefix, sizeof(prefix) - 1);
+            memcpy(frame + sizeof(prefix) - 1, batch->ids, batch->len);
+            memcpy(frame + sizeof(prefix) - 1 + batch->len, "]}", 3);
+            send_private_message(batch->sender, frame, len, NULL);
+            free(frame);
+        }
+        free_batch(batch);
+        batch = next;
+    }
+}
+
+void delivery_ack_init(struct lws_context *context) {
+    ack_context = context;
+}
+
+void delivery_ack_delivered(delivery_receipt_t *receipt) {
+    if (!ack_context) {
+        delivery_receipt_free(receipt);
+        return;
+    }
+    ack_batch_t *batch = batches;
+    while (batch && strcmp(batch->sender, receipt->sender) != 0)
+        batch = batch->next;
+    if (!batch) {
+        batch = calloc(1, sizeof(ack_batch_t));
+        if (!batch) {
+            delivery_receipt_free(receipt);
+            return;
+        }
+        // El remitente pasa al lote; el recibo ya no lo necesita
+        batch->sender = receipt->sender;
+        receipt->sender = NULL;
+        batch->next = batches;
+        batches = batch;
+    }
+
+    size_t id_len = strlen(receipt->id);
+    size_t needed = batch->len + id_len + 1;
+    if (needed > batch->cap) {
+        size_t cap = batch->cap ? batch->cap * 2 : 64;
+        while (cap < needed)
+            cap *= 2;
+        char *grown = realloc(batch->ids, cap);
+        if (!grown) {
+            log_error("Error al asignar memoria para el delivery_ack de %s", batch->sender);
+            delivery_receipt_free(receipt);
+            return;
+        }
+        batch->ids = grown;
+        batch->cap = cap;
+    }
+    if (batch->len > 0)
+        batch->ids[batch->len++] = ',';
+    memcpy(batch->ids + batch->len, receipt->id, id_len);
+    batch->len += id_len;
+    delivery_receipt_free(receipt);
+
+    if (!flush_scheduled) {
+        flush_scheduled = true;
+        lws_sul_schedule(ack_context, 0, &flush_sul, flush_acks,
+                         (lws_usec_t)DELIVERY_ACK_WINDOW_MS * 1000);
+    }
+}
+
+void delivery_ack_shutdown(void) {
+    if (ack_context && flush_scheduled)
+        lws_sul_cancel(&flush_sul);
+    flush_scheduled = false;
+    while (batches) {
+        ack_batch_t *next = batches->next;
+        free_batch(batches);
+        batches = next;
+    }
+    ack_context = NULL;
+}
@@ -0,0 +1,39 @@
+#ifndef DELIVERY_ACK_H
+#define DELIVERY_ACK_H
+
+#include <libwebsockets.h>
+#include <cjson/cJSON.h>
+
+/**
+ * Recibos de entrega de mensajes privados.
+ *
+ * Un "private" con "id" viaja en la cola del destinatario con un recibo.
+ * Cuando el hilo de servicio lo escribe al socket del destinatario, el
+ * recibo se junta con los demás del mismo remitente y, pasados
+ * DELIVERY_ACK_WINDOW_MS, se envía un solo frame:
+ *   {"type":"delivery_ack","sender":"server","content":[id, id, ...]}
+ * Todo el agrupado ocurre en el hilo de servicio, sin locks.
+ */
+
+typedef struct delivery_receipt {
+    char *sender;       // Usuario al que se le avisa
+    char *id;           // "id" de la petición, serializado en JSON
+} delivery_receipt_t;
+
+// Crea el recibo; retorna NULL si la petición no trae "id" (no pidió recibo).
+delivery_receipt_t *delivery_receipt_create(const char *sender, const cJSON *id);
+// Igual, con el "id" ya serializado (un string entre comillas o un número).
+delivery_receipt_t *delivery_receipt_create_raw(const char *sender, const char *id, size_t id_len);
+void delivery_receipt_free(delivery_receipt_t *receipt);
+
+// Habilita el envío de acks con un timer en el contexto de libwebsockets.
+// Sin llamarla (p. ej. en los benchmarks) los recibos se descartan.
+void delivery_ack_init(struct lws_context *context);
+
+// Hilo de servicio: el mensaje del recibo ya se escribió. Toma posesión del recibo.
+void delivery_ack_delivered(delivery_receipt_t *receipt);
+
+// Cancela el timer y descarta los acks sin enviar (antes de lws_context_destroy).
+void delivery_ack_shutdown(void);
+
+#endif
@@ -0,0 +1,70 @@
+#include "frame.h"
+#include <stdlib.h>
+#include <string.h>
+
+frame_t *frame_alloc(size_t len) {
+    frame_t *frame = malloc(sizeof(frame_t) + LWS_PRE + len);
+    if (!frame)
+        return NULL;
+    atomic_init(&frame->refcount, 1);
+    frame->binary = false;
+    atomic_init(&frame->translated, NULL);
+    atomic_init(&frame->deflated, NULL);
+    frame->len = len;
+    return frame;
+}
+
+frame_t *frame_create(const char *payload, size_t len) {
+    frame_t *frame = frame_alloc(len + 1);
+    if (!frame)
+        return NULL;
+    memcpy(frame_payload(frame), payload, len);
+    frame_payload(frame)[len] = '\n';
+    return frame;
+}
+
+frame_t *frame_create_raw(const char *payload, size_t len) {
+    frame_t *frame = frame_alloc(len);
+    if (!frame)
+        return NULL;
+    memcpy(frame_payload(frame), payload, len);
+    return frame;
+}
+
+static frame_t *encode(frame_write_fn write, const void *ctx, bool binary) {
+    json_writer_t measure = { NULL, 0 };
+    write(&measure, ctx);
+    frame_t *frame = frame_alloc(measure.len + !binary);
+    if (!frame)
+        return NULL;
+    json_writer_t w = { (char *)frame_payload(frame), 0 };
+    write(&w, ctx);
+    if (!binary)
+        frame_payload(frame)[w.len] = '\n';
+    frame->binary = binary;
+    return frame;
+}
+
+frame_t *frame_encode(frame_write_fn write, const void *ctx) {
+    return encode(write, ctx, false);
+}
+
+frame_t *frame_encode_binary(frame_write_fn write, const void *ctx) {
+    return encode(write, ctx, true);
+}
+
+void frame_retain(frame_t *frame) {
+    atomic_fetch_add_explicit(&frame->refcount, 1, memory_order_relaxed);
+}
+
+void frame_release(frame_t *frame) {
+    if (!frame)
+        return;
+    if (atomic_fetch_sub_explicit(&frame->refcount, 1, memory_order_acq_rel) == 1) {
+        frame_release(atomic_load_explicit(&frame->translated, memory_order_relaxed));
+        frame_t *deflated = atomic_load_explicit(&frame->deflated, memory_order_relaxed);
+        if (deflated != frame)
+            frame_release(deflated);
+        free(frame);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <libwebsockets.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "json_slice.h"
+
+/**
+ * Frame serializado y compartido entre varias colas de envío.
+ *
+ * Un broadcast se serializa una sola vez y cada destinatario encola una
+ * referencia al mismo frame. Los LWS_PRE bytes iniciales quedan reservados
+ * para que lws_write escriba el encabezado WebSocket sin copiar el payload;
+ * como todas las escrituras ocurren en el hilo de servicio, compartir esa
+ * zona entre destinatarios es seguro.
+ *
+ * Un frame está en JSON (chat-protocol) o en binario (chat-protocol-bin,
+ * ver binproto.h). La traducción al otro formato se hace la primera vez que
+ * un destinatario la necesita y queda guardada en 'translated' para el resto.
+ * Lo mismo con 'deflated', la versión comprimida para permessage-deflate
+ * (ver deflate.h).
+ */
+typedef struct frame_s {
+    atomic_int refcount;
+    bool binary;                              // Codificado con binproto
+    _Atomic(struct frame_s *) translated;     // El mismo mensaje en el otro formato
+    _Atomic(struct frame_s *) deflated;       // Payload comprimido (el mismo frame si no conviene)
+    size_t len;               // bytes de payload (JSON: incluye el '\n' final)
+    unsigned char data[];     // LWS_PRE + payload
+} frame_t;
+
+/* Crea un frame con 'len' bytes de payload sin inicializar (refcount = 1),
+   para serializar directo en frame_payload() */
+frame_t *frame_alloc(size_t len);
+
+/* Crea un frame con una copia de 'payload' más '\n' (refcount = 1) */
+frame_t *frame_create(const char *payload, size_t len);
+
+/* Crea un frame con el payload tal cual, sin agregar '\n' (refcount = 1) */
+frame_t *frame_create_raw(const char *payload, size_t len);
+
+/* Serializa con 'write' en dos pasadas (la primera solo mide) directo sobre
+   el payload de un frame del tamaño exacto, más '\n' (refcount = 1) */
+typedef void (*frame_write_fn)(json_writer_t *w, const void *ctx);
+frame_t *frame_encode(frame_write_fn write, const void *ctx);
+
+/* Como frame_encode para un frame binario: sin '\n' y con binary = true */
+frame_t *frame_encode_binary(frame_write_fn write, const void *ctx);
+
+void frame_retain(frame_t *frame);
+void frame_release(frame_t *frame);
+
+static inline unsigned char *frame_payload(frame_t *frame) {
+    return frame->data + LWS_PRE;
+}
+
+#endif
@@ -0,0 +1,156 @@
+#include "rate_limit.h"
+#include "config.h"
+#include "json_slice.h"
+#include <string.h>
+
+typedef struct {
+    double per_sec;     // 0: el tipo solo está sujeto al límite total
+    double burst;
+} bucket_limit_t;
+
+// Límites por tipo: lo que hace fan-out o recorre registros es más caro
+static const bucket_limit_t type_limits[METRIC_MSG_COUNT] = {
+    [METRIC_MSG_REGISTER]      = { 1.0, 3.0 },
+    [METRIC_MSG_BROADCAST]     = { 10.0, 20.0 },
+    [METRIC_MSG_PRIVATE]       = { 20.0, 40.0 },
+    [METRIC_MSG_LIST_USERS]    = { 2.0, 5.0 },
+    [METRIC_MSG_USER_INFO]     = { 5.0, 10.0 },
+    [METRIC_MSG_CHANGE_STATUS] = { 2.0, 5.0 },
+    [METRIC_MSG_JOIN_ROOM]     = { 5.0, 10.0 },
+    [METRIC_MSG_LEAVE_ROOM]    = { 5.0, 10.0 },
+    [METRIC_MSG_ROOM_MESSAGE]  = { 20.0, 40.0 },
+    [METRIC_MSG_LIST_ROOMS]    = { 2.0, 5.0 },
+    [METRIC_MSG_SUBSCRIBE]     = { 5.0, 10.0 },
+    [METRIC_MSG_UNSUBSCRIBE]   = { 5.0, 10.0 },
+    [METRIC_MSG_MULTICAST]     = { 2.0, 5.0 },
+    [METRIC_MSG_SEARCH_USERS]  = { 5.0, 10.0 },
+};
+
+static const bucket_limit_t total_limit = { RATE_LIMIT_PER_SEC, RATE_LIMIT_BURST };
+
+/* Repone los tokens acumulados desde la última consulta */
+static void refill(token_bucket_t *b, const bucket_limit_t *limit, uint64_t now_ns) {
+    if (now_ns > b->last_ns) {
+        b->tokens += (double)(now_ns - b->last_ns) * limit->per_sec / 1e9;
+        if (b->tokens > limit->burst)
+            b->tokens = limit->burst;
+    }
+    b->last_ns = now_ns;
+}
+
+void rate_limit_init(rate_limit_t *rl, uint64_t now_ns) {
+    memset(rl, 0, sizeof(*rl));
+    rl->total.tokens = total_limit.burst;
+    rl->total.last_ns = now_ns;
+    for (int i = 0; i < METRIC_MSG_COUNT; i++) {
+        rl->per_type[i].tokens = type_limits[i].burst;
+        rl->per_type[i].last_ns = now_ns;
+    }
+}
+
+bool rate_limit_allow(rate_limit_t *rl, metric_msg_type_t type, uint64_t now_ns) {
+    if (type >= METRIC_MSG_COUNT)
+        type = METRIC_MSG_OTHER;
+    const bucket_limit_t *limit = &type_limits[type];
+    token_bucket_t *typed = limit->per_sec > 0 ? &rl->per_type[type] : NULL;
+
+    // Se revisan ambos antes de consumir: un rechazo no gasta tokens
+    refill(&rl->total, &total_limit, now_ns);
+    if (typed)
+        refill(typed, limit, now_ns);
+    if (rl->total.tokens < 1.0 || (typed && typed->tokens < 1.0))
+        return false;
+    rl->total.tokens -= 1.0;
+    if (typed)
+        typed->tokens -= 1.0;
+    return true;
+}
+
+bool rate_limit_should_notify(rate_limit_t *rl, uint64_t now_ns) {
+    if (rl->last_notice_ns && now_ns - rl->last_notice_ns < RATE_LIMIT_NOTICE_NS)
+        return false;
+    rl->last_notice_ns = now_ns;
+    return true;
+}
+
+// Alcanza para cualquier nombre de tipo aunque venga entero como \uXXXX
+#define TYPE_TEXT_MAX 128
+
+/* Texto de un string JSON (todavía escapado) decodificado en 'buf' */
+static bool slice_text(const json_slice_t *slice, char *buf, size_t cap) {
+    if (!slice || slice->kind != JSON_SLICE_STRING || slice->len >= cap)
+        return false;
+    // Decodificado nunca es más largo que escapado
+    size_t n = json_slice_unescape(slice, buf);
+    buf[n] = '\0';
+    return true;
+}
+
+static metric_msg_type_t slice_type(const json_slice_t *value) {
+    char type[TYPE_TEXT_MAX];
+    return slice_text(value, type, sizeof(type)) ? metrics_msg_type(type) : METRIC_MSG_OTHER;
+}
+
+/* Salta un string desde su comilla inicial y lo deja en 'out'. Retorna la
+   posición de la comilla final, o 'len' si no termina o sus escapes no
+   son válidos (se validan solo si los tiene). */
+static size_t skip_string(const char *msg, size_t len, size_t open, json_slice_t *out) {
+    bool escaped = false;
+    size_t i = open + 1;
+    while (i < len && msg[i] != '"') {
+        if (msg[i] == '\\') {
+            escaped = true;
+            i++;
+        }
+        i++;
+    }
+    if (i >= len || (escaped && !json_slice_valid(msg + open, i - open + 1)))
+        return len;
+    *out = (json_slice_t){ msg + open + 1, i - open - 1, JSON_SLICE_STRING, escaped, false };
+    return i;
+}
+
+static size_t skip_space(const char *msg, size_t len, size_t i) {
+    while (i < len && (msg[i] == ' ' || msg[i] == '\t' || msg[i] == '\n' || msg[i] == '\r'))
+        i++;
+    return i;
+}
+
+/* Para lo que json_slice_scan no acepta (más de JSON_SLICE_MAX_FIELDS
+   campos, claves escapadas, mucho anidamiento) y cJSON sí: la primera
+   clave "type" del primer nivel, saltando strings y valores anidados */
+static metric_msg_type_t top_level_type(const char *msg, size_t len) {
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (msg[i] == '{' || msg[i] == '[') {
+            depth++;
+        } else if (msg[i] == '}' || msg[i] == ']') {
+            depth--;
+        } else if (msg[i] == '"') {
+            json_slice_t key;
+            i = skip_string(msg, len, i, &key);
+            if (i >= len)
+                return METRIC_MSG_OTHER;
+            // Una clave es un string del primer nivel seguido de ':'
+            size_t p = skip_space(msg, len, i + 1);
+            char name[TYPE_TEXT_MAX];
+            if (depth != 1 || p >= len || msg[p] != ':' ||
+                !slice_text(&key, name, sizeof(name)) || strcmp(name, "type") != 0)
+                continue;
+            p = skip_space(msg, len, p + 1);
+            json_slice_t value;
+            if (p >= len || msg[p] != '"' || skip_string(msg, len, p, &value) >= len)
+                return METRIC_MSG_OTHER;
+            return slice_type(&value);
+        }
+    }
+    return METRIC_MSG_OTHER;
+}
+
+metric_msg_type_t rate_limit_msg_type(const char *msg, size_t len) {
+    // La misma clave que usa el worker: la primera "type" del primer nivel
+    json_fields_t fields;
+    if (json_slice_scan(msg, len, &fields))
+        return slice_type(json_slice_get(&fields, "type"));
+    return top_level_type(msg, len);
+}
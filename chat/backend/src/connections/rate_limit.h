@@ -0,0 +1,43 @@
+#ifndef RATE_LIMIT_H
+#define RATE_LIMIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "metrics.h"
+
+/**
+ * Límite de frecuencia por conexión con token buckets.
+ *
+ * Cada conexión tiene un bucket para todos sus mensajes y uno por tipo de
+ * mensaje (indexado igual que las métricas). Se consulta en el hilo de
+ * servicio antes de dispatch_message, así que un cliente que inunda el
+ * servidor no llega a ocupar la cola de los workers. El estado vive en los
+ * datos por sesión de libwebsockets y solo lo toca ese hilo: no usa locks.
+ */
+
+typedef struct {
+    double tokens;
+    uint64_t last_ns;
+} token_bucket_t;
+
+typedef struct {
+    token_bucket_t total;
+    token_bucket_t per_type[METRIC_MSG_COUNT];
+    uint64_t last_notice_ns;    // Último aviso de límite enviado al cliente
+} rate_limit_t;
+
+// Deja todos los buckets llenos.
+void rate_limit_init(rate_limit_t *rl, uint64_t now_ns);
+
+// Consume un token del tipo y uno del total. Retorna false si alguno está vacío.
+bool rate_limit_allow(rate_limit_t *rl, metric_msg_type_t type, uint64_t now_ns);
+
+// Retorna true si corresponde avisar al cliente (como mucho uno por RATE_LIMIT_NOTICE_NS).
+bool rate_limit_should_notify(rate_limit_t *rl, uint64_t now_ns);
+
+// Tipo de un mensaje sin armar el DOM: la clave "type" del primer nivel,
+// con los escapes decodificados, como la lee el worker.
+metric_msg_type_t rate_limit_msg_type(const char *msg, size_t len);
+
+#endif
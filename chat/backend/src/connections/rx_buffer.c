@@ -0,0 +1,58 @@
+#include "rx_buffer.h"
+#include <string.h>
+
+rx_buffer_t *rx_buffer_create(size_t cap) {
+    if (cap < RX_BUFFER_CAP)
+        cap = RX_BUFFER_CAP;
+    rx_buffer_t *rx = slab_alloc(sizeof(rx_buffer_t) + cap + 1);
+    if (!rx)
+        return NULL;
+    atomic_init(&rx->refcount, 1);
+    rx->len = 0;
+    rx->cap = cap;
+    rx->binary = false;
+    rx->data[0] = '\0';
+    return rx;
+}
+
+rx_buffer_t *rx_buffer_from(const void *data, size_t len) {
+    rx_buffer_t *rx = rx_buffer_create(len);
+    if (!rx)
+        return NULL;
+    memcpy(rx->data, data, len);
+    rx->data[len] = '\0';
+    rx->len = len;
+    return rx;
+}
+
+bool rx_buffer_append(rx_buffer_t **rx, const void *data, size_t len) {
+    rx_buffer_t *cur = *rx;
+    if (len > cur->cap - cur->len) {
+        size_t cap = cur->cap * 2;
+        if (cap < cur->len + len)
+            cap = cur->len + len;
+        rx_buffer_t *grown = rx_buffer_create(cap);
+        if (!grown)
+            return false;
+        memcpy(grown->data, cur->data, cur->len);
+        grown->len = cur->len;
+        grown->binary = cur->binary;
+        rx_buffer_release(cur);
+        *rx = cur = grown;
+    }
+    memcpy(cur->data + cur->len, data, len);
+    cur->len += len;
+    cur->data[cur->len] = '\0';
+    return true;
+}
+
+void rx_buffer_retain(rx_buffer_t *rx) {
+    atomic_fetch_add_explicit(&rx->refcount, 1, memory_order_relaxed);
+}
+
+void rx_buffer_release(rx_buffer_t *rx) {
+    if (!rx)
+        return;
+    if (atomic_fetch_sub_explicit(&rx->refcount, 1, memory_order_acq_rel) == 1)
+        slab_free(rx);
+}
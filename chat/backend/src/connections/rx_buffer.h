@@ -0,0 +1,51 @@
+#ifndef RX_BUFFER_H
+#define RX_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "slab.h"
+
+/**
+ * Buffer de recepción compartido por referencia.
+ *
+ * El hilo de servicio copia cada mensaje que entrega libwebsockets en un
+ * rx_buffer (la única copia del payload: lws reutiliza su propio buffer) y
+ * la tarea del pool lo referencia en vez de copiarlo otra vez. El worker lee
+ * los campos como slices del buffer (json_slice.h) y los escribe directo en
+ * el frame de salida.
+ *
+ * Los buffers de hasta RX_BUFFER_CAP bytes son todos del mismo tamaño y
+ * salen de la clase más grande del allocator slab, que los recicla por
+ * hilo y devuelve a la caché del hilo de servicio los que libera un worker.
+ * Los mensajes más grandes usan un buffer a medida: un mensaje que llega en
+ * varios fragmentos se reensambla con rx_buffer_append(), que duplica la
+ * capacidad al llenarse.
+ */
+
+typedef struct rx_buffer {
+    atomic_int refcount;
+    size_t len;
+    size_t cap;
+    bool binary;            // Llegó por chat-protocol-bin (binproto.h)
+    char data[];            // len bytes + '\0' (cJSON_Parse lo necesita)
+} rx_buffer_t;
+
+/* Capacidad de un buffer del pool (sin contar el '\0') */
+#define RX_BUFFER_CAP (SLAB_MAX_SIZE - sizeof(rx_buffer_t) - 1)
+
+/* Buffer vacío con espacio para al menos 'cap' bytes (refcount = 1) */
+rx_buffer_t *rx_buffer_create(size_t cap);
+
+/* Buffer con una copia de 'data' (refcount = 1) */
+rx_buffer_t *rx_buffer_from(const void *data, size_t len);
+
+/* Agrega 'len' bytes al final. Si no caben, pasa el contenido a un buffer
+   más grande y libera el anterior (*rx cambia). Solo para un buffer que aún
+   no se compartió. Retorna false sin memoria; *rx queda intacto. */
+bool rx_buffer_append(rx_buffer_t **rx, const void *data, size_t len);
+
+void rx_buffer_retain(rx_buffer_t *rx);
+void rx_buffer_release(rx_buffer_t *rx);
+
+#endif
@@ -0,0 +1,185 @@
+#include "chat_local.h"
+#include "json_slice.h"
+#include "config.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define USERNAME_MAX 64
+
+struct chat_local {
+    int fd;
+    char username[USERNAME_MAX];
+    char *buf;              // Último mensaje recibido
+    size_t cap;
+    size_t max_send;        // Datagrama más grande que admite el buffer de envío
+};
+
+chat_local_t *chat_local_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(addr.sun_path, path);
+
+    chat_local_t *c = calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->fd < 0 || connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = errno;
+        if (c->fd >= 0)
+            close(c->fd);
+        free(c);
+        errno = err;
+        return NULL;
+    }
+    // Un datagrama tiene que caber entero en el buffer de envío; el kernel lo
+    // recorta a net.core.wmem_max, así que se lee el que quedó
+    int sndbuf = MAX_MESSAGE_SIZE + LOCAL_GATEWAY_DGRAM_OVERHEAD;
+    socklen_t optlen = sizeof(sndbuf);
+    if (setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0 ||
+        getsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0) {
+        int err = errno;
+        close(c->fd);
+        free(c);
+        errno = err;
+        return NULL;
+    }
+    c->max_send = sndbuf > LOCAL_GATEWAY_DGRAM_OVERHEAD ?
+                  (size_t)(sndbuf - LOCAL_GATEWAY_DGRAM_OVERHEAD) : 0;
+    if (c->max_send > MAX_MESSAGE_SIZE)
+        c->max_send = MAX_MESSAGE_SIZE;
+    return c;
+}
+
+int chat_local_fd(const chat_local_t *c) {
+    return c->fd;
+}
+
+size_t chat_local_max_message(const chat_local_t *c) {
+    return c->max_send;
+}
+
+bool chat_local_send(chat_local_t *c, const char *json, size_t len) {
+    // El servidor toma un datagrama vacío como fin de la conexión
+    if (len == 0 || len > c->max_send) {
+        errno = EMSGSIZE;
+        return false;
+    }
+    ssize_t n;
+    do {
+        n = send(c->fd, json, len, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == (ssize_t)len;
+}
+
+typedef struct {
+    const char *type;
+    const char *sender;
+    const char *target;     // Opcional
+    const char *content;
+} message_t;
+
+static void write_message(json_writer_t *w, const message_t *m) {
+    json_write_literal(w, "{\"type\":");
+    json_write_string(w, m->type);
+    json_write_literal(w, ",\"sender\":");
+    json_write_string(w, m->sender);
+    if (m->target) {
+        json_write_literal(w, ",\"target\":");
+        json_write_string(w, m->target);
+    }
+    if (m->content) {
+        json_write_literal(w, ",\"content\":");
+        json_write_string(w, m->content);
+    }
+    json_write_literal(w, "}");
+}
+
+/* Mide, arma y envía el mensaje */
+static bool send_message(chat_local_t *c, const message_t *m) {
+    json_writer_t w = { NULL, 0 };
+    write_message(&w, m);
+    char *json = malloc(w.len);
+    if (!json)
+        return false;
+    w.out = json;
+    w.len = 0;
+    write_message(&w, m);
+    bool ok = chat_local_send(c, json, w.len);
+    free(json);
+    return ok;
+}
+
+bool chat_local_register(chat_local_t *c, const char *username) {
+    if (strlen(username) >= sizeof(c->username)) {
+        errno = EINVAL;
+        return false;
+    }
+    strcpy(c->username, username);
+    message_t m = { "register", c->username, NULL, NULL };
+    return send_message(c, &m);
+}
+
+bool chat_local_subscribe(chat_local_t *c, const char *pattern) {
+    message_t m = { "subscribe", c->username, NULL, pattern };
+    return send_message(c, &m);
+}
+
+bool chat_local_broadcast(chat_local_t *c, const char *content) {
+    message_t m = { "broadcast", c->username, NULL, content };
+    return send_message(c, &m);
+}
+
+bool chat_local_private(chat_local_t *c, const char *target, const char *content) {
+    message_t m = { "private", c->username, target, content };
+    return send_message(c, &m);
+}
+
+long chat_local_recv(chat_local_t *c, const char **msg, int timeout_ms) {
+    struct pollfd pfd = { c->fd, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready < 0)
+        return -1;
+    if (ready == 0)
+        return 0;
+
+    // Largo del datagrama sin sacarlo, para recibirlo entero
+    ssize_t size = recv(c->fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (size <= 0)
+        return -1;
+    if ((size_t)size + 1 > c->cap) {
+        char *grown = realloc(c->buf, (size_t)size + 1);
+        if (!grown)
+            return -1;
+        c->buf = grown;
+        c->cap = (size_t)size + 1;
+    }
+    ssize_t n = recv(c->fd, c->buf, (size_t)size, 0);
+    if (n <= 0)
+        return -1;
+    if (c->buf[n - 1] == '\n')
+        n--;
+    c->buf[n] = '\0';
+    *msg = c->buf;
+    return (long)n;
+}
+
+void chat_local_close(chat_local_t *c) {
+    if (!c)
+        return;
+    close(c->fd);
+    free(c->buf);
+    free(c);
+}
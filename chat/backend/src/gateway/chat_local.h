@@ -0,0 +1,65 @@
+#ifndef CHAT_LOCAL_H
+#define CHAT_LOCAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Cliente de la entrada local del servidor (local_gateway.h), para bots y
+ * servicios en la misma máquina. Se compila como libchatlocal.a y solo
+ * depende de libc.
+ *
+ * Cada mensaje es un datagrama con el mismo JSON que chat-protocol; el
+ * servidor lo pasa directo al pool de hilos. Ejemplo:
+ *
+ *   chat_local_t *c = chat_local_connect("chat_server.sock");
+ *   chat_local_register(c, "alertas");
+ *   chat_local_subscribe(c, "presence.#");
+ *   const char *msg;
+ *   while (chat_local_recv(c, &msg, -1) > 0)
+ *       ...
+ *   chat_local_close(c);
+ *
+ * Un mensaje viaja en un solo datagrama, así que su tamaño está limitado en
+ * ambos sentidos por SO_SNDBUF del que envía, que el kernel recorta a
+ * net.core.wmem_max y luego duplica: con el valor por defecto de Linux
+ * (212992) el límite real es de unos 416 KB y no MAX_MESSAGE_SIZE. chat_local_send
+ * rechaza lo que no cabe con EMSGSIZE, y el servidor descarta (y cuenta en
+ * sus métricas) los mensajes para el bot que no caben, incluidos los lotes
+ * de broadcasts agrupados, que pueden pasar de MAX_MESSAGE_SIZE. Para
+ * mensajes grandes hay que subir net.core.wmem_max.
+ *
+ * Un chat_local_t no se comparte entre hilos sin un lock propio.
+ */
+
+typedef struct chat_local chat_local_t;
+
+// Conecta al socket en 'path'. NULL si falló (errno indica por qué).
+chat_local_t *chat_local_connect(const char *path);
+
+// Descriptor de la conexión, para esperar con poll() junto a otros.
+int chat_local_fd(const chat_local_t *c);
+
+// Mensaje más largo que se puede enviar por esta conexión.
+size_t chat_local_max_message(const chat_local_t *c);
+
+// Envía un mensaje JSON ya armado. Bloquea si el socket está lleno; falla
+// con EMSGSIZE si pasa de chat_local_max_message.
+bool chat_local_send(chat_local_t *c, const char *json, size_t len);
+
+// Arman y envían los mensajes más comunes. register guarda el nombre, que
+// va como "sender" en los demás.
+bool chat_local_register(chat_local_t *c, const char *username);
+bool chat_local_subscribe(chat_local_t *c, const char *pattern);
+bool chat_local_broadcast(chat_local_t *c, const char *content);
+bool chat_local_private(chat_local_t *c, const char *target, const char *content);
+
+// Espera el próximo mensaje hasta timeout_ms (-1: sin límite). Retorna su
+// largo con *msg en un buffer interno terminado en '\0' (sin el '\n' final)
+// que vale hasta la próxima llamada; 0 si venció el plazo, -1 si se cerró
+// la conexión o hubo un error.
+long chat_local_recv(chat_local_t *c, const char **msg, int timeout_ms);
+
+void chat_local_close(chat_local_t *c);
+
+#endif
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE     // accept4
+#include "local_gateway.h"
+#include "logger.h"
+#include "metrics.h"
+#include "config.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+static int listen_fd = -1;
+static char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+static size_t send_limit = MAX_MESSAGE_SIZE;    // Datagrama más grande que se puede enviar
+
+/* Adopta 'fd' en el vhost como descriptor crudo con el protocolo local */
+static struct lws *adopt(struct lws_vhost *vhost, int fd) {
+    lws_sock_file_fd_type desc;
+    desc.filefd = fd;
+    return lws_adopt_descriptor_vhost(vhost, LWS_ADOPT_RAW_FILE_DESC, desc,
+                                      LOCAL_GATEWAY_NAME, NULL);
+}
+
+bool local_gateway_start(struct lws_context *context, const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        log_error("Ruta demasiado larga para el socket local: %s", path);
+        return false;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        log_error("No se pudo crear el socket local: %s", strerror(errno));
+        return false;
+    }
+    // Un socket de una ejecución anterior impide el bind
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        chmod(path, LOCAL_GATEWAY_MODE) < 0 ||
+        listen(fd, LOCAL_GATEWAY_BACKLOG) < 0) {
+        log_error("No se pudo escuchar en %s: %s", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    listen_fd = fd;
+    snprintf(socket_path, sizeof(socket_path), "%s", path);
+
+    struct lws_vhost *vhost = lws_get_vhost_by_name(context, "default");
+    if (!vhost || !adopt(vhost, fd)) {
+        log_error("No se pudo adoptar el socket local en libwebsockets");
+        listen_fd = -1;
+        close(fd);
+        unlink(path);
+        socket_path[0] = '\0';
+        return false;
+    }
+    log_info("Entrada local en %s", path);
+    return true;
+}
+
+void local_gateway_stop(void) {
+    // lws cierra los descriptores adoptados al destruir el contexto
+    if (socket_path[0])
+        unlink(socket_path);
+    socket_path[0] = '\0';
+    listen_fd = -1;
+}
+
+bool local_gateway_listener(struct lws *wsi) {
+    return listen_fd >= 0 && lws_get_socket_fd(wsi) == listen_fd;
+}
+
+void local_gateway_accept(struct lws *listener) {
+    while (true) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                log_error("Error al aceptar una conexión local: %s", strerror(errno));
+            if (errno != EINTR)
+                return;
+            continue;
+        }
+        // Un datagrama tiene que caber entero en el buffer de envío; el kernel
+        // lo recorta a net.core.wmem_max sin avisar, así que se lee el que quedó
+        int sndbuf = MAX_MESSAGE_SIZE + LOCAL_GATEWAY_DGRAM_OVERHEAD;
+        socklen_t optlen = sizeof(sndbuf);
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) < 0 ||
+            getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &optlen) < 0) {
+            log_error("No se pudo ajustar el buffer de una conexión local: %s", strerror(errno));
+            close(fd);
+            continue;
+        }
+        size_t limit = sndbuf > LOCAL_GATEWAY_DGRAM_OVERHEAD ?
+                       (size_t)(sndbuf - LOCAL_GATEWAY_DGRAM_OVERHEAD) : 0;
+        if (limit < MAX_MESSAGE_SIZE && limit != send_limit)
+            log_error("Entrada local: los mensajes de más de %zu bytes no se entregan "
+                      "(subir net.core.wmem_max)", limit);
+        send_limit = limit;
+        if (!adopt(lws_get_vhost(listener), fd)) {
+            log_error("No se pudo adoptar una conexión local");
+            close(fd);
+        }
+    }
+}
+
+int local_gateway_recv(struct lws *wsi, rx_buffer_t **out) {
+    int fd = lws_get_socket_fd(wsi);
+    *out = NULL;
+    // Largo del próximo datagrama sin sacarlo de la cola
+    ssize_t size = recv(fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    if (size < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    if (size == 0)
+        return -1;  // SEQPACKET: fin de la conexión (no se aceptan mensajes vacíos)
+
+    if (size > MAX_MESSAGE_SIZE) {
+        char discard;
+        recv(fd, &discard, 1, 0);   // Saca el datagrama entero
+        log_error("Mensaje local de %zd bytes descartado", size);
+        metrics_count_oversized();
+        return 1;
+    }
+    rx_buffer_t *rx = rx_buffer_create((size_t)size);
+    if (!rx) {
+        char discard;
+        recv(fd, &discard, 1, 0);
+        log_error("Error al asignar memoria para un mensaje local");
+        return 0;
+    }
+    ssize_t n = recv(fd, rx->data, (size_t)size, 0);
+    if (n != size) {
+        rx_buffer_release(rx);
+        return n < 0 && (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    rx->len = (size_t)n;
+    rx->data[n] = '\0';
+    *out = rx;
+    return 1;
+}
+
+int local_gateway_send(struct lws *wsi, frame_t *frame) {
+    if (frame->len > send_limit) {
+        log_error("Mensaje de %zu bytes no cabe en un datagrama local; descartado", frame->len);
+        metrics_count_oversized();
+        return -2;
+    }
+    ssize_t n = send(lws_get_socket_fd(wsi), frame_payload(frame), frame->len,
+                     MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        if (errno == EMSGSIZE) {
+            // No entra nunca: reintentarlo trabaría la cola
+            log_error("Mensaje de %zu bytes no cabe en un datagrama local; descartado", frame->len);
+            metrics_count_oversized();
+            return -2;
+        }
+        log_error("Error al enviar a una conexión local: %s", strerror(errno));
+        return -1;
+    }
+    return (int)n;
+}
@@ -0,0 +1,62 @@
+#ifndef LOCAL_GATEWAY_H
+#define LOCAL_GATEWAY_H
+
+#include <libwebsockets.h>
+#include <stdbool.h>
+#include "frame.h"
+#include "rx_buffer.h"
+
+/**
+ * Entrada local para servicios en la misma máquina (bots de moderación,
+ * alertas, etc.).
+ *
+ * Un socket Unix SOCK_SEQPACKET en LOCAL_GATEWAY_PATH: cada datagrama es un
+ * mensaje entero del mismo JSON que chat-protocol, sin handshake HTTP,
+ * encabezados WebSocket, máscara ni fragmentación. El socket y cada conexión
+ * se adoptan en el contexto de lws como descriptores crudos, así que una
+ * conexión local es un wsi más: se registra, se suscribe a tópicos y recibe
+ * sus mensajes por la misma cola que un cliente WebSocket, y lo que envía
+ * va directo al pool de hilos. No pasa por el límite de frecuencia: quien
+ * puede abrir el socket ya está en la máquina.
+ *
+ * Lado cliente: chat_local.h (libchatlocal.a).
+ */
+
+#define LOCAL_GATEWAY_NAME "chat-local"
+#define LOCAL_GATEWAY_ID 2      // lws_protocols.id de la entrada local
+
+/* true si el wsi es una conexión (o el socket de escucha) de la entrada local */
+static inline bool local_gateway_wsi(struct lws *wsi) {
+    const struct lws_protocols *protocol = lws_get_protocol(wsi);
+    return protocol && protocol->id == LOCAL_GATEWAY_ID;
+}
+
+// Crea el socket en 'path' y lo adopta en el vhost por defecto, que debe
+// tener el protocolo LOCAL_GATEWAY_NAME. Retorna false si no se pudo.
+bool local_gateway_start(struct lws_context *context, const char *path);
+
+// Borra el socket del sistema de archivos (después de lws_context_destroy).
+void local_gateway_stop(void);
+
+// true si el wsi es el socket de escucha y no una conexión.
+bool local_gateway_listener(struct lws *wsi);
+
+// Hilo de servicio, en LWS_CALLBACK_RAW_RX_FILE del socket de escucha:
+// acepta y adopta las conexiones pendientes.
+void local_gateway_accept(struct lws *listener);
+
+// Hilo de servicio, en LWS_CALLBACK_RAW_RX_FILE de una conexión: lee el
+// próximo datagrama. Retorna 1 con *out (refcount = 1) o con *out NULL si
+// superaba MAX_MESSAGE_SIZE y se descartó, 0 si no hay más por ahora y -1
+// si la conexión se cerró.
+int local_gateway_recv(struct lws *wsi, rx_buffer_t **out);
+
+// Hilo de servicio: envía el frame entero como un datagrama. Retorna los
+// bytes enviados, 0 si el socket está lleno (reintentar cuando se pueda
+// escribir), -2 si el frame no cabe en un datagrama y se descartó (el límite
+// es SO_SNDBUF, que el kernel recorta a net.core.wmem_max; un lote de
+// broadcast_batch puede pasar de MAX_MESSAGE_SIZE) o -1 por error, tras el
+// cual hay que cerrar la conexión.
+int local_gateway_send(struct lws *wsi, frame_t *frame);
+
+#endif
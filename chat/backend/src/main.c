@@ -3,58 +3,301 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <signal.h>
 #include "config.h"
 #include "utils/logger.h"
 #include "utils/time_utils.h"
 #include "users/user_manager.h"
 #include "connections/connection_manager.h"
 #include "thread_manager.h"
+#include "rooms/room_manager.h"
+#include "pubsub/topic_router.h"
+#include "persistence/snapshot.h"
+#include "metrics/metrics.h"
+#include "metrics/trace.h"
+#include "capture/capture.h"
+#include "connections/rate_limit.h"
+#include "connections/delivery_ack.h"
+#include "connections/rx_buffer.h"
+#include "connections/binproto.h"
+#include "connections/deflate.h"
+#include "connections/broadcast_batch.h"
+#include "gateway/local_gateway.h"
+#include "utils/json_arena.h"
 #include <cjson/cJSON.h>  // Asegúrate de tener cJSON instalada
 
+// Se activa con SIGINT/SIGTERM para salir del loop y dejar un snapshot final
+static volatile sig_atomic_t interrupted = 0;
+
+static void handle_signal(int sig)
+{
+    (void)sig;
+    interrupted = 1;
+}
+
+// Datos por conexión; las conexiones HTTP (GET /metrics) llegan al primer protocolo
+typedef struct {
+    metrics_http_t metrics;
+    capture_conn_t capture_conn;    // Id en la captura de tráfico (0 si está apagada)
+    rate_limit_t limit;             // Token buckets de la conexión
+    struct lws *wsi;
+    lws_sorted_usec_list_t idle_sul;    // Vence INACTIVITY_TIMEOUT después del último mensaje
+    uint64_t last_rx_ns;
+    bool idle;                          // Ya se marcó INACTIVO; el próximo mensaje rearma el timer
+    rx_buffer_t *partial;               // Mensaje en reensamblado (NULL entre mensajes)
+    uint64_t first_rx_ns;               // Llegada de su primer fragmento, para la traza
+    bool discarding;                    // Superó MAX_MESSAGE_SIZE: se ignora hasta el fragmento final
+} per_session_data_t;
+
+#define INACTIVITY_NS ((uint64_t)INACTIVITY_TIMEOUT * 1000000000ULL)
+
+/* Ping/pong de libwebsockets: detecta conexiones muertas sin esperar a que
+   falle una escritura; al cortarse, la sesión sigue el camino de CLOSED. */
+static const lws_retry_bo_t liveness_policy = {
+    .secs_since_valid_ping = LIVENESS_PING_SECS,
+    .secs_since_valid_hangup = LIVENESS_HANGUP_SECS,
+};
+
+/* Timer de inactividad por conexión. No se reprograma en cada mensaje: al
+   vencer mira last_rx_ns y, si hubo tráfico, se arma por el tiempo restante. */
+static void idle_timeout_cb(lws_sorted_usec_list_t *sul)
+{
+    per_session_data_t *pss = lws_container_of(sul, per_session_data_t, idle_sul);
+    uint64_t idle_ns = monotonic_ns() - pss->last_rx_ns;
+    if (idle_ns < INACTIVITY_NS) {
+        lws_sul_schedule(lws_get_context(pss->wsi), 0, &pss->idle_sul, idle_timeout_cb,
+                         (lws_usec_t)((INACTIVITY_NS - idle_ns) / 1000));
+        return;
+    }
+    pss->idle = true;
+    char *username = get_client_username(pss->wsi);
+    if (username) {
+        if (change_user_status(username, "INACTIVO")) {
+            log_info("Usuario %s inactivo por %d segundos, cambiando estado a INACTIVO",
+                     username, INACTIVITY_TIMEOUT);
+            publish_presence(username, "INACTIVO");
+        }
+        free(username);
+    }
+}
+
+// Aviso al cliente cuando se le descartan mensajes por el límite de frecuencia
+static const char RATE_LIMIT_NOTICE[] =
+    "{\"type\":\"error\",\"sender\":\"server\","
+    "\"content\":\"Demasiados mensajes; algunos fueron descartados\"}";
+
+static const char OVERSIZED_NOTICE[] =
+    "{\"type\":\"error\",\"sender\":\"server\","
+    "\"content\":\"Mensaje demasiado grande; fue descartado\"}";
+
+/* Agrega un fragmento al mensaje en curso. lws entrega un mensaje en varios
+   RECEIVE si viene fragmentado o si no cabe en rx_buffer_size; el buffer
+   crece hasta MAX_MESSAGE_SIZE y lo que pase de ahí se descarta entero. */
+static void append_fragment(per_session_data_t *pss, const void *in, size_t len)
+{
+    if (pss->discarding)
+        return;
+    if (!pss->partial)
+        pss->partial = rx_buffer_create(len);
+    if (pss->partial && pss->partial->len + len <= MAX_MESSAGE_SIZE &&
+        rx_buffer_append(&pss->partial, in, len))
+        return;
+    if (pss->partial) {
+        log_error("Mensaje de más de %d bytes descartado", MAX_MESSAGE_SIZE);
+        metrics_count_oversized();
+        enqueue_pending_message(pss->wsi, OVERSIZED_NOTICE, sizeof(OVERSIZED_NOTICE) - 1);
+    } else {
+        log_error("Error al asignar memoria para el mensaje recibido");
+    }
+    rx_buffer_release(pss->partial);
+    pss->partial = NULL;
+    pss->discarding = true;
+}
+
+/* Inicio de una sesión de chat, por WebSocket o por la entrada local */
+static void open_session(per_session_data_t *pss, struct lws *wsi)
+{
+    pss->capture_conn = capture_open();
+    rate_limit_init(&pss->limit, monotonic_ns());
+    pss->wsi = wsi;
+    pss->last_rx_ns = monotonic_ns();
+    lws_sul_schedule(lws_get_context(wsi), 0, &pss->idle_sul, idle_timeout_cb,
+                     (lws_usec_t)INACTIVITY_TIMEOUT * LWS_US_PER_SEC);
+}
+
+/* Registra actividad para el timer de inactividad */
+static void note_activity(per_session_data_t *pss, struct lws *wsi, uint64_t now)
+{
+    pss->last_rx_ns = now;
+    if (pss->idle) {
+        // update_user_activity lo vuelve a ACTIVO al procesarlo
+        pss->idle = false;
+        lws_sul_schedule(lws_get_context(wsi), 0, &pss->idle_sul, idle_timeout_cb,
+                         (lws_usec_t)INACTIVITY_TIMEOUT * LWS_US_PER_SEC);
+    }
+}
+
+/* La captura guarda JSON para que chat_replay la reproduzca igual: un
+   mensaje binario se traduce, solo mientras se está capturando */
+static void capture_message(per_session_data_t *pss, const rx_buffer_t *rx)
+{
+    if (!pss->capture_conn)
+        return;
+    if (!rx->binary) {
+        capture_frame(pss->capture_conn, rx->data, rx->len);
+        return;
+    }
+    bin_msg_t msg;
+    size_t len;
+    char *json = bin_decode(rx->data, rx->len, &msg) ? bin_json_text(&msg, &len) : NULL;
+    if (json) {
+        capture_frame(pss->capture_conn, json, len);
+        free(json);
+    }
+}
+
+/* Datagramas de una conexión local: cada uno es un mensaje entero y va
+   directo al pool, sin límite de frecuencia */
+static int receive_local(per_session_data_t *pss, struct lws *wsi)
+{
+    for (int i = 0; i < LOCAL_GATEWAY_RX_BATCH; i++) {
+        rx_buffer_t *rx;
+        int n = local_gateway_recv(wsi, &rx);
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        if (!rx) {
+            enqueue_pending_message(wsi, OVERSIZED_NOTICE, sizeof(OVERSIZED_NOTICE) - 1);
+            continue;
+        }
+        uint64_t now = monotonic_ns();
+        note_activity(pss, wsi, now);
+        capture_message(pss, rx);
+        dispatch_message(wsi, rx, now);
+    }
+    // Lo que quede se lee en la próxima vuelta del loop
+    return 0;
+}
+
 static int callback_chat(struct lws *wsi,
                          enum lws_callback_reasons reason,
                          void *user, void *in, size_t len)
 {
+    per_session_data_t *pss = (per_session_data_t *)user;
+
     switch (reason)
     {
+        case LWS_CALLBACK_HTTP:
+        case LWS_CALLBACK_HTTP_WRITEABLE:
+        case LWS_CALLBACK_CLOSED_HTTP:
+            // Endpoint de métricas en el mismo contexto que chat-protocol
+            return metrics_http_callback(wsi, reason, pss ? &pss->metrics : NULL, in, len);
+
         case LWS_CALLBACK_ESTABLISHED:
+            // El protocolo local no se negocia por WebSocket
+            if (local_gateway_wsi(wsi))
+                return -1;
             log_info("Nuevo cliente conectado");
+            open_session(pss, wsi);
+            deflate_configure(wsi);
+            break;
+
+        case LWS_CALLBACK_RAW_ADOPT_FILE:
+            if (!local_gateway_listener(wsi)) {
+                log_info("Nuevo cliente local conectado");
+                open_session(pss, wsi);
+            }
             break;
 
-        case LWS_CALLBACK_RECEIVE:
-            // Encolar el mensaje para que lo procese el pool de hilos
-            dispatch_message(wsi, (const char *)in, len);
+        case LWS_CALLBACK_RAW_RX_FILE:
+            if (local_gateway_listener(wsi)) {
+                local_gateway_accept(wsi);
+                break;
+            }
+            return receive_local(pss, wsi);
+
+        case LWS_CALLBACK_RECEIVE: {
+            uint64_t now = monotonic_ns();
+            note_activity(pss, wsi, now);
+            if (!pss->partial && !pss->discarding)
+                pss->first_rx_ns = now;
+            append_fragment(pss, in, len);
+            // Final del mensaje: último fragmento y sin bytes pendientes del frame
+            if (!lws_is_final_fragment(wsi))
+                break;
+            pss->discarding = false;
+            rx_buffer_t *rx = pss->partial;
+            pss->partial = NULL;
+            if (!rx)
+                break;
+            rx->binary = binproto_wsi(wsi);
+            capture_message(pss, rx);
+            // El límite se aplica aquí para que lo descartado no llegue a la cola
+            metric_msg_type_t type;
+            if (rx->binary) {
+                const char *name = bin_peek_type(rx->data, rx->len);
+                type = name ? metrics_msg_type(name) : METRIC_MSG_OTHER;
+            } else {
+                type = rate_limit_msg_type(rx->data, rx->len);
+            }
+            if (!rate_limit_allow(&pss->limit, type, now)) {
+                metrics_count_rate_limited(type);
+                if (rate_limit_should_notify(&pss->limit, now))
+                    enqueue_pending_message(wsi, RATE_LIMIT_NOTICE, sizeof(RATE_LIMIT_NOTICE) - 1);
+                rx_buffer_release(rx);
+                break;
+            }
+            // Encolar el mensaje para que lo procese el pool de hilos; el
+            // worker lo lee desde este buffer, sin otra copia
+            dispatch_message(wsi, rx, pss->first_rx_ns);
             break;
+        }
 
         case LWS_CALLBACK_SERVER_WRITEABLE:
+        case LWS_CALLBACK_RAW_WRITEABLE_FILE:
             // Envía los mensajes pendientes para este wsi
-            write_pending_messages(wsi);
+            if (write_pending_messages(wsi) < 0)
+                return -1;
             break;
 
+        case LWS_CALLBACK_RAW_CLOSE_FILE:
+            if (local_gateway_listener(wsi))
+                break;
+            // Un servicio local no reanuda sesiones: sin esto, su nombre quedaría
+            // tomado durante RESUME_GRACE y no podría volver a registrarse
+            revoke_resume_token(wsi);
+            // fall through
         case LWS_CALLBACK_CLOSED:
             log_info("Cliente desconectado");
+            lws_sul_cancel(&pss->idle_sul);
+            rx_buffer_release(pss->partial);
+            pss->partial = NULL;
+            capture_close(pss->capture_conn);
+            // Caída sin "disconnect": la sesión queda guardada para reanudarse
+            if (park_client(wsi))
+                break;
             // Antes de remover el cliente, obtenemos el nombre de usuario
             {
-                client_node_t *client = get_all_clients(); // O usa una función para obtener el cliente asociado a 'wsi'
-                if (client && client->username) {
-                    remove_user(client->username); // Elimina el usuario
+                char *username = get_client_username(wsi);
+                if (username) {
+                    remove_user(username); // Elimina el usuario
+                    publish_presence(username, "DESCONECTADO");
+                    free(username);
                 }
             }
+            leave_all_rooms(get_client_session(wsi)); // Sale de sus salas
+            unsubscribe_all_topics(get_client_session(wsi)); // Cancela sus suscripciones
             remove_client(wsi); // Elimina la conexión
             break;
 
         // -------------- NUEVO: --------------
-        case LWS_CALLBACK_EVENT_WAIT_CANCELLED: {
-            // Recorres tu lista de wsi y llamas lws_callback_on_writable() para los que tengan pendientes
-            client_node_t *cur = get_all_clients();
-            while (cur) {
-                if (cur->pending_head != NULL) {
-                    lws_callback_on_writable(cur->wsi);
-                }
-                cur = cur->next;
-            }
+        case LWS_CALLBACK_EVENT_WAIT_CANCELLED:
+            // Pide escritura para los wsi que tengan mensajes pendientes
+            request_pending_writes();
+            broadcast_batch_service();
             break;
-        }        
+
         default:
             break;
     }
@@ -66,46 +309,112 @@ static struct lws_protocols protocols[] = {
     {
         "chat-protocol",
         callback_chat,
-        0,
+        sizeof(per_session_data_t),
         1024,
     },
+    {
+        // Mismos mensajes en binario (ver binproto.h); el cliente lo elige en el handshake
+        BINPROTO_NAME,
+        callback_chat,
+        sizeof(per_session_data_t),
+        1024,
+        BINPROTO_ID,
+        NULL,
+        0,
+    },
+    {
+        // Conexiones de la entrada local (ver local_gateway.h); no se ofrece por WebSocket
+        LOCAL_GATEWAY_NAME,
+        callback_chat,
+        sizeof(per_session_data_t),
+        0,
+        LOCAL_GATEWAY_ID,
+        NULL,
+        0,
+    },
     { NULL, NULL, 0, 0 }
 };
 
 int main(int argc, char *argv[])
 {
     int port = SERVER_PORT; // valor por defecto definido en config.h
+    logger_init();
+    // Antes de cualquier uso de cJSON y de crear hilos
+    json_arena_install();
     if (argc > 1) {
         port = atoi(argv[1]);
         if (port <= 0) {
-            fprintf(stderr, "Puerto inválido: %s\n", argv[1]);
+            log_error("Puerto inválido: %s", argv[1]);
+            logger_shutdown();
             return -1;
         }
     } else {
         log_info("No se especificó puerto, usando puerto por defecto: %d", port);
     }
+    // Segundo argumento opcional: archivo donde capturar el tráfico entrante
+    // ("" para no capturar y pasar el tercero)
+    if (argc > 2 && argv[2][0] && !capture_start(argv[2])) {
+        logger_shutdown();
+        return -1;
+    }
+    // Tercero: archivo de la traza por etapas de TRACE_SAMPLE_RATE de los mensajes
+    if (argc > 3 && !trace_start(argv[3], TRACE_SAMPLE_RATE)) {
+        capture_stop();
+        logger_shutdown();
+        return -1;
+    }
 
     struct lws_context_creation_info info;
     memset(&info, 0, sizeof(info));
     info.port = port;
     info.protocols = protocols;
+    info.retry_and_idle_policy = &liveness_policy;
+    info.ka_time = TCP_KEEPALIVE_SECS;
+    info.ka_probes = 3;
+    info.ka_interval = 10;
+    if (DEFLATE_ENABLED)
+        info.extensions = deflate_extensions;
 
     struct lws_context *context = lws_create_context(&info);
     if (context == NULL) {
         log_error("Error al iniciar libwebsockets");
+        trace_stop();
+        capture_stop();
+        logger_shutdown();
         return -1;
     }
     log_info("Servidor iniciado en el puerto %d", port);
+    set_service_context(context);
+    delivery_ack_init(context);
+    broadcast_batch_init(context);
+    // Sin la entrada local el servidor sigue funcionando por WebSocket
+    if (LOCAL_GATEWAY_ENABLED)
+        local_gateway_start(context, LOCAL_GATEWAY_PATH);
+
+    // Restaurar usuarios y colas del reinicio anterior, si hay snapshot
+    load_snapshot(SNAPSHOT_PATH);
 
     // Iniciar el pool de hilos (ejemplo: 4 hilos)
     init_thread_pool(4);
+    init_snapshot_writer(SNAPSHOT_PATH, SNAPSHOT_INTERVAL);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
 
     // Loop principal del servicio de libwebsockets
-    while (1) {
+    while (!interrupted) {
         lws_service(context, 50);
     }
 
+    log_info("Apagando servidor");
     shutdown_thread_pool();
+    broadcast_batch_shutdown();     // Lo agrupado entra en las colas antes del snapshot final
+    shutdown_snapshot_writer();
+    delivery_ack_shutdown();
     lws_context_destroy(context);
+    local_gateway_stop();
+    capture_stop();     // Después de destroy, para incluir los cierres de conexión
+    trace_stop();
+    logger_shutdown();
     return 0;
 }
@@ -0,0 +1,444 @@
+#include "metrics.h"
+#include "histogram.h"
+#include "logger.h"
+#include "user_manager.h"
+#include "connection_manager.h"
+#include "thread_manager.h"
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#define METRICS_HTTP_CHUNK 16384
+
+// Contadores de un hilo; solo ese hilo los escribe
+typedef struct metrics_shard {
+    _Atomic uint64_t messages[METRIC_MSG_COUNT];
+    _Atomic uint64_t rate_limited[METRIC_MSG_COUNT];
+    _Atomic uint64_t oversized;
+    histogram_t stages[METRIC_STAGE_COUNT];
+    struct metrics_shard *next;
+} metrics_shard_t;
+
+static __thread metrics_shard_t *thread_shard = NULL;
+
+// Los shards nunca se liberan: sus contadores siguen siendo parte del total
+static metrics_shard_t *shards = NULL;
+static pthread_mutex_t shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *msg_type_names[METRIC_MSG_COUNT] = {
+    [METRIC_MSG_REGISTER]      = "register",
+    [METRIC_MSG_BROADCAST]     = "broadcast",
+    [METRIC_MSG_PRIVATE]       = "private",
+    [METRIC_MSG_LIST_USERS]    = "list_users",
+    [METRIC_MSG_USER_INFO]     = "user_info",
+    [METRIC_MSG_CHANGE_STATUS] = "change_status",
+    [METRIC_MSG_DISCONNECT]    = "disconnect",
+    [METRIC_MSG_JOIN_ROOM]     = "join_room",
+    [METRIC_MSG_LEAVE_ROOM]    = "leave_room",
+    [METRIC_MSG_ROOM_MESSAGE]  = "room_message",
+    [METRIC_MSG_LIST_ROOMS]    = "list_rooms",
+    [METRIC_MSG_SUBSCRIBE]     = "subscribe",
+    [METRIC_MSG_UNSUBSCRIBE]   = "unsubscribe",
+    [METRIC_MSG_MULTICAST]     = "multicast",
+    [METRIC_MSG_SEARCH_USERS]  = "search_users",
+    [METRIC_MSG_OTHER]         = "other",
+};
+
+static const char *stage_names[METRIC_STAGE_COUNT] = {
+    [METRIC_STAGE_RECEIVE_DISPATCH] = "receive_dispatch",
+    [METRIC_STAGE_DISPATCH_PROCESS] = "dispatch_process",
+    [METRIC_STAGE_PROCESS_WRITTEN]  = "process_written",
+};
+
+// Límites "le" exportados (en segundos); se derivan de los buckets HDR
+static const double latency_bounds[] = {
+    0.000001, 0.0000025, 0.000005, 0.00001, 0.000025, 0.00005, 0.0001,
+    0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+    0.25, 0.5, 1.0, 2.5, 5.0, 10.0,
+};
+
+static metrics_shard_t *get_thread_shard(void) {
+    if (thread_shard)
+        return thread_shard;
+    metrics_shard_t *shard = calloc(1, sizeof(metrics_shard_t));
+    if (!shard)
+        return NULL;
+    pthread_mutex_lock(&shards_mutex);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&shards_mutex);
+    thread_shard = shard;
+    return shard;
+}
+
+metric_msg_type_t metrics_msg_type(const char *type) {
+    for (int i = 0; i < METRIC_MSG_OTHER; i++) {
+        if (strcmp(msg_type_names[i], type) == 0)
+            return (metric_msg_type_t)i;
+    }
+    return METRIC_MSG_OTHER;
+}
+
+const char *metrics_msg_type_name(metric_msg_type_t type) {
+    return type < METRIC_MSG_COUNT ? msg_type_names[type] : msg_type_names[METRIC_MSG_OTHER];
+}
+
+// Un solo escritor por shard: load + store relajados, sin lock xadd
+static void shard_increment(_Atomic uint64_t *counter) {
+    uint64_t v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + 1, memory_order_relaxed);
+}
+
+void metrics_count_message(metric_msg_type_t type) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (!shard || type >= METRIC_MSG_COUNT)
+        return;
+    shard_increment(&shard->messages[type]);
+}
+
+void metrics_count_rate_limited(metric_msg_type_t type) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (!shard || type >= METRIC_MSG_COUNT)
+        return;
+    shard_increment(&shard->rate_limited[type]);
+}
+
+void metrics_count_oversized(void) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (!shard)
+        return;
+    shard_increment(&shard->oversized);
+}
+
+void metrics_record_latency(metric_stage_t stage, uint64_t ns) {
+    metrics_shard_t *shard = get_thread_shard();
+    if (!shard || stage >= METRIC_STAGE_COUNT)
+        return;
+    histogram_record(&shard->stages[stage], ns);
+}
+
+/* ---------- Render ---------- */
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} text_buf_t;
+
+static void buf_printf(text_buf_t *b, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static void buf_printf(text_buf_t *b, const char *fmt, ...) {
+    if (b->failed)
+        return;
+    while (true) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            b->failed = true;
+            return;
+        }
+        if ((size_t)n < b->cap - b->len) {
+            b->len += (size_t)n;
+            return;
+        }
+        size_t new_cap = b->cap * 2 + (size_t)n;
+        char *grown = realloc(b->data, new_cap);
+        if (!grown) {
+            b->failed = true;
+            return;
+        }
+        b->data = grown;
+        b->cap = new_cap;
+    }
+}
+
+/* Las colas y bytes por cliente se exportan como distribución sobre los
+   clientes conectados y no como una serie por usuario: /metrics no pide
+   autenticación, y una serie por nombre crecería con cada usuario nuevo */
+static const uint64_t pending_bounds[] = { 0, 1, 10, 100, 1000, 10000 };
+static const uint64_t bytes_bounds[] = {
+    1ULL << 10, 1ULL << 16, 1ULL << 20, 1ULL << 24, 1ULL << 28, 1ULL << 32,
+};
+#define CLIENT_BOUNDS (sizeof(pending_bounds) / sizeof(pending_bounds[0]))
+
+typedef struct {
+    uint64_t buckets[CLIENT_BOUNDS];   // Clientes con valor <= límite (no acumulado)
+    uint64_t sum;
+    uint64_t max;
+} client_dist_t;
+
+typedef struct {
+    client_dist_t pending;
+    client_dist_t bytes;
+} client_stats_t;
+
+static void dist_add(client_dist_t *d, const uint64_t *bounds, uint64_t value) {
+    for (size_t i = 0; i < CLIENT_BOUNDS; i++) {
+        if (value <= bounds[i]) {
+            d->buckets[i]++;
+            break;
+        }
+    }
+    d->sum += value;
+    if (value > d->max)
+        d->max = value;
+}
+
+static void collect_client(const char *username, uint64_t bytes_out,
+                           size_t pending_msgs, void *ctx) {
+    client_stats_t *stats = ctx;
+    (void)username;
+    dist_add(&stats->pending, pending_bounds, pending_msgs);
+    dist_add(&stats->bytes, bytes_bounds, bytes_out);
+}
+
+/* Tres familias gauge: clientes con valor <= cada límite, suma y máximo */
+static void render_client_dist(text_buf_t *b, const char *name, const char *what,
+                               const client_dist_t *d, const uint64_t *bounds, size_t clients) {
+    buf_printf(b, "# HELP %s_clients Clientes conectados con hasta 'le' %s.\n", name, what);
+    buf_printf(b, "# TYPE %s_clients gauge\n", name);
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < CLIENT_BOUNDS; i++) {
+        cumulative += d->buckets[i];
+        buf_printf(b, "%s_clients{le=\"%llu\"} %llu\n", name,
+                   (unsigned long long)bounds[i], (unsigned long long)cumulative);
+    }
+    buf_printf(b, "%s_clients{le=\"+Inf\"} %zu\n", name, clients);
+    buf_printf(b, "# HELP %s_sum Suma de %s de los clientes conectados.\n", name, what);
+    buf_printf(b, "# TYPE %s_sum gauge\n", name);
+    buf_printf(b, "%s_sum %llu\n", name, (unsigned long long)d->sum);
+    buf_printf(b, "# HELP %s_max Máximo de %s entre los clientes conectados.\n", name, what);
+    buf_printf(b, "# TYPE %s_max gauge\n", name);
+    buf_printf(b, "%s_max %llu\n", name, (unsigned long long)d->max);
+}
+
+static void render_histogram(text_buf_t *b, const char *stage, const histogram_t *h) {
+    size_t bucket = 0;
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < sizeof(latency_bounds) / sizeof(latency_bounds[0]); i++) {
+        uint64_t bound_ns = (uint64_t)(latency_bounds[i] * 1e9);
+        while (bucket < HIST_BUCKETS && histogram_bucket_upper(bucket) <= bound_ns) {
+            cumulative += atomic_load_explicit(&h->counts[bucket], memory_order_relaxed);
+            bucket++;
+        }
+        buf_printf(b, "chat_stage_latency_seconds_bucket{stage=\"%s\",le=\"%g\"} %llu\n",
+                   stage, latency_bounds[i], (unsigned long long)cumulative);
+    }
+    uint64_t total = atomic_load_explicit(&h->total, memory_order_relaxed);
+    buf_printf(b, "chat_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+               stage, (unsigned long long)total);
+    buf_printf(b, "chat_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n",
+               stage, (double)atomic_load_explicit(&h->sum, memory_order_relaxed) / 1e9);
+    buf_printf(b, "chat_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+               stage, (unsigned long long)total);
+}
+
+size_t metrics_render(char **out) {
+    text_buf_t b = { malloc(8192), 0, 8192, false };
+    if (!b.data) {
+        *out = NULL;
+        return 0;
+    }
+
+    // Agregar los shards de todos los hilos
+    uint64_t messages[METRIC_MSG_COUNT] = { 0 };
+    uint64_t rate_limited[METRIC_MSG_COUNT] = { 0 };
+    uint64_t oversized = 0;
+    histogram_t *stages = calloc(METRIC_STAGE_COUNT, sizeof(histogram_t));
+    pthread_mutex_lock(&shards_mutex);
+    for (metrics_shard_t *s = shards; s; s = s->next) {
+        for (int i = 0; i < METRIC_MSG_COUNT; i++)
+            messages[i] += atomic_load_explicit(&s->messages[i], memory_order_relaxed);
+        for (int i = 0; i < METRIC_MSG_COUNT; i++)
+            rate_limited[i] += atomic_load_explicit(&s->rate_limited[i], memory_order_relaxed);
+        oversized += atomic_load_explicit(&s->oversized, memory_order_relaxed);
+        for (int i = 0; stages && i < METRIC_STAGE_COUNT; i++)
+            histogram_merge(&stages[i], &s->stages[i]);
+    }
+    pthread_mutex_unlock(&shards_mutex);
+
+    buf_printf(&b, "# HELP chat_messages_received_total Mensajes recibidos por tipo.\n");
+    buf_printf(&b, "# TYPE chat_messages_received_total counter\n");
+    for (int i = 0; i < METRIC_MSG_COUNT; i++)
+        buf_printf(&b, "chat_messages_received_total{type=\"%s\"} %llu\n",
+                   msg_type_names[i], (unsigned long long)messages[i]);
+
+    buf_printf(&b, "# HELP chat_messages_rate_limited_total Mensajes descartados por el límite de frecuencia.\n");
+    buf_printf(&b, "# TYPE chat_messages_rate_limited_total counter\n");
+    for (int i = 0; i < METRIC_MSG_COUNT; i++)
+        buf_printf(&b, "chat_messages_rate_limited_total{type=\"%s\"} %llu\n",
+                   msg_type_names[i], (unsigned long long)rate_limited[i]);
+
+    buf_printf(&b, "# HELP chat_messages_oversized_total Mensajes descartados por superar MAX_MESSAGE_SIZE.\n");
+    buf_printf(&b, "# TYPE chat_messages_oversized_total counter\n");
+    buf_printf(&b, "chat_messages_oversized_total %llu\n", (unsigned long long)oversized);
+
+    if (stages) {
+        buf_printf(&b, "# HELP chat_stage_latency_seconds Latencia por etapa del mensaje.\n");
+        buf_printf(&b, "# TYPE chat_stage_latency_seconds histogram\n");
+        for (int i = 0; i < METRIC_STAGE_COUNT; i++)
+            render_histogram(&b, stage_names[i], &stages[i]);
+
+        buf_printf(&b, "# HELP chat_stage_latency_quantile_seconds Percentiles HDR por etapa.\n");
+        buf_printf(&b, "# TYPE chat_stage_latency_quantile_seconds gauge\n");
+        static const double quantiles[] = { 50.0, 99.0, 99.9 };
+        for (int i = 0; i < METRIC_STAGE_COUNT; i++) {
+            for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+                buf_printf(&b, "chat_stage_latency_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                           stage_names[i], quantiles[q] / 100.0,
+                           (double)histogram_percentile(&stages[i], quantiles[q]) / 1e9);
+            }
+        }
+        free(stages);
+    }
+
+    buf_printf(&b, "# HELP chat_task_queue_depth Tareas esperando un worker.\n");
+    buf_printf(&b, "# TYPE chat_task_queue_depth gauge\n");
+    buf_printf(&b, "chat_task_queue_depth %zu\n", get_task_queue_depth());
+
+    buf_printf(&b, "# HELP chat_registered_users Usuarios en el registro.\n");
+    buf_printf(&b, "# TYPE chat_registered_users gauge\n");
+    buf_printf(&b, "chat_registered_users %zu\n", get_user_count());
+
+    client_stats_t client_stats;
+    memset(&client_stats, 0, sizeof(client_stats));
+    size_t clients = visit_client_stats(collect_client, &client_stats);
+    render_client_dist(&b, "chat_client_pending_messages", "mensajes en cola de envío",
+                       &client_stats.pending, pending_bounds, clients);
+    render_client_dist(&b, "chat_client_outbound_bytes", "bytes enviados en la sesión",
+                       &client_stats.bytes, bytes_bounds, clients);
+
+    buf_printf(&b, "# HELP chat_connected_clients Conexiones registradas.\n");
+    buf_printf(&b, "# TYPE chat_connected_clients gauge\n");
+    buf_printf(&b, "chat_connected_clients %zu\n", clients);
+
+    buf_printf(&b, "# HELP chat_log_dropped_total Mensajes de log descartados.\n");
+    buf_printf(&b, "# TYPE chat_log_dropped_total counter\n");
+    buf_printf(&b, "chat_log_dropped_total %llu\n", logger_dropped());
+
+    struct mallinfo2 mi = mallinfo2();
+    buf_printf(&b, "# HELP chat_malloc_bytes Estadísticas del allocator de glibc.\n");
+    buf_printf(&b, "# TYPE chat_malloc_bytes gauge\n");
+    buf_printf(&b, "chat_malloc_bytes{kind=\"arena\"} %zu\n", mi.arena);
+    buf_printf(&b, "chat_malloc_bytes{kind=\"in_use\"} %zu\n", mi.uordblks);
+    buf_printf(&b, "chat_malloc_bytes{kind=\"free\"} %zu\n", mi.fordblks);
+    buf_printf(&b, "chat_malloc_bytes{kind=\"mmap\"} %zu\n", mi.hblkhd);
+
+    slab_class_stats_t slab[SLAB_CLASS_COUNT + 1];
+    slab_stats(slab);
+    char slab_class[SLAB_CLASS_COUNT + 1][16];
+    for (int i = 0; i <= SLAB_CLASS_COUNT; i++) {
+        if (slab[i].block_size)
+            snprintf(slab_class[i], sizeof(slab_class[i]), "%zu", slab[i].block_size);
+        else
+            snprintf(slab_class[i], sizeof(slab_class[i]), "large");
+    }
+    buf_printf(&b, "# HELP chat_slab_allocs_total Bloques alocados por clase del allocator slab.\n");
+    buf_printf(&b, "# TYPE chat_slab_allocs_total counter\n");
+    for (int i = 0; i <= SLAB_CLASS_COUNT; i++)
+        buf_printf(&b, "chat_slab_allocs_total{class=\"%s\"} %llu\n",
+                   slab_class[i], (unsigned long long)slab[i].allocs);
+    buf_printf(&b, "# HELP chat_slab_remote_frees_total Bloques liberados desde un hilo distinto al dueño.\n");
+    buf_printf(&b, "# TYPE chat_slab_remote_frees_total counter\n");
+    for (int i = 0; i <= SLAB_CLASS_COUNT; i++)
+        buf_printf(&b, "chat_slab_remote_frees_total{class=\"%s\"} %llu\n",
+                   slab_class[i], (unsigned long long)slab[i].remote_frees);
+    buf_printf(&b, "# HELP chat_slab_objects Bloques en uso por clase.\n");
+    buf_printf(&b, "# TYPE chat_slab_objects gauge\n");
+    for (int i = 0; i <= SLAB_CLASS_COUNT; i++)
+        buf_printf(&b, "chat_slab_objects{class=\"%s\"} %llu\n",
+                   slab_class[i], (unsigned long long)slab[i].in_use);
+    buf_printf(&b, "# HELP chat_slab_bytes Memoria tomada en slabs por clase.\n");
+    buf_printf(&b, "# TYPE chat_slab_bytes gauge\n");
+    for (int i = 0; i < SLAB_CLASS_COUNT; i++)
+        buf_printf(&b, "chat_slab_bytes{class=\"%s\"} %zu\n", slab_class[i], slab[i].slab_bytes);
+
+    if (b.failed) {
+        free(b.data);
+        *out = NULL;
+        return 0;
+    }
+    *out = b.data;
+    return b.len;
+}
+
+/* ---------- HTTP ---------- */
+
+int metrics_http_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                          metrics_http_t *state, void *in, size_t len) {
+    if (!state)
+        return reason == LWS_CALLBACK_CLOSED_HTTP ? 0 : -1;
+    switch (reason) {
+        case LWS_CALLBACK_HTTP: {
+            const char *uri = (const char *)in;
+            if (!uri || strcmp(uri, "/metrics") != 0) {
+                lws_return_http_status(wsi, HTTP_STATUS_NOT_FOUND, NULL);
+                return -1;
+            }
+            free(state->body);
+            state->len = metrics_render(&state->body);
+            state->sent = 0;
+            if (!state->body)
+                return -1;
+
+            unsigned char headers[LWS_PRE + 512];
+            unsigned char *start = &headers[LWS_PRE];
+            unsigned char *p = start;
+            unsigned char *end = &headers[sizeof(headers) - 1];
+            if (lws_add_http_common_headers(wsi, HTTP_STATUS_OK,
+                                            "text/plain; version=0.0.4",
+                                            state->len, &p, end))
+                return -1;
+            if (lws_finalize_write_http_header(wsi, start, &p, end))
+                return -1;
+            lws_callback_on_writable(wsi);
+            return 0;
+        }
+
+        case LWS_CALLBACK_HTTP_WRITEABLE: {
+            if (!state->body)
+                return -1;
+            // Se envía por trozos para no bloquear el hilo de servicio con un scrape grande
+            size_t chunk = state->len - state->sent;
+            if (chunk > METRICS_HTTP_CHUNK)
+                chunk = METRICS_HTTP_CHUNK;
+            bool last = state->sent + chunk == state->len;
+
+            unsigned char buffer[LWS_PRE + METRICS_HTTP_CHUNK];
+            memcpy(&buffer[LWS_PRE], state->body + state->sent, chunk);
+            if (lws_write(wsi, &buffer[LWS_PRE], chunk,
+                          last ? LWS_WRITE_HTTP_FINAL : LWS_WRITE_HTTP) != (int)chunk)
+                return -1;
+            state->sent += chunk;
+
+            if (!last) {
+                lws_callback_on_writable(wsi);
+                return 0;
+            }
+            free(state->body);
+            state->body = NULL;
+            if (lws_http_transaction_completed(wsi))
+                return -1;
+            return 0;
+        }
+
+        case LWS_CALLBACK_CLOSED_HTTP:
+            free(state->body);
+            state->body = NULL;
+            break;
+
+        default:
+            break;
+    }
+    (void)len;
+    return 0;
+}
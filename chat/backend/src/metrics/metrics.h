@@ -0,0 +1,77 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <libwebsockets.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Métricas del servidor en formato de texto de Prometheus.
+ *
+ * Cada hilo escribe en su propio shard (contadores e histogramas con un solo
+ * escritor), así que instrumentar el camino caliente no toma locks ni usa
+ * instrucciones atómicas con lock. Los shards solo se suman al hacer scrape.
+ */
+
+// Tipos de mensaje contados por separado; el resto cae en METRIC_MSG_OTHER
+typedef enum {
+    METRIC_MSG_REGISTER,
+    METRIC_MSG_BROADCAST,
+    METRIC_MSG_PRIVATE,
+    METRIC_MSG_LIST_USERS,
+    METRIC_MSG_USER_INFO,
+    METRIC_MSG_CHANGE_STATUS,
+    METRIC_MSG_DISCONNECT,
+    METRIC_MSG_JOIN_ROOM,
+    METRIC_MSG_LEAVE_ROOM,
+    METRIC_MSG_ROOM_MESSAGE,
+    METRIC_MSG_LIST_ROOMS,
+    METRIC_MSG_SUBSCRIBE,
+    METRIC_MSG_UNSUBSCRIBE,
+    METRIC_MSG_MULTICAST,
+    METRIC_MSG_SEARCH_USERS,
+    METRIC_MSG_OTHER,
+    METRIC_MSG_COUNT
+} metric_msg_type_t;
+
+// Etapas de latencia de un mensaje
+typedef enum {
+    METRIC_STAGE_RECEIVE_DISPATCH,  // Recepción en lws -> un worker lo toma de la cola
+    METRIC_STAGE_DISPATCH_PROCESS,  // Worker lo toma -> process_message termina
+    METRIC_STAGE_PROCESS_WRITTEN,   // Respuesta encolada -> lws_write
+    METRIC_STAGE_COUNT
+} metric_stage_t;
+
+// Traduce el campo "type" de un mensaje a su contador.
+metric_msg_type_t metrics_msg_type(const char *type);
+
+// Nombre del tipo, como en el campo "type" ("other" para METRIC_MSG_OTHER).
+const char *metrics_msg_type_name(metric_msg_type_t type);
+
+// Cuenta un mensaje recibido del tipo indicado.
+void metrics_count_message(metric_msg_type_t type);
+
+// Cuenta un mensaje descartado por el límite de frecuencia (ver rate_limit.h).
+void metrics_count_rate_limited(metric_msg_type_t type);
+
+// Cuenta un mensaje descartado por superar MAX_MESSAGE_SIZE al reensamblarlo.
+void metrics_count_oversized(void);
+
+// Registra la latencia (en ns) de una etapa.
+void metrics_record_latency(metric_stage_t stage, uint64_t ns);
+
+// Genera el texto de /metrics (malloc'd, liberar con free()). Retorna su largo.
+size_t metrics_render(char **out);
+
+/* Estado de una respuesta HTTP de /metrics en curso */
+typedef struct {
+    char *body;
+    size_t len;
+    size_t sent;
+} metrics_http_t;
+
+// Atiende los callbacks HTTP de libwebsockets: GET /metrics y 404 para el resto.
+int metrics_http_callback(struct lws *wsi, enum lws_callback_reasons reason,
+                          metrics_http_t *state, void *in, size_t len);
+
+#endif
@@ -0,0 +1,274 @@
+#include "trace.h"
+#include "config.h"
+#include "logger.h"
+#include "slab.h"
+#include "time_utils.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    uint64_t start_ns;
+    uint64_t end_ns;
+    uint32_t trace_id;
+    uint32_t lane;
+    uint8_t stage;
+    uint8_t type;           // Solo en TRACE_STAGE_PROCESS
+} trace_span_t;
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    [TRACE_STAGE_RECEIVE] = "receive",
+    [TRACE_STAGE_QUEUE]   = "queue",
+    [TRACE_STAGE_PROCESS] = "process",
+    [TRACE_STAGE_PENDING] = "pending",
+    [TRACE_STAGE_WRITE]   = "write",
+};
+
+static FILE *trace_file = NULL;
+static bool tracing = false;
+static uint64_t origin_ns = 0;              // Los "ts" del archivo cuentan desde aquí
+
+// Un mensaje se traza si el hash de su número queda bajo el umbral (0: apagado)
+static _Atomic uint64_t sample_threshold = 0;
+static _Atomic uint64_t sample_counter = 0;
+static atomic_uint next_trace_id = 1;
+
+// Buffer que llenan los hilos del servidor y buffer libre para el próximo cambio;
+// mientras el escritor vuelca uno, spare_spans es NULL
+static trace_span_t *active_spans = NULL;
+static size_t active_count = 0;
+static trace_span_t *spare_spans = NULL;
+static unsigned long long dropped = 0;
+
+static pthread_t writer_thread;
+static pthread_mutex_t spans_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool stop_writer = false;
+static bool first_event = true;             // Solo el escritor
+
+static __thread trace_t *current_trace = NULL;
+
+/* Mezcla de splitmix64: números consecutivos dan valores uniformes, así que
+   el muestreo no se alinea con tráfico periódico */
+static uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/* ---------- Escritor ---------- */
+
+static double to_us(uint64_t ns) {
+    return (double)(int64_t)(ns - origin_ns) / 1000.0;
+}
+
+static void write_event_prefix(void) {
+    fputs(first_event ? "\n" : ",\n", trace_file);
+    first_event = false;
+}
+
+static void write_span(const trace_span_t *span) {
+    // Metadatos de Chrome trace: nombre del proceso (el mensaje) y de sus filas
+    if (span->stage == TRACE_STAGE_PROCESS) {
+        write_event_prefix();
+        fprintf(trace_file,
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%u,\"args\":{\"name\":\"%s #%u\"}}",
+                span->trace_id, metrics_msg_type_name(span->type), span->trace_id);
+    }
+    if (span->stage == TRACE_STAGE_RECEIVE || span->stage == TRACE_STAGE_PENDING) {
+        write_event_prefix();
+        if (span->lane == TRACE_LANE_SERVER)
+            fprintf(trace_file,
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":0,"
+                    "\"args\":{\"name\":\"servidor\"}}", span->trace_id);
+        else
+            fprintf(trace_file,
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%u,\"tid\":%u,"
+                    "\"args\":{\"name\":\"sesión %u\"}}",
+                    span->trace_id, span->lane, span->lane - 1);
+    }
+    write_event_prefix();
+    fprintf(trace_file,
+            "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            stage_names[span->stage], span->trace_id, span->lane,
+            to_us(span->start_ns), (double)(span->end_ns - span->start_ns) / 1000.0);
+}
+
+static void *trace_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&spans_mutex);
+    while (true) {
+        // Vuelca cada TRACE_FLUSH_MS, o antes si el buffer va por la mitad
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += TRACE_FLUSH_MS / 1000;
+        deadline.tv_nsec += (long)(TRACE_FLUSH_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!stop_writer && active_count < TRACE_BUFFER_SPANS / 2) {
+            if (pthread_cond_timedwait(&writer_cond, &spans_mutex, &deadline) == ETIMEDOUT)
+                break;
+        }
+        bool stopping = stop_writer;
+        trace_span_t *spans = active_spans;
+        size_t count = active_count;
+        active_spans = spare_spans;
+        active_count = 0;
+        spare_spans = NULL;
+        pthread_mutex_unlock(&spans_mutex);
+
+        for (size_t i = 0; i < count; i++)
+            write_span(&spans[i]);
+        if (count > 0)
+            fflush(trace_file);
+
+        pthread_mutex_lock(&spans_mutex);
+        spare_spans = spans;
+        if (stopping)
+            break;
+    }
+    pthread_mutex_unlock(&spans_mutex);
+    return NULL;
+}
+
+/* ---------- API ---------- */
+
+bool trace_start(const char *path, double sample_rate) {
+    if (tracing)
+        return true;
+    if (!(sample_rate > 0.0 && sample_rate <= 1.0)) {
+        log_error("Fracción de trazado inválida: %g", sample_rate);
+        return false;
+    }
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        log_error("No se pudo abrir la traza %s: %s", path, strerror(errno));
+        return false;
+    }
+    active_spans = malloc(TRACE_BUFFER_SPANS * sizeof(trace_span_t));
+    spare_spans = malloc(TRACE_BUFFER_SPANS * sizeof(trace_span_t));
+    if (!active_spans || !spare_spans) {
+        log_error("Error al asignar memoria para la traza");
+        goto fail;
+    }
+    fputs("[", trace_file);
+    first_event = true;
+    active_count = 0;
+    dropped = 0;
+    stop_writer = false;
+    origin_ns = monotonic_ns();
+    if (pthread_create(&writer_thread, NULL, trace_writer, NULL) != 0) {
+        log_error("No se pudo crear el hilo de la traza");
+        goto fail;
+    }
+    // 2^64 * rate, sin pasar de UINT64_MAX con rate = 1
+    double threshold = sample_rate * 18446744073709551616.0;
+    atomic_store(&sample_threshold, threshold >= 18446744073709551615.0 ?
+                                    UINT64_MAX : (uint64_t)threshold);
+    tracing = true;
+    log_info("Trazando %.4g de los mensajes en %s", sample_rate, path);
+    return true;
+
+fail:
+    free(active_spans);
+    free(spare_spans);
+    active_spans = spare_spans = NULL;
+    fclose(trace_file);
+    trace_file = NULL;
+    return false;
+}
+
+void trace_stop(void) {
+    if (!tracing)
+        return;
+    tracing = false;
+    atomic_store(&sample_threshold, 0);
+    pthread_mutex_lock(&spans_mutex);
+    stop_writer = true;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&spans_mutex);
+    pthread_join(writer_thread, NULL);
+
+    fputs("\n]\n", trace_file);
+    if (fclose(trace_file) != 0)
+        log_error("Error cerrando la traza: %s", strerror(errno));
+    trace_file = NULL;
+    // Los spans de trazas que sigan vivas (en colas sin escribir) se descartan
+    pthread_mutex_lock(&spans_mutex);
+    free(active_spans);
+    free(spare_spans);
+    active_spans = spare_spans = NULL;
+    pthread_mutex_unlock(&spans_mutex);
+    if (dropped > 0)
+        log_error("Traza: %llu spans descartados", dropped);
+}
+
+trace_t *trace_begin(uint64_t first_rx_ns, uint64_t queued_ns) {
+    uint64_t threshold = atomic_load_explicit(&sample_threshold, memory_order_relaxed);
+    if (threshold == 0)
+        return NULL;
+    uint64_t n = atomic_fetch_add_explicit(&sample_counter, 1, memory_order_relaxed);
+    if (mix64(n) >= threshold)
+        return NULL;
+
+    trace_t *trace = slab_alloc(sizeof(trace_t));
+    if (!trace)
+        return NULL;
+    atomic_init(&trace->refcount, 1);
+    trace->id = atomic_fetch_add_explicit(&next_trace_id, 1, memory_order_relaxed);
+    atomic_init(&trace->type, METRIC_MSG_OTHER);
+    trace_span(trace, TRACE_STAGE_RECEIVE, TRACE_LANE_SERVER, first_rx_ns, queued_ns);
+    return trace;
+}
+
+void trace_retain(trace_t *trace) {
+    if (trace)
+        atomic_fetch_add_explicit(&trace->refcount, 1, memory_order_relaxed);
+}
+
+void trace_release(trace_t *trace) {
+    if (trace && atomic_fetch_sub_explicit(&trace->refcount, 1, memory_order_acq_rel) == 1)
+        slab_free(trace);
+}
+
+void trace_set_current(trace_t *trace) {
+    current_trace = trace;
+}
+
+trace_t *trace_current(void) {
+    return current_trace;
+}
+
+void trace_set_type(metric_msg_type_t type) {
+    if (current_trace)
+        atomic_store_explicit(&current_trace->type, (uint8_t)type, memory_order_relaxed);
+}
+
+void trace_span(const trace_t *trace, trace_stage_t stage, uint32_t lane,
+                uint64_t start_ns, uint64_t end_ns) {
+    if (!trace)
+        return;
+    pthread_mutex_lock(&spans_mutex);
+    // Sin buffer libre (el trazado se apagó) o lleno: se descarta
+    if (!active_spans || active_count == TRACE_BUFFER_SPANS) {
+        dropped++;
+        pthread_mutex_unlock(&spans_mutex);
+        return;
+    }
+    trace_span_t *span = &active_spans[active_count++];
+    span->start_ns = start_ns;
+    span->end_ns = end_ns;
+    span->trace_id = trace->id;
+    span->lane = lane;
+    span->stage = (uint8_t)stage;
+    span->type = atomic_load_explicit(&trace->type, memory_order_relaxed);
+    if (active_count == TRACE_BUFFER_SPANS / 2)
+        pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&spans_mutex);
+}
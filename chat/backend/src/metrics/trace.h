@@ -0,0 +1,78 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include "metrics.h"
+
+/**
+ * Trazas por etapa de una muestra de los mensajes.
+ *
+ * Con el trazado encendido, una fracción de los mensajes recibidos lleva un
+ * trace_t desde libwebsockets hasta la escritura a cada destinatario, y cada
+ * etapa deja un span con sus instantes de monotonic_ns():
+ *
+ *   receive  primer fragmento en lws -> mensaje completo encolado al pool
+ *   queue    espera en la cola del pool hasta que lo toma un worker
+ *   process  process_message en el worker
+ *   pending  espera en la cola del destinatario hasta su primera escritura
+ *   write    lws_write (uno por fragmento)
+ *
+ * Los spans se copian a un buffer en memoria; un hilo aparte los escribe
+ * como JSON de Chrome trace (se abre en ui.perfetto.dev o chrome://tracing).
+ * Cada mensaje trazado es un proceso con una fila para las etapas del
+ * servidor y una por destinatario. Si el escritor va atrasado y el buffer se
+ * llena, los spans se descartan y se cuentan en vez de bloquear.
+ *
+ * El worker deja la traza del mensaje en curso en una variable del hilo, y
+ * cada frame que encola mientras tanto la referencia. Los broadcasts que
+ * agrupa broadcast_batch salen desde el hilo de servicio y no la llevan.
+ */
+
+typedef enum {
+    TRACE_STAGE_RECEIVE,
+    TRACE_STAGE_QUEUE,
+    TRACE_STAGE_PROCESS,
+    TRACE_STAGE_PENDING,
+    TRACE_STAGE_WRITE,
+    TRACE_STAGE_COUNT
+} trace_stage_t;
+
+// Fila de un span: las etapas del servidor, o la sesión del destinatario + 1
+#define TRACE_LANE_SERVER 0
+
+typedef struct trace {
+    atomic_int refcount;
+    uint32_t id;
+    _Atomic uint8_t type;       // metric_msg_type_t; lo fija el worker al leer el mensaje
+} trace_t;
+
+// Empieza a trazar en 'path' una fracción 'sample_rate' (0..1] de los
+// mensajes. Retorna false si no se pudo abrir el archivo.
+bool trace_start(const char *path, double sample_rate);
+
+// Escribe lo pendiente, cierra el JSON y el archivo.
+void trace_stop(void);
+
+// Decide si se traza un mensaje que empezó a llegar en 'first_rx_ns' y se
+// encola en 'queued_ns'; si se traza, registra su span de recepción y
+// retorna la traza (refcount = 1). NULL si no se traza.
+trace_t *trace_begin(uint64_t first_rx_ns, uint64_t queued_ns);
+
+void trace_retain(trace_t *trace);
+void trace_release(trace_t *trace);
+
+// Traza del mensaje que procesa este hilo (NULL si no se traza ninguno).
+// El worker la fija mientras procesa; no toma una referencia.
+void trace_set_current(trace_t *trace);
+trace_t *trace_current(void);
+
+// Tipo del mensaje en curso, para nombrarlo en la traza.
+void trace_set_type(metric_msg_type_t type);
+
+// Registra un span de 'trace' (NULL: no hace nada).
+void trace_span(const trace_t *trace, trace_stage_t stage, uint32_t lane,
+                uint64_t start_ns, uint64_t end_ns);
+
+#endif
@@ -0,0 +1,318 @@
+#include "snapshot.h"
+#include "config.h"
+#include "logger.h"
+#include "user_manager.h"
+#include "connection_manager.h"
+#include "binproto.h"
+#include "time_utils.h"
+#include "slab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+
+// Versión 2: cada sesión guarda su token de reanudación
+static const char SNAPSHOT_MAGIC[8] = "CHSNAP2";
+
+// Estado del hilo escritor
+static pthread_t writer_thread;
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool writer_running = false;
+static bool stop_writer = false;
+static char *writer_path = NULL;
+static unsigned int writer_interval = 0;
+
+/* ---------- Escritura ---------- */
+
+static bool write_u32(FILE *f, uint32_t v) {
+    return fwrite(&v, sizeof(v), 1, f) == 1;
+}
+
+static bool write_i64(FILE *f, int64_t v) {
+    return fwrite(&v, sizeof(v), 1, f) == 1;
+}
+
+static bool write_bytes(FILE *f, const char *data, size_t len) {
+    if (!write_u32(f, (uint32_t)len))
+        return false;
+    return len == 0 || fwrite(data, 1, len, f) == len;
+}
+
+static bool write_str(FILE *f, const char *s) {
+    return write_bytes(f, s ? s : "", s ? strlen(s) : 0);
+}
+
+bool write_snapshot(const char *path) {
+    // Copiar el estado en memoria; los locks se sueltan antes de tocar el disco
+    user_snapshot_t *users = NULL;
+    size_t user_count = snapshot_users(&users);
+    queue_snapshot_t *queues = snapshot_pending_queues();
+
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp_path = malloc(tmp_len);
+    if (!tmp_path) {
+        free_user_snapshot(users, user_count);
+        free_queue_snapshot(queues);
+        return false;
+    }
+    snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+    bool ok = false;
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        log_error("No se pudo abrir %s: %s", tmp_path, strerror(errno));
+        goto done;
+    }
+
+    ok = fwrite(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC), 1, f) == 1;
+    ok = ok && write_u32(f, (uint32_t)user_count);
+    for (size_t i = 0; ok && i < user_count; i++) {
+        ok = write_str(f, users[i].username) &&
+             write_str(f, users[i].ip) &&
+             write_str(f, users[i].status) &&
+             write_i64(f, (int64_t)users[i].last_activity);
+    }
+
+    uint32_t queue_count = 0;
+    for (queue_snapshot_t *q = queues; q; q = q->next)
+        queue_count++;
+    ok = ok && write_u32(f, queue_count);
+    for (queue_snapshot_t *q = queues; ok && q; q = q->next) {
+        uint32_t msg_count = 0;
+        for (pending_msg_t *m = q->head; m; m = m->next)
+            msg_count++;
+        ok = write_str(f, q->username) && write_str(f, q->resume_token) &&
+             write_u32(f, msg_count);
+        for (pending_msg_t *m = q->head; ok && m; m = m->next) {
+            // Se guarda en JSON: al restaurar, los frames se crean como JSON
+            frame_t *frame = binproto_frame(m->frame, false);
+            ok = frame && write_bytes(f, (const char *)frame_payload(frame), frame->len);
+        }
+    }
+
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    if (fclose(f) != 0)
+        ok = false;
+    if (ok && rename(tmp_path, path) != 0) {
+        log_error("No se pudo renombrar %s: %s", tmp_path, strerror(errno));
+        ok = false;
+    }
+    if (!ok)
+        unlink(tmp_path);
+
+done:
+    free(tmp_path);
+    free_user_snapshot(users, user_count);
+    free_queue_snapshot(queues);
+    return ok;
+}
+
+/* ---------- Lectura ---------- */
+
+// Cursor sobre el archivo completo cargado en memoria
+typedef struct {
+    const char *data;
+    size_t len;
+    size_t pos;
+} reader_t;
+
+static bool read_u32(reader_t *r, uint32_t *v) {
+    if (r->len - r->pos < sizeof(*v))
+        return false;
+    memcpy(v, r->data + r->pos, sizeof(*v));
+    r->pos += sizeof(*v);
+    return true;
+}
+
+static bool read_i64(reader_t *r, int64_t *v) {
+    if (r->len - r->pos < sizeof(*v))
+        return false;
+    memcpy(v, r->data + r->pos, sizeof(*v));
+    r->pos += sizeof(*v);
+    return true;
+}
+
+// Retorna un puntero dentro del buffer (sin copiar) y su largo
+static bool read_bytes(reader_t *r, const char **out, uint32_t *out_len) {
+    uint32_t len;
+    if (!read_u32(r, &len) || r->len - r->pos < len)
+        return false;
+    *out = r->data + r->pos;
+    *out_len = len;
+    r->pos += len;
+    return true;
+}
+
+// Copia una cadena del buffer a un char[] terminado en '\0'
+static bool read_str(reader_t *r, char *dst, size_t dst_size) {
+    const char *s;
+    uint32_t len;
+    if (!read_bytes(r, &s, &len) || len >= dst_size)
+        return false;
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    return true;
+}
+
+bool load_snapshot(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size < (long)sizeof(SNAPSHOT_MAGIC)) {
+        fclose(f);
+        log_error("Snapshot %s inválido", path);
+        return false;
+    }
+    char *data = malloc((size_t)size);
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        fclose(f);
+        log_error("No se pudo leer el snapshot %s", path);
+        return false;
+    }
+    fclose(f);
+
+    reader_t r = { data, (size_t)size, sizeof(SNAPSHOT_MAGIC) };
+    if (memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        free(data);
+        log_error("Snapshot %s con formato desconocido", path);
+        return false;
+    }
+
+    bool ok = true;
+    uint32_t user_count = 0, restored_users = 0;
+    ok = read_u32(&r, &user_count);
+    for (uint32_t i = 0; ok && i < user_count; i++) {
+        char username[256], ip[64], status[64];
+        int64_t last_activity;
+        ok = read_str(&r, username, sizeof(username)) &&
+             read_str(&r, ip, sizeof(ip)) &&
+             read_str(&r, status, sizeof(status)) &&
+             read_i64(&r, &last_activity);
+        if (ok && restore_user(username, ip, status, (time_t)last_activity))
+            restored_users++;
+    }
+
+    uint32_t queue_count = 0, restored_msgs = 0;
+    ok = ok && read_u32(&r, &queue_count);
+    for (uint32_t i = 0; ok && i < queue_count; i++) {
+        char username[256], token[RESUME_TOKEN_LEN + 1];
+        uint32_t msg_count = 0;
+        bool named = read_str(&r, username, sizeof(username)) &&
+                     read_str(&r, token, sizeof(token));
+        ok = named && read_u32(&r, &msg_count);
+
+        pending_msg_t *head = NULL, **tail = &head;
+        for (uint32_t j = 0; ok && j < msg_count; j++) {
+            const char *msg;
+            uint32_t len;
+            ok = read_bytes(&r, &msg, &len);
+            if (!ok)
+                break;
+            pending_msg_t *node = slab_alloc(sizeof(pending_msg_t));
+            // El payload guardado ya incluye el '\n' final
+            frame_t *frame = frame_create_raw(msg, len);
+            if (!node || !frame) {
+                slab_free(node);
+                frame_release(frame);
+                continue;
+            }
+            node->frame = frame;
+            node->enqueued_ns = monotonic_ns();
+            node->seq = 0;      // Se numera al entregarse en add_client
+            node->receipt = NULL;
+            node->trace = NULL;
+            node->next = NULL;
+            *tail = node;
+            tail = &node->next;
+            restored_msgs++;
+        }
+        // Aun sin mensajes: el token es lo que permite reclamar el usuario
+        if (named)
+            restore_pending_queue(username, token, head);
+    }
+    free(data);
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    long elapsed_us = (end.tv_sec - start.tv_sec) * 1000000L +
+                      (end.tv_nsec - start.tv_nsec) / 1000L;
+
+    if (!ok)
+        log_error("Snapshot %s truncado; se restauró solo una parte", path);
+    log_info("Snapshot %s cargado: %u usuarios, %u mensajes pendientes en %ld us",
+             path, restored_users, restored_msgs, elapsed_us);
+    return ok;
+}
+
+/* ---------- Hilo escritor ---------- */
+
+static void *snapshot_writer(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&writer_mutex);
+    while (!stop_writer) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += writer_interval;
+        pthread_cond_timedwait(&writer_cond, &writer_mutex, &ts);
+        if (stop_writer)
+            break;
+        pthread_mutex_unlock(&writer_mutex);
+
+        time_t now = time(NULL);
+        expire_restored_users(now, SNAPSHOT_RESTORE_GRACE);
+        expire_orphan_queues(now, SNAPSHOT_RESTORE_GRACE);
+        if (!write_snapshot(writer_path))
+            log_error("No se pudo escribir el snapshot %s", writer_path);
+
+        pthread_mutex_lock(&writer_mutex);
+    }
+    pthread_mutex_unlock(&writer_mutex);
+    return NULL;
+}
+
+void init_snapshot_writer(const char *path, unsigned int interval_secs) {
+    if (writer_running || interval_secs == 0)
+        return;
+    writer_path = strdup(path);
+    if (!writer_path)
+        return;
+    writer_interval = interval_secs;
+    stop_writer = false;
+    if (pthread_create(&writer_thread, NULL, snapshot_writer, NULL) != 0) {
+        log_error("No se pudo crear el hilo de snapshots");
+        free(writer_path);
+        writer_path = NULL;
+        return;
+    }
+    writer_running = true;
+    log_info("Snapshots cada %u segundos en %s", interval_secs, path);
+}
+
+void shutdown_snapshot_writer(void) {
+    if (!writer_running)
+        return;
+    pthread_mutex_lock(&writer_mutex);
+    stop_writer = true;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+    pthread_join(writer_thread, NULL);
+    writer_running = false;
+
+    if (write_snapshot(writer_path))
+        log_info("Snapshot final escrito en %s", writer_path);
+    free(writer_path);
+    writer_path = NULL;
+}
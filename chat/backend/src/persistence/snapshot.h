@@ -0,0 +1,39 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdbool.h>
+
+/**
+ * Snapshots para reinicio en caliente.
+ *
+ * El archivo guarda el registro de usuarios (nombre, IP, estado, última
+ * actividad) y las colas de mensajes pendientes por usuario. Se escribe en
+ * binario con el orden de bytes de la máquina: está pensado para reiniciar
+ * el mismo servidor, no para moverlo entre arquitecturas.
+ */
+
+/**
+ * Carga el snapshot de 'path' en user_manager y connection_manager.
+ * Los usuarios quedan "restaurados" hasta que vuelvan a registrarse.
+ * Retorna false si el archivo no existe o está corrupto.
+ */
+bool load_snapshot(const char *path);
+
+/**
+ * Escribe un snapshot de forma atómica (archivo temporal + rename).
+ * Los locks de los registros solo se toman mientras se copian en memoria.
+ */
+bool write_snapshot(const char *path);
+
+/**
+ * Inicia el hilo que escribe un snapshot cada interval_secs segundos y
+ * descarta los usuarios restaurados que no volvieron a tiempo.
+ */
+void init_snapshot_writer(const char *path, unsigned int interval_secs);
+
+/**
+ * Detiene el hilo escritor y deja un último snapshot en disco.
+ */
+void shutdown_snapshot_writer(void);
+
+#endif
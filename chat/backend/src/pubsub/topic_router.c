@@ -0,0 +1,469 @@
+#include "topic_router.h"
+#include "connection_manager.h"
+#include "frame.h"
+#include "binproto.h"
+#include "logger.h"
+#include "time_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct topic_node {
+    char *segment;
+    struct topic_node *parent;
+    struct topic_node **children;  // Hijos literales, ordenados por segmento
+    size_t child_count;
+    size_t child_cap;
+    struct topic_node *star;       // Hijo '*'
+    struct topic_node *hash;       // Hijo '#'
+    uint32_t *subs;                // Sesiones suscritas a este patrón, ordenadas
+    size_t sub_count;
+    size_t sub_cap;
+} topic_node_t;
+
+// Patrones de cada sesión, para limpiar al desconectarse
+typedef struct {
+    char **patterns;
+    size_t count;
+    size_t cap;
+} session_subs_t;
+
+static topic_node_t root;
+static session_subs_t *session_subs = NULL;
+static size_t session_subs_cap = 0;
+
+// Bitset de trabajo para deduplicar sesiones durante un match
+static uint64_t *match_bits = NULL;
+static size_t match_words = 0;
+
+static pthread_mutex_t router_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Divide 'topic' (copiado en 'buf') en segmentos. Retorna la cantidad o -1. */
+static int split_topic(const char *topic, char *buf, char **segs) {
+    size_t len = strlen(topic);
+    if (len == 0 || len >= MAX_TOPIC_LEN)
+        return -1;
+    memcpy(buf, topic, len + 1);
+    int count = 0;
+    char *start = buf;
+    for (char *p = buf; ; p++) {
+        if (*p == '.' || *p == '\0') {
+            bool end = *p == '\0';
+            *p = '\0';
+            if (*start == '\0' || count == MAX_TOPIC_SEGMENTS)
+                return -1;
+            segs[count++] = start;
+            if (end)
+                break;
+            start = p + 1;
+        }
+    }
+    return count;
+}
+
+/* Un patrón válido usa '*' y '#' solo como segmento completo, y '#' solo al final */
+static bool valid_pattern(char **segs, int count) {
+    for (int i = 0; i < count; i++) {
+        bool wildcard = strcmp(segs[i], "*") == 0 || strcmp(segs[i], "#") == 0;
+        if (!wildcard && strpbrk(segs[i], "*#"))
+            return false;
+        if (strcmp(segs[i], "#") == 0 && i != count - 1)
+            return false;
+    }
+    return true;
+}
+
+/* Busca un hijo literal; si no existe y create es true, lo inserta en orden */
+static topic_node_t *literal_child(topic_node_t *node, const char *segment, bool create) {
+    size_t lo = 0, hi = node->child_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int cmp = strcmp(node->children[mid]->segment, segment);
+        if (cmp == 0)
+            return node->children[mid];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (!create)
+        return NULL;
+
+    if (node->child_count == node->child_cap) {
+        size_t new_cap = node->child_cap ? node->child_cap * 2 : 4;
+        topic_node_t **grown = realloc(node->children, new_cap * sizeof(*grown));
+        if (!grown)
+            return NULL;
+        node->children = grown;
+        node->child_cap = new_cap;
+    }
+    topic_node_t *child = calloc(1, sizeof(topic_node_t));
+    if (!child)
+        return NULL;
+    child->segment = strdup(segment);
+    if (!child->segment) {
+        free(child);
+        return NULL;
+    }
+    child->parent = node;
+    memmove(&node->children[lo + 1], &node->children[lo],
+            (node->child_count - lo) * sizeof(*node->children));
+    node->children[lo] = child;
+    node->child_count++;
+    return child;
+}
+
+static topic_node_t *child_for(topic_node_t *node, const char *segment, bool create) {
+    topic_node_t **slot = NULL;
+    if (strcmp(segment, "*") == 0)
+        slot = &node->star;
+    else if (strcmp(segment, "#") == 0)
+        slot = &node->hash;
+    else
+        return literal_child(node, segment, create);
+
+    if (!*slot && create) {
+        *slot = calloc(1, sizeof(topic_node_t));
+        if (*slot) {
+            (*slot)->segment = strdup(segment);
+            (*slot)->parent = node;
+        }
+    }
+    return *slot;
+}
+
+/* Elimina hacia arriba los nodos que quedaron sin suscriptores ni hijos */
+static void prune(topic_node_t *node) {
+    while (node && node != &root && node->sub_count == 0 &&
+           node->child_count == 0 && !node->star && !node->hash) {
+        topic_node_t *parent = node->parent;
+        if (parent->star == node) {
+            parent->star = NULL;
+        } else if (parent->hash == node) {
+            parent->hash = NULL;
+        } else {
+            for (size_t i = 0; i < parent->child_count; i++) {
+                if (parent->children[i] == node) {
+                    memmove(&parent->children[i], &parent->children[i + 1],
+                            (parent->child_count - i - 1) * sizeof(*parent->children));
+                    parent->child_count--;
+                    break;
+                }
+            }
+        }
+        free(node->children);
+        free(node->subs);
+        free(node->segment);
+        free(node);
+        node = parent;
+    }
+}
+
+/* Inserta 'id' en el arreglo ordenado de suscriptores. Retorna false si ya estaba. */
+static bool add_sub(topic_node_t *node, uint32_t id) {
+    size_t lo = 0, hi = node->sub_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (node->subs[mid] == id)
+            return false;
+        if (node->subs[mid] < id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (node->sub_count == node->sub_cap) {
+        size_t new_cap = node->sub_cap ? node->sub_cap * 2 : 4;
+        uint32_t *grown = realloc(node->subs, new_cap * sizeof(uint32_t));
+        if (!grown)
+            return false;
+        node->subs = grown;
+        node->sub_cap = new_cap;
+    }
+    memmove(&node->subs[lo + 1], &node->subs[lo], (node->sub_count - lo) * sizeof(uint32_t));
+    node->subs[lo] = id;
+    node->sub_count++;
+    return true;
+}
+
+static bool remove_sub(topic_node_t *node, uint32_t id) {
+    for (size_t i = 0; i < node->sub_count; i++) {
+        if (node->subs[i] == id) {
+            memmove(&node->subs[i], &node->subs[i + 1],
+                    (node->sub_count - i - 1) * sizeof(uint32_t));
+            node->sub_count--;
+            return true;
+        }
+    }
+    return false;
+}
+
+static session_subs_t *subs_of(uint32_t session_id, bool create) {
+    if (session_id >= session_subs_cap) {
+        if (!create)
+            return NULL;
+        size_t new_cap = session_subs_cap ? session_subs_cap : 64;
+        while (new_cap <= session_id)
+            new_cap *= 2;
+        session_subs_t *grown = realloc(session_subs, new_cap * sizeof(session_subs_t));
+        if (!grown)
+            return NULL;
+        memset(grown + session_subs_cap, 0, (new_cap - session_subs_cap) * sizeof(session_subs_t));
+        session_subs = grown;
+        session_subs_cap = new_cap;
+    }
+    return &session_subs[session_id];
+}
+
+static bool unsubscribe_locked(const char *pattern, uint32_t session_id) {
+    char buf[MAX_TOPIC_LEN];
+    char *segs[MAX_TOPIC_SEGMENTS];
+    int count = split_topic(pattern, buf, segs);
+    if (count < 0)
+        return false;
+
+    topic_node_t *node = &root;
+    for (int i = 0; node && i < count; i++)
+        node = child_for(node, segs[i], false);
+    if (!node || !remove_sub(node, session_id))
+        return false;
+    prune(node);
+
+    session_subs_t *subs = subs_of(session_id, false);
+    for (size_t i = 0; subs && i < subs->count; i++) {
+        if (strcmp(subs->patterns[i], pattern) == 0) {
+            free(subs->patterns[i]);
+            subs->patterns[i] = subs->patterns[--subs->count];
+            break;
+        }
+    }
+    return true;
+}
+
+bool subscribe_topic(const char *pattern, uint32_t session_id) {
+    char buf[MAX_TOPIC_LEN];
+    char *segs[MAX_TOPIC_SEGMENTS];
+    if (session_id == SESSION_NONE)
+        return false;
+    int count = split_topic(pattern, buf, segs);
+    if (count < 0 || !valid_pattern(segs, count))
+        return false;
+
+    bool ok = false;
+    pthread_mutex_lock(&router_mutex);
+    session_subs_t *subs = subs_of(session_id, true);
+    if (subs && subs->count == subs->cap) {
+        size_t new_cap = subs->cap ? subs->cap * 2 : 4;
+        char **grown = realloc(subs->patterns, new_cap * sizeof(char *));
+        if (grown) {
+            subs->patterns = grown;
+            subs->cap = new_cap;
+        }
+    }
+    char *copy = strdup(pattern);
+    if (subs && copy && subs->count < subs->cap) {
+        topic_node_t *node = &root;
+        for (int i = 0; node && i < count; i++)
+            node = child_for(node, segs[i], true);
+        if (node && add_sub(node, session_id)) {
+            subs->patterns[subs->count++] = copy;
+            copy = NULL;
+            ok = true;
+        } else if (node) {
+            ok = node->sub_count > 0;  // Ya estaba suscrito
+            prune(node);
+        }
+    }
+    free(copy);
+    pthread_mutex_unlock(&router_mutex);
+    return ok;
+}
+
+bool unsubscribe_topic(const char *pattern, uint32_t session_id) {
+    pthread_mutex_lock(&router_mutex);
+    bool ok = unsubscribe_locked(pattern, session_id);
+    pthread_mutex_unlock(&router_mutex);
+    return ok;
+}
+
+void unsubscribe_all_topics(uint32_t session_id) {
+    pthread_mutex_lock(&router_mutex);
+    session_subs_t *subs = subs_of(session_id, false);
+    while (subs && subs->count > 0) {
+        char *pattern = strdup(subs->patterns[subs->count - 1]);
+        if (!pattern || !unsubscribe_locked(pattern, session_id)) {
+            // No debería pasar; se descarta para no quedar en un ciclo
+            free(subs->patterns[--subs->count]);
+        }
+        free(pattern);
+    }
+    if (subs) {
+        free(subs->patterns);
+        memset(subs, 0, sizeof(*subs));
+    }
+    pthread_mutex_unlock(&router_mutex);
+}
+
+/* Marca en match_bits las sesiones de 'node'. Retorna cuántas eran nuevas. */
+static size_t collect(const topic_node_t *node) {
+    size_t added = 0;
+    for (size_t i = 0; i < node->sub_count; i++) {
+        uint32_t id = node->subs[i];
+        size_t w = id / 64;
+        if (w >= match_words) {
+            size_t new_words = w + 1;
+            uint64_t *grown = realloc(match_bits, new_words * sizeof(uint64_t));
+            if (!grown)
+                continue;
+            memset(grown + match_words, 0, (new_words - match_words) * sizeof(uint64_t));
+            match_bits = grown;
+            match_words = new_words;
+        }
+        uint64_t bit = 1ULL << (id % 64);
+        if (!(match_bits[w] & bit)) {
+            match_bits[w] |= bit;
+            added++;
+        }
+    }
+    return added;
+}
+
+static size_t match(const topic_node_t *node, char **segs, int count, int depth) {
+    size_t added = 0;
+    // '#' también coincide con cero segmentos restantes
+    if (node->hash)
+        added += collect(node->hash);
+    if (depth == count)
+        return added + collect(node);
+
+    topic_node_t *exact = literal_child((topic_node_t *)node, segs[depth], false);
+    if (exact)
+        added += match(exact, segs, count, depth + 1);
+    if (node->star)
+        added += match(node->star, segs, count, depth + 1);
+    return added;
+}
+
+/* Copia del bitset de sesiones suscritas a 'topic', o NULL si no hay ninguna */
+static uint64_t *match_targets(const char *topic, size_t *words_out) {
+    char buf[MAX_TOPIC_LEN];
+    char *segs[MAX_TOPIC_SEGMENTS];
+    int count = split_topic(topic, buf, segs);
+    if (count < 0)
+        return NULL;
+
+    pthread_mutex_lock(&router_mutex);
+    if (match_words)
+        memset(match_bits, 0, match_words * sizeof(uint64_t));
+    size_t matched = match(&root, segs, count, 0);
+    uint64_t *targets = NULL;
+    size_t words = match_words;
+    if (matched > 0) {
+        targets = malloc(words * sizeof(uint64_t));
+        if (targets)
+            memcpy(targets, match_bits, words * sizeof(uint64_t));
+    }
+    pthread_mutex_unlock(&router_mutex);
+    *words_out = words;
+    return targets;
+}
+
+size_t publish_event(const char *topic, const cJSON *content) {
+    size_t words;
+    uint64_t *targets = match_targets(topic, &words);
+    if (!targets)
+        return 0;
+
+    // Serializar una sola vez para todos los suscriptores
+    cJSON *event = cJSON_CreateObject();
+    cJSON_AddStringToObject(event, "type", "event");
+    cJSON_AddStringToObject(event, "sender", "server");
+    cJSON_AddStringToObject(event, "topic", topic);
+    if (content)
+        cJSON_AddItemToObject(event, "content", cJSON_Duplicate(content, 1));
+
+    char timestamp[TIMESTAMP_LEN];
+    format_timestamp(timestamp);
+    cJSON_AddStringToObject(event, "timestamp", timestamp);
+
+    char *event_str = cJSON_PrintUnformatted(event);
+    size_t sent = 0;
+    frame_t *frame = event_str ? frame_create(event_str, strlen(event_str)) : NULL;
+    if (frame) {
+        sent = send_to_sessions(targets, words, frame);
+        frame_release(frame);
+    }
+    cJSON_free(event_str);
+    cJSON_Delete(event);
+    free(targets);
+    return sent;
+}
+
+typedef struct {
+    const char *topic;
+    const char *content;
+    size_t content_len;
+    const char *timestamp;
+} raw_event_t;
+
+/* Mismo texto que publish_event: type, sender, topic, content, timestamp */
+static void write_raw_event(json_writer_t *w, const void *ctx) {
+    const raw_event_t *ev = ctx;
+    json_write_literal(w, "{\"type\":\"event\",\"sender\":\"server\",\"topic\":");
+    json_write_string(w, ev->topic);
+    json_write_literal(w, ",\"content\":");
+    json_write_raw(w, ev->content, ev->content_len);
+    json_write_literal(w, ",\"timestamp\":");
+    json_write_string(w, ev->timestamp);
+    json_write_literal(w, "}");
+}
+
+size_t publish_event_frame(const char *topic, frame_t *message) {
+    size_t words;
+    uint64_t *targets = match_targets(topic, &words);
+    if (!targets)
+        return 0;
+
+    // Con suscriptores: el mensaje en JSON, sin el '\n' final del frame
+    size_t sent = 0;
+    frame_t *json = binproto_frame(message, false);
+    if (json) {
+        char timestamp[TIMESTAMP_LEN];
+        format_timestamp(timestamp);
+        raw_event_t ev = { topic, (const char *)frame_payload(json), json->len - 1, timestamp };
+        frame_t *frame = frame_encode(write_raw_event, &ev);
+        if (frame) {
+            sent = send_to_sessions(targets, words, frame);
+            frame_release(frame);
+        }
+    }
+    free(targets);
+    return sent;
+}
+
+bool topic_name_valid(const char *name) {
+    size_t len = strlen(name);
+    return len > 0 && len <= MAX_TOPIC_NAME_LEN && !strpbrk(name, ".*#");
+}
+
+bool topic_build(char *topic, const char *prefix, const char *name, const char *suffix) {
+    if (!topic_name_valid(name))
+        return false;
+    int n = suffix ? snprintf(topic, MAX_TOPIC_LEN, "%s.%s.%s", prefix, name, suffix)
+                   : snprintf(topic, MAX_TOPIC_LEN, "%s.%s", prefix, name);
+    return n > 0 && n < MAX_TOPIC_LEN;
+}
+
+void publish_presence(const char *user, const char *status) {
+    char topic[MAX_TOPIC_LEN];
+    // Un nombre como "john.doe" agregaría segmentos: ese usuario no tiene eventos
+    if (!topic_build(topic, "presence", user, NULL)) {
+        log_debug("Sin evento de presencia para %s: el nombre no es un segmento válido", user);
+        return;
+    }
+    cJSON *content = cJSON_CreateObject();
+    cJSON_AddStringToObject(content, "user", user);
+    cJSON_AddStringToObject(content, "status", status);
+    publish_event(topic, content);
+    cJSON_Delete(content);
+}
@@ -0,0 +1,59 @@
+#ifndef TOPIC_ROUTER_H
+#define TOPIC_ROUTER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cjson/cJSON.h>
+#include "frame.h"
+
+/**
+ * Enrutamiento de eventos por tópico (pub/sub).
+ *
+ * Los tópicos son segmentos separados por '.', p. ej. "presence.alice" o
+ * "room.eng.message". Los patrones de suscripción admiten dos comodines
+ * como segmento completo:
+ *   '*'  coincide con exactamente un segmento   ("presence.*")
+ *   '#'  coincide con cero o más segmentos, solo al final ("room.eng.#")
+ *
+ * Las suscripciones se guardan en un trie por segmento, de modo que
+ * publicar cuesta proporcional a la profundidad del tópico y no a la
+ * cantidad de suscriptores.
+ */
+
+#define MAX_TOPIC_LEN 256
+#define MAX_TOPIC_SEGMENTS 16
+#define MAX_TOPIC_NAME_LEN 128      // Nombre de usuario o sala dentro de un tópico
+
+// Suscribe la sesión al patrón. Retorna false si el patrón es inválido.
+bool subscribe_topic(const char *pattern, uint32_t session_id);
+
+// Cancela una suscripción. Retorna false si no existía.
+bool unsubscribe_topic(const char *pattern, uint32_t session_id);
+
+// Cancela todas las suscripciones de la sesión (al desconectarse).
+void unsubscribe_all_topics(uint32_t session_id);
+
+// Publica un evento {"type":"event","topic":...,"content":...}. El frame solo
+// se serializa si hay suscriptores, y una única vez para todos ellos.
+// No toma posesión de 'content'. Retorna la cantidad de destinatarios.
+size_t publish_event(const char *topic, const cJSON *content);
+
+// Como publish_event, con el mensaje de 'message' como content. Si el frame
+// es binario, se traduce a JSON solo cuando hay suscriptores.
+size_t publish_event_frame(const char *topic, frame_t *message);
+
+// true si 'name' sirve como un solo segmento de tópico: no vacío, sin '.',
+// '*' ni '#' y de hasta MAX_TOPIC_NAME_LEN bytes. Los nombres de usuario y
+// de sala no se restringen: uno inválido ("john.doe") solo queda sin eventos.
+bool topic_name_valid(const char *name);
+
+// Arma "<prefix>.<name>" o, con 'suffix', "<prefix>.<name>.<suffix>" en
+// 'topic' (MAX_TOPIC_LEN bytes). false si 'name' no es válido o no cabe; el
+// evento no se publica.
+bool topic_build(char *topic, const char *prefix, const char *name, const char *suffix);
+
+// Publica {"user","status"} en "presence.<user>".
+void publish_presence(const char *user, const char *status);
+
+#endif
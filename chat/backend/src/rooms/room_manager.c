@@ -0,0 +1,268 @@
+#include "room_manager.h"
+#include "connection_manager.h"
+#include "frame.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+typedef struct room_s {
+    char *name;
+    uint64_t *members;     // Bitset indexado por id de sesión
+    size_t words;          // Palabras de 64 bits en 'members'
+    size_t member_count;
+    struct room_s *next;   // Cadena del bucket
+} room_t;
+
+// Una sala de la que es miembro una sesión
+typedef struct membership_s {
+    room_t *room;
+    struct membership_s *next;
+} membership_t;
+
+// Tabla hash de salas por nombre; crece al duplicar la carga
+static room_t **room_buckets = NULL;
+static size_t bucket_count = 0;
+static size_t room_count = 0;
+
+// joined[id]: salas de la sesión 'id', para que al desconectarse se recorran
+// solo esas y no la tabla entera
+static membership_t **joined = NULL;
+static size_t joined_capacity = 0;
+
+static pthread_mutex_t rooms_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a
+static size_t hash_name(const char *name) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    return (size_t)h;
+}
+
+static bool valid_room_name(const char *room) {
+    size_t len = strlen(room);
+    return len > 0 && len <= MAX_ROOM_NAME;
+}
+
+static room_t *find_room(const char *name) {
+    if (!room_buckets)
+        return NULL;
+    room_t *cur = room_buckets[hash_name(name) & (bucket_count - 1)];
+    while (cur) {
+        if (strcmp(cur->name, name) == 0)
+            return cur;
+        cur = cur->next;
+    }
+    return NULL;
+}
+
+static bool grow_buckets(void) {
+    size_t new_count = bucket_count ? bucket_count * 2 : 64;
+    room_t **grown = calloc(new_count, sizeof(room_t *));
+    if (!grown)
+        return false;
+    for (size_t i = 0; i < bucket_count; i++) {
+        room_t *cur = room_buckets[i];
+        while (cur) {
+            room_t *next = cur->next;
+            size_t b = hash_name(cur->name) & (new_count - 1);
+            cur->next = grown[b];
+            grown[b] = cur;
+            cur = next;
+        }
+    }
+    free(room_buckets);
+    room_buckets = grown;
+    bucket_count = new_count;
+    return true;
+}
+
+static room_t *create_room(const char *name) {
+    if (room_count >= bucket_count && !grow_buckets() && !room_buckets)
+        return NULL;
+    room_t *room = calloc(1, sizeof(room_t));
+    if (!room)
+        return NULL;
+    room->name = strdup(name);
+    if (!room->name) {
+        free(room);
+        return NULL;
+    }
+    size_t b = hash_name(name) & (bucket_count - 1);
+    room->next = room_buckets[b];
+    room_buckets[b] = room;
+    room_count++;
+    return room;
+}
+
+static void destroy_room(room_t *room) {
+    room_t **cur = &room_buckets[hash_name(room->name) & (bucket_count - 1)];
+    while (*cur && *cur != room)
+        cur = &(*cur)->next;
+    if (*cur)
+        *cur = room->next;
+    room_count--;
+    free(room->members);
+    free(room->name);
+    free(room);
+}
+
+static bool room_has(const room_t *room, uint32_t id) {
+    size_t w = id / 64;
+    return w < room->words && (room->members[w] & (1ULL << (id % 64)));
+}
+
+// Anota la sala en la lista de la sesión. Requiere rooms_mutex.
+static bool add_membership(room_t *room, uint32_t id) {
+    if (id >= joined_capacity) {
+        size_t new_capacity = joined_capacity ? joined_capacity : 64;
+        while (new_capacity <= id)
+            new_capacity *= 2;
+        membership_t **grown = realloc(joined, new_capacity * sizeof(membership_t *));
+        if (!grown)
+            return false;
+        memset(grown + joined_capacity, 0, (new_capacity - joined_capacity) * sizeof(membership_t *));
+        joined = grown;
+        joined_capacity = new_capacity;
+    }
+    membership_t *m = malloc(sizeof(membership_t));
+    if (!m)
+        return false;
+    m->room = room;
+    m->next = joined[id];
+    joined[id] = m;
+    return true;
+}
+
+// Quita el bit de 'id'; elimina la sala si queda vacía. Requiere rooms_mutex.
+static void clear_member(room_t *room, uint32_t id) {
+    room->members[id / 64] &= ~(1ULL << (id % 64));
+    room->member_count--;
+    if (room->member_count == 0)
+        destroy_room(room);
+}
+
+// Quita 'id' de la sala y de su lista de salas. Requiere rooms_mutex.
+static bool room_remove(room_t *room, uint32_t id) {
+    if (!room_has(room, id))
+        return false;
+    membership_t **cur = &joined[id];
+    while (*cur && (*cur)->room != room)
+        cur = &(*cur)->next;
+    if (*cur) {
+        membership_t *m = *cur;
+        *cur = m->next;
+        free(m);
+    }
+    clear_member(room, id);
+    return true;
+}
+
+bool join_room(const char *room_name, uint32_t session_id) {
+    if (session_id == SESSION_NONE || !valid_room_name(room_name))
+        return false;
+    bool ok = false;
+    pthread_mutex_lock(&rooms_mutex);
+    room_t *room = find_room(room_name);
+    if (!room)
+        room = create_room(room_name);
+    if (room) {
+        size_t w = session_id / 64;
+        if (w >= room->words) {
+            // El bitset solo crece hasta el id más alto de sus miembros
+            size_t new_words = w + 1;
+            uint64_t *grown = realloc(room->members, new_words * sizeof(uint64_t));
+            if (grown) {
+                memset(grown + room->words, 0, (new_words - room->words) * sizeof(uint64_t));
+                room->members = grown;
+                room->words = new_words;
+            }
+        }
+        if (room_has(room, session_id)) {
+            ok = true;
+        } else if (w < room->words && add_membership(room, session_id)) {
+            room->members[w] |= 1ULL << (session_id % 64);
+            room->member_count++;
+            ok = true;
+        } else if (room->member_count == 0) {
+            destroy_room(room);
+        }
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+    return ok;
+}
+
+bool leave_room(const char *room_name, uint32_t session_id) {
+    bool ok = false;
+    pthread_mutex_lock(&rooms_mutex);
+    room_t *room = find_room(room_name);
+    if (room)
+        ok = room_remove(room, session_id);
+    pthread_mutex_unlock(&rooms_mutex);
+    return ok;
+}
+
+void leave_all_rooms(uint32_t session_id) {
+    if (session_id == SESSION_NONE)
+        return;
+    pthread_mutex_lock(&rooms_mutex);
+    membership_t *m = session_id < joined_capacity ? joined[session_id] : NULL;
+    if (m)
+        joined[session_id] = NULL;
+    while (m) {
+        membership_t *next = m->next;
+        clear_member(m->room, session_id);
+        free(m);
+        m = next;
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+}
+
+bool is_room_member(const char *room_name, uint32_t session_id) {
+    bool member = false;
+    pthread_mutex_lock(&rooms_mutex);
+    room_t *room = find_room(room_name);
+    if (room)
+        member = room_has(room, session_id);
+    pthread_mutex_unlock(&rooms_mutex);
+    return member;
+}
+
+size_t room_broadcast(const char *room_name, const char *message, size_t message_len) {
+    frame_t *frame = frame_create(message, message_len);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame de la sala %s", room_name);
+        return 0;
+    }
+    size_t sent = room_broadcast_frame(room_name, frame);
+    frame_release(frame);
+    return sent;
+}
+
+size_t room_broadcast_frame(const char *room_name, frame_t *frame) {
+    size_t sent = 0;
+    pthread_mutex_lock(&rooms_mutex);
+    room_t *room = find_room(room_name);
+    if (room)
+        sent = send_to_sessions(room->members, room->words, frame);
+    pthread_mutex_unlock(&rooms_mutex);
+    return sent;
+}
+
+cJSON* get_room_list(void) {
+    cJSON *array = cJSON_CreateArray();
+    pthread_mutex_lock(&rooms_mutex);
+    for (size_t i = 0; i < bucket_count; i++) {
+        for (room_t *cur = room_buckets[i]; cur; cur = cur->next) {
+            cJSON *entry = cJSON_CreateObject();
+            cJSON_AddStringToObject(entry, "name", cur->name);
+            cJSON_AddNumberToObject(entry, "members", (double)cur->member_count);
+            cJSON_AddItemToArray(array, entry);
+        }
+    }
+    pthread_mutex_unlock(&rooms_mutex);
+    return array;
+}
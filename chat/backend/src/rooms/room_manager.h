@@ -0,0 +1,43 @@
+#ifndef ROOM_MANAGER_H
+#define ROOM_MANAGER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <cjson/cJSON.h>
+#include "frame.h"
+
+/**
+ * Salas (canales) con nombre.
+ *
+ * La membresía de cada sala es un bitset sobre los ids de sesión densos de
+ * connection_manager, así que el envío a una sala recorre solo las palabras
+ * del bitset y encola el mismo frame serializado para cada miembro.
+ */
+
+#define MAX_ROOM_NAME 64
+
+// Agrega la sesión a la sala (la crea si no existe). Retorna false si el nombre es inválido.
+bool join_room(const char *room, uint32_t session_id);
+
+// Quita la sesión de la sala; la sala se elimina al quedar vacía.
+// Retorna false si la sesión no era miembro.
+bool leave_room(const char *room, uint32_t session_id);
+
+// Quita la sesión de todas las salas (al desconectarse el cliente). Recorre
+// solo las salas de la sesión, no todas las existentes.
+void leave_all_rooms(uint32_t session_id);
+
+// Indica si la sesión pertenece a la sala.
+bool is_room_member(const char *room, uint32_t session_id);
+
+// Envía 'message' a todos los miembros de la sala, serializándolo una sola vez.
+// Retorna la cantidad de destinatarios.
+size_t room_broadcast(const char *room, const char *message, size_t message_len);
+// Como room_broadcast, con un frame ya serializado (no toma su referencia).
+size_t room_broadcast_frame(const char *room, frame_t *frame);
+
+// Lista las salas existentes con su cantidad de miembros.
+cJSON* get_room_list(void);
+
+#endif
@@ -3,6 +3,18 @@
 #include "time_utils.h"
 #include "user_manager.h"
 #include "connection_manager.h"
+#include "room_manager.h"
+#include "topic_router.h"
+#include "metrics.h"
+#include "trace.h"
+#include "slab.h"
+#include "json_arena.h"
+#include "json_slice.h"
+#include "text_scan.h"
+#include "frame.h"
+#include "binproto.h"
+#include "broadcast_batch.h"
+#include "local_gateway.h"
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,14 +26,36 @@
 // Estructura para representar una tarea en la cola
 typedef struct task_s {
     struct lws *wsi;
-    char *msg;
-    size_t msg_len;
+    rx_buffer_t *rx;        // Mensaje tal como llegó; la tarea tiene una referencia
+    uint64_t received_ns;   // monotonic_ns() al recibirse en libwebsockets
+    trace_t *trace;         // Traza del mensaje (NULL si no se muestreó)
     struct task_s *next;
 } task_t;
 
-// Cola de tareas (FIFO)
-static task_t *task_queue = NULL;
-static task_t *task_queue_tail = NULL;
+/* Cola de tareas de una conexión. Las conexiones con tareas forman una
+   lista circular que los workers recorren con deficit round robin: en cada
+   turno una conexión puede despachar hasta DRR_QUANTUM bytes (más lo que no
+   usó en el turno anterior), así que un cliente con muchos mensajes en cola
+   no hace esperar a los demás detrás de todos ellos.
+   Mientras un worker procesa una tarea, la cola de esa conexión queda fuera
+   de la ronda (busy) y vuelve al terminar: los mensajes de una conexión se
+   procesan de a uno y en el orden en que llegaron. */
+typedef struct conn_queue_s {
+    struct lws *wsi;
+    task_t *head;
+    task_t *tail;
+    size_t deficit;                 // Bytes que aún puede despachar en este turno
+    bool busy;                      // Un worker procesa una tarea suya
+    struct conn_queue_s *next;      // Siguiente en la lista de activas
+    struct conn_queue_s *hash_next;
+} conn_queue_t;
+
+#define CONN_QUEUE_BUCKETS 1024
+
+static conn_queue_t *conn_queues[CONN_QUEUE_BUCKETS];   // wsi -> cola con tareas
+static conn_queue_t *active_head = NULL;                 // Turno actual
+static conn_queue_t *active_tail = NULL;
+static size_t task_queue_depth = 0;
 
 // Mecanismos de sincronización
 static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -32,19 +66,121 @@ static pthread_t *threads = NULL;
 static size_t thread_count = 0;
 static bool stop_pool = false;
 
-// Hilo adicional para monitorear inactividad
+// Hilo adicional para liberar sesiones caídas
 static pthread_t monitor_thread;
 
-/**
- * Prototipo de la función que procesará la lógica del mensaje.
- * Se ejecuta dentro de un hilo del pool.
- */
-static void process_message(struct lws *wsi, const char *msg, size_t msg_len);
+static size_t conn_bucket(const struct lws *wsi) {
+    uint64_t v = (uintptr_t)wsi;    // En 64 bits aun en 32: ahí v >> 32 sobre uintptr_t es UB
+    v ^= v >> 17;
+    v *= 0x9E3779B97F4A7C15ULL;
+    return (size_t)(v >> 32) & (CONN_QUEUE_BUCKETS - 1);
+}
+
+/* Encola 't' en la cola de su conexión. Requiere queue_mutex tomado. */
+static bool push_task_locked(task_t *t) {
+    size_t bucket = conn_bucket(t->wsi);
+    conn_queue_t *q = conn_queues[bucket];
+    while (q && q->wsi != t->wsi)
+        q = q->hash_next;
+    if (!q) {
+        // Conexión sin tareas: entra al final de la ronda
+        q = calloc(1, sizeof(conn_queue_t));
+        if (!q)
+            return false;
+        q->wsi = t->wsi;
+        q->deficit = DRR_QUANTUM;
+        q->hash_next = conn_queues[bucket];
+        conn_queues[bucket] = q;
+        if (active_tail)
+            active_tail->next = q;
+        else
+            active_head = q;
+        active_tail = q;
+    }
+    // Una cola ocupada entra a la ronda cuando termine su tarea en curso
+    if (q->tail)
+        q->tail->next = t;
+    else
+        q->head = t;
+    q->tail = t;
+    task_queue_depth++;
+    return true;
+}
+
+/* Saca de la tabla y libera una cola que ya no está en la ronda. Requiere queue_mutex. */
+static void free_conn_queue_locked(conn_queue_t *q) {
+    conn_queue_t **bucket = &conn_queues[conn_bucket(q->wsi)];
+    while (*bucket != q)
+        bucket = &(*bucket)->hash_next;
+    *bucket = q->hash_next;
+    free(q);
+}
+
+/* Quita de la ronda y libera una cola vacía (es active_head). Requiere queue_mutex. */
+static void drop_conn_queue_locked(conn_queue_t *q) {
+    active_head = q->next;
+    if (!active_head)
+        active_tail = NULL;
+    free_conn_queue_locked(q);
+}
+
+/* Siguiente tarea según deficit round robin; su cola sale de la ronda hasta
+   que se llame a finish_task_locked. Requiere queue_mutex tomado. */
+static task_t *pop_task_locked(void) {
+    while (active_head) {
+        conn_queue_t *q = active_head;
+        task_t *t = q->head;
+        if (t->rx->len <= q->deficit) {
+            q->deficit -= t->rx->len;
+            q->head = t->next;
+            if (!q->head)
+                q->tail = NULL;
+            t->next = NULL;
+            task_queue_depth--;
+            q->busy = true;
+            active_head = q->next;
+            if (!active_head)
+                active_tail = NULL;
+            q->next = NULL;
+            return t;
+        }
+        // Turno agotado: pasa al final de la ronda con un cuanto más
+        q->deficit += DRR_QUANTUM;
+        if (q != active_tail) {
+            active_head = q->next;
+            q->next = NULL;
+            active_tail->next = q;
+            active_tail = q;
+        }
+    }
+    return NULL;
+}
+
+/* Terminó la tarea de 'wsi': su cola vuelve al frente de la ronda, donde
+   sigue su turno si le queda déficit, o se libera si no tiene más tareas.
+   Requiere queue_mutex tomado. */
+static void finish_task_locked(struct lws *wsi) {
+    conn_queue_t *q = conn_queues[conn_bucket(wsi)];
+    while (q && q->wsi != wsi)
+        q = q->hash_next;
+    if (!q)
+        return;
+    q->busy = false;
+    if (!q->head) {
+        free_conn_queue_locked(q);   // Sin tareas no acumula déficit
+        return;
+    }
+    q->next = active_head;
+    active_head = q;
+    if (!active_tail)
+        active_tail = q;
+    pthread_cond_signal(&queue_cond);
+}
 
 /**
  * Función principal de cada hilo en el pool:
- *  - Espera hasta que haya tareas en la cola.
- *  - Saca la tarea, la procesa.
+ *  - Espera hasta que haya tareas en alguna cola.
+ *  - Saca la siguiente según deficit round robin y la procesa.
  *  - Repite hasta que se ordene el cierre (stop_pool).
  */
 static void *worker_thread(void *arg) {
@@ -52,51 +188,71 @@ static void *worker_thread(void *arg) {
         pthread_mutex_lock(&queue_mutex);
 
         // Espera hasta que haya una tarea o se indique stop_pool
-        while (!stop_pool && task_queue == NULL) {
+        while (!stop_pool && active_head == NULL) {
             pthread_cond_wait(&queue_cond, &queue_mutex);
         }
 
         // Si se está cerrando el pool y no hay más tareas, salimos
-        if (stop_pool && task_queue == NULL) {
+        if (stop_pool && active_head == NULL) {
             pthread_mutex_unlock(&queue_mutex);
             break;
         }
 
-        // Extraer la primera tarea de la cola
-        task_t *t = task_queue;
-        task_queue = t->next;
-        if (task_queue == NULL) {
-            task_queue_tail = NULL;
-        }
+        task_t *t = pop_task_locked();
 
         pthread_mutex_unlock(&queue_mutex);
 
         // Procesar la tarea
-        process_message(t->wsi, t->msg, t->msg_len);
+        uint64_t dispatched_ns = monotonic_ns();
+        metrics_record_latency(METRIC_STAGE_RECEIVE_DISPATCH, dispatched_ns - t->received_ns);
+        // Los frames que se encolen mientras tanto llevan la traza del mensaje
+        trace_span(t->trace, TRACE_STAGE_QUEUE, TRACE_LANE_SERVER, t->received_ns, dispatched_ns);
+        trace_set_current(t->trace);
+        if (t->rx->binary)
+            process_binary_message(t->wsi, t->rx->data, t->rx->len);
+        else
+            process_message(t->wsi, t->rx->data, t->rx->len);
+        trace_set_current(NULL);
+        uint64_t processed_ns = monotonic_ns();
+        metrics_record_latency(METRIC_STAGE_DISPATCH_PROCESS, processed_ns - dispatched_ns);
+        trace_span(t->trace, TRACE_STAGE_PROCESS, TRACE_LANE_SERVER, dispatched_ns, processed_ns);
 
-        free(t->msg);
-        free(t);
+        pthread_mutex_lock(&queue_mutex);
+        finish_task_locked(t->wsi);
+        pthread_mutex_unlock(&queue_mutex);
+
+        trace_release(t->trace);
+        rx_buffer_release(t->rx);
+        slab_free(t);
     }
     return NULL;
 }
 
+/* Sesión caída que no se reanudó a tiempo: se libera como un cierre normal */
+static void release_parked_session(const char *username, uint32_t session_id) {
+    remove_user(username);
+    publish_presence(username, "DESCONECTADO");
+    leave_all_rooms(session_id);
+    unsubscribe_all_topics(session_id);
+}
+
 /**
- * Hilo que monitorea la inactividad de los usuarios cada cierto tiempo.
- * Llama a check_inactive_users(now) periódicamente.
+ * Hilo que libera cada cierto tiempo las sesiones caídas que pasaron
+ * RESUME_GRACE segundos sin reanudarse. La inactividad de los usuarios ya
+ * no se revisa aquí: cada conexión tiene su timer en el hilo de servicio.
  */
-static void *inactivity_monitor(void *arg) {
+static void *parked_session_monitor(void *arg) {
     (void)arg;
     while (!stop_pool) {
         sleep(5);  // Revisa cada 5 segundos (puedes ajustar)
-        time_t now = time(NULL);
-        check_inactive_users(now);
+        expire_parked_clients(time(NULL), RESUME_GRACE, release_parked_session);
     }
     return NULL;
 }
 
 /**
  * Inicializa el pool de hilos con num_threads hilos,
- * además de un hilo para monitorear inactividad.
+ * además de un hilo para liberar las sesiones caídas.
  */
 void init_thread_pool(size_t num_threads) {
     thread_count = num_threads;
@@ -110,9 +266,9 @@ void init_thread_pool(size_t num_threads) {
         }
     }
 
-    // Crear el hilo de monitoreo de inactividad
-    if (pthread_create(&monitor_thread, NULL, inactivity_monitor, NULL) != 0) {
-        log_error("No se pudo crear el hilo de monitoreo de inactividad");
+    // Crear el hilo que libera las sesiones caídas
+    if (pthread_create(&monitor_thread, NULL, parked_session_monitor, NULL) != 0) {
+        log_error("No se pudo crear el hilo de monitoreo de sesiones");
     }
 
     log_info("Pool de hilos inicializado con %zu hilos", thread_count);
@@ -136,16 +292,21 @@ void shutdown_thread_pool(void) {
     threads = NULL;
     thread_count = 0;
 
-    // Limpiar la cola de tareas, por si queda algo
-    while (task_queue) {
-        task_t *tmp = task_queue;
-        task_queue = task_queue->next;
-        free(tmp->msg);
-        free(tmp);
+    // Limpiar las colas de tareas, por si queda algo
+    while (active_head) {
+        conn_queue_t *q = active_head;
+        while (q->head) {
+            task_t *tmp = q->head;
+            q->head = tmp->next;
+            trace_release(tmp->trace);
+            rx_buffer_release(tmp->rx);
+            slab_free(tmp);
+        }
+        drop_conn_queue_locked(q);
     }
-    task_queue_tail = NULL;
+    task_queue_depth = 0;
 
-    // Finalizar también el hilo de inactividad
+    // Finalizar también el hilo de monitoreo
     pthread_join(monitor_thread, NULL);
 
     log_info("Pool de hilos finalizado");
@@ -155,30 +316,554 @@ void shutdown_thread_pool(void) {
  * Encola un mensaje (struct lws *wsi + datos) para que
  * sea procesado por algún hilo del pool.
  */
-void dispatch_message(struct lws *wsi, const char *msg, size_t msg_len) {
-    task_t *t = (task_t *)malloc(sizeof(task_t));
+void dispatch_message(struct lws *wsi, rx_buffer_t *rx, uint64_t first_rx_ns) {
+    // La tarea referencia el buffer recibido: el payload no se vuelve a copiar
+    task_t *t = slab_alloc(sizeof(task_t));
+    if (!t) {
+        log_error("Error al asignar memoria para la tarea");
+        rx_buffer_release(rx);
+        return;
+    }
     t->wsi = wsi;
-    t->msg = (char *)malloc(msg_len);
-    memcpy(t->msg, msg, msg_len);
-    t->msg_len = msg_len;
+    t->rx = rx;
+    t->received_ns = monotonic_ns();
+    t->trace = trace_begin(first_rx_ns, t->received_ns);
     t->next = NULL;
 
     pthread_mutex_lock(&queue_mutex);
-    if (task_queue_tail == NULL) {
-        // Cola vacía
-        task_queue = t;
-        task_queue_tail = t;
-    } else {
-        // Agregar al final de la cola
-        task_queue_tail->next = t;
-        task_queue_tail = t;
+    bool queued = push_task_locked(t);
+    if (queued)
+        pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    if (!queued) {
+        log_error("Error al asignar memoria para la cola de la conexión");
+        trace_release(t->trace);
+        rx_buffer_release(rx);
+        slab_free(t);
     }
-    pthread_cond_signal(&queue_cond);
+}
+
+size_t get_task_queue_depth(void) {
+    pthread_mutex_lock(&queue_mutex);
+    size_t depth = task_queue_depth;
     pthread_mutex_unlock(&queue_mutex);
+    return depth;
+}
+
+/* Cuenta el mensaje en las métricas y le pone el tipo a su traza */
+static void count_message(const char *type) {
+    metric_msg_type_t counted = metrics_msg_type(type);
+    metrics_count_message(counted);
+    trace_set_type(counted);
+}
+
+/* Copia el "id" de la petición en la respuesta, para que el cliente pueda
+   tener varias peticiones en vuelo y asociar cada respuesta a la suya */
+static void add_request_id(cJSON *response, const cJSON *request_id) {
+    if (cJSON_IsNumber(request_id) || cJSON_IsString(request_id))
+        cJSON_AddItemToObject(response, "id", cJSON_Duplicate(request_id, 1));
+}
+
+/* Responde al remitente con un error simple */
+static void send_error_reply(struct lws *wsi, const char *content, const cJSON *request_id) {
+    cJSON *error = cJSON_CreateObject();
+    cJSON_AddStringToObject(error, "type", "error");
+    cJSON_AddStringToObject(error, "sender", "server");
+    cJSON_AddStringToObject(error, "content", content);
+    add_request_id(error, request_id);
+    char *error_str = cJSON_PrintUnformatted(error);
+    enqueue_pending_message(wsi, error_str, strlen(error_str));
+    cJSON_Delete(error);
+    cJSON_free(error_str);
+}
+
+/* Registra 'username' en 'wsi' y le responde register_success o error.
+   Con 'restored_token' (ya verificado) reclama el usuario restaurado de un
+   snapshot y su cola, en vez de registrar uno nuevo. */
+static void handle_register(struct lws *wsi, const char *username, const char *restored_token,
+                            const cJSON *request_id) {
+    char ip[46] = "local";
+    if (!local_gateway_wsi(wsi)) {
+        int fd = lws_get_socket_fd(wsi);
+        char peer_name[256];
+        lws_get_peer_addresses(wsi, fd, peer_name, sizeof(peer_name), ip, sizeof(ip));
+    }
+    log_info("Conexión desde IP: %s", ip);
+
+    bool result = restored_token ? claim_restored_user(username, ip) : register_user(username, ip);
+    if (result) {
+        log_info("Usuario %s registrado exitosamente (hilo %lu)",
+                 username, (unsigned long)pthread_self());
+        add_client(wsi, username, restored_token);
+        publish_presence(username, "ACTIVO");
+
+        // Construir respuesta de "register_success"
+        cJSON *response = cJSON_CreateObject();
+        cJSON_AddStringToObject(response, "type", "register_success");
+        cJSON_AddStringToObject(response, "sender", "server");
+        cJSON_AddStringToObject(response, "content", "Registro exitoso");
+        cJSON_AddItemToObject(response, "userList", get_registered_users());
+        // Token para reanudar la sesión si se cae la conexión
+        char token[RESUME_TOKEN_LEN + 1];
+        if (get_resume_token(wsi, token))
+            cJSON_AddStringToObject(response, "resume_token", token);
+
+        char timestamp[TIMESTAMP_LEN];
+        format_timestamp(timestamp);
+        cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+        add_request_id(response, request_id);
+        char *response_str = cJSON_PrintUnformatted(response);
+        size_t response_len = strlen(response_str);
+
+        // Enviar al mismo wsi (respuesta de registro)
+        enqueue_pending_message(wsi, response_str, response_len);
+
+        cJSON_Delete(response);
+        cJSON_free(response_str);
+    } else {
+        // Usuario ya existe
+        log_error("El usuario %s ya existe (hilo %lu)",
+                  username, (unsigned long)pthread_self());
+
+        cJSON *response = cJSON_CreateObject();
+        cJSON_AddStringToObject(response, "type", "error");
+        cJSON_AddStringToObject(response, "sender", "server");
+        cJSON_AddStringToObject(response, "content", "El usuario ya existe");
+
+        char timestamp[TIMESTAMP_LEN];
+        format_timestamp(timestamp);
+        cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+        add_request_id(response, request_id);
+        char *response_str = cJSON_PrintUnformatted(response);
+        size_t response_len = strlen(response_str);
+
+        enqueue_pending_message(wsi, response_str, response_len);
+
+        cJSON_Delete(response);
+        cJSON_free(response_str);
+    }
+}
+
+typedef struct {
+    const char *name;
+    size_t pos;
+} name_pos_t;
+
+static int compare_name_pos(const void *a, const void *b) {
+    const name_pos_t *x = a, *y = b;
+    int cmp = strcmp(x->name, y->name);
+    if (cmp != 0)
+        return cmp;
+    return x->pos < y->pos ? -1 : x->pos > y->pos;
+}
+
+/* Quita los nombres repetidos de 'names' dejando la primera aparición de
+   cada uno, en el orden original. false si no hubo memoria. */
+static bool dedupe_names(const char **names, size_t *count) {
+    size_t n = *count;
+    name_pos_t *sorted = malloc(n * sizeof(*sorted));
+    bool *repeated = calloc(n, sizeof(*repeated));
+    if (!sorted || !repeated) {
+        free(sorted);
+        free(repeated);
+        return false;
+    }
+    for (size_t i = 0; i < n; i++)
+        sorted[i] = (name_pos_t){ names[i], i };
+    qsort(sorted, n, sizeof(*sorted), compare_name_pos);
+    for (size_t i = 1; i < n; i++) {
+        if (strcmp(sorted[i].name, sorted[i - 1].name) == 0)
+            repeated[sorted[i].pos] = true;
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!repeated[i])
+            names[kept++] = names[i];
+    }
+    *count = kept;
+    free(sorted);
+    free(repeated);
+    return true;
+}
+
+/* "multicast": el mismo "private" para cada usuario del arreglo "target".
+   El frame se arma una vez y cada destinatario recibe una referencia (una
+   sola aunque se repita en el arreglo); el remitente recibe un
+   multicast_result con los que no tenían sesión. */
+static void handle_multicast(struct lws *wsi, const cJSON *sender, const cJSON *targets,
+                             const cJSON *content, const cJSON *request_id) {
+    int count = cJSON_GetArraySize(targets);
+    if (count == 0 || count > MULTICAST_MAX_TARGETS) {
+        send_error_reply(wsi, "Cantidad de destinatarios inválida", request_id);
+        return;
+    }
+    const char **names = malloc((size_t)count * sizeof(*names));
+    bool *offline = malloc((size_t)count * sizeof(*offline));
+    if (!names || !offline) {
+        log_error("Error al asignar memoria para un multicast de %d destinatarios", count);
+        free(names);
+        free(offline);
+        return;
+    }
+    size_t n = 0;
+    const cJSON *item;
+    cJSON_ArrayForEach(item, targets) {
+        if (!cJSON_IsString(item) || item->valuestring == NULL)
+            break;
+        names[n++] = item->valuestring;
+    }
+    if (n != (size_t)count) {
+        send_error_reply(wsi, "Destinatario inválido", request_id);
+        free(names);
+        free(offline);
+        return;
+    }
+    // Un nombre repetido recibiría el mensaje dos veces
+    if (!dedupe_names(names, &n)) {
+        log_error("Error al asignar memoria para un multicast de %d destinatarios", count);
+        free(names);
+        free(offline);
+        return;
+    }
+
+    char timestamp[TIMESTAMP_LEN];
+    format_timestamp(timestamp);
+
+    // El mensaje que recibe cada destinatario, igual que un "private"
+    cJSON *message = cJSON_CreateObject();
+    cJSON_AddStringToObject(message, "type", "private");
+    if (cJSON_IsString(sender) && sender->valuestring != NULL)
+        cJSON_AddItemToObject(message, "sender", cJSON_Duplicate(sender, 1));
+    cJSON_AddItemToObject(message, "content", cJSON_Duplicate(content, 1));
+    cJSON_AddStringToObject(message, "timestamp", timestamp);
+    char *message_str = cJSON_PrintUnformatted(message);
+    frame_t *frame = frame_create(message_str, strlen(message_str));
+    cJSON_Delete(message);
+    cJSON_free(message_str);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame");
+        free(names);
+        free(offline);
+        return;
+    }
+    size_t delivered = send_multicast_frame(names, n, frame, offline);
+    frame_release(frame);
+
+    // Un solo resultado para el remitente
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "type", "multicast_result");
+    cJSON_AddStringToObject(response, "sender", "server");
+    cJSON *result = cJSON_CreateObject();
+    cJSON_AddNumberToObject(result, "delivered", (double)delivered);
+    cJSON *missing = cJSON_CreateArray();
+    for (size_t i = 0; i < n; i++) {
+        if (offline[i])
+            cJSON_AddItemToArray(missing, cJSON_CreateString(names[i]));
+    }
+    cJSON_AddItemToObject(result, "offline", missing);
+    cJSON_AddItemToObject(response, "content", result);
+    cJSON_AddStringToObject(response, "timestamp", timestamp);
+    add_request_id(response, request_id);
+    char *response_str = cJSON_PrintUnformatted(response);
+    enqueue_pending_message(wsi, response_str, strlen(response_str));
+    cJSON_Delete(response);
+    cJSON_free(response_str);
+    free(names);
+    free(offline);
+}
+
+/* "search_users": una página de los usuarios cuyo nombre empieza con "content".
+   "status" filtra por estado y "limit" acota la página; la respuesta trae
+   "next" si quedan más, y se pide la siguiente con ese valor en "cursor". */
+static void handle_search_users(struct lws *wsi, const cJSON *json, const cJSON *request_id) {
+    const cJSON *prefix = cJSON_GetObjectItemCaseSensitive(json, "content");
+    const cJSON *status = cJSON_GetObjectItemCaseSensitive(json, "status");
+    const cJSON *cursor = cJSON_GetObjectItemCaseSensitive(json, "cursor");
+    const cJSON *limit = cJSON_GetObjectItemCaseSensitive(json, "limit");
+
+    size_t page = SEARCH_USERS_DEFAULT_LIMIT;
+    if (cJSON_IsNumber(limit)) {
+        if (limit->valuedouble < 1 || limit->valuedouble > SEARCH_USERS_MAX_LIMIT) {
+            send_error_reply(wsi, "Límite de página inválido", request_id);
+            return;
+        }
+        page = (size_t)limit->valuedouble;
+    }
+
+    bool more = false;
+    cJSON *users = search_users(cJSON_IsString(prefix) ? prefix->valuestring : "",
+                                cJSON_IsString(status) ? status->valuestring : NULL,
+                                cJSON_IsString(cursor) ? cursor->valuestring : NULL,
+                                page, &more);
+
+    cJSON *response = cJSON_CreateObject();
+    cJSON_AddStringToObject(response, "type", "search_users_response");
+    cJSON_AddStringToObject(response, "sender", "server");
+    cJSON *result = cJSON_CreateObject();
+    // El cursor de la página siguiente es el último nombre de esta
+    if (more) {
+        const cJSON *last = cJSON_GetArrayItem(users, cJSON_GetArraySize(users) - 1);
+        cJSON_AddItemToObject(result, "next",
+                              cJSON_Duplicate(cJSON_GetObjectItemCaseSensitive(last, "username"), 1));
+    }
+    cJSON_AddItemToObject(result, "users", users);
+    cJSON_AddItemToObject(response, "content", result);
+
+    char timestamp[TIMESTAMP_LEN];
+    format_timestamp(timestamp);
+    cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+    add_request_id(response, request_id);
+    char *response_str = cJSON_PrintUnformatted(response);
+    enqueue_pending_message(wsi, response_str, strlen(response_str));
+    cJSON_Delete(response);
+    cJSON_free(response_str);
+}
+
+/* ---------- Reenvío sin DOM ---------- */
+
+/* Mensaje reenviado: los campos son slices del buffer recibido */
+typedef struct {
+    const char *type;
+    const json_slice_t *sender;
+    const json_slice_t *target;     // Solo room_message
+    const json_slice_t *content;
+    const char *timestamp;
+} forward_t;
+
+/* Mismo texto que arma handle_message: type, sender, [target], content, timestamp.
+   sender y target vienen sin escapes; content se copia escapado tal como llegó. */
+static void write_forward(json_writer_t *w, const void *ctx) {
+    const forward_t *f = ctx;
+    json_write_literal(w, "{\"type\":");
+    json_write_string(w, f->type);
+    json_write_literal(w, ",\"sender\":\"");
+    json_write_raw(w, f->sender->ptr, f->sender->len);
+    if (f->target) {
+        json_write_literal(w, "\",\"target\":\"");
+        json_write_raw(w, f->target->ptr, f->target->len);
+    }
+    json_write_literal(w, "\",\"content\":\"");
+    json_write_raw(w, f->content->ptr, f->content->len);
+    json_write_literal(w, "\",\"timestamp\":");
+    json_write_string(w, f->timestamp);
+    json_write_literal(w, "}");
+}
+
+/* El mismo mensaje para un emisor de chat-protocol-bin; strings sin escapes */
+typedef struct {
+    bin_type_t type;
+    const bin_field_t *sender;
+    const bin_field_t *target;      // Solo room_message
+    const bin_field_t *content;
+    const char *timestamp;
+} bin_forward_t;
+
+static void write_forward_binary(json_writer_t *w, const void *ctx) {
+    const bin_forward_t *f = ctx;
+    bin_write_type(w, f->type);
+    bin_write_str(w, BIN_KEY_SENDER, f->sender->str, f->sender->str_len);
+    if (f->target)
+        bin_write_str(w, BIN_KEY_TARGET, f->target->str, f->target->str_len);
+    bin_write_str(w, BIN_KEY_CONTENT, f->content->str, f->content->str_len);
+    bin_write_str(w, BIN_KEY_TIMESTAMP, f->timestamp, strlen(f->timestamp));
+}
+
+typedef struct {
+    const char *content;
+    const char *id;         // Token JSON del "id" de la petición, o NULL
+    size_t id_len;
+} error_reply_t;
+
+static void write_error(json_writer_t *w, const void *ctx) {
+    const error_reply_t *e = ctx;
+    json_write_literal(w, "{\"type\":\"error\",\"sender\":\"server\",\"content\":");
+    json_write_string(w, e->content);
+    if (e->id) {
+        json_write_literal(w, ",\"id\":");
+        json_write_raw(w, e->id, e->id_len);
+    }
+    json_write_literal(w, "}");
+}
+
+/* Reenvío ya validado; sender y target sin escapes */
+typedef struct {
+    bool is_private;
+    bool is_room;
+    const char *sender;
+    const char *target;
+    const char *id;         // Token JSON del "id", o NULL
+    size_t id_len;
+} route_t;
+
+/* Encola 'frame' (en el formato del emisor) para sus destinatarios y
+   publica el evento del tópico */
+static void route_forward(struct lws *wsi, const route_t *r, frame_t *frame) {
+    if (r->is_private) {
+        delivery_receipt_t *receipt = NULL;
+        if (r->id)
+            receipt = delivery_receipt_create_raw(r->sender, r->id, r->id_len);
+        if (!send_private_frame(r->target, frame, receipt)) {
+            error_reply_t error = { "Usuario destino no encontrado", r->id, r->id_len };
+            frame_t *reply = frame_encode(write_error, &error);
+            if (reply) {
+                enqueue_pending_frame(wsi, reply);
+                frame_release(reply);
+            }
+        }
+    } else if (r->is_room) {
+        size_t sent = room_broadcast_frame(r->target, frame);
+        log_debug("Mensaje de sala %s encolado para %zu miembros", r->target, sent);
+        char topic[MAX_TOPIC_LEN];
+        if (topic_build(topic, "room", r->target, "message"))
+            publish_event_frame(topic, frame);
+    } else {
+        broadcast_batch_add(frame);
+        publish_event_frame("chat.broadcast", frame);
+    }
 }
 
 /**
- * process_message:
+ * Reenvía "broadcast", "private" y "room_message" sin armar un DOM: los
+ * campos se leen como slices del mensaje y se escriben directo en el frame
+ * de salida. Retorna false, sin efectos, si el mensaje es de otro tipo o
+ * trae algo que este camino no reproduce igual que cJSON (sender o target
+ * con escapes, un "id" con decimales, un emisor fuera de la sala...); en ese
+ * caso lo procesa handle_message.
+ */
+static bool forward_message(struct lws *wsi, const char *msg, size_t msg_len) {
+    json_fields_t fields;
+    if (!json_slice_scan(msg, msg_len, &fields))
+        return false;
+
+    char type[16];
+    char sender[256];
+    char target[256];
+    const json_slice_t *sender_slice = json_slice_get(&fields, "sender");
+    const json_slice_t *content = json_slice_get(&fields, "content");
+    if (!json_slice_copy(json_slice_get(&fields, "type"), type, sizeof(type)) ||
+        !json_slice_copy(sender_slice, sender, sizeof(sender)) ||
+        !content || content->kind != JSON_SLICE_STRING)
+        return false;
+
+    bool is_private = strcmp(type, "private") == 0;
+    bool is_room = strcmp(type, "room_message") == 0;
+    if (!is_private && !is_room && strcmp(type, "broadcast") != 0)
+        return false;
+
+    const json_slice_t *target_slice = NULL;
+    if (is_private || is_room) {
+        target_slice = json_slice_get(&fields, "target");
+        if (!json_slice_copy(target_slice, target, sizeof(target)))
+            return false;
+    }
+    // El error de "no perteneces a la sala" lo arma handle_message
+    if (is_room && !is_room_member(target, get_client_session(wsi)))
+        return false;
+
+    // cJSON reescribe los números con fracción o exponente al imprimirlos
+    const json_slice_t *id = json_slice_get(&fields, "id");
+    if (id && id->kind == JSON_SLICE_NUMBER && (!id->integer || id->len > 15))
+        return false;
+    if (id && id->kind == JSON_SLICE_OTHER)
+        id = NULL;
+
+    count_message(type);
+    update_user_activity(sender);
+
+    char timestamp[TIMESTAMP_LEN];
+    format_timestamp(timestamp);
+    forward_t fwd = { type, sender_slice, is_room ? target_slice : NULL, content, timestamp };
+    frame_t *frame = frame_encode(write_forward, &fwd);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame");
+        return true;
+    }
+    route_t route = { is_private, is_room, sender, target_slice ? target : NULL, NULL, 0 };
+    if (id)
+        route.id = json_slice_token(id, &route.id_len);
+    route_forward(wsi, &route, frame);
+    frame_release(frame);
+    return true;
+}
+
+/* String binario como C string: sin '\0' adentro y con espacio para el final */
+static bool bin_copy(const bin_field_t *field, char *buf, size_t cap) {
+    if (!field || field->kind != BIN_VAL_STR || field->str_len >= cap ||
+        memchr(field->str, '\0', field->str_len))
+        return false;
+    memcpy(buf, field->str, field->str_len);
+    buf[field->str_len] = '\0';
+    return true;
+}
+
+/**
+ * forward_message para un emisor de chat-protocol-bin: el frame de salida se
+ * arma en binario y los destinatarios JSON reciben su traducción, hecha una
+ * sola vez por frame. Las mismas condiciones que forward_message; un "id"
+ * que no sea un entero chico ni un string corto va por handle_message.
+ */
+static bool forward_binary(struct lws *wsi, const bin_msg_t *msg) {
+    bool is_private = msg->type == BIN_TYPE_PRIVATE;
+    bool is_room = msg->type == BIN_TYPE_ROOM_MESSAGE;
+    if (!is_private && !is_room && msg->type != BIN_TYPE_BROADCAST)
+        return false;
+
+    char sender[256];
+    char target[256];
+    const bin_field_t *sender_field = bin_get(msg, BIN_KEY_SENDER);
+    const bin_field_t *content = bin_get(msg, BIN_KEY_CONTENT);
+    if (!bin_copy(sender_field, sender, sizeof(sender)) || !content || content->kind != BIN_VAL_STR)
+        return false;
+    const bin_field_t *target_field = NULL;
+    if (is_private || is_room) {
+        target_field = bin_get(msg, BIN_KEY_TARGET);
+        if (!bin_copy(target_field, target, sizeof(target)))
+            return false;
+    }
+    if (is_room && !is_room_member(target, get_client_session(wsi)))
+        return false;
+
+    // El recibo y el error llevan el "id" como token JSON
+    char id_token[80];
+    json_writer_t id = { id_token, 0 };
+    const bin_field_t *id_field = bin_get(msg, BIN_KEY_ID);
+    if (id_field && id_field->kind == BIN_VAL_INT) {
+        if (id_field->num > 999999999999999LL || id_field->num < -99999999999999LL)
+            return false;
+        id.len = (size_t)snprintf(id_token, sizeof(id_token), "%lld", (long long)id_field->num);
+    } else if (id_field && id_field->kind == BIN_VAL_STR) {
+        json_writer_t measure = { NULL, 0 };
+        json_write_string_len(&measure, id_field->str, id_field->str_len);
+        if (measure.len > sizeof(id_token))
+            return false;
+        json_write_string_len(&id, id_field->str, id_field->str_len);
+    } else if (id_field) {
+        return false;
+    }
+
+    count_message(msg->type_name);
+    update_user_activity(sender);
+
+    char timestamp[TIMESTAMP_LEN];
+    format_timestamp(timestamp);
+    bin_forward_t fwd = { msg->type, sender_field, is_room ? target_field : NULL, content, timestamp };
+    frame_t *frame = frame_encode_binary(write_forward_binary, &fwd);
+    if (!frame) {
+        log_error("Error al asignar memoria para el frame");
+        return true;
+    }
+    route_t route = { is_private, is_room, sender, target_field ? target : NULL,
+                      id_field ? id_token : NULL, id.len };
+    route_forward(wsi, &route, frame);
+    frame_release(frame);
+    return true;
+}
+
+/**
+ * handle_message:
  * Aquí se concentra la lógica que antes tenías en LWS_CALLBACK_RECEIVE:
  *  - Parsear JSON con cJSON
  *  - Manejar "register", "broadcast", "private", "list_users", etc.
@@ -189,11 +874,9 @@ void dispatch_message(struct lws *wsi, const char *msg, size_t msg_len) {
  *  - send_private_message(...) (que encola mensaje a un usuario)
  *  - enqueue_pending_message(wsi, data, len) (para enviar respuesta a 'wsi')
  */
-static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
-    log_info("Hilo %lu procesando mensaje: %.*s",
-             (unsigned long)pthread_self(), (int)msg_len, msg);
-
-    cJSON *json = cJSON_Parse(msg);
+static void handle_message(struct lws *wsi, const char *msg, size_t msg_len) {
+    // Exactamente los msg_len bytes que validó utf8_valid, sin depender de un '\0'
+    cJSON *json = cJSON_ParseWithLength(msg, msg_len);
     if (!json) {
         log_error("Error al parsear JSON en hilo %lu", (unsigned long)pthread_self());
         return;
@@ -204,6 +887,8 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
         cJSON_Delete(json);
         return;
     }
+    count_message(type->valuestring);
+    cJSON *request_id = cJSON_GetObjectItemCaseSensitive(json, "id");
 
     // Actualizar actividad del usuario, excepto si es "disconnect"
     cJSON *sender = cJSON_GetObjectItemCaseSensitive(json, "sender");
@@ -215,59 +900,36 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
     // Manejo de los distintos tipos de mensajes
     if (strcmp(type->valuestring, "register") == 0) {
         cJSON *sender = cJSON_GetObjectItemCaseSensitive(json, "sender");
+        if (cJSON_IsString(sender) && sender->valuestring != NULL)
+            handle_register(wsi, sender->valuestring, NULL, request_id);
+    }
+    else if (strcmp(type->valuestring, "resume") == 0) {
+        // Reconexión: content = token de reanudación, last_seq = último frame recibido
+        cJSON *sender = cJSON_GetObjectItemCaseSensitive(json, "sender");
+        cJSON *token = cJSON_GetObjectItemCaseSensitive(json, "content");
+        cJSON *last_seq = cJSON_GetObjectItemCaseSensitive(json, "last_seq");
         if (cJSON_IsString(sender) && sender->valuestring != NULL) {
-            int fd = lws_get_socket_fd(wsi);
-            char ip[46];
-            char peer_name[256];
-            lws_get_peer_addresses(wsi, fd, peer_name, sizeof(peer_name), ip, sizeof(ip));
-            log_info("Conexión desde IP: %s", ip);
-
-            bool result = register_user(sender->valuestring, ip);
-            if (result) {
-                log_info("Usuario %s registrado exitosamente (hilo %lu)",
-                         sender->valuestring, (unsigned long)pthread_self());
-                add_client(wsi, sender->valuestring);
-
-                // Construir respuesta de "register_success"
-                cJSON *response = cJSON_CreateObject();
-                cJSON_AddStringToObject(response, "type", "register_success");
-                cJSON_AddStringToObject(response, "sender", "server");
-                cJSON_AddStringToObject(response, "content", "Registro exitoso");
-                cJSON_AddItemToObject(response, "userList", get_registered_users());
-
-                char *timestamp = get_timestamp();
-                cJSON_AddStringToObject(response, "timestamp", timestamp);
-                free(timestamp);
-
-                char *response_str = cJSON_PrintUnformatted(response);
-                size_t response_len = strlen(response_str);
-
-                // Enviar al mismo wsi (respuesta de registro)
-                enqueue_pending_message(wsi, response_str, response_len);
-
-                cJSON_Delete(response);
-                free(response_str);
-            } else {
-                // Usuario ya existe
-                log_error("El usuario %s ya existe (hilo %lu)",
-                          sender->valuestring, (unsigned long)pthread_self());
-
-                cJSON *response = cJSON_CreateObject();
-                cJSON_AddStringToObject(response, "type", "error");
-                cJSON_AddStringToObject(response, "sender", "server");
-                cJSON_AddStringToObject(response, "content", "El usuario ya existe");
-
-                char *timestamp = get_timestamp();
-                cJSON_AddStringToObject(response, "timestamp", timestamp);
-                free(timestamp);
-
-                char *response_str = cJSON_PrintUnformatted(response);
-                size_t response_len = strlen(response_str);
-
-                enqueue_pending_message(wsi, response_str, response_len);
+            cJSON *response = cJSON_CreateObject();
+            cJSON_AddStringToObject(response, "type", "resume_success");
+            cJSON_AddStringToObject(response, "sender", "server");
+            cJSON_AddStringToObject(response, "content", "Sesión reanudada");
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
+            cJSON_AddStringToObject(response, "timestamp", timestamp);
+            add_request_id(response, request_id);
 
-                cJSON_Delete(response);
-                free(response_str);
+            bool resumed = cJSON_IsString(token) && token->valuestring != NULL &&
+                           resume_client(wsi, sender->valuestring, token->valuestring,
+                                         cJSON_IsNumber(last_seq) ? (uint64_t)last_seq->valuedouble : 0,
+                                         response);
+            cJSON_Delete(response);
+            // Sin sesión guardada: si el servidor se reinició, el token reclama el
+            // usuario restaurado y su cola; si no (o expiró), registro normal
+            if (!resumed) {
+                bool restored = cJSON_IsString(token) && token->valuestring != NULL &&
+                                restored_session_matches(sender->valuestring, token->valuestring);
+                handle_register(wsi, sender->valuestring,
+                                restored ? token->valuestring : NULL, request_id);
             }
         }
     }
@@ -285,18 +947,25 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
             }
             cJSON_AddItemToObject(response, "content", cJSON_Duplicate(content, 1));
 
-            char *timestamp = get_timestamp();
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
             cJSON_AddStringToObject(response, "timestamp", timestamp);
-            free(timestamp);
 
             char *response_str = cJSON_PrintUnformatted(response);
             size_t response_len = strlen(response_str);
 
-            // broadcast_message encola el mensaje para todos
-            broadcast_message(response_str, response_len);
+            // Encola el mensaje para todos, agrupado con los demás broadcasts
+            frame_t *frame = frame_create(response_str, response_len);
+            if (frame) {
+                broadcast_batch_add(frame);
+                frame_release(frame);
+            } else {
+                log_error("Error al asignar memoria para el frame");
+            }
+            publish_event("chat.broadcast", response);
 
             cJSON_Delete(response);
-            free(response_str);
+            cJSON_free(response_str);
         }
     }
     else if (strcmp(type->valuestring, "private") == 0) {
@@ -316,20 +985,32 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
             }
             cJSON_AddItemToObject(response, "content", cJSON_Duplicate(content, 1));
 
-            char *timestamp = get_timestamp();
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
             cJSON_AddStringToObject(response, "timestamp", timestamp);
-            free(timestamp);
 
             char *response_str = cJSON_PrintUnformatted(response);
             size_t response_len = strlen(response_str);
 
-            // send_private_message encola el mensaje para 'target'
-            send_private_message(target->valuestring, response_str, response_len);
+            // send_private_message encola el mensaje para 'target'; con "id",
+            // el remitente recibe un delivery_ack cuando se escribe
+            delivery_receipt_t *receipt = NULL;
+            if (cJSON_IsString(senderJson) && senderJson->valuestring != NULL)
+                receipt = delivery_receipt_create(senderJson->valuestring, request_id);
+            if (!send_private_message(target->valuestring, response_str, response_len, receipt))
+                send_error_reply(wsi, "Usuario destino no encontrado", request_id);
 
             cJSON_Delete(response);
-            free(response_str);
+            cJSON_free(response_str);
         }
     }
+    else if (strcmp(type->valuestring, "multicast") == 0) {
+        // Un privado a varios usuarios: "target" es un arreglo de nombres
+        cJSON *targets = cJSON_GetObjectItemCaseSensitive(json, "target");
+        cJSON *content = cJSON_GetObjectItemCaseSensitive(json, "content");
+        if (cJSON_IsArray(targets) && cJSON_IsString(content) && content->valuestring != NULL)
+            handle_multicast(wsi, sender, targets, content, request_id);
+    }
     else if (strcmp(type->valuestring, "list_users") == 0) {
         // Listar usuarios conectados
         cJSON *response = cJSON_CreateObject();
@@ -339,17 +1020,22 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
         // Insertar la lista de usuarios
         cJSON_AddItemToObject(response, "content", get_registered_users());
 
-        char *timestamp = get_timestamp();
+        char timestamp[TIMESTAMP_LEN];
+        format_timestamp(timestamp);
         cJSON_AddStringToObject(response, "timestamp", timestamp);
-        free(timestamp);
 
+        add_request_id(response, request_id);
         char *response_str = cJSON_PrintUnformatted(response);
         size_t response_len = strlen(response_str);
 
         enqueue_pending_message(wsi, response_str, response_len);
 
         cJSON_Delete(response);
-        free(response_str);
+        cJSON_free(response_str);
+    }
+    else if (strcmp(type->valuestring, "search_users") == 0) {
+        // Directorio paginado, por prefijo y estado
+        handle_search_users(wsi, json, request_id);
     }
     else if (strcmp(type->valuestring, "user_info") == 0) {
         // Obtener info de un usuario
@@ -363,17 +1049,18 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
                 cJSON_AddStringToObject(response, "target", target->valuestring);
                 cJSON_AddItemToObject(response, "content", info);
 
-                char *timestamp = get_timestamp();
+                char timestamp[TIMESTAMP_LEN];
+                format_timestamp(timestamp);
                 cJSON_AddStringToObject(response, "timestamp", timestamp);
-                free(timestamp);
 
+                add_request_id(response, request_id);
                 char *response_str = cJSON_PrintUnformatted(response);
                 size_t response_len = strlen(response_str);
 
                 enqueue_pending_message(wsi, response_str, response_len);
 
                 cJSON_Delete(response);
-                free(response_str);
+                cJSON_free(response_str);
             } else {
                 // Usuario no encontrado
                 cJSON *response = cJSON_CreateObject();
@@ -381,17 +1068,18 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
                 cJSON_AddStringToObject(response, "sender", "server");
                 cJSON_AddStringToObject(response, "content", "Usuario no encontrado");
 
-                char *timestamp = get_timestamp();
+                char timestamp[TIMESTAMP_LEN];
+                format_timestamp(timestamp);
                 cJSON_AddStringToObject(response, "timestamp", timestamp);
-                free(timestamp);
 
+                add_request_id(response, request_id);
                 char *response_str = cJSON_PrintUnformatted(response);
                 size_t response_len = strlen(response_str);
 
                 enqueue_pending_message(wsi, response_str, response_len);
 
                 cJSON_Delete(response);
-                free(response_str);
+                cJSON_free(response_str);
             }
         }
     }
@@ -416,17 +1104,24 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
                 cJSON_AddStringToObject(content_obj, "status", new_status->valuestring);
                 cJSON_AddItemToObject(response, "content", content_obj);
 
-                char *timestamp = get_timestamp();
+                char timestamp[TIMESTAMP_LEN];
+                format_timestamp(timestamp);
                 cJSON_AddStringToObject(response, "timestamp", timestamp);
-                free(timestamp);
 
+                add_request_id(response, request_id);
                 char *response_str = cJSON_PrintUnformatted(response);
                 size_t response_len = strlen(response_str);
 
                 enqueue_pending_message(wsi, response_str, response_len);
 
+                // Eventos de presencia para los suscriptores
+                publish_presence(senderJson->valuestring, new_status->valuestring);
+                char topic[MAX_TOPIC_LEN];
+                if (topic_build(topic, "user", senderJson->valuestring, "status"))
+                    publish_event(topic, content_obj);
+
                 cJSON_Delete(response);
-                free(response_str);
+                cJSON_free(response_str);
             } else {
                 log_error("No se pudo cambiar el estado de %s (hilo %lu)",
                           senderJson->valuestring, (unsigned long)pthread_self());
@@ -436,25 +1131,171 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
                 cJSON_AddStringToObject(response, "sender", "server");
                 cJSON_AddStringToObject(response, "content", "No se pudo cambiar el estado");
 
-                char *timestamp = get_timestamp();
+                char timestamp[TIMESTAMP_LEN];
+                format_timestamp(timestamp);
                 cJSON_AddStringToObject(response, "timestamp", timestamp);
-                free(timestamp);
 
+                add_request_id(response, request_id);
                 char *response_str = cJSON_PrintUnformatted(response);
                 size_t response_len = strlen(response_str);
 
                 enqueue_pending_message(wsi, response_str, response_len);
 
                 cJSON_Delete(response);
-                free(response_str);
+                cJSON_free(response_str);
             }
         }
     }
+    else if (strcmp(type->valuestring, "join_room") == 0 ||
+             strcmp(type->valuestring, "leave_room") == 0) {
+        // Unirse o salir de una sala: "target" es el nombre de la sala
+        cJSON *target = cJSON_GetObjectItemCaseSensitive(json, "target");
+        if (cJSON_IsString(target) && target->valuestring != NULL) {
+            bool joining = strcmp(type->valuestring, "join_room") == 0;
+            uint32_t session = get_client_session(wsi);
+            bool ok = joining ? join_room(target->valuestring, session)
+                              : leave_room(target->valuestring, session);
+
+            cJSON *response = cJSON_CreateObject();
+            cJSON_AddStringToObject(response, "sender", "server");
+            if (ok) {
+                cJSON_AddStringToObject(response, "type", joining ? "room_joined" : "room_left");
+                cJSON_AddStringToObject(response, "target", target->valuestring);
+                cJSON_AddStringToObject(response, "content",
+                                        joining ? "Te uniste a la sala" : "Saliste de la sala");
+            } else {
+                cJSON_AddStringToObject(response, "type", "error");
+                cJSON_AddStringToObject(response, "content",
+                                        joining ? "No se pudo unir a la sala"
+                                                : "No perteneces a la sala");
+            }
+
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
+            cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+            add_request_id(response, request_id);
+            char *response_str = cJSON_PrintUnformatted(response);
+            size_t response_len = strlen(response_str);
+
+            enqueue_pending_message(wsi, response_str, response_len);
+
+            cJSON_Delete(response);
+            cJSON_free(response_str);
+        }
+    }
+    else if (strcmp(type->valuestring, "room_message") == 0) {
+        // Enviar a los miembros de una sala
+        cJSON *target = cJSON_GetObjectItemCaseSensitive(json, "target");
+        cJSON *content = cJSON_GetObjectItemCaseSensitive(json, "content");
+        if (cJSON_IsString(target) && target->valuestring != NULL &&
+            cJSON_IsString(content) && content->valuestring != NULL) {
+
+            bool is_member = is_room_member(target->valuestring, get_client_session(wsi));
+            cJSON *response = cJSON_CreateObject();
+            if (is_member) {
+                cJSON_AddStringToObject(response, "type", "room_message");
+
+                cJSON *senderJson = cJSON_GetObjectItemCaseSensitive(json, "sender");
+                if (cJSON_IsString(senderJson) && senderJson->valuestring != NULL) {
+                    cJSON_AddItemToObject(response, "sender", cJSON_Duplicate(senderJson, 1));
+                }
+                cJSON_AddStringToObject(response, "target", target->valuestring);
+                cJSON_AddItemToObject(response, "content", cJSON_Duplicate(content, 1));
+            } else {
+                cJSON_AddStringToObject(response, "type", "error");
+                cJSON_AddStringToObject(response, "sender", "server");
+                cJSON_AddStringToObject(response, "content", "No perteneces a la sala");
+                add_request_id(response, request_id);
+            }
+
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
+            cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+            char *response_str = cJSON_PrintUnformatted(response);
+            size_t response_len = strlen(response_str);
+
+            if (is_member) {
+                // room_broadcast serializa una vez y encola el frame para cada miembro
+                size_t sent = room_broadcast(target->valuestring, response_str, response_len);
+                log_debug("Mensaje de sala %s encolado para %zu miembros", target->valuestring, sent);
+
+                char topic[MAX_TOPIC_LEN];
+                if (topic_build(topic, "room", target->valuestring, "message"))
+                    publish_event(topic, response);
+            } else {
+                enqueue_pending_message(wsi, response_str, response_len);
+            }
+
+            cJSON_Delete(response);
+            cJSON_free(response_str);
+        }
+    }
+    else if (strcmp(type->valuestring, "list_rooms") == 0) {
+        // Listar salas existentes
+        cJSON *response = cJSON_CreateObject();
+        cJSON_AddStringToObject(response, "type", "list_rooms_response");
+        cJSON_AddStringToObject(response, "sender", "server");
+        cJSON_AddItemToObject(response, "content", get_room_list());
+
+        char timestamp[TIMESTAMP_LEN];
+        format_timestamp(timestamp);
+        cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+        add_request_id(response, request_id);
+        char *response_str = cJSON_PrintUnformatted(response);
+        size_t response_len = strlen(response_str);
+
+        enqueue_pending_message(wsi, response_str, response_len);
+
+        cJSON_Delete(response);
+        cJSON_free(response_str);
+    }
+    else if (strcmp(type->valuestring, "subscribe") == 0 ||
+             strcmp(type->valuestring, "unsubscribe") == 0) {
+        // Suscripción a eventos: "content" es el patrón de tópico
+        cJSON *pattern = cJSON_GetObjectItemCaseSensitive(json, "content");
+        if (cJSON_IsString(pattern) && pattern->valuestring != NULL) {
+            bool subscribing = strcmp(type->valuestring, "subscribe") == 0;
+            uint32_t session = get_client_session(wsi);
+            bool ok = subscribing ? subscribe_topic(pattern->valuestring, session)
+                                  : unsubscribe_topic(pattern->valuestring, session);
+
+            cJSON *response = cJSON_CreateObject();
+            cJSON_AddStringToObject(response, "sender", "server");
+            if (ok) {
+                cJSON_AddStringToObject(response, "type", subscribing ? "subscribed" : "unsubscribed");
+                cJSON_AddStringToObject(response, "content", pattern->valuestring);
+            } else {
+                cJSON_AddStringToObject(response, "type", "error");
+                cJSON_AddStringToObject(response, "content",
+                                        subscribing ? "Patrón de tópico inválido"
+                                                    : "Suscripción no encontrada");
+            }
+
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
+            cJSON_AddStringToObject(response, "timestamp", timestamp);
+
+            add_request_id(response, request_id);
+            char *response_str = cJSON_PrintUnformatted(response);
+            size_t response_len = strlen(response_str);
+
+            enqueue_pending_message(wsi, response_str, response_len);
+
+            cJSON_Delete(response);
+            cJSON_free(response_str);
+        }
+    }
     else if (strcmp(type->valuestring, "disconnect") == 0) {
         // Procesar desconexión controlada
         cJSON *senderJson = cJSON_GetObjectItemCaseSensitive(json, "sender");
         if (cJSON_IsString(senderJson) && senderJson->valuestring != NULL) {
+            // Salida voluntaria: al cerrar no se guarda la sesión
+            revoke_resume_token(wsi);
             remove_user(senderJson->valuestring);
+            publish_presence(senderJson->valuestring, "DESCONECTADO");
             // Notificar a todos que este usuario se desconectó
             cJSON *response = cJSON_CreateObject();
             cJSON_AddStringToObject(response, "type", "user_disconnected");
@@ -464,9 +1305,9 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
             snprintf(content_str, sizeof(content_str), "%s ha salido", senderJson->valuestring);
             cJSON_AddStringToObject(response, "content", content_str);
 
-            char *timestamp = get_timestamp();
+            char timestamp[TIMESTAMP_LEN];
+            format_timestamp(timestamp);
             cJSON_AddStringToObject(response, "timestamp", timestamp);
-            free(timestamp);
 
             char *response_str = cJSON_PrintUnformatted(response);
             size_t response_len = strlen(response_str);
@@ -475,7 +1316,7 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
             broadcast_message(response_str, response_len);
 
             cJSON_Delete(response);
-            free(response_str);
+            cJSON_free(response_str);
 
             // Forzar cierre de la conexión
             lws_close_reason(wsi, LWS_CLOSE_STATUS_NORMAL,
@@ -485,3 +1326,49 @@ static void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
 
     cJSON_Delete(json);
 }
+
+/**
+ * process_message:
+ * Los mensajes que solo se reenvían van por forward_message; el resto se
+ * parsea con cJSON en la arena del hilo, que se descarta al terminar.
+ */
+void process_message(struct lws *wsi, const char *msg, size_t msg_len) {
+    log_debug("Hilo %lu procesando mensaje: %.*s",
+             (unsigned long)pthread_self(), (int)msg_len, msg);
+    // Una pasada por bloques cubre ambos caminos: ni json_slice ni cJSON validan UTF-8
+    if (!utf8_valid(msg, msg_len)) {
+        log_error("Mensaje con UTF-8 inválido descartado en hilo %lu", (unsigned long)pthread_self());
+        return;
+    }
+    if (forward_message(wsi, msg, msg_len))
+        return;
+    json_arena_begin();
+    handle_message(wsi, msg, msg_len);
+    json_arena_end();
+}
+
+/**
+ * process_binary_message:
+ * Los reenvíos se arman en binario; el resto se traduce a JSON y sigue el
+ * camino de process_message (las respuestas se traducen al escribirlas).
+ */
+void process_binary_message(struct lws *wsi, const char *msg, size_t msg_len) {
+    bin_msg_t decoded;
+    if (!bin_decode(msg, msg_len, &decoded)) {
+        log_error("Mensaje binario inválido en hilo %lu", (unsigned long)pthread_self());
+        return;
+    }
+    if (forward_binary(wsi, &decoded))
+        return;
+    size_t json_len;
+    char *json = bin_json_text(&decoded, &json_len);
+    if (!json) {
+        log_error("Error al asignar memoria para traducir el mensaje");
+        return;
+    }
+    log_debug("Hilo %lu procesando mensaje binario: %s", (unsigned long)pthread_self(), json);
+    json_arena_begin();
+    handle_message(wsi, json, json_len);
+    json_arena_end();
+    free(json);
+}
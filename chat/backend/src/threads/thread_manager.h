@@ -3,6 +3,8 @@
 
 #include <libwebsockets.h>
 #include <stddef.h>
+#include <stdint.h>
+#include "rx_buffer.h"
 
 /**
  * Inicializa el pool de hilos con num_threads hilos.
@@ -16,8 +18,25 @@ void shutdown_thread_pool(void);
 
 /**
  * Encola un mensaje (recibido por libwebsockets) para que sea procesado
- * en uno de los hilos del pool.
+ * en uno de los hilos del pool. Toma la referencia de 'rx'. 'first_rx_ns'
+ * es el monotonic_ns() de su primer fragmento, para la traza (trace.h).
  */
-void dispatch_message(struct lws *wsi, const char *msg, size_t msg_len);
+void dispatch_message(struct lws *wsi, rx_buffer_t *rx, uint64_t first_rx_ns);
+
+/**
+ * Procesa un mensaje en el hilo actual. Los hilos del pool la llaman por
+ * cada tarea; también la usan los benchmarks para medir cada tipo de mensaje.
+ */
+void process_message(struct lws *wsi, const char *msg, size_t msg_len);
+
+/**
+ * Como process_message, para un mensaje de chat-protocol-bin (binproto.h).
+ */
+void process_binary_message(struct lws *wsi, const char *msg, size_t msg_len);
+
+/**
+ * Retorna la cantidad de tareas en cola esperando un hilo del pool.
+ */
+size_t get_task_queue_depth(void);
 
 #endif
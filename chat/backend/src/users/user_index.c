@@ -0,0 +1,362 @@
+#include "user_index.h"
+#include "slab.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct user_index_node {
+    void *value;                            // NULL: nodo sin entrada propia
+    struct user_index_node **children;      // Ordenados por el primer byte de la etiqueta
+    uint32_t counts[USER_INDEX_CLASSES];    // Entradas de cada clase en el subárbol
+    uint32_t label_len;
+    uint16_t child_count;
+    uint16_t child_cap;
+    uint8_t cls;
+    char label[];                           // Tramo del nombre desde el padre, sin '\0'
+};
+
+static user_index_node_t *node_create(const char *label, size_t len) {
+    user_index_node_t *node = slab_calloc(sizeof(*node) + len);
+    if (!node)
+        return NULL;
+    memcpy(node->label, label, len);
+    node->label_len = (uint32_t)len;
+    return node;
+}
+
+static void node_free(user_index_node_t *node) {
+    free(node->children);
+    slab_free(node);
+}
+
+static void free_subtree(user_index_node_t *node) {
+    for (size_t i = 0; i < node->child_count; i++)
+        free_subtree(node->children[i]);
+    node_free(node);
+}
+
+/* Posición del hijo cuya etiqueta empieza con 'c', o donde iría */
+static size_t child_slot(const user_index_node_t *node, unsigned char c, bool *found) {
+    size_t lo = 0, hi = node->child_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        unsigned char first = (unsigned char)node->children[mid]->label[0];
+        if (first == c) {
+            *found = true;
+            return mid;
+        }
+        if (first < c)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *found = false;
+    return lo;
+}
+
+static user_index_node_t *find_child(const user_index_node_t *node, char c) {
+    bool found;
+    size_t slot = child_slot(node, (unsigned char)c, &found);
+    return found ? node->children[slot] : NULL;
+}
+
+static bool insert_child(user_index_node_t *node, size_t slot, user_index_node_t *child) {
+    if (node->child_count == node->child_cap) {
+        size_t cap = node->child_cap ? (size_t)node->child_cap * 2 : 2;
+        user_index_node_t **grown = realloc(node->children, cap * sizeof(*grown));
+        if (!grown)
+            return false;
+        node->children = grown;
+        node->child_cap = (uint16_t)cap;    // Hasta 256: un hijo por byte inicial
+    }
+    memmove(&node->children[slot + 1], &node->children[slot],
+            (node->child_count - slot) * sizeof(*node->children));
+    node->children[slot] = child;
+    node->child_count++;
+    return true;
+}
+
+/* Nodo cuya ruta desde la raíz es exactamente 'key', o NULL */
+static user_index_node_t *lookup(const user_index_t *index, const char *key) {
+    user_index_node_t *node = index->root;
+    size_t len = strlen(key), depth = 0;
+    while (node && depth < len) {
+        node = find_child(node, key[depth]);
+        if (!node || node->label_len > len - depth ||
+            memcmp(node->label, key + depth, node->label_len) != 0)
+            return NULL;
+        depth += node->label_len;
+    }
+    return node;
+}
+
+/* Suma 'delta' a la clase 'cls' en cada nodo del camino hasta 'key', que debe existir */
+static void adjust_counts(user_index_t *index, const char *key, unsigned cls, int32_t delta) {
+    user_index_node_t *node = index->root;
+    size_t depth = 0;
+    for (;;) {
+        node->counts[cls] += (uint32_t)delta;
+        if (key[depth] == '\0')
+            break;
+        node = find_child(node, key[depth]);
+        depth += node->label_len;
+    }
+}
+
+/* Corta la etiqueta del hijo en 'slot' después de 'at' bytes: un nodo nuevo
+   con la parte común queda en su lugar y el hijo, con el resto, debajo */
+static user_index_node_t *split_child(user_index_node_t *parent, size_t slot, size_t at) {
+    user_index_node_t *child = parent->children[slot];
+    user_index_node_t *mid = node_create(child->label, at);
+    if (!mid)
+        return NULL;
+    mid->children = malloc(2 * sizeof(*mid->children));
+    if (!mid->children) {
+        node_free(mid);
+        return NULL;
+    }
+    mid->child_cap = 2;
+    mid->child_count = 1;
+    mid->children[0] = child;
+    memcpy(mid->counts, child->counts, sizeof(mid->counts));
+    memmove(child->label, child->label + at, child->label_len - at);
+    child->label_len -= (uint32_t)at;
+    parent->children[slot] = mid;
+    return mid;
+}
+
+/* El hijo en 'slot' quedó sin entrada y con un solo hijo: los une en un nodo.
+   Sin memoria queda como está, que sigue siendo correcto. */
+static void merge_child(user_index_node_t *parent, size_t slot) {
+    user_index_node_t *node = parent->children[slot];
+    user_index_node_t *only = node->children[0];
+    user_index_node_t *merged = slab_alloc(sizeof(*merged) + node->label_len + only->label_len);
+    if (!merged)
+        return;
+    *merged = *only;                        // Se queda con los hijos de 'only'
+    memcpy(merged->label, node->label, node->label_len);
+    memcpy(merged->label + node->label_len, only->label, only->label_len);
+    merged->label_len = node->label_len + only->label_len;
+    parent->children[slot] = merged;
+    slab_free(only);
+    node_free(node);
+}
+
+bool user_index_insert(user_index_t *index, const char *key, void *value, unsigned cls) {
+    if (!value || cls >= USER_INDEX_CLASSES)
+        return false;
+    if (!index->root && !(index->root = node_create("", 0)))
+        return false;
+
+    user_index_node_t *node = index->root;
+    size_t len = strlen(key), depth = 0;
+    while (depth < len) {
+        bool found;
+        size_t slot = child_slot(node, (unsigned char)key[depth], &found);
+        if (!found) {
+            user_index_node_t *leaf = node_create(key + depth, len - depth);
+            if (!leaf)
+                return false;
+            if (!insert_child(node, slot, leaf)) {
+                node_free(leaf);
+                return false;
+            }
+            node = leaf;
+            break;
+        }
+        user_index_node_t *child = node->children[slot];
+        size_t max = child->label_len < len - depth ? child->label_len : len - depth;
+        size_t common = 0;
+        while (common < max && child->label[common] == key[depth + common])
+            common++;
+        if (common < child->label_len) {
+            // El nombre se separa a mitad de la etiqueta
+            child = split_child(node, slot, common);
+            if (!child)
+                return false;
+        }
+        node = child;
+        depth += common;
+    }
+    if (node->value)
+        return false;
+    node->value = value;
+    node->cls = (uint8_t)cls;
+    index->count++;
+    adjust_counts(index, key, cls, 1);
+    return true;
+}
+
+void *user_index_find(const user_index_t *index, const char *key) {
+    user_index_node_t *node = lookup(index, key);
+    return node ? node->value : NULL;
+}
+
+void *user_index_remove(user_index_t *index, const char *key) {
+    user_index_node_t *node = index->root, *parent = NULL, *grandparent = NULL;
+    size_t slot = 0, parent_slot = 0;
+    size_t len = strlen(key), depth = 0;
+    if (!node)
+        return NULL;
+    while (depth < len) {
+        bool found;
+        size_t i = child_slot(node, (unsigned char)key[depth], &found);
+        if (!found)
+            return NULL;
+        user_index_node_t *child = node->children[i];
+        if (child->label_len > len - depth ||
+            memcmp(child->label, key + depth, child->label_len) != 0)
+            return NULL;
+        grandparent = parent;
+        parent_slot = slot;
+        parent = node;
+        slot = i;
+        node = child;
+        depth += child->label_len;
+    }
+    void *value = node->value;
+    if (!value)
+        return NULL;
+    adjust_counts(index, key, node->cls, -1);
+    node->value = NULL;
+    index->count--;
+    if (!parent)
+        return value;
+
+    // Sin la entrada, el nodo sobra si no tiene hijos o se une con el único que tiene
+    if (node->child_count == 0) {
+        memmove(&parent->children[slot], &parent->children[slot + 1],
+                (parent->child_count - slot - 1) * sizeof(*parent->children));
+        parent->child_count--;
+        node_free(node);
+        if (grandparent && !parent->value && parent->child_count == 1)
+            merge_child(grandparent, parent_slot);
+    } else if (node->child_count == 1) {
+        merge_child(parent, slot);
+    }
+    return value;
+}
+
+bool user_index_set_class(user_index_t *index, const char *key, unsigned cls) {
+    user_index_node_t *node = lookup(index, key);
+    if (!node || !node->value || cls >= USER_INDEX_CLASSES)
+        return false;
+    if (node->cls != cls) {
+        adjust_counts(index, key, node->cls, -1);
+        node->cls = (uint8_t)cls;
+        adjust_counts(index, key, cls, 1);
+    }
+    return true;
+}
+
+/* ---------- Recorrido ---------- */
+
+typedef struct {
+    unsigned mask;
+    user_index_visit_fn visit;
+    void *ctx;
+    size_t visited;
+} walk_t;
+
+// Posición de una ruta respecto del cursor
+enum {
+    WALK_SKIP,      // Todo el subárbol es menor o igual que el cursor
+    WALK_BOUNDED,   // La ruta es prefijo del cursor (o igual): se compara más abajo
+    WALK_ALL,       // Todo el subárbol es mayor que el cursor
+};
+
+/* Compara 'len' bytes de ruta con el tramo del cursor a la misma profundidad */
+static int bound(const char *path, size_t len, const char *after, size_t after_len) {
+    int cmp = memcmp(path, after, len < after_len ? len : after_len);
+    if (cmp < 0)
+        return WALK_SKIP;
+    if (cmp > 0)
+        return WALK_ALL;
+    return len <= after_len ? WALK_BOUNDED : WALK_ALL;
+}
+
+static bool has_class(const user_index_node_t *node, unsigned mask) {
+    for (unsigned c = 0; c < USER_INDEX_CLASSES; c++) {
+        if ((mask >> c & 1) && node->counts[c])
+            return true;
+    }
+    return false;
+}
+
+/* 'after' es lo que queda del cursor debajo de 'node' mientras su ruta sea
+   prefijo del cursor; NULL cuando ya todo es mayor */
+static bool walk_node(const user_index_node_t *node, const char *after, size_t after_len,
+                      walk_t *w) {
+    if (!has_class(node, w->mask))
+        return true;
+    if (!after && node->value && (w->mask >> node->cls & 1)) {
+        w->visited++;
+        if (!w->visit(node->value, w->ctx))
+            return false;
+    }
+    for (size_t i = 0; i < node->child_count; i++) {
+        const user_index_node_t *child = node->children[i];
+        const char *rest = NULL;
+        size_t rest_len = 0;
+        if (after) {
+            int pos = bound(child->label, child->label_len, after, after_len);
+            if (pos == WALK_SKIP)
+                continue;
+            if (pos == WALK_BOUNDED) {
+                rest = after + child->label_len;
+                rest_len = after_len - child->label_len;
+            } else {
+                after = NULL;       // Los hermanos siguientes también son mayores
+            }
+        }
+        if (!walk_node(child, rest, rest_len, w))
+            return false;
+    }
+    return true;
+}
+
+size_t user_index_walk(const user_index_t *index, const char *prefix, const char *after,
+                       unsigned class_mask, user_index_visit_fn visit, void *ctx) {
+    const user_index_node_t *node = index->root;
+    if (!node)
+        return 0;
+
+    // Baja hasta el nodo más alto cuyas entradas empiezan todas con 'prefix'
+    size_t prefix_len = strlen(prefix), depth = 0;
+    while (depth < prefix_len) {
+        node = find_child(node, prefix[depth]);
+        if (!node)
+            return 0;
+        size_t n = node->label_len < prefix_len - depth ? node->label_len : prefix_len - depth;
+        if (memcmp(node->label, prefix + depth, n) != 0)
+            return 0;
+        depth += node->label_len;
+    }
+
+    // Su ruta es el prefijo hasta el padre más la etiqueta completa
+    const char *rest = NULL;
+    size_t rest_len = 0;
+    if (after) {
+        size_t after_len = strlen(after);
+        size_t base = depth - node->label_len;
+        int pos = bound(prefix, base, after, after_len);
+        if (pos == WALK_BOUNDED)
+            pos = bound(node->label, node->label_len, after + base, after_len - base);
+        if (pos == WALK_SKIP)
+            return 0;
+        if (pos == WALK_BOUNDED) {
+            rest = after + depth;
+            rest_len = after_len - depth;
+        }
+    }
+
+    walk_t w = { class_mask, visit, ctx, 0 };
+    walk_node(node, rest, rest_len, &w);
+    return w.visited;
+}
+
+void user_index_clear(user_index_t *index) {
+    if (index->root)
+        free_subtree(index->root);
+    index->root = NULL;
+    index->count = 0;
+}
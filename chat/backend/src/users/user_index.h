@@ -0,0 +1,56 @@
+#ifndef USER_INDEX_H
+#define USER_INDEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Índice de nombres de usuario en un árbol radix (trie con las cadenas de un
+ * solo hijo comprimidas en una etiqueta por nodo).
+ *
+ * Buscar, insertar y quitar cuestan O(largo del nombre), sin importar cuántos
+ * usuarios haya, y los nombres con un prefijo dado se recorren en orden de
+ * bytes (el de strcmp) sin tocar el resto. Cada entrada tiene además una
+ * clase (0..USER_INDEX_CLASSES-1; user_manager usa el estado) y cada nodo
+ * cuenta las entradas de cada clase en su subárbol, así que un recorrido
+ * filtrado por clase salta las ramas que no tienen ninguna.
+ *
+ * No tiene lock propio: lo protege el mutex de quien lo usa.
+ */
+
+#define USER_INDEX_CLASSES 4
+#define USER_INDEX_ALL_CLASSES ((1u << USER_INDEX_CLASSES) - 1)
+
+typedef struct user_index_node user_index_node_t;
+
+typedef struct {
+    user_index_node_t *root;    // Etiqueta vacía; se crea con la primera entrada
+    size_t count;
+} user_index_t;
+
+// Agrega 'key' con 'value' (no NULL). false si ya existe o no hubo memoria.
+bool user_index_insert(user_index_t *index, const char *key, void *value, unsigned cls);
+
+// Valor de 'key', o NULL si no está.
+void *user_index_find(const user_index_t *index, const char *key);
+
+// Quita 'key' y retorna su valor (NULL si no estaba).
+void *user_index_remove(user_index_t *index, const char *key);
+
+// Cambia la clase de 'key'. false si no está.
+bool user_index_set_class(user_index_t *index, const char *key, unsigned cls);
+
+// Recibe cada valor del recorrido; false lo corta.
+typedef bool (*user_index_visit_fn)(void *value, void *ctx);
+
+// Recorre en orden las entradas que empiezan con 'prefix', son mayores que
+// 'after' (NULL: desde la primera) y tienen su clase en 'class_mask' (bit i =
+// clase i). Retorna cuántas visitó, incluida la que cortó el recorrido.
+size_t user_index_walk(const user_index_t *index, const char *prefix, const char *after,
+                       unsigned class_mask, user_index_visit_fn visit, void *ctx);
+
+// Quita todas las entradas (los valores son del que llama).
+void user_index_clear(user_index_t *index);
+
+#endif
@@ -1,9 +1,12 @@
 #include "user_manager.h"
+#include "user_index.h"
 #include "logger.h"
 #include "config.h"
+#include "slab.h"
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
 #include <cjson/cJSON.h>
 
 typedef struct user_node {
@@ -11,134 +14,323 @@ typedef struct user_node {
     char *ip;
     char *status;         // "ACTIVO", "OCUPADO", "INACTIVO"
     time_t last_activity; // Última actividad (timestamp)
+    bool restored;        // Cargado desde un snapshot, aún sin reconectarse
+    time_t restored_at;
     struct user_node *next;
+    struct user_node *prev;
 } user_node_t;
 
 static user_node_t *user_list = NULL;
 
-bool register_user(const char *username, const char *ip) {
-    user_node_t *current = user_list;
-    while (current) {
-        if (strcmp(current->username, username) == 0)
-            return false;
-        current = current->next;
+// Los mismos usuarios por nombre, para buscar por nombre o prefijo y estado
+static user_index_t user_index;
+
+// Protege user_list y user_index: lo usan los workers, el monitor y el escritor de snapshots.
+static pthread_mutex_t users_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Clase de cada estado en el índice; cualquier otro estado va en la última
+static const char *indexed_statuses[USER_INDEX_CLASSES - 1] = { "ACTIVO", "OCUPADO", "INACTIVO" };
+
+static unsigned status_class(const char *status) {
+    for (unsigned i = 0; i < USER_INDEX_CLASSES - 1; i++) {
+        if (strcmp(status, indexed_statuses[i]) == 0)
+            return i;
     }
-    user_node_t *new_node = malloc(sizeof(user_node_t));
+    return USER_INDEX_CLASSES - 1;
+}
+
+static user_node_t *find_user(const char *username) {
+    return user_index_find(&user_index, username);
+}
+
+static void free_user_node(user_node_t *node) {
+    slab_free(node->username);
+    slab_free(node->ip);
+    slab_free(node->status);
+    slab_free(node);
+}
+
+static user_node_t *create_user_node(const char *username, const char *ip,
+                                     const char *status, time_t last_activity) {
+    user_node_t *new_node = slab_alloc(sizeof(user_node_t));
     if (!new_node)
-        return false;
-    new_node->username = strdup(username);
-    new_node->ip = strdup(ip);
-    new_node->status = strdup("ACTIVO");
-    new_node->last_activity = time(NULL);
+        return NULL;
+    new_node->username = slab_strdup(username);
+    new_node->ip = slab_strdup(ip);
+    new_node->status = slab_strdup(status);
+    new_node->last_activity = last_activity;
+    new_node->restored = false;
+    new_node->restored_at = 0;
+    new_node->next = NULL;
+    new_node->prev = NULL;
     if (!new_node->username || !new_node->ip || !new_node->status) {
-        free(new_node->username);
-        free(new_node->ip);
-        free(new_node->status);
-        free(new_node);
+        free_user_node(new_node);
+        return NULL;
+    }
+    return new_node;
+}
+
+/* Agrega el nodo a la lista y al índice; si no entra al índice lo libera */
+static bool link_user(user_node_t *node) {
+    if (!user_index_insert(&user_index, node->username, node, status_class(node->status))) {
+        free_user_node(node);
         return false;
     }
-    new_node->next = user_list;
-    user_list = new_node;
+    node->next = user_list;
+    if (user_list)
+        user_list->prev = node;
+    user_list = node;
     return true;
 }
 
-bool change_user_status(const char *username, const char *new_status) {
-    user_node_t *current = user_list;
-    while (current) {
-        if (strcmp(current->username, username) == 0) {
-            free(current->status);
-            current->status = strdup(new_status);
-            return current->status != NULL;
+/* Quita el nodo de la lista y del índice y lo libera */
+static void unlink_user(user_node_t *node) {
+    user_index_remove(&user_index, node->username);
+    if (node->prev)
+        node->prev->next = node->next;
+    else
+        user_list = node->next;
+    if (node->next)
+        node->next->prev = node->prev;
+    free_user_node(node);
+}
+
+/* Reemplaza el estado del nodo y su clase en el índice */
+static bool set_user_status(user_node_t *node, const char *status) {
+    char *copy = slab_strdup(status);
+    if (!copy)
+        return false;
+    slab_free(node->status);
+    node->status = copy;
+    user_index_set_class(&user_index, node->username, status_class(status));
+    return true;
+}
+
+bool register_user(const char *username, const char *ip) {
+    pthread_mutex_lock(&users_mutex);
+    // Un usuario restaurado también cuenta: solo su dueño lo reclama (claim_restored_user)
+    if (find_user(username)) {
+        pthread_mutex_unlock(&users_mutex);
+        return false;
+    }
+    user_node_t *new_node = create_user_node(username, ip, "ACTIVO", time(NULL));
+    bool registered = new_node && link_user(new_node);
+    pthread_mutex_unlock(&users_mutex);
+    return registered;
+}
+
+bool claim_restored_user(const char *username, const char *ip) {
+    bool claimed = false;
+    pthread_mutex_lock(&users_mutex);
+    user_node_t *existing = find_user(username);
+    // Se re-asocia el mismo nodo, sin crear uno nuevo
+    if (existing && existing->restored) {
+        char *new_ip = slab_strdup(ip);
+        if (new_ip) {
+            slab_free(existing->ip);
+            existing->ip = new_ip;
+            existing->restored = false;
+            existing->last_activity = time(NULL);
+            claimed = true;
         }
-        current = current->next;
     }
-    return false;
+    pthread_mutex_unlock(&users_mutex);
+    return claimed;
+}
+
+bool change_user_status(const char *username, const char *new_status) {
+    bool changed = false;
+    pthread_mutex_lock(&users_mutex);
+    user_node_t *current = find_user(username);
+    if (current)
+        changed = set_user_status(current, new_status);
+    pthread_mutex_unlock(&users_mutex);
+    return changed;
 }
 
 void update_user_activity(const char *username) {
-    user_node_t *current = user_list;
     time_t now = time(NULL);
-    while (current) {
-        if (strcmp(current->username, username) == 0) {
-            current->last_activity = now;
-            // Si el usuario estaba inactivo, reactívalo
-            if (strcmp(current->status, "INACTIVO") == 0) {
-                free(current->status);
-                current->status = strdup("ACTIVO");
-                log_info("Usuario %s reactivado", username);
-            }
-            return;
+    pthread_mutex_lock(&users_mutex);
+    user_node_t *current = find_user(username);
+    if (current) {
+        current->last_activity = now;
+        // Si el usuario estaba inactivo, reactívalo
+        if (strcmp(current->status, "INACTIVO") == 0 && set_user_status(current, "ACTIVO")) {
+            log_info("Usuario %s reactivado", username);
         }
-        current = current->next;
     }
+    pthread_mutex_unlock(&users_mutex);
 }
 
 
 void check_inactive_users(time_t now) {
+    pthread_mutex_lock(&users_mutex);
     user_node_t *current = user_list;
     while (current) {
         if (strcmp(current->status, "INACTIVO") != 0) {
             if ((now - current->last_activity) >= INACTIVITY_TIMEOUT) {
                 log_info("Usuario %s inactivo por %ld segundos, cambiando estado a INACTIVO",
                          current->username, now - current->last_activity);
-                free(current->status);
-                current->status = strdup("INACTIVO");
+                set_user_status(current, "INACTIVO");
             }
         }
         current = current->next;
     }
+    pthread_mutex_unlock(&users_mutex);
 }
 
 void remove_user(const char *username) {
-    user_node_t **current = &user_list;
-    while (*current) {
-        if (strcmp((*current)->username, username) == 0) {
-            user_node_t *to_delete = *current;
-            *current = to_delete->next;
-            free(to_delete->username);
-            free(to_delete->ip);
-            free(to_delete->status);
-            free(to_delete);
-            return;
-        }
-        current = &((*current)->next);
-    }
+    pthread_mutex_lock(&users_mutex);
+    user_node_t *node = find_user(username);
+    if (node)
+        unlink_user(node);
+    pthread_mutex_unlock(&users_mutex);
 }
 
 void free_all_users(void) {
+    pthread_mutex_lock(&users_mutex);
     user_node_t *current = user_list;
     while (current) {
         user_node_t *next = current->next;
-        free(current->username);
-        free(current->ip);
-        free(current->status);
-        free(current);
+        free_user_node(current);
         current = next;
     }
     user_list = NULL;
+    user_index_clear(&user_index);
+    pthread_mutex_unlock(&users_mutex);
 }
 
 cJSON* get_user_info(const char *target) {
-    user_node_t *current = user_list;
-    while (current) {
-        if (strcmp(current->username, target) == 0) {
-            cJSON *info = cJSON_CreateObject();
-            cJSON_AddStringToObject(info, "ip", current->ip);
-            cJSON_AddStringToObject(info, "status", current->status);
-            return info;
-        }
-        current = current->next;
+    cJSON *info = NULL;
+    pthread_mutex_lock(&users_mutex);
+    user_node_t *current = find_user(target);
+    if (current) {
+        info = cJSON_CreateObject();
+        cJSON_AddStringToObject(info, "ip", current->ip);
+        cJSON_AddStringToObject(info, "status", current->status);
     }
-    return NULL;
+    pthread_mutex_unlock(&users_mutex);
+    return info;
 }
 
 
 cJSON* get_registered_users(void) {
     cJSON *array = cJSON_CreateArray();
+    pthread_mutex_lock(&users_mutex);
     user_node_t *current = user_list;
     while (current) {
         cJSON_AddItemToArray(array, cJSON_CreateString(current->username));
         current = current->next;
     }
+    pthread_mutex_unlock(&users_mutex);
     return array;
 }
+
+size_t get_user_count(void) {
+    pthread_mutex_lock(&users_mutex);
+    size_t count = user_index.count;
+    pthread_mutex_unlock(&users_mutex);
+    return count;
+}
+
+typedef struct {
+    cJSON *users;
+    const char *status;     // NULL: cualquiera
+    size_t limit;
+    size_t found;
+    bool more;
+} search_t;
+
+static bool add_search_result(void *value, void *ctx) {
+    const user_node_t *node = value;
+    search_t *search = ctx;
+    // La clase "otros" agrupa varios estados: se confirma el exacto
+    if (search->status && strcmp(node->status, search->status) != 0)
+        return true;
+    if (search->found == search->limit) {
+        search->more = true;
+        return false;
+    }
+    cJSON *user = cJSON_CreateObject();
+    cJSON_AddStringToObject(user, "username", node->username);
+    cJSON_AddStringToObject(user, "status", node->status);
+    cJSON_AddItemToArray(search->users, user);
+    search->found++;
+    return true;
+}
+
+cJSON *search_users(const char *prefix, const char *status, const char *after,
+                    size_t limit, bool *more) {
+    search_t search = { cJSON_CreateArray(), status, limit, 0, false };
+    unsigned mask = status ? 1u << status_class(status) : USER_INDEX_ALL_CLASSES;
+    pthread_mutex_lock(&users_mutex);
+    user_index_walk(&user_index, prefix, after, mask, add_search_result, &search);
+    pthread_mutex_unlock(&users_mutex);
+    *more = search.more;
+    return search.users;
+}
+
+size_t snapshot_users(user_snapshot_t **out) {
+    *out = NULL;
+    pthread_mutex_lock(&users_mutex);
+    size_t count = 0;
+    for (user_node_t *cur = user_list; cur; cur = cur->next)
+        count++;
+    user_snapshot_t *users = count ? calloc(count, sizeof(user_snapshot_t)) : NULL;
+    if (count && !users) {
+        pthread_mutex_unlock(&users_mutex);
+        return 0;
+    }
+    size_t i = 0;
+    for (user_node_t *cur = user_list; cur; cur = cur->next, i++) {
+        users[i].username = strdup(cur->username);
+        users[i].ip = strdup(cur->ip);
+        users[i].status = strdup(cur->status);
+        users[i].last_activity = cur->last_activity;
+    }
+    pthread_mutex_unlock(&users_mutex);
+    *out = users;
+    return count;
+}
+
+void free_user_snapshot(user_snapshot_t *users, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        free(users[i].username);
+        free(users[i].ip);
+        free(users[i].status);
+    }
+    free(users);
+}
+
+bool restore_user(const char *username, const char *ip,
+                  const char *status, time_t last_activity) {
+    pthread_mutex_lock(&users_mutex);
+    if (find_user(username)) {
+        pthread_mutex_unlock(&users_mutex);
+        return false;
+    }
+    user_node_t *node = create_user_node(username, ip, status, last_activity);
+    if (!node) {
+        pthread_mutex_unlock(&users_mutex);
+        return false;
+    }
+    node->restored = true;
+    node->restored_at = time(NULL);
+    bool restored = link_user(node);
+    pthread_mutex_unlock(&users_mutex);
+    return restored;
+}
+
+void expire_restored_users(time_t now, time_t max_age) {
+    pthread_mutex_lock(&users_mutex);
+    user_node_t *node = user_list;
+    while (node) {
+        user_node_t *next = node->next;
+        if (node->restored && (now - node->restored_at) >= max_age) {
+            log_info("Usuario restaurado %s no se reconectó, eliminándolo", node->username);
+            unlink_user(node);
+        }
+        node = next;
+    }
+    pthread_mutex_unlock(&users_mutex);
+}
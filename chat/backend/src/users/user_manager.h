@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <cjson/cJSON.h>
 #include <time.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -20,6 +21,7 @@ bool change_user_status(const char *username, const char *new_status);
 void update_user_activity(const char *username);
 
 // Revisa la inactividad de los usuarios y actualiza su estado a "INACTIVO" si corresponde.
+// El servidor ya no la usa (cada conexión tiene su timer en main.c); recorre todo el registro.
 void check_inactive_users(time_t now);
 
 // Funciones para eliminar y liberar usuarios.
@@ -31,6 +33,42 @@ cJSON* get_user_info(const char *target);
 
 cJSON* get_registered_users(void);
 
+// Cantidad de usuarios en el registro (incluye los restaurados sin reconectar).
+size_t get_user_count(void);
+
+// Una página del directorio: los usuarios cuyo nombre empieza con 'prefix'
+// ("" para todos), en orden de nombre, a partir del primero mayor que 'after'
+// (NULL: desde el principio) y con estado 'status' (NULL: cualquiera).
+// Retorna un arreglo cJSON de hasta 'limit' objetos {username, status};
+// *more indica si quedan más después del último.
+cJSON *search_users(const char *prefix, const char *status, const char *after,
+                    size_t limit, bool *more);
+
+// Copia de un usuario usada por los snapshots de reinicio en caliente.
+typedef struct user_snapshot {
+    char *username;
+    char *ip;
+    char *status;
+    time_t last_activity;
+} user_snapshot_t;
+
+// Copia el registro completo en un arreglo nuevo (el lock se mantiene solo durante la copia).
+// Retorna la cantidad de usuarios; liberar con free_user_snapshot().
+size_t snapshot_users(user_snapshot_t **out);
+void free_user_snapshot(user_snapshot_t *users, size_t count);
+
+// Restaura un usuario desde un snapshot. Queda marcado como restaurado (y
+// register_user rechaza el nombre) hasta que lo reclame claim_restored_user.
+bool restore_user(const char *username, const char *ip,
+                  const char *status, time_t last_activity);
+
+// Re-asocia un usuario restaurado a una conexión nueva. El llamador ya
+// verificó el token de reanudación. Retorna false si no está restaurado.
+bool claim_restored_user(const char *username, const char *ip);
+
+// Elimina los usuarios restaurados que no se reconectaron en max_age segundos.
+void expire_restored_users(time_t now, time_t max_age);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,70 @@
+#include "histogram.h"
+#include <string.h>
+
+static size_t bucket_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT)
+        return (size_t)value;
+    int exp = 63 - __builtin_clzll(value);
+    if (exp > HIST_MAX_EXP)
+        return HIST_BUCKETS - 1;
+    int shift = exp - HIST_SUB_BITS;
+    size_t sub = (size_t)(value >> shift) - HIST_SUB_COUNT;
+    return (size_t)(shift + 1) * HIST_SUB_COUNT + sub;
+}
+
+uint64_t histogram_bucket_upper(size_t index) {
+    if (index < HIST_SUB_COUNT)
+        return index;
+    int shift = (int)(index / HIST_SUB_COUNT) - 1;
+    uint64_t sub = index % HIST_SUB_COUNT;
+    uint64_t lower = (HIST_SUB_COUNT + sub) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+// Incremento de un único escritor: evita el lock xadd de un fetch_add
+static inline void bump(_Atomic uint64_t *counter, uint64_t delta) {
+    uint64_t v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + delta, memory_order_relaxed);
+}
+
+void histogram_record(histogram_t *hist, uint64_t value) {
+    bump(&hist->counts[bucket_index(value)], 1);
+    bump(&hist->total, 1);
+    bump(&hist->sum, value);
+    if (value > atomic_load_explicit(&hist->max, memory_order_relaxed))
+        atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+}
+
+void histogram_merge(histogram_t *dst, const histogram_t *src) {
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        uint64_t c = atomic_load_explicit(&src->counts[i], memory_order_relaxed);
+        if (c)
+            bump(&dst->counts[i], c);
+    }
+    bump(&dst->total, atomic_load_explicit(&src->total, memory_order_relaxed));
+    bump(&dst->sum, atomic_load_explicit(&src->sum, memory_order_relaxed));
+    uint64_t max = atomic_load_explicit(&src->max, memory_order_relaxed);
+    if (max > atomic_load_explicit(&dst->max, memory_order_relaxed))
+        atomic_store_explicit(&dst->max, max, memory_order_relaxed);
+}
+
+uint64_t histogram_percentile(const histogram_t *hist, double p) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++)
+        total += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)((p / 100.0) * (double)total + 0.5);
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += atomic_load_explicit(&hist->counts[i], memory_order_relaxed);
+        if (seen >= rank) {
+            uint64_t upper = histogram_bucket_upper(i);
+            uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+            return upper < max ? upper : max;
+        }
+    }
+    return atomic_load_explicit(&hist->max, memory_order_relaxed);
+}
@@ -0,0 +1,42 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/**
+ * Histograma log-lineal estilo HDR para latencias en nanosegundos.
+ *
+ * Cada potencia de 2 se divide en HIST_SUB_COUNT sub-buckets, lo que da un
+ * error relativo máximo de ~6% con un costo de registro O(1) (un clz y un
+ * incremento). Los contadores son atómicos pero cada histograma tiene un
+ * único escritor: se actualizan con load/store relajados, sin instrucciones
+ * con lock, y un lector puede agregarlos en cualquier momento.
+ */
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 47                       // Hasta ~2^48 ns (~78 horas)
+#define HIST_BUCKETS ((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB_COUNT)
+
+typedef struct {
+    _Atomic uint64_t counts[HIST_BUCKETS];
+    _Atomic uint64_t total;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} histogram_t;
+
+// Registra un valor. Solo debe llamarlo el hilo dueño del histograma.
+void histogram_record(histogram_t *hist, uint64_t value);
+
+// Suma 'src' en 'dst' (dst no debe tener escritores concurrentes).
+void histogram_merge(histogram_t *dst, const histogram_t *src);
+
+// Valor aproximado del percentil p (0..100).
+uint64_t histogram_percentile(const histogram_t *hist, double p);
+
+// Límite superior (inclusive) de los valores que caen en el bucket 'index'.
+uint64_t histogram_bucket_upper(size_t index);
+
+#endif
@@ -0,0 +1,98 @@
+#include "json_arena.h"
+#include "config.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <cjson/cJSON.h>
+
+#define ARENA_ALIGN 16
+
+/* Cabecera de un bloque; los datos empiezan justo después (16 bytes, alineados) */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+} arena_chunk_t;
+
+typedef struct {
+    arena_chunk_t *base;        // Bloque de JSON_ARENA_SIZE que se reutiliza en cada mensaje
+    arena_chunk_t *overflow;    // Bloques extra del mensaje actual; se liberan al terminar
+    char *cur;
+    char *end;
+    bool active;
+} json_arena_t;
+
+static __thread json_arena_t arena;
+
+static char *chunk_data(arena_chunk_t *chunk) {
+    return (char *)(chunk + 1);
+}
+
+static bool chunk_contains(arena_chunk_t *chunk, const void *ptr) {
+    uintptr_t start = (uintptr_t)chunk_data(chunk);
+    return (uintptr_t)ptr >= start && (uintptr_t)ptr < start + chunk->size;
+}
+
+static bool arena_owns(const void *ptr) {
+    if (arena.base && chunk_contains(arena.base, ptr))
+        return true;
+    for (arena_chunk_t *c = arena.overflow; c; c = c->next) {
+        if (chunk_contains(c, ptr))
+            return true;
+    }
+    return false;
+}
+
+static void *arena_malloc(size_t size) {
+    if (!arena.active)
+        return malloc(size);
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(arena.end - arena.cur) < size) {
+        // Mensaje más grande que la arena: un bloque extra solo por este mensaje
+        size_t chunk_size = size > JSON_ARENA_SIZE ? size : JSON_ARENA_SIZE;
+        arena_chunk_t *chunk = malloc(sizeof(arena_chunk_t) + chunk_size);
+        if (!chunk)
+            return NULL;
+        chunk->size = chunk_size;
+        chunk->next = arena.overflow;
+        arena.overflow = chunk;
+        arena.cur = chunk_data(chunk);
+        arena.end = arena.cur + chunk_size;
+    }
+    void *ptr = arena.cur;
+    arena.cur += size;
+    return ptr;
+}
+
+static void arena_free(void *ptr) {
+    // Lo que vino de malloc (antes del tramo o en otro hilo) se libera normal
+    if (ptr && !arena_owns(ptr))
+        free(ptr);
+}
+
+void json_arena_install(void) {
+    cJSON_Hooks hooks = { arena_malloc, arena_free };
+    cJSON_InitHooks(&hooks);
+}
+
+void json_arena_begin(void) {
+    if (!arena.base) {
+        arena.base = malloc(sizeof(arena_chunk_t) + JSON_ARENA_SIZE);
+        if (!arena.base)
+            return;     // Sin arena: cJSON sigue usando malloc
+        arena.base->size = JSON_ARENA_SIZE;
+        arena.base->next = NULL;
+    }
+    arena.cur = chunk_data(arena.base);
+    arena.end = arena.cur + arena.base->size;
+    arena.active = true;
+}
+
+void json_arena_end(void) {
+    arena.active = false;
+    while (arena.overflow) {
+        arena_chunk_t *next = arena.overflow->next;
+        free(arena.overflow);
+        arena.overflow = next;
+    }
+    arena.cur = arena.end = NULL;
+}
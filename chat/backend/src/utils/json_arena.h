@@ -0,0 +1,24 @@
+#ifndef JSON_ARENA_H
+#define JSON_ARENA_H
+
+/**
+ * Arena por hilo para las asignaciones de cJSON.
+ *
+ * json_arena_install() registra hooks con cJSON_InitHooks. Entre
+ * json_arena_begin() y json_arena_end(), lo que cJSON aloca en ese hilo sale
+ * de un bloque propio avanzando un puntero, y sus frees no hacen nada;
+ * json_arena_end() lo descarta todo de una vez. Fuera de ese tramo, y en los
+ * demás hilos, los hooks delegan en malloc/free.
+ *
+ * Nada que cJSON aloque dentro del tramo puede sobrevivir a json_arena_end():
+ * lo que deba guardarse se copia. Los strings de cJSON_Print* se liberan
+ * siempre con cJSON_free(), nunca con free().
+ */
+
+// Instala los hooks. Llamarla una vez, antes de crear hilos y de usar cJSON.
+void json_arena_install(void);
+
+void json_arena_begin(void);
+void json_arena_end(void);
+
+#endif
@@ -0,0 +1,435 @@
+#include "json_slice.h"
+#include "text_scan.h"
+#include <string.h>
+#include <stdio.h>
+
+typedef struct {
+    const char *p;
+    const char *end;
+} scanner_t;
+
+static void skip_ws(scanner_t *s) {
+    while (s->p < s->end && (*s->p == ' ' || *s->p == '\t' || *s->p == '\n' || *s->p == '\r'))
+        s->p++;
+}
+
+static bool is_hex(char c) {
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+static unsigned hex_value(char c) {
+    if (c >= '0' && c <= '9')
+        return (unsigned)(c - '0');
+    return (unsigned)((c | 0x20) - 'a' + 10);
+}
+
+static unsigned read_hex4(const char *p) {
+    return hex_value(p[0]) << 12 | hex_value(p[1]) << 8 | hex_value(p[2]) << 4 | hex_value(p[3]);
+}
+
+/* Un \uXXXX en 'p', con 'n' bytes disponibles desde ahí */
+static bool hex4_escape(const char *p, ptrdiff_t n) {
+    return n >= 6 && p[0] == '\\' && p[1] == 'u' &&
+           is_hex(p[2]) && is_hex(p[3]) && is_hex(p[4]) && is_hex(p[5]);
+}
+
+/* String con s->p en la comilla inicial; deja s->p después de la final */
+static bool scan_string(scanner_t *s, json_slice_t *out) {
+    s->p++;
+    const char *start = s->p;
+    bool escaped = false;
+    while (s->p < s->end) {
+        // Los bytes comunes se saltan de a bloques
+        s->p += json_plain_span(s->p, (size_t)(s->end - s->p));
+        if (s->p >= s->end || *s->p == '"')
+            break;
+        unsigned char c = (unsigned char)*s->p;
+        if (c < 0x20)
+            return false;
+        if (c == '\\') {
+            escaped = true;
+            if (s->end - s->p < 2)
+                return false;
+            char e = s->p[1];
+            if (e == 'u') {
+                if (!hex4_escape(s->p, s->end - s->p))
+                    return false;
+                unsigned cp = read_hex4(s->p + 2);
+                s->p += 6;
+                // Sustitutos solo en pares alto + bajo, como exige cJSON: uno
+                // suelto no tiene UTF-8 válido
+                if (cp >= 0xDC00 && cp < 0xE000)
+                    return false;
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    if (!hex4_escape(s->p, s->end - s->p))
+                        return false;
+                    unsigned low = read_hex4(s->p + 2);
+                    if (low < 0xDC00 || low >= 0xE000)
+                        return false;
+                    s->p += 6;
+                }
+                continue;
+            }
+            if (e == '\0' || !strchr("\"\\/bfnrt", e))
+                return false;
+            s->p += 2;
+            continue;
+        }
+        s->p++;
+    }
+    if (s->p >= s->end)
+        return false;
+    if (out) {
+        out->ptr = start;
+        out->len = (size_t)(s->p - start);
+        out->kind = JSON_SLICE_STRING;
+        out->escaped = escaped;
+        out->integer = false;
+    }
+    s->p++;
+    return true;
+}
+
+static bool scan_number(scanner_t *s, json_slice_t *out) {
+    const char *start = s->p;
+    bool integer = true;
+    if (*s->p == '-')
+        s->p++;
+    if (s->p >= s->end || !is_digit(*s->p))
+        return false;
+    if (*s->p == '0') {
+        s->p++;
+    } else {
+        while (s->p < s->end && is_digit(*s->p))
+            s->p++;
+    }
+    if (s->p < s->end && *s->p == '.') {
+        integer = false;
+        s->p++;
+        if (s->p >= s->end || !is_digit(*s->p))
+            return false;
+        while (s->p < s->end && is_digit(*s->p))
+            s->p++;
+    }
+    if (s->p < s->end && (*s->p == 'e' || *s->p == 'E')) {
+        integer = false;
+        s->p++;
+        if (s->p < s->end && (*s->p == '+' || *s->p == '-'))
+            s->p++;
+        if (s->p >= s->end || !is_digit(*s->p))
+            return false;
+        while (s->p < s->end && is_digit(*s->p))
+            s->p++;
+    }
+    out->ptr = start;
+    out->len = (size_t)(s->p - start);
+    out->kind = JSON_SLICE_NUMBER;
+    out->escaped = false;
+    out->integer = integer;
+    return true;
+}
+
+static bool scan_literal(scanner_t *s, const char *word) {
+    size_t n = strlen(word);
+    if ((size_t)(s->end - s->p) < n || memcmp(s->p, word, n) != 0)
+        return false;
+    s->p += n;
+    return true;
+}
+
+static bool scan_value(scanner_t *s, json_slice_t *out, int depth);
+
+/* Objeto o arreglo anidado: solo se valida */
+static bool scan_container(scanner_t *s, int depth) {
+    if (depth >= JSON_SLICE_MAX_DEPTH)
+        return false;
+    char close = *s->p == '{' ? '}' : ']';
+    bool object = close == '}';
+    s->p++;
+    skip_ws(s);
+    if (s->p < s->end && *s->p == close) {
+        s->p++;
+        return true;
+    }
+    while (s->p < s->end) {
+        json_slice_t ignored;
+        if (object) {
+            if (*s->p != '"' || !scan_string(s, NULL))
+                return false;
+            skip_ws(s);
+            if (s->p >= s->end || *s->p != ':')
+                return false;
+            s->p++;
+            skip_ws(s);
+        }
+        if (!scan_value(s, &ignored, depth + 1))
+            return false;
+        skip_ws(s);
+        if (s->p >= s->end)
+            return false;
+        if (*s->p == close) {
+            s->p++;
+            return true;
+        }
+        if (*s->p != ',')
+            return false;
+        s->p++;
+        skip_ws(s);
+    }
+    return false;
+}
+
+static bool scan_value(scanner_t *s, json_slice_t *out, int depth) {
+    if (s->p >= s->end)
+        return false;
+    const char *start = s->p;
+    switch (*s->p) {
+        case '"':
+            return scan_string(s, out);
+        case '{':
+        case '[':
+            if (!scan_container(s, depth))
+                return false;
+            break;
+        case 't':
+            if (!scan_literal(s, "true"))
+                return false;
+            break;
+        case 'f':
+            if (!scan_literal(s, "false"))
+                return false;
+            break;
+        case 'n':
+            if (!scan_literal(s, "null"))
+                return false;
+            break;
+        default:
+            return scan_number(s, out);
+    }
+    out->ptr = start;
+    out->len = (size_t)(s->p - start);
+    out->kind = JSON_SLICE_OTHER;
+    out->escaped = false;
+    out->integer = false;
+    return true;
+}
+
+bool json_slice_scan(const char *json, size_t len, json_fields_t *out) {
+    scanner_t s = { json, json + len };
+    out->count = 0;
+    skip_ws(&s);
+    if (s.p >= s.end || *s.p != '{')
+        return false;
+    s.p++;
+    skip_ws(&s);
+    if (s.p < s.end && *s.p == '}')
+        return true;
+    while (s.p < s.end) {
+        if (out->count == JSON_SLICE_MAX_FIELDS || *s.p != '"')
+            return false;
+        json_slice_t *key = &out->keys[out->count];
+        // Una clave escapada podría coincidir con otra ya vista al decodificarla
+        if (!scan_string(&s, key) || key->escaped)
+            return false;
+        skip_ws(&s);
+        if (s.p >= s.end || *s.p != ':')
+            return false;
+        s.p++;
+        skip_ws(&s);
+        if (!scan_value(&s, &out->values[out->count], 1))
+            return false;
+        out->count++;
+        skip_ws(&s);
+        if (s.p >= s.end)
+            return false;
+        if (*s.p == '}')
+            return true;
+        if (*s.p != ',')
+            return false;
+        s.p++;
+        skip_ws(&s);
+    }
+    return false;
+}
+
+bool json_slice_array(const char *json, size_t len, json_slice_each_fn each, void *ctx) {
+    scanner_t s = { json, json + len };
+    skip_ws(&s);
+    if (s.p >= s.end || *s.p != '[')
+        return false;
+    s.p++;
+    skip_ws(&s);
+    if (s.p < s.end && *s.p == ']')
+        return true;
+    while (s.p < s.end) {
+        json_slice_t value;
+        if (!scan_value(&s, &value, 1) || !each(&value, ctx))
+            return false;
+        skip_ws(&s);
+        if (s.p >= s.end)
+            return false;
+        if (*s.p == ']')
+            return true;
+        if (*s.p != ',')
+            return false;
+        s.p++;
+        skip_ws(&s);
+    }
+    return false;
+}
+
+const json_slice_t *json_slice_get(const json_fields_t *fields, const char *key) {
+    size_t key_len = strlen(key);
+    for (size_t i = 0; i < fields->count; i++) {
+        if (fields->keys[i].len == key_len && memcmp(fields->keys[i].ptr, key, key_len) == 0)
+            return &fields->values[i];
+    }
+    return NULL;
+}
+
+bool json_slice_copy(const json_slice_t *slice, char *buf, size_t cap) {
+    if (!slice || slice->kind != JSON_SLICE_STRING || slice->escaped || slice->len >= cap)
+        return false;
+    memcpy(buf, slice->ptr, slice->len);
+    buf[slice->len] = '\0';
+    return true;
+}
+
+const char *json_slice_token(const json_slice_t *slice, size_t *len) {
+    if (slice->kind == JSON_SLICE_STRING) {
+        *len = slice->len + 2;
+        return slice->ptr - 1;
+    }
+    *len = slice->len;
+    return slice->ptr;
+}
+
+/* Escribe 'cp' en UTF-8; retorna los bytes usados (out == NULL: solo cuenta) */
+static size_t put_utf8(char *out, unsigned cp) {
+    unsigned char buf[4];
+    size_t n;
+    if (cp < 0x80) {
+        buf[0] = (unsigned char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        buf[0] = (unsigned char)(0xC0 | cp >> 6);
+        buf[1] = (unsigned char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        buf[0] = (unsigned char)(0xE0 | cp >> 12);
+        buf[1] = (unsigned char)(0x80 | (cp >> 6 & 0x3F));
+        buf[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        buf[0] = (unsigned char)(0xF0 | cp >> 18);
+        buf[1] = (unsigned char)(0x80 | (cp >> 12 & 0x3F));
+        buf[2] = (unsigned char)(0x80 | (cp >> 6 & 0x3F));
+        buf[3] = (unsigned char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+    if (out)
+        memcpy(out, buf, n);
+    return n;
+}
+
+size_t json_slice_unescape(const json_slice_t *slice, char *out) {
+    if (!slice->escaped) {
+        if (out)
+            memcpy(out, slice->ptr, slice->len);
+        return slice->len;
+    }
+    // json_slice_scan ya validó las secuencias
+    const char *p = slice->ptr;
+    const char *end = p + slice->len;
+    size_t n = 0;
+    while (p < end) {
+        if (*p != '\\') {
+            if (out)
+                out[n] = *p;
+            n++;
+            p++;
+            continue;
+        }
+        char e = p[1];
+        p += 2;
+        char c;
+        switch (e) {
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u': {
+                unsigned cp = read_hex4(p);
+                p += 4;
+                // Par sustituto: scan_string no deja pasar uno suelto
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (read_hex4(p + 2) - 0xDC00);
+                    p += 6;
+                }
+                n += put_utf8(out ? out + n : NULL, cp);
+                continue;
+            }
+            default: c = e; break;     // '"', '\\' y '/'
+        }
+        if (out)
+            out[n] = c;
+        n++;
+    }
+    return n;
+}
+
+bool json_slice_valid(const char *json, size_t len) {
+    scanner_t s = { json, json + len };
+    json_slice_t ignored;
+    skip_ws(&s);
+    if (!scan_value(&s, &ignored, 0))
+        return false;
+    skip_ws(&s);
+    return s.p == s.end;
+}
+
+void json_write_raw(json_writer_t *w, const char *data, size_t len) {
+    if (w->out)
+        memcpy(w->out + w->len, data, len);
+    w->len += len;
+}
+
+void json_write_string(json_writer_t *w, const char *str) {
+    json_write_string_len(w, str, strlen(str));
+}
+
+void json_write_string_len(json_writer_t *w, const char *str, size_t len) {
+    json_write_raw(w, "\"", 1);
+    const char *run = str;
+    const char *end = str + len;
+    for (const char *p = str; p < end; p++) {
+        // Hasta el próximo byte a escapar, de a bloques
+        p += json_plain_span(p, (size_t)(end - p));
+        if (p >= end)
+            break;
+        unsigned char c = (unsigned char)*p;
+        json_write_raw(w, run, (size_t)(p - run));
+        run = p + 1;
+        char esc[7];
+        switch (c) {
+            case '"':  json_write_raw(w, "\\\"", 2); break;
+            case '\\': json_write_raw(w, "\\\\", 2); break;
+            case '\b': json_write_raw(w, "\\b", 2); break;
+            case '\f': json_write_raw(w, "\\f", 2); break;
+            case '\n': json_write_raw(w, "\\n", 2); break;
+            case '\r': json_write_raw(w, "\\r", 2); break;
+            case '\t': json_write_raw(w, "\\t", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                json_write_raw(w, esc, 6);
+                break;
+        }
+    }
+    json_write_raw(w, run, (size_t)(end - run));
+    json_write_raw(w, "\"", 1);
+}
@@ -0,0 +1,82 @@
+#ifndef JSON_SLICE_H
+#define JSON_SLICE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Lectura y escritura de JSON sin construir un DOM.
+ *
+ * json_slice_scan() valida un objeto completo y anota sus campos de primer
+ * nivel como slices (puntero + largo) del mismo texto: no aloca ni copia.
+ * Un string se entrega tal como viene, todavía escapado, así que se puede
+ * reenviar sin decodificar y volver a escapar.
+ *
+ * json_writer_t escribe JSON en un buffer; con out == NULL solo mide, para
+ * serializar en dos pasadas directo sobre un buffer del tamaño exacto.
+ */
+
+#define JSON_SLICE_MAX_FIELDS 16
+#define JSON_SLICE_MAX_DEPTH 32
+
+typedef enum {
+    JSON_SLICE_STRING,
+    JSON_SLICE_NUMBER,
+    JSON_SLICE_OTHER,       // Objeto, arreglo, true, false o null
+} json_slice_kind_t;
+
+typedef struct {
+    const char *ptr;        // STRING: contenido entre las comillas; resto: el texto del valor
+    size_t len;
+    json_slice_kind_t kind;
+    bool escaped;           // STRING con al menos una secuencia de escape
+    bool integer;           // NUMBER sin fracción ni exponente
+} json_slice_t;
+
+typedef struct {
+    json_slice_t keys[JSON_SLICE_MAX_FIELDS];
+    json_slice_t values[JSON_SLICE_MAX_FIELDS];
+    size_t count;
+} json_fields_t;
+
+// Valida 'json' (un objeto; se ignora lo que venga después, como cJSON_Parse)
+// y anota sus campos. Retorna false si no es válido, si tiene más de
+// JSON_SLICE_MAX_FIELDS campos, alguna clave escapada o anida demasiado.
+bool json_slice_scan(const char *json, size_t len, json_fields_t *out);
+
+// Valida un arreglo (lo que venga después se ignora) y llama a 'each' con
+// cada elemento. Retorna false si no es válido o si 'each' retorna false.
+typedef bool (*json_slice_each_fn)(const json_slice_t *value, void *ctx);
+bool json_slice_array(const char *json, size_t len, json_slice_each_fn each, void *ctx);
+
+// Primer campo con esa clave, o NULL.
+const json_slice_t *json_slice_get(const json_fields_t *fields, const char *key);
+
+// Copia un string sin escapes en 'buf' terminado en '\0'. Retorna false si
+// no es un string, tiene escapes o no cabe.
+bool json_slice_copy(const json_slice_t *slice, char *buf, size_t cap);
+
+// Texto JSON completo del valor (con las comillas si es un string).
+const char *json_slice_token(const json_slice_t *slice, size_t *len);
+
+// Decodifica los escapes de un string (\uXXXX a UTF-8) en 'out', que debe
+// tener espacio para slice->len bytes; con out == NULL solo mide. Retorna el
+// largo decodificado (sin '\0').
+size_t json_slice_unescape(const json_slice_t *slice, char *out);
+
+// true si 'json' es exactamente un valor JSON válido (espacios alrededor aparte).
+bool json_slice_valid(const char *json, size_t len);
+
+typedef struct {
+    char *out;              // NULL: solo se mide
+    size_t len;
+} json_writer_t;
+
+void json_write_raw(json_writer_t *w, const char *data, size_t len);
+#define json_write_literal(w, lit) json_write_raw((w), (lit), sizeof(lit) - 1)
+// String entre comillas con los mismos escapes que cJSON_PrintUnformatted.
+void json_write_string(json_writer_t *w, const char *str);
+// Como json_write_string, para 'len' bytes que pueden incluir '\0'.
+void json_write_string_len(json_writer_t *w, const char *str, size_t len);
+
+#endif
@@ -1,23 +1,246 @@
 #include "logger.h"
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
 
-void log_info(const char *format, ...)
+#define LOG_RING_SLOTS 1024         // Potencia de 2
+#define LOG_RECORD_SIZE 256
+#define LOG_BATCH_SIZE 65536
+#define LOG_IDLE_SLEEP_NS 2000000   // 2 ms sin mensajes antes de volver a revisar
+
+// Registro preformateado; el texto se trunca a lo que entre en el slot
+typedef struct {
+    unsigned char level;
+    unsigned short len;
+    char text[LOG_RECORD_SIZE - 4];
+} log_record_t;
+
+// Ring de un solo productor (su hilo) y un solo consumidor (el hilo escritor)
+typedef struct log_ring {
+    _Atomic size_t head;        // Siguiente slot a leer (consumidor)
+    _Atomic size_t tail;        // Siguiente slot a escribir (productor)
+    atomic_bool orphaned;       // El hilo dueño terminó
+    struct log_ring *next;
+    log_record_t slots[LOG_RING_SLOTS];
+} log_ring_t;
+
+static __thread log_ring_t *thread_ring = NULL;
+
+// Lista de rings; el mutex solo se toma al registrar un hilo y al recorrerla
+static log_ring_t *rings = NULL;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static atomic_bool async_enabled = false;
+static atomic_bool stop_writer = false;
+static atomic_ullong dropped = 0;
+static pthread_t writer_thread;
+
+// Buffers de lote del hilo escritor
+static char out_batch[LOG_BATCH_SIZE];
+static size_t out_len = 0;
+static char err_batch[LOG_BATCH_SIZE];
+static size_t err_len = 0;
+
+static const char *level_prefix(int level) {
+    switch (level) {
+        case LOG_LEVEL_DEBUG: return "[DEBUG] ";
+        case LOG_LEVEL_ERROR: return "[ERROR] ";
+        default:              return "[INFO] ";
+    }
+}
+
+static void write_sync(int level, const char *format, va_list args) {
+    FILE *stream = level == LOG_LEVEL_ERROR ? stderr : stdout;
+    fputs(level_prefix(level), stream);
+    vfprintf(stream, format, args);
+    fputc('\n', stream);
+}
+
+static void mark_ring_orphaned(void *ring) {
+    atomic_store_explicit(&((log_ring_t *)ring)->orphaned, true, memory_order_release);
+}
+
+static void create_ring_key(void) {
+    pthread_key_create(&ring_key, mark_ring_orphaned);
+}
+
+static log_ring_t *get_thread_ring(void) {
+    if (thread_ring)
+        return thread_ring;
+    log_ring_t *ring = malloc(sizeof(log_ring_t));
+    if (!ring)
+        return NULL;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->orphaned, false);
+
+    pthread_once(&ring_key_once, create_ring_key);
+    pthread_setspecific(ring_key, ring);
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+    thread_ring = ring;
+    return ring;
+}
+
+void log_write(int level, const char *format, ...)
 {
     va_list args;
     va_start(args, format);
-    printf("[INFO] ");
-    vprintf(format, args);
-    printf("\n");
+
+    if (!atomic_load_explicit(&async_enabled, memory_order_acquire)) {
+        write_sync(level, format, args);
+        va_end(args);
+        return;
+    }
+
+    log_ring_t *ring = get_thread_ring();
+    if (!ring) {
+        atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == LOG_RING_SLOTS) {
+        // Ring lleno: los errores se escriben igual; el resto se descarta
+        // en vez de bloquear el hilo
+        if (level == LOG_LEVEL_ERROR)
+            write_sync(level, format, args);
+        else
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+        va_end(args);
+        return;
+    }
+
+    log_record_t *rec = &ring->slots[tail & (LOG_RING_SLOTS - 1)];
+    int n = vsnprintf(rec->text, sizeof(rec->text), format, args);
     va_end(args);
+    if (n < 0)
+        n = 0;
+    if ((size_t)n >= sizeof(rec->text))
+        n = sizeof(rec->text) - 1;
+    rec->len = (unsigned short)n;
+    rec->level = (unsigned char)level;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
 }
 
-void log_error(const char *format, ...)
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n <= 0)
+            return;
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+static void flush_batches(void) {
+    if (out_len) {
+        write_all(STDOUT_FILENO, out_batch, out_len);
+        out_len = 0;
+    }
+    if (err_len) {
+        write_all(STDERR_FILENO, err_batch, err_len);
+        err_len = 0;
+    }
+}
+
+static void append_record(const log_record_t *rec) {
+    const char *prefix = level_prefix(rec->level);
+    size_t prefix_len = strlen(prefix);
+    size_t needed = prefix_len + rec->len + 1;
+    bool is_error = rec->level == LOG_LEVEL_ERROR;
+    char *batch = is_error ? err_batch : out_batch;
+    size_t *len = is_error ? &err_len : &out_len;
+
+    if (*len + needed > LOG_BATCH_SIZE)
+        flush_batches();
+    memcpy(batch + *len, prefix, prefix_len);
+    memcpy(batch + *len + prefix_len, rec->text, rec->len);
+    batch[*len + prefix_len + rec->len] = '\n';
+    *len += needed;
+}
+
+/* Vacía todos los rings en los buffers de lote. Retorna los registros leídos. */
+static size_t drain_rings(void) {
+    size_t total = 0;
+    pthread_mutex_lock(&rings_mutex);
+    log_ring_t **cur = &rings;
+    while (*cur) {
+        log_ring_t *ring = *cur;
+        bool orphaned = atomic_load_explicit(&ring->orphaned, memory_order_acquire);
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        for (; head != tail; head++) {
+            append_record(&ring->slots[head & (LOG_RING_SLOTS - 1)]);
+            total++;
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+
+        // El hilo dueño terminó y ya no queda nada por leer
+        if (orphaned) {
+            *cur = ring->next;
+            free(ring);
+            continue;
+        }
+        cur = &ring->next;
+    }
+    pthread_mutex_unlock(&rings_mutex);
+    flush_batches();
+    return total;
+}
+
+static void *log_writer(void *arg) {
+    (void)arg;
+    const struct timespec idle = { 0, LOG_IDLE_SLEEP_NS };
+    while (!atomic_load_explicit(&stop_writer, memory_order_acquire)) {
+        if (drain_rings() == 0)
+            nanosleep(&idle, NULL);
+    }
+    drain_rings();
+    return NULL;
+}
+
+void logger_init(void)
 {
-    va_list args;
-    va_start(args, format);
-    fprintf(stderr, "[ERROR] ");
-    vfprintf(stderr, format, args);
-    fprintf(stderr, "\n");
-    va_end(args);
+    if (atomic_load(&async_enabled))
+        return;
+    fflush(stdout);
+    fflush(stderr);
+    atomic_store(&stop_writer, false);
+    if (pthread_create(&writer_thread, NULL, log_writer, NULL) != 0) {
+        fprintf(stderr, "[ERROR] No se pudo iniciar el logger asíncrono\n");
+        return;
+    }
+    atomic_store_explicit(&async_enabled, true, memory_order_release);
+}
+
+void logger_shutdown(void)
+{
+    if (!atomic_load(&async_enabled))
+        return;
+    atomic_store_explicit(&async_enabled, false, memory_order_release);
+    atomic_store_explicit(&stop_writer, true, memory_order_release);
+    pthread_join(writer_thread, NULL);
+
+    unsigned long long lost = logger_dropped();
+    if (lost > 0)
+        fprintf(stderr, "[ERROR] Logger: %llu mensajes descartados por rings llenos\n", lost);
+}
+
+unsigned long long logger_dropped(void)
+{
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
 }
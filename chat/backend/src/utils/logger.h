@@ -1,8 +1,42 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
-// Funciones básicas de logging.
-void log_info(const char *format, ...);
-void log_error(const char *format, ...);
+// Niveles de log. Los niveles por debajo de LOG_LEVEL se eliminan al compilar:
+// la llamada queda como código muerto, así que sus argumentos no se evalúan.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_ERROR 2
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Encola un mensaje ya formateado en el ring del hilo actual. Si el logger
+// asíncrono no está iniciado, escribe directamente en stdout/stderr.
+void log_write(int level, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define log_debug(...) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define log_debug(...) do { if (0) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define log_info(...) log_write(LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define log_info(...) do { if (0) log_write(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#endif
+
+#define log_error(...) log_write(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Inicia el hilo que vacía los rings de todos los hilos en lotes.
+void logger_init(void);
+
+// Vacía lo pendiente y detiene el hilo escritor (vuelve al modo síncrono).
+void logger_shutdown(void);
+
+// Cantidad de mensajes descartados porque el ring de su hilo estaba lleno.
+unsigned long long logger_dropped(void);
 
 #endif
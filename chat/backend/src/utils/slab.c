@@ -0,0 +1,218 @@
+#include "slab.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+struct slab_cache;
+
+/* Cabecera de cada bloque (16 bytes, conserva la alineación de malloc).
+   Mientras el bloque está libre, sus primeros bytes útiles guardan el
+   siguiente de la lista. */
+typedef struct block {
+    struct slab_cache *owner;   // NULL: pedido grande alocado con malloc
+    uint32_t cls;
+    uint32_t reserved;
+} block_t;
+
+typedef struct slab_cache {
+    block_t *local[SLAB_CLASS_COUNT];               // Solo la toca el dueño
+    _Atomic(block_t *) remote[SLAB_CLASS_COUNT];    // Liberados por otros hilos
+    char *bump[SLAB_CLASS_COUNT];                   // Resto sin cortar del último slab
+    char *bump_end[SLAB_CLASS_COUNT];
+    // Un solo escritor (el hilo dueño); la última entrada es para los pedidos grandes
+    _Atomic uint64_t allocs[SLAB_CLASS_COUNT + 1];
+    _Atomic uint64_t frees[SLAB_CLASS_COUNT + 1];
+    _Atomic uint64_t remote_frees[SLAB_CLASS_COUNT + 1];
+    _Atomic uint64_t slab_bytes[SLAB_CLASS_COUNT];
+    bool in_use;                                    // Protegido por caches_mutex
+    struct slab_cache *next;
+} slab_cache_t;
+
+static __thread slab_cache_t *thread_cache = NULL;
+
+// Las cachés nunca se liberan: siguen siendo dueñas de sus bloques
+static slab_cache_t *caches = NULL;
+static pthread_mutex_t caches_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+
+static block_t **next_free(block_t *b) {
+    return (block_t **)(b + 1);
+}
+
+static void counter_add(_Atomic uint64_t *counter, uint64_t n) {
+    uint64_t v = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, v + n, memory_order_relaxed);
+}
+
+// El hilo termina: su caché queda libre para que la adopte otro
+static void release_cache(void *arg) {
+    slab_cache_t *cache = arg;
+    pthread_mutex_lock(&caches_mutex);
+    cache->in_use = false;
+    pthread_mutex_unlock(&caches_mutex);
+    thread_cache = NULL;
+}
+
+static void create_cache_key(void) {
+    pthread_key_create(&cache_key, release_cache);
+}
+
+static slab_cache_t *get_cache(void) {
+    if (thread_cache)
+        return thread_cache;
+    pthread_once(&cache_key_once, create_cache_key);
+
+    pthread_mutex_lock(&caches_mutex);
+    slab_cache_t *cache = caches;
+    while (cache && cache->in_use)
+        cache = cache->next;
+    if (!cache) {
+        cache = calloc(1, sizeof(slab_cache_t));
+        if (cache) {
+            cache->next = caches;
+            caches = cache;
+        }
+    }
+    if (cache)
+        cache->in_use = true;
+    pthread_mutex_unlock(&caches_mutex);
+
+    if (cache) {
+        thread_cache = cache;
+        pthread_setspecific(cache_key, cache);
+    }
+    return cache;
+}
+
+static uint32_t size_class(size_t size) {
+    if (size <= SLAB_MIN_SIZE)
+        return 0;
+    // Bits de (size - 1) por encima de log2(SLAB_MIN_SIZE)
+    return (uint32_t)(64 - __builtin_clzll((unsigned long long)(size - 1))) - 5;
+}
+
+/* Toma un bloque nuevo del slab actual de la clase, o de uno nuevo */
+static block_t *carve_block(slab_cache_t *cache, uint32_t cls) {
+    size_t stride = sizeof(block_t) + ((size_t)SLAB_MIN_SIZE << cls);
+    if (!cache->bump[cls] || (size_t)(cache->bump_end[cls] - cache->bump[cls]) < stride) {
+        char *chunk = malloc(SLAB_CHUNK_SIZE);
+        if (!chunk)
+            return NULL;
+        cache->bump[cls] = chunk;
+        cache->bump_end[cls] = chunk + SLAB_CHUNK_SIZE;
+        counter_add(&cache->slab_bytes[cls], SLAB_CHUNK_SIZE);
+    }
+    block_t *b = (block_t *)cache->bump[cls];
+    cache->bump[cls] += stride;
+    b->owner = cache;
+    b->cls = cls;
+    b->reserved = 0;
+    return b;
+}
+
+static void *large_alloc(slab_cache_t *cache, size_t size) {
+    block_t *b = malloc(sizeof(block_t) + size);
+    if (!b)
+        return NULL;
+    b->owner = NULL;
+    b->cls = SLAB_CLASS_COUNT;
+    b->reserved = 0;
+    if (cache)
+        counter_add(&cache->allocs[SLAB_CLASS_COUNT], 1);
+    return b + 1;
+}
+
+void *slab_alloc(size_t size) {
+    slab_cache_t *cache = get_cache();
+    if (size > SLAB_MAX_SIZE || !cache)
+        return large_alloc(cache, size);
+
+    uint32_t cls = size_class(size);
+    block_t *b = cache->local[cls];
+    if (!b) {
+        // Se recupera de una vez todo lo que liberaron los otros hilos
+        b = atomic_exchange_explicit(&cache->remote[cls], NULL, memory_order_acquire);
+    }
+    if (b) {
+        cache->local[cls] = *next_free(b);
+    } else {
+        b = carve_block(cache, cls);
+        if (!b)
+            return NULL;
+    }
+    counter_add(&cache->allocs[cls], 1);
+    return b + 1;
+}
+
+void *slab_calloc(size_t size) {
+    void *ptr = slab_alloc(size);
+    if (ptr)
+        memset(ptr, 0, size);
+    return ptr;
+}
+
+void slab_free(void *ptr) {
+    if (!ptr)
+        return;
+    block_t *b = (block_t *)ptr - 1;
+    slab_cache_t *cache = get_cache();
+    uint32_t cls = b->cls;
+
+    if (!b->owner) {
+        if (cache)
+            counter_add(&cache->frees[SLAB_CLASS_COUNT], 1);
+        free(b);
+        return;
+    }
+
+    if (b->owner == cache) {
+        *next_free(b) = cache->local[cls];
+        cache->local[cls] = b;
+    } else {
+        // Pila sin lock: solo se empuja de a uno y el dueño la vacía entera,
+        // así que no hay ABA
+        slab_cache_t *owner = b->owner;
+        block_t *head = atomic_load_explicit(&owner->remote[cls], memory_order_relaxed);
+        do {
+            *next_free(b) = head;
+        } while (!atomic_compare_exchange_weak_explicit(&owner->remote[cls], &head, b,
+                                                        memory_order_release,
+                                                        memory_order_relaxed));
+        if (cache)
+            counter_add(&cache->remote_frees[cls], 1);
+    }
+    if (cache)
+        counter_add(&cache->frees[cls], 1);
+}
+
+char *slab_strdup(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = slab_alloc(len);
+    if (copy)
+        memcpy(copy, s, len);
+    return copy;
+}
+
+void slab_stats(slab_class_stats_t out[SLAB_CLASS_COUNT + 1]) {
+    memset(out, 0, sizeof(slab_class_stats_t) * (SLAB_CLASS_COUNT + 1));
+    pthread_mutex_lock(&caches_mutex);
+    for (slab_cache_t *c = caches; c; c = c->next) {
+        for (int i = 0; i <= SLAB_CLASS_COUNT; i++) {
+            out[i].allocs += atomic_load_explicit(&c->allocs[i], memory_order_relaxed);
+            out[i].frees += atomic_load_explicit(&c->frees[i], memory_order_relaxed);
+            out[i].remote_frees += atomic_load_explicit(&c->remote_frees[i], memory_order_relaxed);
+            if (i < SLAB_CLASS_COUNT)
+                out[i].slab_bytes += atomic_load_explicit(&c->slab_bytes[i], memory_order_relaxed);
+        }
+    }
+    pthread_mutex_unlock(&caches_mutex);
+
+    for (int i = 0; i <= SLAB_CLASS_COUNT; i++) {
+        out[i].block_size = i < SLAB_CLASS_COUNT ? (size_t)SLAB_MIN_SIZE << i : 0;
+        // Los contadores se leen sin sincronizar: el resultado es aproximado
+        out[i].in_use = out[i].allocs > out[i].frees ? out[i].allocs - out[i].frees : 0;
+    }
+}
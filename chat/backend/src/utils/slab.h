@@ -0,0 +1,46 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Allocator por clases de tamaño para los objetos del camino caliente
+ * (tareas, mensajes pendientes, clientes y usuarios, con sus strings).
+ *
+ * Cada hilo tiene una caché con una lista libre por clase y corta los
+ * bloques de slabs de SLAB_CHUNK_SIZE bytes: alocar y liberar en el mismo
+ * hilo no toma locks. Un bloque liberado por otro hilo (p. ej. un pendiente
+ * que encola un worker y escribe el hilo de servicio) vuelve a la lista
+ * remota de su dueño, una pila sin lock que el dueño recupera entera cuando
+ * se le vacía la lista local. Los pedidos mayores que SLAB_MAX_SIZE van a
+ * malloc. Los slabs no se devuelven al sistema: la caché de un hilo que
+ * termina la adopta el próximo hilo que aloque.
+ *
+ * Todo lo alocado aquí se libera con slab_free(), nunca con free().
+ */
+
+#define SLAB_CHUNK_SIZE (64 * 1024)
+#define SLAB_CLASS_COUNT 7                          // 32, 64, ..., 2048 bytes
+#define SLAB_MIN_SIZE 32
+#define SLAB_MAX_SIZE (SLAB_MIN_SIZE << (SLAB_CLASS_COUNT - 1))
+
+typedef struct {
+    size_t block_size;      // Tamaño útil de la clase (0: pedidos grandes, van a malloc)
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t remote_frees;  // Liberados desde un hilo distinto al dueño (incluidos en frees)
+    uint64_t in_use;
+    size_t slab_bytes;      // Memoria tomada en slabs para la clase
+} slab_class_stats_t;
+
+void *slab_alloc(size_t size);
+// Como slab_alloc, con el bloque en cero.
+void *slab_calloc(size_t size);
+void slab_free(void *ptr);
+char *slab_strdup(const char *s);
+
+// Suma las estadísticas de todos los hilos. La última entrada son los pedidos grandes.
+void slab_stats(slab_class_stats_t out[SLAB_CLASS_COUNT + 1]);
+
+#endif
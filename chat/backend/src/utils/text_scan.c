@@ -0,0 +1,348 @@
+#include "text_scan.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* ---------- Escalar ---------- */
+
+static bool utf8_valid_scalar(const unsigned char *s, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        // ASCII de a 8 bytes
+        if (len - i >= 8) {
+            uint64_t word;
+            memcpy(&word, s + i, sizeof(word));
+            if (!(word & 0x8080808080808080ULL)) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        // Rango del segundo byte según el primero (tabla 3-7 de Unicode)
+        size_t extra;
+        unsigned char lo = 0x80, hi = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF) {
+            extra = 1;
+        } else if (c >= 0xE0 && c <= 0xEF) {
+            extra = 2;
+            if (c == 0xE0)
+                lo = 0xA0;          // Sobrelargo
+            else if (c == 0xED)
+                hi = 0x9F;          // Surrogates
+        } else if (c >= 0xF0 && c <= 0xF4) {
+            extra = 3;
+            if (c == 0xF0)
+                lo = 0x90;          // Sobrelargo
+            else if (c == 0xF4)
+                hi = 0x8F;          // Mayor a U+10FFFF
+        } else {
+            return false;
+        }
+        if (len - i <= extra || s[i + 1] < lo || s[i + 1] > hi)
+            return false;
+        for (size_t k = 2; k <= extra; k++) {
+            if ((s[i + k] & 0xC0) != 0x80)
+                return false;
+        }
+        i += extra + 1;
+    }
+    return true;
+}
+
+static size_t plain_span_scalar(const unsigned char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < 0x20 || s[i] == '"' || s[i] == '\\')
+            return i;
+    }
+    return len;
+}
+
+#ifdef TEXT_SCAN_X86
+
+/*
+ * Validación UTF-8 por tablas (Keiser y Lemire, "Validating UTF-8 in less
+ * than one instruction per byte"). Cada byte se clasifica con tres tablas
+ * de 16 entradas indexadas por los nibbles del byte anterior y el suyo; el
+ * AND de las tres marca los errores de dos bytes, y las continuaciones que
+ * exigen un tercer o cuarto byte se comprueban aparte con los bytes de dos
+ * y tres posiciones atrás.
+ */
+#define TOO_SHORT       0x01    // Inicio o ASCII donde hacía falta una continuación
+#define TOO_LONG        0x02    // Continuación después de ASCII
+#define OVERLONG_3      0x04
+#define TOO_LARGE       0x08
+#define SURROGATE       0x10
+#define OVERLONG_2      0x20
+#define TOO_LARGE_1000  0x40
+#define OVERLONG_4      0x40
+#define TWO_CONTS       0x80    // Dos continuaciones seguidas
+#define CARRY           (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define B(x) ((char)(x))
+
+// Por el nibble alto del byte anterior
+#define BYTE_1_HIGH \
+    B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), \
+    B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), B(TOO_LONG), \
+    B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), B(TWO_CONTS), \
+    B(TOO_SHORT | OVERLONG_2), \
+    B(TOO_SHORT), \
+    B(TOO_SHORT | OVERLONG_3 | SURROGATE), \
+    B(TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4)
+
+// Por el nibble bajo del byte anterior
+#define BYTE_1_LOW \
+    B(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4), \
+    B(CARRY | OVERLONG_2), \
+    B(CARRY), \
+    B(CARRY), \
+    B(CARRY | TOO_LARGE), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000), \
+    B(CARRY | TOO_LARGE | TOO_LARGE_1000)
+
+// Por el nibble alto del byte actual
+#define BYTE_2_HIGH \
+    B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), \
+    B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), \
+    B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4), \
+    B(TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE), \
+    B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), \
+    B(TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE), \
+    B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT), B(TOO_SHORT)
+
+// Un bloque que termina en una secuencia sin completar supera estos valores
+#define INCOMPLETE_TAIL B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), \
+    B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xF0 - 1), B(0xE0 - 1), B(0xC0 - 1)
+#define ALL_FF_16 B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), \
+    B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF), B(0xFF)
+
+typedef struct {
+    __m128i prev;           // Bloque anterior
+    __m128i incomplete;     // Distinto de cero si el anterior terminó a mitad de secuencia
+    __m128i error;
+} utf8_sse_t;
+
+__attribute__((target("sse4.2")))
+static void utf8_block_sse42(utf8_sse_t *st, __m128i in) {
+    if (_mm_movemask_epi8(in) == 0) {
+        st->error = _mm_or_si128(st->error, st->incomplete);
+        st->incomplete = _mm_setzero_si128();
+        st->prev = in;
+        return;
+    }
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(in, st->prev, 15);
+    __m128i prev2 = _mm_alignr_epi8(in, st->prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(in, st->prev, 13);
+    __m128i b1h = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_HIGH),
+                                   _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i b1l = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_1_LOW), _mm_and_si128(prev1, nibble));
+    __m128i b2h = _mm_shuffle_epi8(_mm_setr_epi8(BYTE_2_HIGH),
+                                   _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+    // Tercer y cuarto byte de una secuencia: tienen que ser continuaciones
+    __m128i third = _mm_subs_epu8(prev2, _mm_set1_epi8(B(0xE0 - 0x80)));
+    __m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(B(0xF0 - 0x80)));
+    __m128i must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(B(0x80)));
+    st->error = _mm_or_si128(st->error, _mm_xor_si128(must23, special));
+    st->incomplete = _mm_subs_epu8(in, _mm_setr_epi8(INCOMPLETE_TAIL));
+    st->prev = in;
+}
+
+__attribute__((target("sse4.2")))
+static bool utf8_valid_sse42(const unsigned char *s, size_t len) {
+    utf8_sse_t st = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+        utf8_block_sse42(&st, _mm_loadu_si128((const __m128i *)(s + i)));
+    // El resto con ceros: una secuencia cortada al final queda como error
+    unsigned char tail[16] = { 0 };
+    memcpy(tail, s + i, len - i);
+    utf8_block_sse42(&st, _mm_loadu_si128((const __m128i *)tail));
+    st.error = _mm_or_si128(st.error, st.incomplete);
+    return _mm_testz_si128(st.error, st.error);
+}
+
+__attribute__((target("sse4.2")))
+static size_t plain_span_sse42(const unsigned char *s, size_t len) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(in, quote), _mm_cmpeq_epi8(in, backslash));
+        // min(c, 0x1F) == c solo si c <= 0x1F
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(in, control), in));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + plain_span_scalar(s + i, len - i);
+}
+
+/* Lo mismo de a 32 bytes; las tablas se repiten en las dos mitades porque
+   vpshufb busca dentro de cada una */
+
+typedef struct {
+    __m256i prev;
+    __m256i incomplete;
+    __m256i error;
+} utf8_avx_t;
+
+/* Los 32 bytes anteriores a in[0..31] corridos 'n' posiciones */
+#define PREV_AVX2(in, prev, n) \
+    _mm256_alignr_epi8((in), _mm256_permute2x128_si256((prev), (in), 0x21), 16 - (n))
+
+__attribute__((target("avx2")))
+static void utf8_block_avx2(utf8_avx_t *st, __m256i in) {
+    if (_mm256_movemask_epi8(in) == 0) {
+        st->error = _mm256_or_si256(st->error, st->incomplete);
+        st->incomplete = _mm256_setzero_si256();
+        st->prev = in;
+        return;
+    }
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = PREV_AVX2(in, st->prev, 1);
+    __m256i prev2 = PREV_AVX2(in, st->prev, 2);
+    __m256i prev3 = PREV_AVX2(in, st->prev, 3);
+    __m256i b1h = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH),
+                                      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i b1l = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW),
+                                      _mm256_and_si256(prev1, nibble));
+    __m256i b2h = _mm256_shuffle_epi8(_mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH),
+                                      _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(B(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(B(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(B(0x80)));
+    st->error = _mm256_or_si256(st->error, _mm256_xor_si256(must23, special));
+    st->incomplete = _mm256_subs_epu8(in, _mm256_setr_epi8(ALL_FF_16, INCOMPLETE_TAIL));
+    st->prev = in;
+}
+
+__attribute__((target("avx2")))
+static bool utf8_valid_avx2(const unsigned char *s, size_t len) {
+    utf8_avx_t st = { _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256() };
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+        utf8_block_avx2(&st, _mm256_loadu_si256((const __m256i *)(s + i)));
+    unsigned char tail[32] = { 0 };
+    memcpy(tail, s + i, len - i);
+    utf8_block_avx2(&st, _mm256_loadu_si256((const __m256i *)tail));
+    st.error = _mm256_or_si256(st.error, st.incomplete);
+    return _mm256_testz_si256(st.error, st.error);
+}
+
+__attribute__((target("avx2")))
+static size_t plain_span_avx2(const unsigned char *s, size_t len) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i control = _mm256_set1_epi8(0x1F);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i in = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi8(in, quote),
+                                      _mm256_cmpeq_epi8(in, backslash));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(_mm256_min_epu8(in, control), in));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+    }
+    // Menos de 32: todavía conviene un bloque de 16. Se escribe acá y no se
+    // llama a la versión SSE para no mezclar instrucciones SSE y AVX.
+    if (i + 16 <= len) {
+        __m128i in = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi8(in, _mm256_castsi256_si128(quote)),
+                                   _mm_cmpeq_epi8(in, _mm256_castsi256_si128(backslash)));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(_mm_min_epu8(in, _mm256_castsi256_si128(control)), in));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask)
+            return i + (size_t)__builtin_ctz(mask);
+        i += 16;
+    }
+    return i + plain_span_scalar(s + i, len - i);
+}
+
+#endif
+
+/* ---------- Elección ---------- */
+
+static _Atomic int active_level = -1;   // -1: todavía no se detectó la CPU
+
+static text_scan_level_t cpu_level(void) {
+#ifdef TEXT_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return TEXT_SCAN_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return TEXT_SCAN_SSE42;
+#endif
+    return TEXT_SCAN_SCALAR;
+}
+
+text_scan_level_t text_scan_level(void) {
+    int level = atomic_load_explicit(&active_level, memory_order_relaxed);
+    if (level < 0) {
+        // Si dos hilos llegan juntos detectan lo mismo
+        level = (int)cpu_level();
+        atomic_store_explicit(&active_level, level, memory_order_relaxed);
+    }
+    return (text_scan_level_t)level;
+}
+
+text_scan_level_t text_scan_set_level(text_scan_level_t level) {
+    text_scan_level_t max = cpu_level();
+    if (level > max)
+        level = max;
+    atomic_store_explicit(&active_level, (int)level, memory_order_relaxed);
+    return level;
+}
+
+const char *text_scan_level_name(text_scan_level_t level) {
+    switch (level) {
+        case TEXT_SCAN_AVX2:  return "avx2";
+        case TEXT_SCAN_SSE42: return "sse4.2";
+        default:              return "scalar";
+    }
+}
+
+bool utf8_valid(const char *s, size_t len) {
+    const unsigned char *u = (const unsigned char *)s;
+    switch (text_scan_level()) {
+#ifdef TEXT_SCAN_X86
+        case TEXT_SCAN_AVX2:  return utf8_valid_avx2(u, len);
+        case TEXT_SCAN_SSE42: return utf8_valid_sse42(u, len);
+#endif
+        default:              return utf8_valid_scalar(u, len);
+    }
+}
+
+size_t json_plain_span(const char *s, size_t len) {
+    const unsigned char *u = (const unsigned char *)s;
+    switch (text_scan_level()) {
+#ifdef TEXT_SCAN_X86
+        case TEXT_SCAN_AVX2:  return plain_span_avx2(u, len);
+        case TEXT_SCAN_SSE42: return plain_span_sse42(u, len);
+#endif
+        default:              return plain_span_scalar(u, len);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef TEXT_SCAN_H
+#define TEXT_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Recorridos de texto de 16 o 32 bytes por vuelta.
+ *
+ * El content de un mensaje de chat se recorre al validarlo, al escanear el
+ * JSON y al escaparlo para otro formato; con mensajes pegados de varios KB
+ * esas pasadas byte a byte son lo más caro del camino. Cada función tiene
+ * una versión AVX2, una SSE4.2 y una escalar, y la primera llamada elige la
+ * mejor que soporta la CPU (en otras arquitecturas, siempre la escalar).
+ */
+
+typedef enum {
+    TEXT_SCAN_SCALAR,
+    TEXT_SCAN_SSE42,
+    TEXT_SCAN_AVX2,
+} text_scan_level_t;
+
+// Versión en uso.
+text_scan_level_t text_scan_level(void);
+
+// Fija la versión, sin pasar de lo que soporta la CPU; retorna la que quedó.
+// Para comparar versiones en los benchmarks.
+text_scan_level_t text_scan_set_level(text_scan_level_t level);
+
+const char *text_scan_level_name(text_scan_level_t level);
+
+// true si los 'len' bytes son UTF-8 válido: sin secuencias cortadas ni
+// sobrelargas, surrogates ni puntos de código mayores a U+10FFFF.
+bool utf8_valid(const char *s, size_t len);
+
+// Bytes desde 's' hasta el primero que JSON no deja tal cual dentro de un
+// string ('"', '\\' o un control < 0x20); 'len' si no hay ninguno.
+size_t json_plain_span(const char *s, size_t len);
+
+#endif
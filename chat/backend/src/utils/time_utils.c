@@ -3,13 +3,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-char *get_timestamp(void) {
+void format_timestamp(char buf[TIMESTAMP_LEN]) {
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    // Reserva 20 bytes: "YYYY-MM-DD HH:MM:SS" + '\0'
-    char *buffer = malloc(20);
-    if (buffer) {
-        strftime(buffer, 20, "%Y-%m-%d %H:%M:%S", tm_info);
-    }
+    struct tm tm_info;
+    // localtime_r: lo llaman varios workers a la vez
+    localtime_r(&now, &tm_info);
+    strftime(buf, TIMESTAMP_LEN, "%Y-%m-%d %H:%M:%S", &tm_info);
+}
+
+char *get_timestamp(void) {
+    char *buffer = malloc(TIMESTAMP_LEN);
+    if (buffer)
+        format_timestamp(buffer);
     return buffer;
 }
+
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
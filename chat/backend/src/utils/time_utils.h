@@ -1,8 +1,19 @@
 #ifndef TIME_UTILS_H
 #define TIME_UTILS_H
 
+#include <stdint.h>
+
+// "YYYY-MM-DD HH:MM:SS" + '\0'
+#define TIMESTAMP_LEN 20
+
+// Escribe el timestamp actual en 'buf' sin alocar memoria.
+void format_timestamp(char buf[TIMESTAMP_LEN]);
+
 // Retorna una cadena (malloc'd) con el timestamp actual en formato "YYYY-MM-DD HH:MM:SS".
 // La cadena debe liberarse con free() cuando ya no se necesite.
 char *get_timestamp(void);
 
+// Reloj monotónico en nanosegundos, para medir latencias.
+uint64_t monotonic_ns(void);
+
 #endif